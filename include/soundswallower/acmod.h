@@ -49,13 +49,16 @@
 #include <soundswallower/bin_mdef.h>
 #include <soundswallower/bitvec.h>
 #include <soundswallower/configuration.h>
+#include <soundswallower/datacache.h>
 #include <soundswallower/err.h>
 #include <soundswallower/fe.h>
 #include <soundswallower/feat.h>
 #include <soundswallower/hmm.h>
 #include <soundswallower/logmath.h>
 #include <soundswallower/mllr.h>
+#include <soundswallower/model_bundle.h>
 #include <soundswallower/prim_type.h>
+#include <soundswallower/thread_pool.h>
 #include <soundswallower/tmat.h>
 
 #ifdef __cplusplus
@@ -75,11 +78,27 @@ typedef enum acmod_state_e {
     ACMOD_ENDED /**< Utterance ended, still buffering. */
 } acmod_state_t;
 
+/**
+ * Senone scores kept for one frame, for rescoring an utterance.
+ */
+typedef struct acmod_scored_frame_s {
+    int16 *senscr; /**< Scores for all senones, or for those in
+                      senone_active, or NULL if not kept. */
+    uint8 *senone_active; /**< Deltas to the senones scored in this frame,
+                             or NULL if they all were (compallsen). */
+    int n_senone_active; /**< Number of entries in senone_active. */
+} acmod_scored_frame_t;
+
 /**
  * Is acmod growable by default? (yes, for minimal surprise)
  */
 #define ACMOD_GROW_DEFAULT TRUE
 
+/**
+ * Maximum number of frames scored at once by acmod_score_batch().
+ */
+#define ACMOD_MAX_BATCH 8
+
 /**
  * Dummy senone score value for unintentionally active states.
  */
@@ -89,6 +108,7 @@ typedef enum acmod_state_e {
  * Acoustic model parameter structure.
  */
 typedef struct mgau_s mgau_t;
+struct acmod_s;
 
 typedef struct mgaufuncs_s {
     const char *name;
@@ -100,23 +120,64 @@ typedef struct mgaufuncs_s {
                       mfcc_t **feat,
                       int32 frame,
                       int32 compallsen);
+    int (*frame_eval_batch)(mgau_t *mgau,
+                            int16 **senscr,
+                            uint8 *senone_active,
+                            int32 n_senone_active,
+                            mfcc_t ***feat,
+                            int32 frame,
+                            int32 n_frames,
+                            int32 compallsen); /**< Optional, may be NULL. */
+    int (*frame_prepare)(mgau_t *mgau,
+                         uint8 *senone_active,
+                         int32 n_senone_active,
+                         mfcc_t ***feat,
+                         int32 frame,
+                         int32 n_frames); /**< Optional, may be NULL
+                                             (see acmod_score_batch()). */
     int (*transform)(mgau_t *mgau,
                      mllr_t *mllr);
+    mgau_t *(*clone)(mgau_t *mgau,
+                     struct acmod_s *acmod); /**< Optional, may be NULL. */
+    int (*set_topn)(mgau_t *mgau,
+                    int topn); /**< Optional, may be NULL. */
     void (*free)(mgau_t *mgau);
 } mgaufuncs_t;
 
 struct mgau_s {
     mgaufuncs_t *vt; /**< vtable of mgau functions. */
     int frame_idx; /**< frame counter. */
+    int refcount; /**< Reference count. */
+    mgau_t *shared; /**< Model whose parameters we share (or NULL). */
 };
 
 #define ps_mgau_base(mg) ((mgau_t *)(mg))
 #define ps_mgau_frame_eval(mg, senscr, senone_active, n_senone_active, feat, frame, compallsen) \
     (*ps_mgau_base(mg)->vt->frame_eval)(mg, senscr, senone_active, n_senone_active, feat, frame, compallsen)
+#define ps_mgau_frame_eval_batch(mg, senscr, senone_active, n_senone_active, feat, frame, n_frames, compallsen) \
+    (*ps_mgau_base(mg)->vt->frame_eval_batch)(mg, senscr, senone_active, n_senone_active, feat, frame, n_frames, compallsen)
+#define ps_mgau_frame_prepare(mg, senone_active, n_senone_active, feat, frame, n_frames) \
+    (*ps_mgau_base(mg)->vt->frame_prepare)(mg, senone_active, n_senone_active, feat, frame, n_frames)
 #define mgau_transform(mg, mllr) \
     (*ps_mgau_base(mg)->vt->transform)(mg, mllr)
+#define ps_mgau_clone(mg, acmod) \
+    (*ps_mgau_base(mg)->vt->clone)(mg, acmod)
+#define ps_mgau_set_topn(mg, topn) \
+    (*ps_mgau_base(mg)->vt->set_topn)(mg, topn)
 #define ps_mgau_free(mg) \
-    (*ps_mgau_base(mg)->vt->free)(mg)
+    mgau_free(ps_mgau_base(mg))
+
+/**
+ * Retain a pointer to a GMM computation module.
+ */
+mgau_t *mgau_retain(mgau_t *mgau);
+
+/**
+ * Release a GMM computation module.
+ *
+ * @return new reference count (0 if freed).
+ */
+int mgau_free(mgau_t *mgau);
 
 /**
  * Acoustic model structure.
@@ -140,6 +201,7 @@ struct acmod_s {
     config_t *config; /**< Configuration. */
     logmath_t *lmath; /**< Log-math computation. */
     glist_t strings; /**< Temporary acoustic model filenames. */
+    datacache_t *cache; /**< Cache of derived model data (or NULL). */
 
     /* Feature computation: */
     fe_t *fe; /**< Acoustic feature computation. */
@@ -150,13 +212,29 @@ struct acmod_s {
     tmat_t *tmat; /**< Transition matrices. */
     mgau_t *mgau; /**< Model parameters. */
     mllr_t *mllr; /**< Speaker transformation. */
+    thread_pool_t *pool; /**< Worker threads for senone scoring (or NULL). */
 
     /* Senone scoring: */
     int16 *senone_scores; /**< GMM scores for current frame. */
     bitvec_t *senone_active_vec; /**< Active GMMs in current frame. */
     uint8 *senone_active; /**< Array of deltas to active GMMs. */
     int senscr_frame; /**< Frame index for senone_scores. */
+    int16 **senscr_batch; /**< Scores from acmod_score_batch() (with compallsen). */
+    int senscr_batch_frame; /**< First frame done by acmod_score_batch(). */
+    int n_senscr_batch; /**< Number of frames done by acmod_score_batch(). */
+    acmod_scored_frame_t *score_cache; /**< Scores kept for this utterance. */
+    int n_score_cache_alloc; /**< Number of frames allocated in score_cache. */
+    size_t score_cache_size; /**< Bytes of scores in score_cache. */
+    size_t score_cache_max; /**< Maximum bytes in score_cache (0 for none). */
+    int32 score_cache_hits; /**< Frames served from score_cache. */
+    int32 score_cache_misses; /**< Frames computed rather than served from
+                                 score_cache. */
     int n_senone_active; /**< Number of active GMMs. */
+    int32 ci_beam; /**< Beam on CI senone scores for CD senones (0 for none). */
+    bitvec_t *ci_active_vec; /**< CI parents of active senones. */
+    int16 *ci_scores; /**< CI senone scores used for ci_beam. */
+    uint8 *senone_gated; /**< Array of deltas to CI and CD senones within ci_beam. */
+    int32 n_ci_gated; /**< CD senones backed off by ci_beam this utterance. */
     int log_zero; /**< Zero log-probability value. */
 
     /* Utterance processing: */
@@ -204,6 +282,31 @@ acmod_t *acmod_init(config_t *config, logmath_t *lmath, fe_t *fe, feat_t *fcb);
  */
 acmod_t *acmod_create(config_t *config, logmath_t *lmath, fe_t *fe, feat_t *fcb);
 
+/**
+ * Create an acmod which shares model parameters with another one.
+ *
+ * The model definition, transition matrices and GMM parameters of
+ * <code>other</code> are retained rather than copied, and only the
+ * buffers and scratch space needed to process a separate stream of
+ * audio are allocated.  The GMM parameters can no longer be adapted
+ * with acmod_update_mllr() once they are shared.
+ *
+ * @param other acmod whose parameters will be shared.
+ * @param fe feature computation module for the new acmod (retained).
+ * @param fcb dynamic feature module for the new acmod (retained).
+ * @return new acmod, or NULL on failure (for instance if the GMM
+ *         computation module does not support sharing).
+ */
+acmod_t *acmod_clone(acmod_t *other, fe_t *fe, feat_t *fcb);
+
+/**
+ * Check if an acmod shares its model parameters with another one.
+ *
+ * @return TRUE if acmod was created with acmod_clone(), or if it has
+ *         been cloned and the clones still exist.
+ */
+int acmod_shared(acmod_t *acmod);
+
 /**
  * Reinitialize acmod with new feature computation modules.
  */
@@ -214,6 +317,20 @@ int acmod_reinit_feat(acmod_t *acmod, fe_t *fe, feat_t *fcb);
  */
 int acmod_load_am(acmod_t *acmod);
 
+/**
+ * Load acoustic model from a packed model bundle.
+ *
+ * The binary model definition is used directly from the bundle's
+ * memory, which is kept as long as it is needed.  If the bundle was
+ * created with decoder_pack_model() and acmod has no cache directory,
+ * the precomputed Gaussian parameters and reordered mixture weights
+ * packed in it are used in place as well, as long as they match this
+ * model and configuration.  Otherwise each section is parsed and
+ * copied as the corresponding model file would be (quantized mixture
+ * weights are used in place if they do not need to be reordered).
+ */
+int acmod_load_am_bundle(acmod_t *acmod, model_bundle_t *bundle);
+
 /**
  * Initialize senone scoring (after loading acoustic model files).
  */
@@ -299,6 +416,26 @@ int acmod_advance(acmod_t *acmod);
  */
 int acmod_set_grow(acmod_t *acmod, int grow_feat);
 
+/**
+ * Set the beam for gating CD senone computation on CI senone scores.
+ *
+ * @param beam Beam as a probability, or 0 to compute all active
+ *             senones normally.
+ * @return the beam in senone score units, or 0 if gating is disabled
+ *         (including for models with no CD senones).
+ */
+int32 acmod_set_ci_beam(acmod_t *acmod, float64 beam);
+
+/**
+ * Set the number of Gaussians per codebook used to score each frame.
+ *
+ * @param topn Number of Gaussians, which will be clamped to between 1
+ *             and the value of the <code>topn</code> parameter.
+ * @return the number actually used, or -1 if the acoustic model does
+ *         not support changing it.
+ */
+int acmod_set_topn(acmod_t *acmod, int topn);
+
 /**
  * TODO: Set queue length for utterance processing.
  *
@@ -395,10 +532,57 @@ mfcc_t **acmod_get_frame(acmod_t *acmod, int *inout_frame_idx);
  *         requested that is not yet or no longer available).  The
  *         data pointed to persists only until the next call to
  *         acmod_score() or acmod_advance().
+ *
+ * If the scorecache option is non-zero, the scores computed in each
+ * frame of the utterance are kept (up to that many KiB), so that a
+ * frame scored again (for instance, after acmod_rewind() for forced
+ * alignment) is served from them rather than recomputed.  Unless all
+ * senones are computed (the compallsen option), only the active ones
+ * are kept, along with the set of them, and since scores are
+ * normalized over that set, they are only reused if exactly the same
+ * senones are active again.  This does not change what is computed
+ * in the first place, nor the scores.  It is not done with frame
+ * downsampling, since the top-N codewords for a frame depend on those
+ * for previous frames.
+ *
+ * If the cibeam option is non-zero, the context-independent senones
+ * are scored first, and context-dependent senones whose CI parent
+ * falls outside that beam of the best CI score are not computed, but
+ * are given the score of their CI parent instead.
  */
 int16 const *acmod_score(acmod_t *acmod,
                          int *inout_frame_idx);
 
+/**
+ * Score several queued frames of data at once.
+ *
+ * This computes scores for up to ACMOD_MAX_BATCH frames in one pass
+ * over the acoustic model, which is faster than scoring them one at a
+ * time, since the model parameters only need to be brought into cache
+ * once.  Subsequent calls to acmod_score() for those frames will
+ * return the precomputed scores.
+ *
+ * Since the active senones for future frames are not known, unless
+ * all senones are being computed (the compallsen option), only the
+ * part of the computation that depends on the features is done, for
+ * the senones currently active (such as the top-N codewords for the
+ * codebooks they use).  Subsequent calls to acmod_score() then only
+ * need to combine these for the senones active in each frame, and
+ * give the same scores as they would have otherwise.  This is not
+ * supported by continuous models, or by PTM models with frame
+ * downsampling, in which case it does nothing.
+ *
+ * @param frame_idx First frame index to score.
+ * @param n_frames Maximum number of frames to score.
+ * @return Number of frames scored (which may be zero), or <0 on error.
+ */
+int acmod_score_batch(acmod_t *acmod, int frame_idx, int n_frames);
+
+/**
+ * Discard all senone scores kept by the scorecache option.
+ */
+void acmod_clear_score_cache(acmod_t *acmod);
+
 /**
  * Get best score and senone index for current frame.
  */
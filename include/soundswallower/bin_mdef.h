@@ -158,11 +158,13 @@ struct bin_mdef_s {
 #define bin_mdef_n_emit_state_phone(m, p) ((m)->n_emit_state ? (m)->n_emit_state \
                                                              : (m)->sseq_len[(m)->phone[p].ssid])
 #define bin_mdef_n_sen(m) ((m)->n_sen)
+#define bin_mdef_n_ci_sen(m) ((m)->n_ci_sen)
 #define bin_mdef_n_tmat(m) ((m)->n_tmat)
 #define bin_mdef_pid2ssid(m, p) ((m)->phone[p].ssid)
 #define bin_mdef_pid2tmatid(m, p) ((m)->phone[p].tmat)
 #define bin_mdef_silphone(m) ((m)->sil)
 #define bin_mdef_sen2cimap(m, s) ((m)->sen2cimap[s])
+#define bin_mdef_cd2cisen(m, s) ((m)->cd2cisen[s])
 #define bin_mdef_sseq2sen(m, ss, pos) ((m)->sseq[ss][pos])
 #define bin_mdef_pid2ci(m, p) (((p) < (m)->n_ciphone) ? (p) \
                                                       : (m)->phone[p].info.cd.ctx[0])
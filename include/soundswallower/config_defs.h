@@ -106,7 +106,19 @@
         { "maxhmmpf",                                                                           \
           ARG_INTEGER,                                                                          \
           "30000",                                                                              \
-          "Maximum number of active HMMs to maintain at each frame (or -1 for no pruning)" }
+          "Maximum number of active HMMs to maintain at each frame (or -1 for no pruning)" },   \
+        { "maxwpf",                                                                             \
+          ARG_INTEGER,                                                                          \
+          "-1",                                                                                 \
+          "Maximum number of word exits at each frame (or -1 for no pruning)" },                \
+        { "rtf",                                                                                \
+          ARG_FLOATING,                                                                         \
+          "0",                                                                                  \
+          "Target real-time factor, adjusting beams and top-N to meet it (or 0 to disable)" },  \
+        { "rtfbeam",                                                                            \
+          ARG_FLOATING,                                                                         \
+          "0.3",                                                                                \
+          "Narrowest fraction of the log beams allowed when meeting rtf" }
 
 /** Command-line options for finite state grammars. */
 #define FSG_OPTIONS                                               \
@@ -129,7 +141,23 @@
         { "fsgusefiller",                                         \
           ARG_BOOLEAN,                                            \
           "yes",                                                  \
-          "Insert filler words at each state." }
+          "Insert filler words at each state." },                 \
+        { "fsgshare",                                             \
+          ARG_BOOLEAN,                                            \
+          "no",                                                   \
+          "Share lextrees of repeated word lists" },              \
+        { "fsglazy",                                              \
+          ARG_BOOLEAN,                                            \
+          "no",                                                   \
+          "Build FSG lextrees on demand" },                       \
+        { "fsgsharefiller",                                       \
+          ARG_BOOLEAN,                                            \
+          "no",                                                   \
+          "Pool filler HMMs for FSG states that need them" },     \
+        { "fsgevict",                                             \
+          ARG_INTEGER,                                            \
+          "0",                                                    \
+          "Evict lextrees unused for N utterances (0=never)" }
 
 /** Command-line options for statistical language models (not used) and grammars. */
 #define NGRAM_OPTIONS                                                           \
@@ -183,6 +211,18 @@
           ARG_STRING,                                                                \
           NULL,                                                                      \
           "File containing feature extraction parameters." },                        \
+        { "bundle",                                                                  \
+          ARG_STRING,                                                                \
+          NULL,                                                                      \
+          "Packed model bundle file (used instead of the files in -hmm)" },          \
+        { "cachedir",                                                                \
+          ARG_STRING,                                                                \
+          NULL,                                                                      \
+          "Directory for caching tables derived from the model (faster startup)" },  \
+        { "sharedmodel",                                                             \
+          ARG_BOOLEAN,                                                               \
+          "no",                                                                      \
+          "Share Gaussians and mixture weights in cachedir between processes" },     \
         { "mdef",                                                                    \
           ARG_STRING,                                                                \
           NULL,                                                                      \
@@ -239,6 +279,14 @@
           ARG_INTEGER,                                                               \
           "1",                                                                       \
           "Frame GMM computation downsampling ratio" },                              \
+        { "ds_thresh",                                                               \
+          ARG_FLOATING,                                                              \
+          "0",                                                                       \
+          "RMS change in std devs for adaptive PTM frame downsampling (0 = off)" },  \
+        { "ds_max",                                                                  \
+          ARG_INTEGER,                                                               \
+          "4",                                                                       \
+          "Maximum number of frames to skip with adaptive downsampling" },           \
         { "topn",                                                                    \
           ARG_INTEGER,                                                               \
           "4",                                                                       \
@@ -247,6 +295,34 @@
           ARG_STRING,                                                                \
           "0",                                                                       \
           "Beam width used to determine top-N Gaussians (or a list, per-feature)" }, \
+        { "simd",                                                                    \
+          ARG_STRING,                                                                \
+          "auto",                                                                    \
+          "SIMD kernel for GMMs/HMMs (auto, scalar, sse2, avx2, neon, simd128)" },   \
+        { "gquant",                                                                  \
+          ARG_INTEGER,                                                               \
+          "0",                                                                       \
+          "Quantize PTM/semi-continuous Gaussians to 8 or 16 bits (0 = off)" },      \
+        { "gslist",                                                                  \
+          ARG_INTEGER,                                                               \
+          "0",                                                                       \
+          "Shortlist size for Gaussian selection in continuous models (0 = off)" },  \
+        { "gsvq",                                                                    \
+          ARG_INTEGER,                                                               \
+          "32",                                                                      \
+          "Number of codewords per codebook for Gaussian selection" },               \
+        { "nthreads",                                                                \
+          ARG_INTEGER,                                                               \
+          "1",                                                                       \
+          "Number of threads to use for GMM computation" },                          \
+        { "scorecache",                                                              \
+          ARG_INTEGER,                                                               \
+          "0",                                                                       \
+          "Memory (in KiB) for keeping senone scores to rescore an utterance" },     \
+        { "cibeam",                                                                  \
+          ARG_FLOATING,                                                              \
+          "0",                                                                       \
+          "Beam on CI senone scores for computing CD senones (0 = off)" },           \
         { "logbase",                                                                 \
           ARG_FLOATING,                                                              \
           "1.0001",                                                                  \
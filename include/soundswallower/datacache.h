@@ -0,0 +1,209 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+/**
+ * @file datacache.h Cache of derived model data.
+ *
+ * Quite a few tables are computed from the model files every time a
+ * decoder is initialized, such as the log-add table, precomputed
+ * Gaussian parameters, reordered mixture weights and triphone
+ * mappings.  If a cache directory is configured (the cachedir
+ * option), these are written there once, each one to a file named by
+ * a hash of its inputs, and later simply memory-mapped (or copied)
+ * from it instead of being recomputed.
+ *
+ * Files are only valid on the machine (byte order, fixed-point
+ * configuration) which created them, but this is included in the
+ * hash key, so a stale or foreign cache file is simply not used.
+ *
+ * Cache files are mapped read-only and shared, so if a cache is
+ * marked as shared (the sharedmodel option), the largest tables
+ * (Gaussians and mixture weights) are used in place rather than
+ * copied, and all processes using the same cache directory share a
+ * single physical copy of them.  Putting the directory on a memory
+ * filesystem such as /dev/shm makes it a named shared memory region.
+ *
+ * The same tables can also be packed into a model bundle (see
+ * model_bundle.h), which then serves as a read-only, shared cache, or
+ * collected in memory in order to do so.
+ */
+
+#ifndef __DATACACHE_H__
+#define __DATACACHE_H__
+
+#include <stddef.h>
+
+#include <soundswallower/model_bundle.h>
+#include <soundswallower/prim_type.h>
+#include <soundswallower/s3file.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#if 0
+}
+#endif
+
+/**
+ * Cache directory handle.
+ */
+typedef struct datacache_s datacache_t;
+
+/**
+ * Initial value for datacache_hash().
+ */
+#define DATACACHE_HASH_INIT ((uint64)0xcbf29ce484222325ULL)
+
+/**
+ * Open a cache directory, creating it if necessary.
+ *
+ * @param dir Directory, or NULL (or empty) for no caching.
+ * @return cache handle, or NULL if dir is NULL or can't be created.
+ */
+datacache_t *datacache_init(const char *dir);
+
+/**
+ * Use the tables packed in a model bundle as a cache.
+ *
+ * This cache is read-only (nothing can be stored in it) and shared,
+ * so the tables in it are used in place, directly from the mapping of
+ * the bundle.
+ *
+ * @param bundle Model bundle (retained).
+ * @return cache handle, or NULL if bundle is NULL.
+ */
+datacache_t *datacache_init_bundle(model_bundle_t *bundle);
+
+/**
+ * Create a cache which keeps tables in memory.
+ *
+ * This is used to collect the tables for a model in order to pack
+ * them into a bundle (see datacache_n_tables()).
+ */
+datacache_t *datacache_init_memory(void);
+
+/**
+ * Retain a pointer to a cache handle.
+ */
+datacache_t *datacache_retain(datacache_t *dc);
+
+/**
+ * Release a cache handle.
+ */
+int datacache_free(datacache_t *dc);
+
+/**
+ * Set whether tables from this cache should be used in place.
+ *
+ * This is a hint to the users of the cache, which must treat tables
+ * used in place as read-only, since they are shared with any other
+ * process which maps them.
+ */
+void datacache_set_shared(datacache_t *dc, int shared);
+
+/**
+ * Should tables from this cache be used in place?
+ *
+ * @return TRUE if dc is shared, FALSE if not (or if dc is NULL).
+ */
+int datacache_shared(datacache_t *dc);
+
+/**
+ * Can tables be stored in this cache?
+ *
+ * @return TRUE if dc is a cache directory or in memory, FALSE if it
+ *         comes from a model bundle (or is NULL).
+ */
+int datacache_can_store(datacache_t *dc);
+
+/**
+ * Update a hash key with some input data.
+ *
+ * This is not a cryptographic hash, it is only meant to be fast and
+ * to distinguish different inputs in practice.
+ */
+uint64 datacache_hash(uint64 key, const void *data, size_t len);
+
+/**
+ * Update a hash key with a string (including its terminating NUL).
+ */
+uint64 datacache_hash_str(uint64 key, const char *str);
+
+/**
+ * Map a cached table.
+ *
+ * @param dc Cache handle (may be NULL, in which case this fails).
+ * @param kind Short name of the kind of table (used in the filename).
+ * @param key Hash of the inputs used to create the table.
+ * @param out_data Output: pointer to the table, which is aligned to
+ *                 at least 16 bytes.
+ * @param out_size Output: size of the table in bytes.
+ * @return file containing the table, to be released with
+ *         s3file_free() once the table is no longer needed, or NULL
+ *         if not found or not valid.
+ */
+s3file_t *datacache_map(datacache_t *dc, const char *kind, uint64 key,
+                        const void **out_data, size_t *out_size);
+
+/**
+ * Store a table in the cache.
+ *
+ * The file is written under a temporary name and then renamed, so
+ * other processes never see partial tables.
+ *
+ * @param dc Cache handle (may be NULL, in which case nothing is done).
+ * @return 0 on success, <0 on failure.
+ */
+int datacache_store(datacache_t *dc, const char *kind, uint64 key,
+                    const void *data, size_t size);
+
+/**
+ * Get the number of tables in a cache created with
+ * datacache_init_memory().
+ */
+int datacache_n_tables(datacache_t *dc);
+
+/**
+ * Get a table from a cache created with datacache_init_memory().
+ *
+ * @param idx Index of table, from 0 to datacache_n_tables() - 1.
+ * @param out_name Output: name of the table, which is also the name
+ *                 of its section in a model bundle.
+ * @return file containing the table in the same format as a cache
+ *         file (including its header), to be released with
+ *         s3file_free(), or NULL if idx is out of range.
+ */
+s3file_t *datacache_get_table(datacache_t *dc, int idx,
+                              const char **out_name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DATACACHE_H__ */
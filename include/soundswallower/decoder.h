@@ -52,6 +52,7 @@
 #include <soundswallower/logmath.h>
 #include <soundswallower/mllr.h>
 #include <soundswallower/profile.h>
+#include <soundswallower/rtf_control.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -103,6 +104,68 @@ decoder_t *decoder_create(config_t *config);
  */
 decoder_t *decoder_init(config_t *config);
 
+/**
+ * Create a decoder for another stream of audio which shares the
+ * models of an existing one.
+ *
+ * The new decoder retains the configuration, acoustic model
+ * parameters (model definition, transition matrices and GMMs),
+ * dictionary, dictionary-to-senone mappings and grammar of
+ * <code>other</code> instead of loading them again.  It allocates
+ * only what it needs to process its own audio: feature extraction,
+ * acoustic buffers and scratch space, and the search.  The cepstral
+ * mean starts from the current estimate in <code>other</code>.
+ *
+ * Unlike the other model state, the FSG lexicon tree is not shared.
+ * It holds the active HMMs for each stream, and trees are built,
+ * shared between states and evicted while searching, so each clone
+ * builds its own from the shared grammar and dictionary.
+ *
+ * For the default US English model with a small grammar, this costs
+ * roughly 0.4MB of heap per stream instead of about 28MB for a new
+ * decoder.  The cost grows with the size of the grammar, and each
+ * clone also has its own worker threads if <code>nthreads</code> is
+ * greater than 1.
+ *
+ * Decoders created this way can be created, used and freed
+ * concurrently from different threads, as the reference counts of the
+ * objects they share are updated atomically (this is not the case if
+ * <code>dither</code> is enabled, as its random number generator is
+ * global).  Shared models cannot be
+ * modified: decoder_add_word() and decoder_apply_mllr() will fail on
+ * a decoder whose models are shared with another one.  The
+ * configuration object is shared too, so it must not be changed
+ * while other threads are using it.  Changes to it only take effect
+ * in a decoder once it is reinitialized, at which point it loads its
+ * own copy of everything.
+ *
+ * @param other Initialized decoder whose models will be shared.
+ * @return Newly created decoder, or NULL on failure.
+ */
+decoder_t *decoder_clone(decoder_t *other);
+
+/**
+ * Pack the model directory given in a configuration into a bundle.
+ *
+ * The model is loaded with <code>config</code>, and the tables
+ * computed from it (precomputed Gaussians, reordered mixture weights,
+ * log tables and dictionary-to-senone mappings) are packed into the
+ * bundle along with the model files.  A decoder using the bundle
+ * with the same model parameters and on the same kind of machine
+ * will use these tables directly from the bundle's memory instead of
+ * computing them again.  If the parameters differ, they are ignored
+ * and the model files are read as with model_bundle_pack().
+ *
+ * @note Unlike decoder_init(), this does not consume
+ * <code>config</code>.
+ *
+ * @param config Configuration, where <code>hmm</code> is the model
+ *               directory, which must have a binary <code>mdef</code>.
+ * @param outfile Bundle file to write.
+ * @return 0 for success, <0 for failure.
+ */
+int decoder_pack_model(config_t *config, const char *outfile);
+
 /**
  * Reinitialize the decoder with updated configuration.
  *
@@ -297,7 +360,8 @@ mllr_t *decoder_apply_mllr(decoder_t *d, mllr_t *mllr);
  *               If adding multiple words, it is more efficient to
  *               pass FALSE here in all but the last word.
  * @return The internal ID (>= 0) of the newly added word, or <0 on
- *         failure.
+ *         failure (including if the dictionary is shared with another
+ *         decoder, see decoder_clone()).
  */
 int decoder_add_word(decoder_t *d,
                      const char *word,
@@ -577,6 +641,38 @@ void decoder_utt_time(decoder_t *d, double *out_nspeech,
 void decoder_all_time(decoder_t *d, double *out_nspeech,
                       double *out_ncpu, double *out_nwall);
 
+/**
+ * Pruning settings and timing from the real-time factor controller.
+ */
+typedef struct rtf_stats_s {
+    double target; /**< Target real-time factor (0 if disabled). */
+    double rtf; /**< Real-time factor so far in this utterance. */
+    double beam; /**< Current beam, as a probability. */
+    double pbeam; /**< Current phone transition beam, as a probability. */
+    double wbeam; /**< Current word exit beam, as a probability. */
+    int topn; /**< Current top-N (0 if it cannot be adjusted). */
+    int n_frames; /**< Frames timed in this utterance. */
+    int n_miss; /**< Frames in this utterance which went over budget. */
+} rtf_stats_t;
+
+/**
+ * Get the current pruning settings and budget misses.
+ *
+ * With the <code>rtf</code> parameter set, the decoder times the
+ * search and scoring of each frame, and narrows the beams, then
+ * reduces top-N, when it falls behind, restoring them when it has
+ * time to spare.  Beams are scaled together in the log domain, no
+ * further than <code>rtfbeam</code>.  The settings carry over from
+ * one utterance to the next.
+ *
+ * @param d Decoder.
+ * @param out_stats Output: current settings and statistics.  If the
+ *                  controller is disabled, the configured beams and
+ *                  top-N are reported.
+ * @return 0 if the controller is enabled, -1 otherwise.
+ */
+int decoder_rtf_stats(decoder_t *d, rtf_stats_t *out_stats);
+
 /**
  * Set logging to go to a file.
  *
@@ -606,6 +702,7 @@ struct decoder_s {
     dict_t *dict; /**< Pronunciation dictionary. */
     dict2pid_t *d2p; /**< Dictionary to senone mapping. */
     logmath_t *lmath; /**< Log math computation. */
+    model_bundle_t *bundle; /**< Packed model bundle (or NULL). */
     search_module_t *search; /**< Main search module. */
     search_module_t *align; /**< State alignment module. */
     char *json_result; /**< Decoding result as JSON. */
@@ -613,6 +710,7 @@ struct decoder_s {
     /* Utterance-processing related stuff. */
     uint32 uttno; /**< Utterance counter. */
     ptmr_t perf; /**< Performance counter for all of decoding. */
+    rtf_control_t *rtf; /**< Real-time factor controller (or NULL). */
     uint32 n_frame; /**< Total number of frames processed. */
 
 #ifndef EMSCRIPTEN
@@ -43,6 +43,7 @@
 
 #include <soundswallower/bin_mdef.h>
 #include <soundswallower/bitvec.h>
+#include <soundswallower/datacache.h>
 #include <soundswallower/dict.h>
 #include <soundswallower/logmath.h>
 #include <soundswallower/s3types.h>
@@ -121,6 +122,15 @@ dict2pid_t *dict2pid_build(bin_mdef_t *mdef, /**< A  model definition*/
                            dict_t *dict /**< An initialized dictionary */
 );
 
+/**
+ * Build the dict2pid structure, using tables from a cache directory
+ * if they were already built for the same model and dictionary.
+ */
+dict2pid_t *dict2pid_build_cached(bin_mdef_t *mdef, /**< A  model definition*/
+                                  dict_t *dict, /**< An initialized dictionary */
+                                  datacache_t *dc /**< Cache directory, or NULL */
+);
+
 /**
  * Retain a pointer to dict2pid
  */
@@ -241,6 +241,15 @@ feat_t *feat_init(config_t *config);
  */
 feat_t *feat_init_s3file(config_t *config, s3file_t *lda);
 
+/**
+ * Initialize feature module with the same linear transform (if any)
+ * and initial cepstral mean as an existing one.
+ *
+ * The new module has its own buffers and normalization state, so it
+ * can be used for a separate stream of input.
+ */
+feat_t *feat_clone(config_t *config, feat_t *other);
+
 /**
  * Add an LDA transformation to the feature module from a file.
  * @return 0 for success or -1 if reading the LDA file failed.
@@ -73,7 +73,6 @@
 #ifndef __S2_FSG_HISTORY_H__
 #define __S2_FSG_HISTORY_H__
 
-#include <soundswallower/blkarray_list.h>
 #include <soundswallower/dict.h>
 #include <soundswallower/fsg_lextree.h>
 #include <soundswallower/fsg_model.h>
@@ -127,9 +126,10 @@ typedef struct fsg_hist_entry_s {
  * pruning is done in two stages: first for the non-null transitions, and then
  * for the null transitions alone.  (This solution is sub-optimal, and can be
  * improved with a little more work.  SMOP.)
- * Why is frame_entries a list?  Each entry has a unique terminating state,
- * and has a unique lc CIphone.  But it has a SET of rc CIphones.
- * frame_entries[s][lc] is an ordered list of entries created in the current
+ * Why is there a list for each state and lc?  Each entry has a unique
+ * terminating state, and has a unique lc CIphone.  But it has a SET of rc
+ * CIphones.  frame_bucket[s * n_ciphone + lc] is the first of an ordered
+ * list (linked by frame_next) of entries created in the current
  * frame, terminating in state s, and with left context lc.  The list is in
  * descending order of path score.  When a new entry with (s,lc) arrives,
  * its position in the list is determined.  Then its rc set is modified by
@@ -140,12 +140,25 @@ typedef struct fsg_hist_entry_s {
  * empty, it is also discarded.
  * As mentioned earlier, this procedure is applied in two stages, for the
  * non-null transitions, and the null transitions, separately.
+ * Since only a few of these lists are non-empty in any given frame, their
+ * indices are kept in frame_dirty, so that only those are visited at the end
+ * of the frame.  Entries for the current frame are allocated from one array,
+ * and those that get pruned are simply forgotten until it is emptied.
  */
 typedef struct fsg_history_s {
     fsg_model_t *fsg; /* The FSG for which this object applies */
-    blkarray_list_t *entries; /* A list of history table entries; the root
-                                 entry is the first element of the list */
-    glist_t **frame_entries;
+    fsg_hist_entry_t **blocks; /* History table entries, in fixed-size
+                                  blocks which are kept for reuse; the
+                                  root entry is the first one */
+    int32 n_blocks; /* Number of blocks allocated */
+    int32 n_entries; /* Number of valid history table entries */
+    fsg_hist_entry_t *frame_entries; /* Entries created in the current frame */
+    int32 *frame_next; /* Next entry in the same list, or -1 */
+    int32 n_frame_entries; /* Number of entries in frame_entries */
+    int32 max_frame_entries; /* Allocated size of frame_entries */
+    int32 *frame_bucket; /* First entry for each state and lc, or -1 */
+    int32 *frame_dirty; /* Indices of non-empty lists in frame_bucket */
+    int32 n_frame_dirty; /* Number of non-empty lists */
     int n_ciphone;
 } fsg_history_t;
 
@@ -43,6 +43,7 @@
 #include <soundswallower/dict.h>
 #include <soundswallower/dict2pid.h>
 #include <soundswallower/fsg_model.h>
+#include <soundswallower/hash_table.h>
 #include <soundswallower/hmm.h>
 
 #ifdef __cplusplus
@@ -54,7 +55,7 @@ extern "C" {
 
 /*
  * Compile-time constant determining the size of the
- * bitvector fsg_pnode_t.fsg_pnode_ctxt_t.bv.  (See below.)
+ * bitvector fsg_pnode_ctxt_t.bv.  (See below.)
  * But it makes memory allocation simpler and more efficient.
  * Make it smaller (2) to save memory if your phoneset has less than
  * 64 phones.
@@ -74,82 +75,21 @@ typedef struct fsg_pnode_ctxt_s {
  * is the max of the probs of all leaf nodes (and, hence, FSG transitions)
  * reachable from that node.
  *
- * To conserve memory, the underlying HMMs with state-level information are
- * allocated only as needed.  Root and leaf nodes must also account for all
- * the possible phonetic contexts, with an independent HMM for each distinct
- * context.
+ * Root and leaf nodes must also account for all the possible phonetic
+ * contexts, with an independent HMM for each distinct context.  Root nodes
+ * for different left contexts share the same children, so the "tree" is
+ * really a DAG.
+ *
+ * The lextree is built as a linked structure of nodes (see
+ * fsg_lextree.c) and then compiled into flat arrays indexed by node ID,
+ * which is what the search uses.  Children are stored in compressed
+ * sparse row form, and the fields touched for every active node in every
+ * frame (HMM, transition prob, children) are kept apart from those only
+ * needed on word entry and exit.
  */
-typedef struct fsg_pnode_s {
-    /*
-     * If this is not a leaf node, the first successor (child) node.  Otherwise
-     * the parent FSG transition for which this is the leaf node (for figuring
-     * the FSG destination state, and word emitted by the transition).  A node
-     * may have several children.  The succ ptr gives just the first; the rest
-     * are linked via the sibling ptr below.
-     */
-    union {
-        struct fsg_pnode_s *succ;
-        fsg_link_t *fsglink;
-    } next;
-
-    /*
-     * For simplicity of memory management (i.e., freeing the pnodes), all
-     * pnodes allocated for all transitions out of a state are maintained in a
-     * linear linked list through the alloc_next pointer.
-     */
-    struct fsg_pnode_s *alloc_next;
-
-    /*
-     * The next node that is also a child of the parent of this node; NULL if
-     * none.
-     */
-    struct fsg_pnode_s *sibling;
-
-    /*
-     * The transition (log) probability to be incurred upon transitioning to
-     * this node.  (Transition probabilities are really associated with the
-     * transitions.  But a lextree node has exactly one incoming transition.
-     * Hence, the prob can be associated with the node.)
-     * This is a logs2(prob) value, and includes the language weight.
-     */
-    int32 logs2prob;
-
-    /*
-     * The root and leaf positions associated with any transition have to deal
-     * with multiple phonetic contexts.  However, different contexts may result
-     * in the same SSID (senone-seq ID), and can share a single pnode with that
-     * SSID.  But the pnode should track the set of context CI phones that share
-     * it.  Hence the fsg_pnode_ctxt_t bit-vector set-representation.  (For
-     * simplicity of implementation, its size is a compile-time constant for
-     * now.)  Single phone words would need a 2-D array of context, but that's
-     * too expensive.  For now, they simply use SIL as right context, so only
-     * the left context is properly modelled.
-     * (For word-internal phones, this field is unused, of course.)
-     */
-    fsg_pnode_ctxt_t ctxt;
-
-    uint16 ci_ext; /* This node's CIphone as viewed externally (context) */
-    uint8 ppos; /* Phoneme position in pronunciation */
-    uint8 leaf; /* Whether this is a leaf node */
-
-    /* HMM-state-level stuff here */
-    hmm_context_t *ctx;
-    hmm_t hmm;
-} fsg_pnode_t;
-
-/* Access macros */
-#define fsg_pnode_leaf(p) ((p)->leaf)
-#define fsg_pnode_logs2prob(p) ((p)->logs2prob)
-#define fsg_pnode_succ(p) ((p)->next.succ)
-#define fsg_pnode_fsglink(p) ((p)->next.fsglink)
-#define fsg_pnode_sibling(p) ((p)->sibling)
-#define fsg_pnode_hmmptr(p) (&((p)->hmm))
-#define fsg_pnode_ci_ext(p) ((p)->ci_ext)
-#define fsg_pnode_ppos(p) ((p)->ppos)
-#define fsg_pnode_leaf(p) ((p)->leaf)
-#define fsg_pnode_ctxt(p) ((p)->ctxt)
 
 #define fsg_pnode_add_ctxt(p, c) ((p)->ctxt.bv[(c) >> 5] |= (1 << ((c) & 0x001f)))
+#define fsg_pnode_ctxt_has(ctxt, c) ((ctxt).bv[(c) >> 5] & (1 << ((c) & 0x001f)))
 
 /*
  * The following is macroized because its called very frequently
@@ -203,28 +143,195 @@ typedef struct fsg_lextree_s {
     int16 **lc; /**< Left context triphone mappings for FSG. */
     int16 **rc; /**< Right context triphone mappings for FSG. */
 
-    fsg_pnode_t **root; /* root[s] = lextree representing all transitions
-                           out of state s.  Note that the "tree" for each
-                           state is actually a collection of trees, linked
-                           via fsg_pnode_t.sibling (root[s]->sibling) */
-    fsg_pnode_t **alloc_head; /* alloc_head[s] = head of linear list of all
-                                 pnodes allocated for state s */
-    int32 n_pnode; /* #HMM nodes in search structure */
+    /*
+     * Compiled lextree nodes for all states.  States with the same
+     * outgoing words and contexts share one tree (see
+     * fsg_lextree_build_state()), so state s uses tree t =
+     * state_tree[s], or -1 if it has not been built yet.  The nodes for
+     * tree t have IDs root_off[t] to root_off[t+1]-1, of which the
+     * first n_root[t] are its roots.
+     * The children of node q are succ[succ_off[q]] to
+     * succ[succ_off[q+1]-1], in the same order in which they were linked
+     * in the lextree.
+     *
+     * The roots of each tree are sorted by first CI phone then left
+     * context set, and each run of roots with the same ones forms a
+     * group, so that a word exit only needs to look at the roots it
+     * can actually enter.  The groups for tree t are grp_off[t] to
+     * grp_off[t+1]-1, and group g ends just before root grp_end[g]
+     * (and starts where the previous one ends, or at root_off[t]).
+     */
+    int32 n_tnode; /**< Number of nodes in all trees */
+    int32 n_tree; /**< Number of distinct trees */
+    int32 n_tnode_alloc; /**< Allocated size of per-node arrays */
+    int32 n_succ_alloc; /**< Allocated size of succ */
+    int32 n_tree_alloc; /**< Allocated size of per-tree arrays */
+    int32 *state_tree; /**< Tree used by each state */
+    int32 *root_off; /**< First node of each tree (plus one past the end) */
+    int32 *n_root; /**< Number of root nodes for each tree */
+    int32 n_grp; /**< Number of root groups in all trees */
+    int32 n_grp_alloc; /**< Allocated size of per-group arrays */
+    int32 *grp_off; /**< First root group of each tree (plus one past the end) */
+    uint16 *grp_ci; /**< First CI phone of the roots in each group */
+    fsg_pnode_ctxt_t *grp_ctxt; /**< Left context set of the roots in each group */
+    int32 *grp_end; /**< One past the last root in each group */
+    uint16 *ssid; /**< Senone sequence ID for each node */
+    int16 *tmatid; /**< Transition matrix ID for each node */
+    int32 *logs2prob; /**< Transition (log) prob into each node, with
+                         insertion penalties and language weight */
+    int32 *succ_off; /**< Offset of each node's children in succ */
+    int32 *succ; /**< Children of all nodes */
+    uint8 *leaf; /**< Whether each node is a leaf */
+    uint16 *ci_ext; /**< CIphone of each node as viewed externally */
+    fsg_pnode_ctxt_t *ctxt; /**< Context sets for root and leaf nodes */
+    fsg_link_t **fsglink; /**< FSG transition for leaf nodes */
+    int32 *leaf_arc; /**< Index of fsglink among its state's transitions */
+    fsg_link_t ***arc_link; /**< For states using another state's tree,
+                               their own transitions, indexed by leaf_arc
+                               (NULL for the state that owns the tree) */
+    uint8 *ppos; /**< Phone position in pronunciation */
+
+    /*
+     * HMMs for the trees, which are what the search works with.  A
+     * tree only describes the structure, and each state that enters
+     * one gets an instance of it, with an HMM for each of its nodes,
+     * which it shares only with states that have exactly the same
+     * transitions (in which case it does not matter which of them a
+     * path came from).  So state s uses instance i = state_inst[s],
+     * or -1 if it has none yet, whose HMM nodes have IDs inst_off[i]
+     * to inst_off[i+1]-1, in the same order as the nodes of tree
+     * inst_tree[i].  HMM node p is an instance of node[p], so its
+     * children are p + succ[k] - node[p] for each child succ[k] of
+     * node[p].
+     */
+    int32 n_pnode; /**< Number of HMM nodes in search structure */
+    int32 n_pnode_alloc; /**< Allocated size of per-HMM arrays */
+    int32 n_inst; /**< Number of tree instances */
+    int32 n_inst_alloc; /**< Allocated size of per-instance arrays */
+    int32 *state_inst; /**< Instance used by each state */
+    int32 *inst_tree; /**< Tree of each instance */
+    int32 *inst_off; /**< First HMM node of each instance (plus one past the end) */
+    hmm_t *hmm; /**< HMM for each HMM node */
+    int32 *node; /**< Tree node for each HMM node */
+
+    /*
+     * If filler sharing is enabled, the single-phone filler self-loops
+     * are left out of the per-state trees, so that states which differ
+     * only in them can share a tree.  Instead, each state in which a
+     * filler is active gets a filler bank of its own, for as long as
+     * it needs one, from a pool of them.  Bank b is tree fill_tree[b]
+     * and its only instance fill_inst[b], whose node f (a leaf) is the
+     * HMM for filler word fill_wid[f].
+     * The self-loop for that filler in state s is
+     * fill_link[s * n_fill + f], or NULL if s has none.
+     */
+    int32 n_fill; /**< Number of fillers in a bank (0 if not shared) */
+    int32 *fill_wid; /**< FSG word ID for each filler in a bank */
+    int32 *fill_idx; /**< Position in a bank of each FSG word, or -1 */
+    fsg_link_t **fill_link; /**< Filler self-loop for each state and filler */
+    int32 n_fill_bank; /**< Number of filler banks allocated */
+    int32 *fill_tree; /**< Tree for each filler bank */
+    int32 *fill_inst; /**< Instance of the tree for each filler bank */
+    int32 *fill_state; /**< State using each filler bank, or -1 if free */
+    int32 *state_fill; /**< Filler bank used by each state, or -1 */
+
+    hash_table_t *tree_ht; /**< Tree for each key in tree_sig */
+    int32 **tree_sig; /**< Key identifying the states which can use
+                         each tree (see fsg_lextree_build_state()) */
+    size_t *tree_sig_len; /**< Length of each tree's key */
+    int32 *tree_utt; /**< Last utterance in which each tree was entered */
+    hash_table_t *inst_ht; /**< Instance for each key in inst_sig */
+    int32 **inst_sig; /**< Key identifying the states which can use
+                         each instance */
+    size_t *inst_sig_len; /**< Length of each instance's key */
+    int32 *inst_utt; /**< Last utterance in which each instance was entered */
+    int32 *rc_id; /**< Right context set ID for each state, if sharing */
+    int32 utt; /**< Number of utterances started */
     int32 wip;
     int32 pip;
 } fsg_lextree_t;
 
-/* Access macros */
-#define fsg_lextree_root(lt, s) ((lt)->root[s])
+/* Access macros (p is an HMM node, q a tree node) */
 #define fsg_lextree_n_pnode(lt) ((lt)->n_pnode)
+#define fsg_lextree_hmm(lt, p) (&(lt)->hmm[p])
+#define fsg_lextree_node(lt, p) ((lt)->node[p])
+#define fsg_lextree_leaf(lt, p) ((lt)->leaf[(lt)->node[p]])
+#define fsg_lextree_first_root(lt, s) ((lt)->root_off[(lt)->state_tree[s]])
+#define fsg_lextree_end_root(lt, s) (fsg_lextree_first_root(lt, s) \
+                                     + (lt)->n_root[(lt)->state_tree[s]])
+/** Filler self-loop for bank position f in state s, or NULL. */
+#define fsg_lextree_fill_link(lt, s, f) ((lt)->fill_link[(s) * (lt)->n_fill + (f)])
+/** FSG transition for leaf node q when its tree was entered from state s. */
+#define fsg_lextree_fsglink(lt, q, s) (((lt)->arc_link[s] && (lt)->leaf_arc[q] >= 0) \
+                                           ? (lt)->arc_link[s][(lt)->leaf_arc[q]]   \
+                                           : (lt)->fsglink[q])
 
 /**
  * Create, initialize, and return a new phonetic lextree for the given FSG.
+ *
+ * States with exactly the same word transitions always share a lextree
+ * and its HMMs.  If share is TRUE, states whose transitions differ only
+ * in destinations with the same right contexts, such as the copies of
+ * <w> in a JSGF rule like <w> <w> <w>, also share the structure of
+ * their lextree, which saves the memory and time to build it.  Each
+ * of them still gets its own HMMs, so this is exact.
+ *
+ * If lazy is TRUE, no trees are built until the search enters their
+ * states with fsg_lextree_enter_state().
+ *
+ * If share_filler is TRUE, the single-phone filler self-loops are
+ * taken out of the per-state trees, and only the states in which a
+ * filler is currently active have filler HMMs, which they get with
+ * fsg_lextree_enter_fillers().  Each of these states has its own, so
+ * this is exact.
  */
 fsg_lextree_t *fsg_lextree_init(fsg_model_t *fsg, dict_t *dict,
                                 dict2pid_t *d2p,
                                 bin_mdef_t *mdef, hmm_context_t *ctx,
-                                int32 wip, int32 pip);
+                                int32 wip, int32 pip, int share, int lazy,
+                                int share_filler);
+
+/**
+ * Build the lextree for state s, or find an existing one it can share,
+ * and the instance of it (with its HMMs) used by s.
+ *
+ * This appends to the node arrays, which may move them, so pointers
+ * to nodes (such as from fsg_lextree_hmm()) are invalidated.
+ *
+ * @return Index of the instance used by s.
+ */
+int32 fsg_lextree_build_state(fsg_lextree_t *lextree, int32 s);
+
+/**
+ * Get the lextree instance for state s, building it if necessary, and
+ * mark it and its tree as used in the current utterance.
+ *
+ * @return Index of the instance used by s.
+ */
+int32 fsg_lextree_enter_state(fsg_lextree_t *lextree, int32 s);
+
+/**
+ * Get the filler bank for state s, taking a free one (or building a
+ * new one) if it does not have one already.
+ *
+ * Like fsg_lextree_build_state(), this may move the node arrays.
+ *
+ * @return First HMM node of the bank, whose node f is filler f.
+ */
+int32 fsg_lextree_enter_fillers(fsg_lextree_t *lextree, int32 s);
+
+/**
+ * Free the filler banks which have no HMMs active in the given frame,
+ * so that other states can use them.
+ */
+void fsg_lextree_release_fillers(fsg_lextree_t *lextree, int32 frame);
+
+/**
+ * Start a new utterance, first evicting trees and instances which have
+ * not been entered in the last max_idle utterances (if max_idle > 0).  This
+ * renumbers nodes, so it must only be called when none are active.
+ */
+void fsg_lextree_start_utt(fsg_lextree_t *lextree, int32 max_idle);
 
 /**
  * Free lextrees for an FSG.
@@ -237,9 +344,9 @@ void fsg_lextree_free(fsg_lextree_t *fsg);
 void fsg_lextree_dump(fsg_lextree_t *fsg, FILE *fh);
 
 /**
- * Mark the given pnode as inactive (for search).
+ * Mark the given node as inactive (for search).
  */
-void fsg_psubtree_pnode_deactivate(fsg_pnode_t *pnode);
+#define fsg_lextree_pnode_deactivate(lt, p) hmm_clear(fsg_lextree_hmm(lt, p))
 
 /**
  *  Set all flags on in the given context bitvector.
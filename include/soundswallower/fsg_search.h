@@ -46,6 +46,7 @@
 #include <soundswallower/fsg_model.h>
 #include <soundswallower/glist.h>
 #include <soundswallower/hmm.h>
+#include <soundswallower/hmm_simd.h>
 #include <soundswallower/search_module.h>
 
 #ifdef __cplusplus
@@ -72,24 +73,36 @@ typedef struct fsg_search_s {
     search_module_t base;
 
     hmm_context_t *hmmctx; /**< HMM context. */
+    const hmm_simd_t *simd; /**< SIMD kernels for HMM evaluation, or NULL. */
 
     fsg_model_t *fsg; /**< FSG model */
     struct fsg_lextree_s *lextree; /**< Lextree structure for the currently
                                     active FSG */
     struct fsg_history_s *history; /**< For storing the Viterbi search history */
 
-    glist_t pnode_active; /**< Those active in this frame */
-    glist_t pnode_active_next; /**< Those activated for the next frame */
+    int32 *pnode_active; /**< Lextree nodes active in this frame */
+    int32 *pnode_active_next; /**< Those activated for the next frame */
+    int32 n_pnode_active; /**< Number active in this frame */
+    int32 n_pnode_active_next; /**< Number activated for the next frame */
+    int32 max_pnode_active; /**< Allocated size of pnode_active */
+    int32 max_pnode_active_next; /**< Allocated size of pnode_active_next */
+    hmm_t **hmm_eval; /**< HMMs of pnode_active, for batch evaluation */
+    int32 max_hmm_eval; /**< Allocated size of hmm_eval */
 
     int32 beam_orig; /**< Global pruning threshold */
     int32 pbeam_orig; /**< Pruning threshold for phone transition */
     int32 wbeam_orig; /**< Pruning threshold for word exit */
-    float32 beam_factor; /**< Dynamic/adaptive factor (<=1) applied to above
-                              beams to determine actual effective beams.
-                              For implementing absolute pruning. */
-    int32 beam, pbeam, wbeam; /**< Effective beams after applying beam_factor */
+    int32 beam, pbeam, wbeam; /**< Effective beams for this frame */
+    float32 beam_factor; /**< Scale applied to all three beams */
+    int32 maxhmmpf; /**< Maximum HMMs to evaluate in each frame (or -1) */
+    int32 maxwpf; /**< Maximum word exits in each frame (or -1) */
     float32 lw; /**< Language weight */
     int32 pip, wip; /**< Log insertion penalties */
+    int32 frate; /**< Frame rate, for performance statistics */
+    int32 evict; /**< Evict lextrees unused for this many utterances */
+    uint8 share; /**< Share lextree structure between similar states */
+    uint8 lazy; /**< Build lextrees on demand */
+    uint8 share_filler; /**< Pool filler banks between states */
 
     frame_idx_t frame; /**< Current frame. */
     uint8 final; /**< Decoding is finished for this utterance. */
@@ -103,6 +116,10 @@ typedef struct fsg_search_s {
     int32 ascr, lscr; /**< Total acoustic and lm score for utt */
 
     int32 n_hmm_eval; /**< Total HMMs evaluated this utt */
+    int32 max_hmm_eval_frame; /**< Most HMMs evaluated in one frame this utt */
+    int32 n_hmm_hist_prune; /**< HMMs removed by histogram pruning this utt */
+    int32 n_word_hist_prune; /**< Word exits removed by histogram pruning
+                                this utt */
     int32 n_sen_eval; /**< Total senones evaluated this utt */
 
     ptmr_t perf; /**< Performance counter */
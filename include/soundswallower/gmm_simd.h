@@ -0,0 +1,275 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+/**
+ * @file gmm_simd.h SIMD kernels for diagonal Gaussian evaluation.
+ *
+ * These kernels evaluate several densities in parallel, one per
+ * vector lane, accumulating the distance over dimensions in exactly
+ * the same order as the scalar code in ptm_mgau.c.  This means that
+ * their results are bit-identical to the scalar ones, which is not
+ * the case if you vectorize over dimensions instead.
+ *
+ * There are also kernels for combining quantized mixture weights
+ * with the top-N density scores in semi-continuous models, which
+ * evaluate many senones in parallel, and give the same results as
+ * the scalar code using fast_logmath_add().
+ */
+
+#ifndef __GMM_SIMD_H__
+#define __GMM_SIMD_H__
+
+#include <soundswallower/datacache.h>
+#include <soundswallower/fe.h>
+#include <soundswallower/ms_gauden.h>
+#include <soundswallower/prim_type.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#if 0
+}
+#endif
+
+/**
+ * Widest vector (in floats) supported by any kernel.
+ */
+#define GMM_SIMD_MAX_WIDTH 8
+
+/**
+ * Evaluate a block of interleaved densities.
+ *
+ * Densities are stored interleaved by dimension, i.e. mean[j * width
+ * + k] is dimension j of density k in the block.
+ *
+ * @param z Observation vector.
+ * @param mean Interleaved means for the block.
+ * @param var Interleaved (precomputed) inverse variances for the block.
+ * @param det Log determinants for the block.
+ * @param ceplen Dimensionality.
+ * @param thresh Threshold for early termination.
+ * @param out Output: width distances.
+ * @return Number of dimensions evaluated.  If less than ceplen then
+ *         all densities in the block fell below thresh and the
+ *         contents of out are partial.
+ */
+typedef int (*gmm_simd_block_func)(const mfcc_t *z, const mfcc_t *mean,
+                                   const mfcc_t *var, const mfcc_t *det,
+                                   int ceplen, mfcc_t thresh, mfcc_t *out);
+
+/**
+ * Evaluate a list of arbitrary densities (no early termination).
+ *
+ * @param z Observation vector.
+ * @param mean Row-major means for the codebook.
+ * @param var Row-major (precomputed) inverse variances for the codebook.
+ * @param det Log determinants for the codebook.
+ * @param cw Indices of densities to evaluate.
+ * @param n Number of densities to evaluate.
+ * @param ceplen Dimensionality.
+ * @param out Output: n distances.
+ */
+typedef void (*gmm_simd_list_func)(const mfcc_t *z, const mfcc_t *mean,
+                                   const mfcc_t *var, const mfcc_t *det,
+                                   const int32 *cw, int n,
+                                   int ceplen, mfcc_t *out);
+
+/**
+ * Compute senone scores from 8-bit mixture weights.
+ *
+ * For each senone j in 0..n-1, this log-adds mixw[k][j] + score[k]
+ * over k in 0..topn-1 (in negated, quantized log units, see
+ * fast_logmath_add()) and adds the result to out[j].
+ *
+ * @param out Senone scores to accumulate into.
+ * @param mixw Mixture weights for each of the top-N densities.
+ * @param score Scores of the top-N densities.
+ * @param topn Number of top-N densities (at least 1).
+ * @param logadd Log-add table with at least 256 entries.
+ * @param n_logadd Number of entries in logadd up to the last non-zero
+ *                 one, which must be less than 256.
+ * @param n Number of senones, a multiple of mixw_width in gmm_simd_t.
+ */
+typedef void (*gmm_simd_mixw_func)(int16 *out, const uint8 *const *mixw,
+                                   const int32 *score, int topn,
+                                   const uint8 *logadd, int n_logadd, int n);
+
+/**
+ * Compute senone scores from 4-bit mixture weights.
+ *
+ * Like gmm_simd_mixw_func, except that mixw contains two senones per
+ * byte (the even one in the low 4 bits) and these are indices into
+ * w_den, which contains 16 entries for each of the top-N densities
+ * (the mixture weight plus the density score).
+ */
+typedef void (*gmm_simd_mixw4_func)(int16 *out, const uint8 *const *mixw,
+                                    const uint8 *w_den, int topn,
+                                    const uint8 *logadd, int n_logadd, int n);
+
+/**
+ * Set of SIMD kernels for a particular instruction set.
+ */
+typedef struct gmm_simd_s {
+    const char *name; /**< Name of instruction set. */
+    int width; /**< Number of densities evaluated in parallel. */
+    gmm_simd_block_func eval_block; /**< Evaluate an interleaved block. */
+    gmm_simd_list_func eval_list; /**< Evaluate a list of densities. */
+    int mixw_width; /**< Number of senones evaluated in parallel. */
+    gmm_simd_mixw_func mixw; /**< 8-bit mixture weights, or NULL. */
+    gmm_simd_mixw4_func mixw4; /**< 4-bit mixture weights, or NULL. */
+} gmm_simd_t;
+
+/**
+ * Interleaved copy of Gaussian parameters for a given kernel.
+ */
+typedef struct gmm_simd_layout_s {
+    int width; /**< Width of kernel for which this was built. */
+    int n_block; /**< Number of blocks per codebook and feature. */
+    mfcc_t ***mean; /**< Interleaved means by codebook, feature. */
+    mfcc_t ***var; /**< Interleaved variances by codebook, feature. */
+    mfcc_t ***det; /**< Padded determinants by codebook, feature. */
+    mfcc_t *buf; /**< Storage for all of the above, or NULL if mapped. */
+    s3file_t *mmap; /**< Cache file containing all of the above if it
+                          is used in place (read-only), or NULL. */
+} gmm_simd_layout_t;
+
+/**
+ * Get the SIMD kernels to use.
+ *
+ * @param name Name of instruction set, or "auto" (or NULL) to pick
+ *             the best one supported by this CPU, or "scalar" to
+ *             not use SIMD.
+ * @return Kernels, or NULL if no SIMD is to be (or can be) used, in
+ *         which case the caller should use its scalar code.
+ */
+const gmm_simd_t *gmm_simd_get(const char *name);
+
+/**
+ * Build interleaved copies of Gaussian parameters.
+ *
+ * The means, variances and determinants for each codebook and
+ * feature are stored contiguously, starting on a 64-byte boundary.
+ * This needs to be redone if the means and variances in g change
+ * (e.g. after MLLR).
+ */
+gmm_simd_layout_t *gmm_simd_layout_init(const gmm_simd_t *simd, gauden_t *g);
+
+/**
+ * Build interleaved copies of Gaussian parameters, or get them from a
+ * cache.
+ *
+ * If dc is shared (see datacache_set_shared()), the cached copy is
+ * used in place.  Parameters without a cache key (see
+ * gauden_init_s3file_cached()) are not cached.
+ */
+gmm_simd_layout_t *gmm_simd_layout_init_cached(const gmm_simd_t *simd,
+                                               gauden_t *g,
+                                               datacache_t *dc);
+
+/**
+ * Compute top-N densities for a codebook, like gauden_dist().
+ *
+ * The results are identical to those of gauden_dist(), including the
+ * order of densities with equal scores.
+ */
+int32 gmm_simd_gauden_dist(const gmm_simd_t *simd,
+                           const gmm_simd_layout_t *layout,
+                           gauden_t *g, int mgau, int32 n_top,
+                           mfcc_t **obs, gauden_dist_t **out_dist);
+
+/**
+ * Compute top-N densities from a Gaussian selection shortlist.
+ *
+ * Results are identical to gauden_dist_gs().  This uses the original
+ * (row-major) means and variances in g, so it needs no layout.
+ */
+int32 gmm_simd_gauden_dist_gs(const gmm_simd_t *simd, gauden_t *g,
+                              gauden_gs_t *gs, int mgau, int32 n_top,
+                              mfcc_t **obs, gauden_dist_t **out_dist);
+
+/**
+ * Maximum number of senones evaluated in parallel by any kernel.
+ */
+#define GMM_SIMD_MAX_MIXW_WIDTH 32
+
+/**
+ * Compute senone scores from 8-bit mixture weights.
+ *
+ * See gmm_simd_mixw_func for the parameters, except that n can be
+ * anything, and simd can be NULL, in which case scalar code is used.
+ */
+void gmm_simd_mixw(const gmm_simd_t *simd, int16 *out,
+                   const uint8 *const *mixw, const int32 *score, int topn,
+                   const uint8 *logadd, int n_logadd, int n);
+
+/**
+ * Compute senone scores from 4-bit mixture weights.
+ *
+ * See gmm_simd_mixw4_func for the parameters, except that n can be
+ * anything, and simd can be NULL, in which case scalar code is used.
+ */
+void gmm_simd_mixw4(const gmm_simd_t *simd, int16 *out,
+                    const uint8 *const *mixw, const uint8 *w_den, int topn,
+                    const uint8 *logadd, int n_logadd, int n);
+
+/**
+ * Compute scores for active senones from 8-bit mixture weights.
+ *
+ * This is scalar code, for when too few senones are active to make
+ * scoring all of them with gmm_simd_mixw() worthwhile.
+ *
+ * @param senone_active Delta-coded list of active senones, as in
+ *                      acmod_t.
+ * @param n_senone_active Number of entries in senone_active.
+ */
+void gmm_simd_mixw_active(int16 *out, const uint8 *const *mixw,
+                          const int32 *score, int topn,
+                          const uint8 *logadd, int n_logadd,
+                          const uint8 *senone_active, int n_senone_active);
+
+/**
+ * Compute scores for active senones from 4-bit mixture weights.
+ *
+ * See gmm_simd_mixw_active().
+ */
+void gmm_simd_mixw4_active(int16 *out, const uint8 *const *mixw,
+                           const uint8 *w_den, int topn,
+                           const uint8 *logadd, int n_logadd,
+                           const uint8 *senone_active, int n_senone_active);
+
+/**
+ * Free interleaved Gaussian parameters.
+ */
+void gmm_simd_layout_free(gmm_simd_layout_t *layout);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __GMM_SIMD_H__ */
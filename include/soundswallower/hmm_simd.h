@@ -0,0 +1,134 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+
+/**
+ * @file hmm_simd.h SIMD kernels for Viterbi evaluation of HMMs.
+ *
+ * These kernels evaluate several left-to-right HMMs in parallel, one
+ * per vector lane, doing the same comparisons as the scalar code in
+ * hmm.c, including the way it breaks ties between equal scores and
+ * which states it leaves alone when their predecessors are inactive.
+ * This means that their results are identical to the scalar ones.
+ */
+
+#ifndef __HMM_SIMD_H__
+#define __HMM_SIMD_H__
+
+#include <soundswallower/hmm.h>
+#include <soundswallower/prim_type.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#if 0
+}
+#endif
+
+/**
+ * Number of HMMs evaluated together by every kernel.
+ */
+#define HMM_SIMD_WIDTH 8
+
+/**
+ * Smallest batch of HMMs worth evaluating with SIMD.
+ *
+ * Gathering HMMs into lanes and scattering them back costs more than
+ * it saves while the batch still fits in cache.  With bench_hmm_simd
+ * on x86-64, one HMM at a time with hmm_vit_eval() takes 7-10 ns for
+ * up to 128 3-state or 5-state HMMs, against 11-17 ns with SSE2 or
+ * AVX2.  The SIMD kernels catch up at about 256 5-state and 512
+ * 3-state HMMs, and are 20-40% faster from 1024 up.
+ */
+#define HMM_SIMD_MIN_BATCH 256
+
+/**
+ * HMMs gathered into lanes for a kernel.
+ *
+ * Everything is stored by state, then by lane.  The scores and
+ * histories include the non-emitting exit state at index
+ * n_emit_state.
+ */
+typedef struct hmm_simd_lanes_s {
+    int32 score[HMM_MAX_NSTATE + 1][HMM_SIMD_WIDTH]; /**< State scores. */
+    int32 history[HMM_MAX_NSTATE + 1][HMM_SIMD_WIDTH]; /**< History indices. */
+    int32 senscr[HMM_MAX_NSTATE][HMM_SIMD_WIDTH]; /**< Senone scores, as
+                                                     added to state
+                                                     scores. */
+    int32 tprob[HMM_MAX_NSTATE][3][HMM_SIMD_WIDTH]; /**< Transition scores
+                                                       from state i to
+                                                       i, i+1, i+2. */
+    int32 best[HMM_SIMD_WIDTH]; /**< Output: best state score. */
+} hmm_simd_lanes_t;
+
+/**
+ * Evaluate HMM_SIMD_WIDTH non-multiplex HMMs in place.
+ */
+typedef void (*hmm_simd_eval_func)(hmm_simd_lanes_t *lanes);
+
+/**
+ * Set of SIMD kernels for a particular instruction set.
+ */
+typedef struct hmm_simd_s {
+    const char *name; /**< Name of instruction set. */
+    hmm_simd_eval_func eval_3st; /**< 3-state left-to-right HMMs. */
+    hmm_simd_eval_func eval_5st; /**< 5-state left-to-right HMMs. */
+} hmm_simd_t;
+
+/**
+ * Get the SIMD kernels to use.
+ *
+ * @param name Name of instruction set, or "auto" (or NULL) to pick
+ *             the best one supported by this CPU, or "scalar" to
+ *             not use SIMD.
+ * @return Kernels, or NULL if no SIMD is to be (or can be) used.
+ */
+const hmm_simd_t *hmm_simd_get(const char *name);
+
+/**
+ * Viterbi evaluation of a list of HMMs.
+ *
+ * The results are identical to calling hmm_vit_eval() on each of
+ * them.  If there are at least HMM_SIMD_MIN_BATCH of them,
+ * non-multiplex 3- and 5-state HMMs are evaluated HMM_SIMD_WIDTH at
+ * a time with simd, and everything else with the scalar code.
+ *
+ * @param simd Kernels to use, or NULL to use only scalar code.
+ * @param hmms HMMs to evaluate, all sharing the same context.
+ * @param n Number of HMMs in hmms.
+ * @return Best state score over all of the HMMs, or WORST_SCORE if n
+ *         is zero.
+ */
+int32 hmm_simd_vit_eval(const hmm_simd_t *simd, hmm_t *const *hmms, int n);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __HMM_SIMD_H__ */
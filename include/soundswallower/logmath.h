@@ -73,6 +73,7 @@
 #define __LOGMATH_H__
 
 #include <soundswallower/configuration.h>
+#include <soundswallower/datacache.h>
 #include <soundswallower/prim_type.h>
 
 #ifdef __cplusplus
@@ -119,6 +120,14 @@ typedef struct logmath_s logmath_t;
  */
 logmath_t *logmath_init(float64 base, int shift, int use_table);
 
+/**
+ * Initialize a log math computation table, using a cached add table
+ * if one exists in dc, and storing it there otherwise.
+ * @param dc Derived data cache, or NULL to just call logmath_init().
+ */
+logmath_t *logmath_init_cached(float64 base, int shift, int use_table,
+                               datacache_t *dc);
+
 /**
  * Get the log table size and dimensions.
  */
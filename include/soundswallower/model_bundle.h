@@ -0,0 +1,177 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+/**
+ * @file model_bundle.h Single-file packed acoustic models.
+ *
+ * An acoustic model is normally a directory of separate files, each
+ * of which is opened and mapped separately.  A bundle packs them
+ * all into one file, with a section table at the start and each
+ * section aligned to MODEL_BUNDLE_ALIGN bytes, so that the whole
+ * model can be distributed as, and mapped from, a single file.  The
+ * sections are the files from the model directory (named as they are
+ * there, e.g. "mdef", "means", "dict.txt") in their usual formats.
+ *
+ * A bundle can also hold the tables which are otherwise computed from
+ * those files at startup, in the layout used in memory (see
+ * datacache.h), as sections named "cache/" followed by the name of
+ * their cache file.  These are used in place, directly from the
+ * mapping of the bundle, whenever they match the machine and the
+ * configuration, so that loading a model from a bundle made by
+ * decoder_pack_model() copies very little.  Otherwise they are
+ * ignored and the model files are parsed as usual.
+ */
+
+#ifndef __MODEL_BUNDLE_H__
+#define __MODEL_BUNDLE_H__
+
+#include <soundswallower/prim_type.h>
+#include <soundswallower/s3file.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#if 0
+}
+#endif
+
+/**
+ * Alignment of sections in a bundle.
+ */
+#define MODEL_BUNDLE_ALIGN 64
+
+/**
+ * Maximum length of a section name (including terminating NUL).
+ */
+#define MODEL_BUNDLE_NAMELEN 48
+
+/**
+ * Packed model bundle.
+ */
+typedef struct model_bundle_s model_bundle_t;
+
+/**
+ * Map a model bundle from a file.
+ *
+ * @return bundle, or NULL on failure.
+ */
+model_bundle_t *model_bundle_read(const char *path);
+
+/**
+ * Read a model bundle from an s3file_t (e.g. one loaded into memory).
+ *
+ * @param s3f File, which is retained by the bundle.
+ * @return bundle, or NULL on failure.
+ */
+model_bundle_t *model_bundle_init_s3file(s3file_t *s3f);
+
+/**
+ * Retain a pointer to a model bundle.
+ */
+model_bundle_t *model_bundle_retain(model_bundle_t *bundle);
+
+/**
+ * Release a model bundle.
+ *
+ * Sections obtained with model_bundle_get() remain valid after this.
+ */
+int model_bundle_free(model_bundle_t *bundle);
+
+/**
+ * Get the number of sections in a bundle.
+ */
+int model_bundle_n_sections(model_bundle_t *bundle);
+
+/**
+ * Get the name of a section in a bundle.
+ */
+const char *model_bundle_section_name(model_bundle_t *bundle, int idx);
+
+/**
+ * Get a section of a bundle.
+ *
+ * @return new s3file_t pointing into the bundle, to be released with
+ *         s3file_free(), or NULL if there is no such section.
+ */
+s3file_t *model_bundle_get(model_bundle_t *bundle, const char *name);
+
+/**
+ * Write a bundle from a list of files.
+ *
+ * @param outfile Bundle to write.
+ * @param names Section names.
+ * @param paths Files containing each section.
+ * @param n_sections Number of sections.
+ * @return 0 on success, <0 on failure.
+ */
+int model_bundle_write(const char *outfile, const char *const *names,
+                       const char *const *paths, int n_sections);
+
+/**
+ * Write a bundle from a list of files in memory.
+ *
+ * @param outfile Bundle to write.
+ * @param names Section names.
+ * @param files Contents of each section.
+ * @param n_sections Number of sections.
+ * @return 0 on success, <0 on failure.
+ */
+int model_bundle_write_s3file(const char *outfile, const char *const *names,
+                              s3file_t *const *files, int n_sections);
+
+/**
+ * Pack a model directory into a bundle.
+ *
+ * All the files which the decoder would use from the directory
+ * (acoustic model, feature parameters, dictionaries) are packed.  The
+ * model definition must be in binary format.  No precomputed tables
+ * are packed (see decoder_pack_model()).
+ *
+ * @return 0 on success, <0 on failure.
+ */
+int model_bundle_pack(const char *hmmdir, const char *outfile);
+
+/**
+ * Pack a model directory into a bundle, along with some tables.
+ *
+ * @param table_names Names of table sections, which follow the files
+ *                    from the model directory.
+ * @param tables Contents of each table section.
+ * @param n_tables Number of table sections.
+ * @return 0 on success, <0 on failure.
+ */
+int model_bundle_pack_tables(const char *hmmdir, const char *outfile,
+                             const char *const *table_names,
+                             s3file_t *const *tables, int n_tables);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MODEL_BUNDLE_H__ */
@@ -51,6 +51,7 @@
  */
 
 #include <soundswallower/configuration.h>
+#include <soundswallower/datacache.h>
 #include <soundswallower/feat.h>
 #include <soundswallower/hmm.h>
 #include <soundswallower/logmath.h>
@@ -76,6 +77,11 @@ typedef struct gauden_dist_s {
 
 } gauden_dist_t;
 
+/**
+ * Initial value for top-N density values.
+ */
+#define GAUDEN_WORST_DIST (mfcc_t)(int32)0x80000000
+
 /**
  * \struct gauden_t
  * \brief Multivariate gaussian mixture density parameters
@@ -90,8 +96,37 @@ typedef struct gauden_s {
     int32 n_feat; /**< Number feature streams in each codebook */
     int32 n_density; /**< Number gaussian densities in each codebook-feature stream */
     int32 *featlen; /**< feature length for each feature */
+    int32 quant_bits; /**< Bits per quantized parameter (8 or 16), or 0 */
+    void ***qmean; /**< Quantized means by codebook, feature (n_density x
+                      featlen int8 or int16, mean and var are NULL) */
+    void ***qvar; /**< Quantized variances, like qmean */
+    mfcc_t ***qscale; /**< Per-dimension scale for quantized means */
+    mfcc_t ***qoffset; /**< Per-dimension offset for quantized means */
+    mfcc_t ***qvscale; /**< Per-density scale for quantized variances */
+    uint64 key; /**< Cache key for these parameters, or 0 if not cached */
+    s3file_t *mmap; /**< Cache file containing mean, var and det if
+                          they are used in place (read-only), or NULL */
 } gauden_t;
 
+/**
+ * \struct gauden_gs_t
+ * \brief Vector-quantized Gaussian selection index.
+ *
+ * The means of each codebook and feature stream are clustered into
+ * n_vq codewords, each of which has a shortlist of the n_list
+ * densities most likely at that codeword.  For each frame, only the
+ * shortlist for the codeword closest to the observation is scored.
+ */
+typedef struct gauden_gs_s {
+    int32 n_vq; /**< Number of codewords per codebook and feature */
+    int32 n_list; /**< Number of densities in each shortlist */
+    mfcc_t ***vq; /**< vq[codebook][feature] = n_vq x featlen codewords */
+    mfcc_t ***weight; /**< Per-dimension weights for codeword distances */
+    int32 ***list; /**< list[codebook][feature] = n_vq x n_list density IDs,
+                      in increasing order */
+    void *buf; /**< Storage for the above */
+} gauden_gs_t;
+
 /**
  * Read mixture gaussian codebooks from the given files.  Allocate memory space needed
  * for them.  Apply the specified variance floor value.
@@ -111,10 +146,64 @@ gauden_t *gauden_init_s3file(s3file_t *meanfile, /**< Input: File containing mea
                              float32 varfloor, /**< Input: Floor value to be applied to variances */
                              logmath_t *lmath);
 
+/**
+ * Read mixture gaussian codebooks from s3file_t, using precomputed
+ * parameters from dc if they exist, and storing them there otherwise.
+ */
+gauden_t *gauden_init_s3file_cached(s3file_t *meanfile,
+                                    s3file_t *varfile,
+                                    float32 varfloor,
+                                    logmath_t *lmath,
+                                    datacache_t *dc);
+
+/**
+ * Quantize means and variances to 8 or 16 bit integers.
+ *
+ * Means are quantized per dimension with a scale and offset, and
+ * variances are rescaled to the units of the quantized means, then
+ * quantized with a per-density scale, such that the distance from a
+ * quantized observation (see gauden_quant_obs()) to a quantized
+ * density is:
+ *
+ *   det - qvscale * sum((qobs - qmean)^2 * qvar)
+ *
+ * where the sum can be computed with integer arithmetic.  The
+ * floating-point means and variances are freed.
+ *
+ * @return 0 for success, -1 for failure (invalid number of bits).
+ */
+int32 gauden_quantize(gauden_t *g, int bits);
+
+/**
+ * Quantize an observation for a given codebook and feature, for use
+ * with quantized means and variances.
+ *
+ * Values are clamped to a range which ensures that, for 8-bit
+ * quantization, each term of the sum cannot overflow 32 bits.
+ */
+void gauden_quant_obs(gauden_t *g, int mgau, int feat,
+                      const mfcc_t *obs, int32 *out_qobs);
+
+/**
+ * Compute the distance from a quantized observation to one quantized
+ * density, as described for gauden_quantize().
+ *
+ * The sum is abandoned once the distance falls below thresh, in which
+ * case the return value is only guaranteed to be less than thresh.
+ */
+mfcc_t gauden_quant_dist(gauden_t *g, int mgau, int feat,
+                         const int32 *qobs, int32 cw, mfcc_t thresh);
+
 /** Release memory allocated by gauden_init. */
 void gauden_free(gauden_t *g); /**< In: The gauden_t to free */
 
-/** Transform Gaussians according to an MLLR matrix (or, eventually, more). */
+/**
+ * Transform Gaussians according to an MLLR matrix (or, eventually, more).
+ *
+ * This leaves floating-point means and variances, so if g->quant_bits
+ * is set, the caller must requantize them with gauden_quantize() once
+ * it has derived anything else it needs from them.
+ */
 int32 gauden_mllr_transform(gauden_t *s, mllr_t *mllr, config_t *config);
 
 /**
@@ -136,6 +225,44 @@ gauden_dist(gauden_t *g, /**< In: handle to entire ensemble of codebooks */
                Caller must allocate memory for this output */
 );
 
+/**
+ * Insert a density into a top-N list, in worsening order, before any
+ * others with the same value.  Its value must be at least that of the
+ * last entry in the list, which is dropped.
+ */
+void gauden_dist_insert(gauden_dist_t *topn, int32 n_top, int32 id, mfcc_t dist);
+
+/**
+ * Build a Gaussian selection index for a set of codebooks.
+ *
+ * @param n_vq Number of codewords per codebook and feature.
+ * @param n_list Number of densities in each shortlist.
+ * @return Newly allocated index, or NULL if the codebooks are too
+ *         small for it to be useful or are quantized.
+ */
+gauden_gs_t *gauden_gs_init(gauden_t *g, int32 n_vq, int32 n_list);
+
+/** Release memory allocated by gauden_gs_init. */
+void gauden_gs_free(gauden_gs_t *gs);
+
+/**
+ * Find the shortlist of densities for an observation.
+ *
+ * @return Pointer to gs->n_list density IDs in increasing order.
+ */
+const int32 *gauden_gs_shortlist(gauden_gs_t *gs, gauden_t *g,
+                                 int mgau, int feat, const mfcc_t *obs);
+
+/**
+ * Like gauden_dist(), but only scores the shortlisted densities.
+ *
+ * If the shortlists contain all of the top N densities, the results
+ * are the same as gauden_dist().
+ */
+int32 gauden_dist_gs(gauden_t *g, gauden_gs_t *gs,
+                     int mgau, int n_top, mfcc_t **obs,
+                     gauden_dist_t **out_dist);
+
 /**
    Dump the definitionn of Gaussian distribution.
 */
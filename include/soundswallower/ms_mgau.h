@@ -99,9 +99,11 @@
 #include <soundswallower/bin_mdef.h>
 #include <soundswallower/configuration.h>
 #include <soundswallower/feat.h>
+#include <soundswallower/gmm_simd.h>
 #include <soundswallower/logmath.h>
 #include <soundswallower/ms_gauden.h>
 #include <soundswallower/ms_senone.h>
+#include <soundswallower/thread_pool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -120,9 +122,15 @@ typedef struct ms_mgau_model_s {
     senone_t *s; /**< The senone */
     int topn; /**< Top-n gaussian will be computed */
 
-    /**< Intermediate used in computation */
+    /**< Intermediate used in computation (n_mgau per frame, for
+       up to ACMOD_MAX_BATCH frames) */
     gauden_dist_t ***dist;
     uint8 *mgau_active;
+    int32 *sen_active; /**< Active senone IDs for the current frame */
+    thread_pool_t *pool; /**< Worker threads (owned by acmod), or NULL */
+    const gmm_simd_t *simd; /**< SIMD kernels, or NULL for scalar code */
+    gmm_simd_layout_t *simd_layout; /**< Interleaved Gaussians for SIMD */
+    gauden_gs_t *gs; /**< Gaussian selection index, or NULL */
     config_t *config;
 } ms_mgau_model_t;
 
@@ -142,8 +150,17 @@ int32 ms_cont_mgau_frame_eval(mgau_t *msg,
                               mfcc_t **feat,
                               int32 frame,
                               int32 compallsen);
+int32 ms_cont_mgau_frame_eval_batch(mgau_t *msg,
+                                    int16 **senscr,
+                                    uint8 *senone_active,
+                                    int32 n_senone_active,
+                                    mfcc_t ***feat,
+                                    int32 frame,
+                                    int32 n_frames,
+                                    int32 compallsen);
 int32 ms_mgau_mllr_transform(mgau_t *s,
                              mllr_t *mllr);
+mgau_t *ms_mgau_clone(mgau_t *s, acmod_t *acmod);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -45,10 +45,12 @@
 #include <soundswallower/acmod.h>
 #include <soundswallower/bin_mdef.h>
 #include <soundswallower/fe.h>
+#include <soundswallower/gmm_simd.h>
 #include <soundswallower/hmm.h>
 #include <soundswallower/logmath.h>
 #include <soundswallower/ms_gauden.h>
 #include <soundswallower/s3file.h>
+#include <soundswallower/thread_pool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -67,6 +69,7 @@ typedef struct ptm_topn_s {
 typedef struct ptm_fast_eval_s {
     ptm_topn_t ***topn; /**< Top-N for each codebook (mgau x feature x topn) */
     bitvec_t *mgau_active; /**< Set of active codebooks */
+    int full_eval; /**< Evaluate all codewords, not just previous top-N */
 } ptm_fast_eval_t;
 
 struct ptm_mgau_s {
@@ -75,11 +78,38 @@ struct ptm_mgau_s {
     gauden_t *g; /**< Set of Gaussians. */
     int32 n_sen; /**< Number of senones. */
     uint8 *sen2cb; /**< Senone to codebook mapping. */
-    uint8 ***mixw; /**< Mixture weight distributions by feature, codeword, senone */
+    uint8 ***mixw; /**< Mixture weight distributions by feature, codeword, senone
+                      (used in place if cb_mixw is NULL) */
     s3file_t *sendump_mmap; /* Memory map for mixw (or NULL if not mmap) */
     uint8 *mixw_cb; /* Mixture weight codebook, if any (assume it contains 16 values) */
-    int16 max_topn;
+    int32 *cb_sen_start; /**< Index of first senone in cb_sen for each codebook (plus one) */
+    int32 *cb_sen; /**< Senones for each codebook, in order */
+    int32 *sen2cbidx; /**< Position of each senone in its codebook's list */
+    uint8 ***cb_mixw; /**< Mixture weights by feature, codebook, then codeword
+                         (rows of senones in cb_sen order, packed 4-bit if mixw_cb),
+                         or NULL to use mixw directly */
+    s3file_t *cb_mixw_mmap; /**< Memory map for cb_mixw (or NULL if not cached) */
+    int32 *cb_active; /**< Active senones for each codebook (columns in cb_mixw or mixw) */
+    int32 *n_cb_active; /**< Number of active senones for each codebook */
+    int32 **cb_fden; /**< Scratch space for feature densities, per thread */
+    int32 **cb_ascore; /**< Scratch space for senone scores, per thread */
+    int32 *sen_best; /**< Best senone score found by each thread */
+    int32 *feat_norm; /**< Normalizer for top-N scores in each feature stream */
+    int16 max_topn; /**< Top-N from configuration (size of top-N arrays) */
+    int16 topn; /**< Top-N currently evaluated (at most max_topn) */
     int16 ds_ratio;
+    mfcc_t ds_thresh; /**< Cepstral distance for adaptive downsampling, or 0 */
+    int32 ds_max; /**< Maximum frames to skip in adaptive downsampling */
+    int32 ds_skip; /**< Frames skipped since last full evaluation */
+    mfcc_t *ds_ref; /**< Cepstra of last fully evaluated frame */
+    mfcc_t *ds_weight; /**< Per-dimension weights for cepstral distance */
+
+    const gmm_simd_t *simd; /**< SIMD kernels, or NULL to use scalar code. */
+    gmm_simd_layout_t *simd_layout; /**< Gaussians interleaved for SIMD kernels. */
+    int32 **simd_cw; /**< Scratch space for top-N codewords, per thread. */
+    mfcc_t **simd_dist; /**< Scratch space for top-N distances, per thread. */
+    int32 **qobs; /**< Scratch space for quantized observation, per thread. */
+    thread_pool_t *pool; /**< Worker threads (owned by acmod), or NULL. */
 
     ptm_fast_eval_t *hist; /**< Fast evaluation info for past frames. */
     ptm_fast_eval_t *f; /**< Fast eval info for current frame. */
@@ -102,8 +132,24 @@ int ptm_mgau_frame_eval(mgau_t *s,
                         mfcc_t **featbuf,
                         int32 frame,
                         int32 compallsen);
+int ptm_mgau_frame_eval_batch(mgau_t *s,
+                              int16 **senone_scores,
+                              uint8 *senone_active,
+                              int32 n_senone_active,
+                              mfcc_t ***featbuf,
+                              int32 frame,
+                              int32 n_frames,
+                              int32 compallsen);
+int ptm_mgau_frame_prepare(mgau_t *s,
+                           uint8 *senone_active,
+                           int32 n_senone_active,
+                           mfcc_t ***featbuf,
+                           int32 frame,
+                           int32 n_frames);
 int ptm_mgau_mllr_transform(mgau_t *s,
                             mllr_t *mllr);
+mgau_t *ptm_mgau_clone(mgau_t *s, acmod_t *acmod);
+int ptm_mgau_set_topn(mgau_t *s, int topn);
 void ptm_mgau_reset_fast_hist(mgau_t *ps);
 
 #ifdef __cplusplus
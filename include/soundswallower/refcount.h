@@ -0,0 +1,114 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+/**
+ * @file refcount.h Reference counting for objects shared between threads.
+ *
+ * Models, dictionaries and configuration can be shared between
+ * decoders created with decoder_clone(), which may then be used and
+ * freed in different threads, so their reference counts are updated
+ * atomically.  Without compiler support for this, clones must be
+ * created and freed from a single thread.
+ */
+
+#ifndef __REFCOUNT_H__
+#define __REFCOUNT_H__
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#if 0
+}
+#endif
+
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L)
+#define REFCOUNT_INLINE static inline
+#elif defined(_MSC_VER)
+#define REFCOUNT_INLINE static __inline
+#else
+#define REFCOUNT_INLINE static
+#endif
+
+/**
+ * Increment a reference count.
+ *
+ * @return New reference count.
+ */
+REFCOUNT_INLINE int
+refcount_inc(int *refcount)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_add_fetch(refcount, 1, __ATOMIC_RELAXED);
+#elif defined(_MSC_VER)
+    return _InterlockedIncrement((long volatile *)refcount);
+#else
+    return ++*refcount;
+#endif
+}
+
+/**
+ * Decrement a reference count.
+ *
+ * @return New reference count, which is 0 if the caller now has the
+ *         only remaining pointer to the object and should free it.
+ */
+REFCOUNT_INLINE int
+refcount_dec(int *refcount)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_sub_fetch(refcount, 1, __ATOMIC_ACQ_REL);
+#elif defined(_MSC_VER)
+    return _InterlockedDecrement((long volatile *)refcount);
+#else
+    return --*refcount;
+#endif
+}
+
+/**
+ * Read a reference count (to check if an object is shared).
+ */
+REFCOUNT_INLINE int
+refcount_get(int *refcount)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(refcount, __ATOMIC_ACQUIRE);
+#else
+    return *(int volatile *)refcount;
+#endif
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __REFCOUNT_H__ */
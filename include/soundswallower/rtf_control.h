@@ -0,0 +1,125 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+/**
+ * @file rtf_control.h
+ * @brief Adjust pruning to track a target real-time factor
+ */
+
+#ifndef __RTF_CONTROL_H__
+#define __RTF_CONTROL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#if 0
+}
+#endif
+
+#include <soundswallower/prim_type.h>
+
+/**
+ * Number of frames between adjustments, so that each one has time
+ * to take effect before the next.
+ */
+#define RTF_CONTROL_INTERVAL 10
+/**
+ * Weight of the newest frame in the smoothed time per frame.
+ */
+#define RTF_CONTROL_ALPHA 0.1
+/**
+ * Factor by which beams are narrowed (or widened) in one step.
+ */
+#define RTF_CONTROL_STEP 0.9
+/**
+ * Fraction of the budget below which pruning is relaxed.
+ */
+#define RTF_CONTROL_SLACK 0.7
+
+/**
+ * @struct rtf_control_t
+ * @brief Feedback controller for search and scoring time.
+ *
+ * This only decides what the beam scale and top-N should be, given
+ * the time taken by each frame; the decoder applies them.  When a
+ * frame (on average) goes over budget, beams are narrowed first, down
+ * to min_factor, then top-N is reduced.  When there is time to spare,
+ * top-N is restored first, then the beams.
+ */
+typedef struct rtf_control_s {
+    double target; /**< Target real-time factor. */
+    double budget; /**< Seconds allowed per frame. */
+    double avg; /**< Smoothed seconds per frame. */
+    float32 min_factor; /**< Narrowest beam scale. */
+    float32 factor; /**< Current beam scale. */
+    int max_topn; /**< Top-N from configuration. */
+    int topn; /**< Current top-N. */
+    int n_since; /**< Frames since last adjustment. */
+    int n_frames; /**< Frames timed in this utterance. */
+    int n_miss; /**< Frames over budget in this utterance. */
+} rtf_control_t;
+
+/**
+ * Create a controller.
+ *
+ * @param target Target real-time factor, greater than zero.
+ * @param frate Frames per second.
+ * @param min_factor Narrowest scale applied to the log beams.
+ * @param max_topn Largest top-N, or 0 if it cannot be adjusted.
+ * @return new controller, or NULL on error.
+ */
+rtf_control_t *rtf_control_init(double target, int frate,
+                                float32 min_factor, int max_topn);
+
+/**
+ * Free a controller.
+ */
+void rtf_control_free(rtf_control_t *rc);
+
+/**
+ * Clear per-utterance statistics.
+ *
+ * The beam scale and top-N are kept, as the next utterance is likely
+ * to need the same.
+ */
+void rtf_control_start_utt(rtf_control_t *rc);
+
+/**
+ * Account for the time taken by one frame.
+ *
+ * @param secs Wall-clock time spent searching and scoring the frame.
+ * @return TRUE if the beam scale or top-N have changed.
+ */
+int rtf_control_update(rtf_control_t *rc, double secs);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __RTF_CONTROL_H__ */
@@ -45,6 +45,7 @@
 #include <soundswallower/acmod.h>
 #include <soundswallower/bin_mdef.h>
 #include <soundswallower/fe.h>
+#include <soundswallower/gmm_simd.h>
 #include <soundswallower/hmm.h>
 #include <soundswallower/logmath.h>
 #include <soundswallower/ms_gauden.h>
@@ -57,7 +58,10 @@ extern "C" {
 }
 #endif
 
-typedef struct vqFeature_s vqFeature_t;
+typedef struct vqFeature_s {
+    int32 score; /**< Score or distance. */
+    int32 codeword; /**< Codeword (vector index). */
+} vqFeature_t;
 
 typedef struct s2_semi_mgau_s s2_semi_mgau_t;
 struct s2_semi_mgau_s {
@@ -79,6 +83,13 @@ struct s2_semi_mgau_s {
     uint8 **topn_hist_n; /**< Variable top-N for past frames. */
     vqFeature_t **f; /**< Topn-N for currently scoring frame. */
     int n_topn_hist; /**< Number of past frames tracked. */
+    int32 *qobs; /**< Scratch space for quantized observation. */
+    const gmm_simd_t *simd; /**< SIMD kernels for mixture weights, or NULL. */
+    int n_logadd; /**< Number of non-zero entries in log-add table. */
+    const uint8 **mixw_cw; /**< Scratch: mixture weights for top-N densities. */
+    int32 *mixw_score; /**< Scratch: scores for top-N densities. */
+    uint8 *w_den; /**< Scratch: 4-bit weights scaled by top-N scores. */
+    int16 *mixw_dense; /**< Scratch: scores for all senones. */
 
     /* Log-add table for compressed values. */
     logmath_t *lmath_8b;
@@ -97,8 +108,15 @@ int s2_semi_mgau_frame_eval(mgau_t *s,
                             mfcc_t **featbuf,
                             int32 frame,
                             int32 compallsen);
+int s2_semi_mgau_frame_prepare(mgau_t *s,
+                               uint8 *senone_active,
+                               int32 n_senone_active,
+                               mfcc_t ***featbuf,
+                               int32 frame,
+                               int32 n_frames);
 int s2_semi_mgau_mllr_transform(mgau_t *s,
                                 mllr_t *mllr);
+mgau_t *s2_semi_mgau_clone(mgau_t *s, acmod_t *acmod);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -79,6 +79,7 @@ typedef struct s3hdr_s {
 typedef struct s3file_s {
     int refcount;
     mmio_file_t *mf;
+    struct s3file_s *parent; /**< File containing this one (or NULL). */
     const void *buf;
     const char *ptr, *end;
     s3hdr_t *headers;
@@ -98,6 +99,14 @@ s3file_t *s3file_init(const void *buf, size_t len);
  */
 s3file_t *s3file_map_file(const char *filename);
 
+/**
+ * Create an s3file_t for part of another one.
+ *
+ * No data is copied; the new file retains a pointer to its parent.
+ * @return new file, or NULL if the range is not inside the parent.
+ */
+s3file_t *s3file_slice(s3file_t *parent, size_t offset, size_t len);
+
 /**
  * Retain s3file_t.
  */
@@ -80,6 +80,8 @@ typedef struct searchfuncs_s {
     const char *(*hyp)(search_module_t *search, int32 *out_score);
     int32 (*prob)(search_module_t *search);
     seg_iter_t *(*seg_iter)(search_module_t *search);
+    int (*set_beam_factor)(search_module_t *search,
+                           float32 factor); /**< Optional, may be NULL. */
 } searchfuncs_t;
 
 /**
@@ -129,6 +131,7 @@ struct search_module_s {
 #define search_module_hyp(s, sc) (*(search_module_base(s)->vt->hyp))(s, sc)
 #define search_module_prob(s) (*(search_module_base(s)->vt->prob))(s)
 #define search_module_seg_iter(s) (*(search_module_base(s)->vt->seg_iter))(s)
+#define search_module_set_beam_factor(s, f) (*(search_module_base(s)->vt->set_beam_factor))(s, f)
 
 /* For convenience... */
 #define search_module_silence_wid(s) search_module_base(s)->silence_wid
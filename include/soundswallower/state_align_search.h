@@ -45,6 +45,7 @@
 #include <soundswallower/alignment.h>
 #include <soundswallower/decoder.h>
 #include <soundswallower/hmm.h>
+#include <soundswallower/hmm_simd.h>
 #include <soundswallower/prim_type.h>
 #include <soundswallower/search_module.h>
 
@@ -70,8 +71,10 @@ typedef struct state_align_hist_s state_align_hist_t;
 struct state_align_search_s {
     search_module_t base; /**< Base search structure. */
     hmm_context_t *hmmctx; /**< HMM context structure. */
+    const hmm_simd_t *simd; /**< SIMD kernels for HMM evaluation, or NULL. */
     alignment_t *al; /**< Alignment structure being operated on. */
     hmm_t *hmms; /**< Vector of HMMs corresponding to phone level. */
+    hmm_t **hmm_eval; /**< HMMs active in the current frame. */
     int *sf; /**< Vector of minimum start frames for HMMs. */
     int *ef; /**< Vector of maximum exit frames for HMMs.
                   (note that exit frame = end frame + 1) */
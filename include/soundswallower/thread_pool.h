@@ -0,0 +1,101 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+/**
+ * @file thread_pool.h Minimal pool of worker threads for acoustic scoring.
+ *
+ * This is deliberately very simple: all threads (including the
+ * calling one) run the same function on the same data for each job,
+ * and are told their index and the number of threads, so that they
+ * can divide up the work among themselves.  The caller waits until
+ * they have all finished before continuing.
+ */
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#if 0
+}
+#endif
+
+/**
+ * Pool of worker threads.
+ */
+typedef struct thread_pool_s thread_pool_t;
+
+/**
+ * Function run by each thread for a job.
+ *
+ * @param data Data passed to thread_pool_run().
+ * @param idx Index of this thread, from 0 to n_threads - 1.
+ * @param n_threads Number of threads running this job.
+ */
+typedef void (*thread_pool_func_t)(void *data, int idx, int n_threads);
+
+/**
+ * Create a pool of threads.
+ *
+ * @param n_threads Total number of threads, including the calling
+ *                  thread (so, 1 creates no new threads).
+ * @return Newly created pool, or NULL if n_threads is less than 2 or
+ *         threads are not supported on this platform, in which case
+ *         thread_pool_run() will simply run jobs in the calling thread.
+ */
+thread_pool_t *thread_pool_init(int n_threads);
+
+/**
+ * Get the number of threads in a pool.
+ *
+ * @param pool Pool, or NULL.
+ * @return Number of threads which will run each job (1 if pool is NULL).
+ */
+int thread_pool_n_threads(thread_pool_t *pool);
+
+/**
+ * Run a job on all threads and wait for them to finish.
+ *
+ * @param pool Pool, or NULL to run func in the calling thread only.
+ * @param func Function to run.
+ * @param data Data to pass to func.
+ */
+void thread_pool_run(thread_pool_t *pool, thread_pool_func_t func, void *data);
+
+/**
+ * Stop and free a pool of threads.
+ */
+void thread_pool_free(thread_pool_t *pool);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __THREAD_POOL_H__ */
@@ -62,6 +62,7 @@ typedef struct tmat_s {
     int16 n_tmat; /**< Number matrices */
     int16 n_state; /**< Number source states in matrix (only the emitting states);
                       Number destination states = n_state+1, it includes the exit state */
+    int refcount; /**< Reference count. */
 } tmat_t;
 
 /** Initialize transition matrix */
@@ -77,10 +78,16 @@ tmat_t *tmat_init(const char *tmatfile, /**< In: input file */
 tmat_t *tmat_init_s3file(s3file_t *s, logmath_t *lmath, float64 tpfloor);
 
 /**
- * RAH, add code to remove memory allocated by tmat_init
+ * Retain a pointer to transition matrices.
  */
+tmat_t *tmat_retain(tmat_t *t);
 
-void tmat_free(tmat_t *t /**< In: transition matrix */
+/**
+ * RAH, add code to remove memory allocated by tmat_init
+ *
+ * @return new reference count (0 if freed).
+ */
+int tmat_free(tmat_t *t /**< In: transition matrix */
 );
 
 #ifdef __cplusplus
@@ -35,6 +35,27 @@ class Decoder {
     this.cdecoder = Module._decoder_create(cconfig);
     if (this.cdecoder == 0) throw new Error("Failed to construct Decoder");
   }
+  /**
+   * Create a decoder for another stream of audio.
+   *
+   * The new decoder shares the acoustic model, dictionary, grammar
+   * and configuration of this one, and only allocates what it needs
+   * to process its own audio (about 0.4MB for the default model and
+   * a small grammar).  Do not add words to either decoder after
+   * cloning it.  Since the configuration is shared, the audio
+   * parameters of the clone cannot be reinitialized.
+   * @returns {Decoder} New decoder, which must also be freed with delete().
+   * @throws {Error} If the decoder could not be cloned.
+   */
+  clone() {
+    this.assert_initialized();
+    const cdecoder = Module._decoder_clone(this.cdecoder);
+    if (cdecoder == 0) throw new Error("Failed to clone decoder");
+    const clone = Object.create(Decoder.prototype);
+    clone.cdecoder = cdecoder;
+    clone.initialized = true;
+    return clone;
+  }
   /**
    * Free resources used by the decoder.
    */
@@ -323,6 +344,8 @@ class Decoder {
    */
   async reinitialize_audio() {
     this.assert_initialized();
+    if (this.cacmod === undefined)
+      throw new Error("Cannot reinitialize audio of a cloned decoder");
     const fe = await this.init_fe();
     const fcb = await this.init_feat();
     if (Module._acmod_reinit_feat(this.cacmod, fe, fcb) < 0)
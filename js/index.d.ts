@@ -1,6 +1,7 @@
 /// <reference types="emscripten" />
 export class Decoder {
   initialized: boolean;
+  clone(): Decoder;
   delete(): void;
   get_config_json(): string;
   set_config(key: string, val: string | number): boolean;
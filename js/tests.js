@@ -177,6 +177,23 @@ export function make_tests(soundswallower, load_binary_file, assert) {
       decoder.delete();
     });
   });
+  describe("Test cloning", () => {
+    it("Should decode with a clone of the decoder", async () => {
+      let decoder = new soundswallower.Decoder({
+        fsg: "testdata/goforward.fsg",
+        samprate: 16000,
+      });
+      await decoder.initialize();
+      let clone = decoder.clone();
+      decoder.delete();
+      let pcm = await load_binary_file("testdata/goforward-float32.raw");
+      clone.start();
+      clone.process_audio(pcm, false, true);
+      clone.stop();
+      assert.equal("go forward ten meters", clone.get_text());
+      clone.delete();
+    });
+  });
   describe("Test loading model for other language", () => {
     it('Should recognize "avance de dix mètres"', async () => {
       let decoder = new soundswallower.Decoder({
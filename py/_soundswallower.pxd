@@ -155,6 +155,8 @@ cdef extern from "soundswallower/decoder.h":
     config_param_t *decoder_args()
     decoder_t *decoder_create(config_t *config)
     decoder_t *decoder_init(config_t *config)
+    decoder_t *decoder_clone(decoder_t *other)
+    int decoder_pack_model(config_t *config, const char *outfile)
     int decoder_free(decoder_t *ps)
     int decoder_reinit(decoder_t *ps, config_t *config)
     int decoder_reinit_feat(decoder_t *ps, config_t *config)
@@ -268,3 +270,6 @@ cdef extern from "soundswallower/alignment.h":
     int alignment_iter_seg(alignment_iter_t *itor, int *start, int *duration)
     const char *alignment_iter_name(alignment_iter_t *itor)
     int alignment_iter_free(alignment_iter_t *itor)
+
+cdef extern from "soundswallower/model_bundle.h":
+    int model_bundle_pack(const char *hmmdir, const char *outfile)
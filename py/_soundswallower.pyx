@@ -19,6 +19,32 @@ cimport _soundswallower
 
 LOGGER = logging.getLogger("soundswallower")
 
+def pack_model(hmmdir, outfile, config=None):
+    """Pack a model directory into a single-file bundle.
+
+    The bundle can then be used with the `bundle` configuration
+    parameter instead of `hmm`.  Along with the model files, it
+    contains the tables which the decoder computes from them, so
+    that a decoder using it with the same parameters can map them
+    directly from the file instead of computing them again.
+
+    Args:
+        hmmdir(str): Model directory (must have a binary `mdef`).
+        outfile(str): Bundle file to write.
+        config(Config): Optional configuration with which the tables
+                        are computed (its `hmm` is set to `hmmdir`).
+    Raises:
+        RuntimeError: If the model could not be packed.
+    """
+    cdef Config cconfig
+    if config is None:
+        config = Config()
+    cconfig = config
+    cconfig["hmm"] = hmmdir
+    if decoder_pack_model(cconfig.config, outfile.encode("utf-8")) < 0:
+        raise RuntimeError("Failed to pack model %s into %s" % (hmmdir, outfile))
+
+
 cdef class Config:
     """Configuration object for SoundSwallower.
 
@@ -325,6 +351,33 @@ cdef class Decoder:
             raise RuntimeError("Failed to create decoder")
         return self
 
+    def clone(self):
+        """Create a decoder for another stream of audio.
+
+        The new decoder shares the acoustic model, dictionary,
+        grammar and configuration of this one, and only allocates
+        what it needs to process its own audio (about 0.4MB for the
+        default model and a small grammar).  This is much faster and
+        uses much less memory than creating a new `Decoder`, and the
+        two can be used at the same time from different threads.
+
+        Because the dictionary is shared, adding words to either
+        decoder fails as long as the other one exists.  Its lexicon
+        tree is not shared, as it holds the search state for its own
+        stream.
+
+        Returns:
+            Decoder: New decoder sharing this one's models.
+        Raises:
+            RuntimeError: If the decoder is not initialized or its
+                          acoustic model cannot be shared.
+        """
+        cdef Decoder clone = Decoder.__new__(Decoder)
+        clone._ps = decoder_clone(self._ps)
+        if clone._ps == NULL:
+            raise RuntimeError("Failed to clone decoder")
+        return clone
+
     def __dealloc__(self):
         decoder_free(self._ps)
 
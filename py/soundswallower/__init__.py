@@ -21,7 +21,7 @@ import os
 import wave
 from typing import Optional, Tuple
 
-from ._soundswallower import Config, Decoder, Endpointer, FsgModel, Vad
+from ._soundswallower import Config, Decoder, Endpointer, FsgModel, Vad, pack_model
 
 
 def get_model_path(subpath: Optional[str] = None) -> str:
@@ -97,4 +97,5 @@ __all__ = [
     "Vad",
     "get_audio_data",
     "get_model_path",
+    "pack_model",
 ]
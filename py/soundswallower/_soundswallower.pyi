@@ -2,6 +2,10 @@ from typing import ClassVar, Iterator, Optional, Sequence, Tuple, Union
 
 import soundswallower
 
+def pack_model(
+    hmmdir: str, outfile: str, config: Optional["Config"] = None
+) -> None: ...
+
 class Config:
     def __init__(self, *args, **kwargs) -> None: ...
     @staticmethod
@@ -32,6 +36,7 @@ class Decoder:
     def __init__(self, *args, **kwargs) -> None: ...
     @staticmethod
     def create(*args, **kwargs) -> "Decoder": ...
+    def clone(self) -> "Decoder": ...
     def initialize(self, config: Optional[Config] = ...): ...
     def reinit_feat(self, config: Optional[Config] = ...): ...
     def update_cmn(self) -> str: ...
@@ -21,6 +21,11 @@ To use a custom dictionary::
 
   soundswallower --dict /path/to/dictionary.dict
 
+To pack a model into a single file, and use it::
+
+  soundswallower --model fr-fr --pack-model fr-fr.bundle
+  soundswallower --bundle fr-fr.bundle ...
+
 """
 
 import argparse
@@ -29,7 +34,7 @@ import os
 import sys
 from typing import Any, Optional, Sequence
 
-from soundswallower import Config, Decoder, get_model_path
+from soundswallower import Config, Decoder, get_model_path, pack_model
 
 
 def make_argparse() -> argparse.ArgumentParser:
@@ -47,6 +52,11 @@ def make_argparse() -> argparse.ArgumentParser:
     parser.add_argument(
         "--model", help="Specific model, built-in or from directory.", default="en-us"
     )
+    parser.add_argument("--bundle", help="Packed model bundle (instead of --model).")
+    parser.add_argument(
+        "--pack-model",
+        help="Pack the model into a single-file bundle PACK_MODEL and exit.",
+    )
     parser.add_argument("--config", help="JSON file with decoder configuration.")
     parser.add_argument(
         "-s", "--set", action="append", help="Set configuration parameter (KEY=VALUE)."
@@ -101,6 +111,9 @@ def make_decoder_config(args: argparse.Namespace) -> Config:
     else:
         config["hmm"] = args.model
 
+    if args.bundle is not None:
+        config["bundle"] = args.bundle
+
     # FIXME: This actually should be in addition to the built-in
     # dictionary, or we should have G2P support, which shouldn't be
     # all that hard, we hope.
@@ -147,6 +160,9 @@ def main(argv: Optional[Sequence[str]] = None) -> None:
         sys.exit(0)
     if args.write_config is not None:
         write_config(config, args.write_config)
+    if args.pack_model is not None:
+        pack_model(config["hmm"], args.pack_model, config)
+        return
     if args.align:
         with open(args.align) as fh:
             args.align_text = fh.read().strip()
@@ -60,6 +60,25 @@ class TestCLI(unittest.TestCase):
             )
             self.check_output(jpath, "avance de dix mètres")
 
+    def test_cli_bundle(self) -> None:
+        with TemporaryDirectory() as tmpdir:
+            bpath = os.path.join(tmpdir, "fr-fr.bundle")
+            jpath = os.path.join(tmpdir, "output.json")
+            cli.main(["--model", get_model_path("fr-fr"), "--pack-model", bpath])
+            self.assertTrue(os.path.exists(bpath))
+            cli.main(
+                [
+                    "--grammar",
+                    os.path.join(DATADIR, "goforward_fr.gram"),
+                    "--bundle",
+                    bpath,
+                    "--output",
+                    jpath,
+                    os.path.join(DATADIR, "goforward_fr.raw"),
+                ]
+            )
+            self.check_output(jpath, "avance de dix mètres")
+
     def test_cli_config(self) -> None:
         with TemporaryDirectory() as tmpdir:
             jpath = os.path.join(tmpdir, "config.json")
@@ -89,6 +89,21 @@ class TestDecoder(unittest.TestCase):
         )
         self._run_decode(decoder)
 
+    def test_clone(self) -> None:
+        decoder = Decoder(
+            hmm=os.path.join(get_model_path("en-us")),
+            fsg=os.path.join(DATADIR, "goforward.fsg"),
+            dict=os.path.join(DATADIR, "turtle.dic"),
+        )
+        clone = decoder.clone()
+        self._run_decode(clone)
+        # The clone keeps the shared models alive
+        del decoder
+        self._run_decode(clone)
+        self.assertEqual(clone.clone().config["dict"], clone.config["dict"])
+        with self.assertRaises(RuntimeError):
+            Decoder.create().clone()
+
     def test_loglevel(self) -> None:
         Decoder(hmm=os.path.join(get_model_path(), "en-us"), loglevel="FATAL")
         with self.assertRaises(RuntimeError):
@@ -54,11 +54,34 @@
 #include <soundswallower/ms_mgau.h>
 #include <soundswallower/prim_type.h>
 #include <soundswallower/ptm_mgau.h>
+#include <soundswallower/refcount.h>
 #include <soundswallower/s2_semi_mgau.h>
 #include <soundswallower/strfuncs.h>
 
 static int32 acmod_process_mfcbuf(acmod_t *acmod);
 
+mgau_t *
+mgau_retain(mgau_t *mgau)
+{
+    if (mgau == NULL)
+        return NULL;
+    refcount_inc(&mgau->refcount);
+    return mgau;
+}
+
+int
+mgau_free(mgau_t *mgau)
+{
+    int refcount;
+
+    if (mgau == NULL)
+        return 0;
+    if ((refcount = refcount_dec(&mgau->refcount)) > 0)
+        return refcount;
+    (*mgau->vt->free)(mgau);
+    return 0;
+}
+
 int
 acmod_load_am(acmod_t *acmod)
 {
@@ -123,11 +146,107 @@ acmod_load_am(acmod_t *acmod)
         mllr_t *mllr = mllr_read(mllrfn);
         if (mllr == NULL)
             return -1;
-        acmod_update_mllr(acmod, mllr);
+        if (acmod_update_mllr(acmod, mllr) == NULL) {
+            mllr_free(mllr);
+            return -1;
+        }
+        /* The acoustic model keeps its own reference. */
+        mllr_free(mllr);
     }
     return 0;
 }
 
+int
+acmod_load_am_bundle(acmod_t *acmod, model_bundle_t *bundle)
+{
+    s3file_t *mdef, *tmat, *means, *vars, *mixw, *sendump, *senmgau;
+    const char *mllrfn;
+    int rv = -1;
+
+    mdef = model_bundle_get(bundle, "mdef");
+    tmat = model_bundle_get(bundle, "transition_matrices");
+    means = model_bundle_get(bundle, "means");
+    vars = model_bundle_get(bundle, "variances");
+    mixw = model_bundle_get(bundle, "mixture_weights");
+    sendump = model_bundle_get(bundle, "sendump");
+    senmgau = model_bundle_get(bundle, "senmgau");
+    if (mdef == NULL || tmat == NULL || means == NULL || vars == NULL
+        || (mixw == NULL && sendump == NULL)) {
+        E_ERROR("Model bundle is missing acoustic model sections\n");
+        goto error_out;
+    }
+    /* Use the tables packed in the bundle, unless there is a cache
+     * directory, which takes precedence. */
+    if (acmod->cache == NULL)
+        acmod->cache = datacache_init_bundle(bundle);
+    if ((acmod->mdef = bin_mdef_read_s3file(mdef, config_bool(acmod->config, "cionly")))
+        == NULL) {
+        E_ERROR("Failed to read acoustic model definition from bundle\n");
+        goto error_out;
+    }
+    if ((acmod->tmat = tmat_init_s3file(tmat, acmod->lmath,
+                                        config_float(acmod->config, "tmatfloor")))
+        == NULL) {
+        E_ERROR("Failed to read transition matrices from bundle\n");
+        goto error_out;
+    }
+
+    /* Same order as acmod_load_am(), but sendump is preferred. */
+    if (senmgau) {
+        E_INFO("Using general multi-stream GMM computation\n");
+        acmod->mgau = ms_mgau_init_s3file(acmod, means, vars, mixw, senmgau);
+    } else {
+        E_INFO("Attempting to use PTM computation module\n");
+        if ((acmod->mgau = ptm_mgau_init_s3file(acmod, means, vars,
+                                                sendump ? NULL : mixw, sendump))
+            == NULL) {
+            E_INFO("Attempting to use semi-continuous computation module\n");
+            s3file_rewind(means);
+            s3file_rewind(vars);
+            s3file_rewind(mixw);
+            s3file_rewind(sendump);
+            if ((acmod->mgau = s2_semi_mgau_init_s3file(acmod, means, vars,
+                                                        sendump ? NULL : mixw,
+                                                        sendump))
+                == NULL) {
+                E_INFO("Falling back to general multi-stream GMM computation\n");
+                s3file_rewind(means);
+                s3file_rewind(vars);
+                s3file_rewind(mixw);
+                acmod->mgau = ms_mgau_init_s3file(acmod, means, vars, mixw, NULL);
+            }
+        }
+    }
+    if (acmod->mgau == NULL) {
+        E_ERROR("Failed to read acoustic model from bundle\n");
+        goto error_out;
+    }
+
+    /* If there is an MLLR transform, apply it. */
+    if ((mllrfn = config_str(acmod->config, "mllr"))) {
+        mllr_t *mllr = mllr_read(mllrfn);
+        if (mllr == NULL)
+            goto error_out;
+        if (acmod_update_mllr(acmod, mllr) == NULL) {
+            mllr_free(mllr);
+            goto error_out;
+        }
+        /* The acoustic model keeps its own reference. */
+        mllr_free(mllr);
+    }
+    rv = 0;
+
+error_out:
+    s3file_free(mdef);
+    s3file_free(tmat);
+    s3file_free(means);
+    s3file_free(vars);
+    s3file_free(mixw);
+    s3file_free(sendump);
+    s3file_free(senmgau);
+    return rv;
+}
+
 int
 acmod_init_senscr(acmod_t *acmod)
 {
@@ -141,12 +260,57 @@ acmod_init_senscr(acmod_t *acmod)
     acmod->senone_active_vec = bitvec_alloc(bin_mdef_n_sen(acmod->mdef));
     acmod->senone_active = ckd_calloc(bin_mdef_n_sen(acmod->mdef),
                                       sizeof(*acmod->senone_active));
+    acmod->senscr_batch = ckd_calloc_2d(ACMOD_MAX_BATCH,
+                                        bin_mdef_n_sen(acmod->mdef),
+                                        sizeof(**acmod->senscr_batch));
     acmod->log_zero = logmath_get_zero(acmod->lmath);
     acmod->compallsen = config_bool(acmod->config, "compallsen");
+    if (config_int(acmod->config, "scorecache") > 0) {
+        /* With frame downsampling, the top-N codewords for one frame
+         * depend on those for previous frames, which a cache hit
+         * would skip computing. */
+        if (config_int(acmod->config, "ds") > 1
+            || config_float(acmod->config, "ds_thresh") > 0)
+            E_WARN("Not keeping senone scores, as frame downsampling is enabled\n");
+        else
+            acmod->score_cache_max = (size_t)config_int(acmod->config, "scorecache") * 1024;
+    }
+    acmod_set_ci_beam(acmod, config_float(acmod->config, "cibeam"));
 
     return 0;
 }
 
+int32
+acmod_set_ci_beam(acmod_t *acmod, float64 beam)
+{
+    int32 n_ci_sen = bin_mdef_n_ci_sen(acmod->mdef);
+
+    if (beam <= 0.0 || n_ci_sen >= bin_mdef_n_sen(acmod->mdef)) {
+        acmod->ci_beam = 0;
+        return 0;
+    }
+    acmod->ci_beam = logmath_log(acmod->lmath, beam) >> SENSCR_SHIFT;
+    if (acmod->ci_scores == NULL) {
+        acmod->ci_active_vec = bitvec_alloc(n_ci_sen);
+        acmod->ci_scores = ckd_calloc(n_ci_sen, sizeof(*acmod->ci_scores));
+        acmod->senone_gated = ckd_calloc(bin_mdef_n_sen(acmod->mdef),
+                                         sizeof(*acmod->senone_gated));
+    }
+    E_INFO("Computing CD senones within %d of best CI senone\n",
+           acmod->ci_beam);
+    return acmod->ci_beam;
+}
+
+int
+acmod_set_topn(acmod_t *acmod, int topn)
+{
+    if (acmod->mgau == NULL || acmod->mgau->vt->set_topn == NULL)
+        return -1;
+    /* Frames scored ahead used the old top-N. */
+    acmod->n_senscr_batch = 0;
+    return ps_mgau_set_topn(acmod->mgau, topn);
+}
+
 int
 acmod_fe_mismatch(acmod_t *acmod, fe_t *fe)
 {
@@ -212,6 +376,14 @@ acmod_create(config_t *config, logmath_t *lmath, fe_t *fe, feat_t *fcb)
     acmod->lmath = logmath_retain(lmath);
     acmod->state = ACMOD_IDLE;
     acmod->grow_feat = ACMOD_GROW_DEFAULT;
+    acmod->pool = thread_pool_init(config_int(config, "nthreads"));
+    acmod->cache = datacache_init(config_str(config, "cachedir"));
+    if (config_bool(config, "sharedmodel")) {
+        if (acmod->cache)
+            datacache_set_shared(acmod->cache, TRUE);
+        else if (config_str(config, "bundle") == NULL)
+            E_WARN("sharedmodel has no effect without cachedir or bundle\n");
+    }
 
     /* Initialize feature computation. */
     if (acmod_fe_mismatch(acmod, fe))
@@ -229,6 +401,32 @@ error_out:
     return NULL;
 }
 
+acmod_t *
+acmod_clone(acmod_t *other, fe_t *fe, feat_t *fcb)
+{
+    acmod_t *acmod;
+
+    if (other->mgau == NULL || ps_mgau_base(other->mgau)->vt->clone == NULL) {
+        E_ERROR("Acoustic model cannot be shared\n");
+        return NULL;
+    }
+    if ((acmod = acmod_create(other->config, other->lmath, fe, fcb)) == NULL)
+        return NULL;
+    acmod->mdef = bin_mdef_retain(other->mdef);
+    acmod->tmat = tmat_retain(other->tmat);
+    /* Already applied to the shared parameters. */
+    acmod->mllr = mllr_retain(other->mllr);
+    if ((acmod->mgau = ps_mgau_clone(other->mgau, acmod)) == NULL)
+        goto error_out;
+    if (acmod_init_senscr(acmod) < 0)
+        goto error_out;
+    return acmod;
+
+error_out:
+    acmod_free(acmod);
+    return NULL;
+}
+
 acmod_t *
 acmod_init(config_t *config, logmath_t *lmath, fe_t *fe, feat_t *fcb)
 {
@@ -272,12 +470,19 @@ acmod_free(acmod_t *acmod)
         ckd_free(acmod->senone_active_vec);
     if (acmod->senone_active)
         ckd_free(acmod->senone_active);
+    ckd_free(acmod->ci_active_vec);
+    ckd_free(acmod->ci_scores);
+    ckd_free(acmod->senone_gated);
+    ckd_free_2d(acmod->senscr_batch);
+    acmod_clear_score_cache(acmod);
+    ckd_free(acmod->score_cache);
 
     bin_mdef_free(acmod->mdef);
     tmat_free(acmod->tmat);
-    if (acmod->mgau) /* FIXME: Should make this transparent */
-        ps_mgau_free(acmod->mgau);
+    mgau_free(acmod->mgau);
+    thread_pool_free(acmod->pool);
     mllr_free(acmod->mllr);
+    datacache_free(acmod->cache);
     logmath_free(acmod->lmath);
 
     ckd_free(acmod);
@@ -313,13 +518,33 @@ acmod_reinit_feat(acmod_t *acmod, fe_t *fe, feat_t *fcb)
     return acmod_alloc_buffers(acmod);
 }
 
+int
+acmod_shared(acmod_t *acmod)
+{
+    if (acmod->mgau == NULL)
+        return FALSE;
+    return (acmod->mgau->shared != NULL
+            || refcount_get(&acmod->mgau->refcount) > 1);
+}
+
 mllr_t *
 acmod_update_mllr(acmod_t *acmod, mllr_t *mllr)
 {
+    if (acmod_shared(acmod)) {
+        E_ERROR("Cannot apply MLLR to an acoustic model shared with other decoders\n");
+        return NULL;
+    }
+    if (mgau_transform(acmod->mgau, mllr) < 0) {
+        E_ERROR("Failed to apply MLLR transform\n");
+        return NULL;
+    }
     if (acmod->mllr)
         mllr_free(acmod->mllr);
     acmod->mllr = mllr_retain(mllr);
-    mgau_transform(acmod->mgau, mllr);
+    /* Any precomputed scores are now wrong. */
+    acmod->n_senscr_batch = 0;
+    acmod->senscr_frame = -1;
+    acmod_clear_score_cache(acmod);
 
     return mllr;
 }
@@ -363,7 +588,11 @@ acmod_start_utt(acmod_t *acmod)
     acmod->feat_outidx = 0;
     acmod->output_frame = 0;
     acmod->senscr_frame = -1;
+    acmod->n_senscr_batch = 0;
     acmod->n_senone_active = 0;
+    acmod_clear_score_cache(acmod);
+    acmod->score_cache_hits = acmod->score_cache_misses = 0;
+    acmod->n_ci_gated = 0;
     acmod->mgau->frame_idx = 0;
     return 0;
 }
@@ -745,6 +974,7 @@ acmod_rewind(acmod_t *acmod)
     acmod->feat_outidx = 0;
     acmod->output_frame = 0;
     acmod->senscr_frame = -1;
+    acmod->n_senscr_batch = 0;
     acmod->mgau->frame_idx = 0;
 
     return 0;
@@ -819,10 +1049,271 @@ acmod_get_frame(acmod_t *acmod, int *inout_frame_idx)
     return acmod->feat_buf[feat_idx];
 }
 
+void
+acmod_clear_score_cache(acmod_t *acmod)
+{
+    int i;
+
+    for (i = 0; i < acmod->n_score_cache_alloc; ++i) {
+        ckd_free(acmod->score_cache[i].senscr);
+        ckd_free(acmod->score_cache[i].senone_active);
+        acmod->score_cache[i].senscr = NULL;
+        acmod->score_cache[i].senone_active = NULL;
+    }
+    acmod->score_cache_size = 0;
+}
+
+static acmod_scored_frame_t *
+score_cache_get(acmod_t *acmod, int frame_idx)
+{
+    if (frame_idx < 0 || frame_idx >= acmod->n_score_cache_alloc)
+        return NULL;
+    if (acmod->score_cache[frame_idx].senscr == NULL)
+        return NULL;
+    return acmod->score_cache + frame_idx;
+}
+
+/**
+ * Bytes needed to keep the scores for this frame.
+ */
+static size_t
+score_cache_frame_size(acmod_t *acmod)
+{
+    if (acmod->compallsen)
+        return bin_mdef_n_sen(acmod->mdef) * sizeof(*acmod->senone_scores);
+    return acmod->n_senone_active
+        * (sizeof(*acmod->senone_scores) + sizeof(*acmod->senone_active));
+}
+
+/**
+ * Look for scores for this frame in the cache, and copy them to
+ * senone_scores if found.  Scores for only some senones are normalized
+ * over those, so they can only be used if the same ones are active.
+ */
+static int
+score_cache_lookup(acmod_t *acmod, int frame_idx)
+{
+    acmod_scored_frame_t *sf;
+    int i, sen;
+
+    if (acmod->score_cache_max == 0)
+        return FALSE;
+    if ((sf = score_cache_get(acmod, frame_idx)) == NULL
+        || (sf->senone_active == NULL) != (acmod->compallsen != 0)
+        || (sf->senone_active
+            && (sf->n_senone_active != acmod->n_senone_active
+                || 0 != memcmp(sf->senone_active, acmod->senone_active,
+                               sf->n_senone_active
+                                   * sizeof(*sf->senone_active))))) {
+        ++acmod->score_cache_misses;
+        return FALSE;
+    }
+    if (sf->senone_active) {
+        for (i = sen = 0; i < sf->n_senone_active; ++i) {
+            sen += sf->senone_active[i];
+            acmod->senone_scores[sen] = sf->senscr[i];
+        }
+    } else
+        memcpy(acmod->senone_scores, sf->senscr,
+               bin_mdef_n_sen(acmod->mdef) * sizeof(*acmod->senone_scores));
+    ++acmod->score_cache_hits;
+    return TRUE;
+}
+
+/**
+ * Keep the scores for this frame (all of them, or the active ones),
+ * replacing any kept for a different set of active senones, unless
+ * that would exceed the memory limit.
+ */
+static void
+score_cache_store(acmod_t *acmod, int frame_idx, int16 const *senscr)
+{
+    acmod_scored_frame_t *sf;
+    size_t size, old_size;
+    int i, sen;
+
+    if (acmod->score_cache_max == 0)
+        return;
+    if (frame_idx >= acmod->n_score_cache_alloc) {
+        int n_alloc = acmod->n_score_cache_alloc ? acmod->n_score_cache_alloc : 128;
+        while (n_alloc <= frame_idx)
+            n_alloc *= 2;
+        acmod->score_cache = ckd_realloc(acmod->score_cache,
+                                         n_alloc * sizeof(*acmod->score_cache));
+        memset(acmod->score_cache + acmod->n_score_cache_alloc, 0,
+               (n_alloc - acmod->n_score_cache_alloc)
+                   * sizeof(*acmod->score_cache));
+        acmod->n_score_cache_alloc = n_alloc;
+    }
+    sf = acmod->score_cache + frame_idx;
+    if (sf->senscr && sf->senone_active == NULL && acmod->compallsen)
+        return;
+    size = score_cache_frame_size(acmod);
+    if (sf->senscr == NULL)
+        old_size = 0;
+    else if (sf->senone_active == NULL)
+        old_size = bin_mdef_n_sen(acmod->mdef) * sizeof(*sf->senscr);
+    else
+        old_size = sf->n_senone_active
+            * (sizeof(*sf->senscr) + sizeof(*sf->senone_active));
+    if (acmod->score_cache_size - old_size + size > acmod->score_cache_max)
+        return;
+    ckd_free(sf->senscr);
+    ckd_free(sf->senone_active);
+    sf->senone_active = NULL;
+    acmod->score_cache_size -= old_size;
+    if (acmod->compallsen) {
+        sf->senscr = ckd_malloc(size);
+        memcpy(sf->senscr, senscr, size);
+    } else {
+        sf->n_senone_active = acmod->n_senone_active;
+        sf->senscr = ckd_calloc(sf->n_senone_active ? sf->n_senone_active : 1,
+                                sizeof(*sf->senscr));
+        sf->senone_active = ckd_calloc(sf->n_senone_active
+                                           ? sf->n_senone_active : 1,
+                                       sizeof(*sf->senone_active));
+        memcpy(sf->senone_active, acmod->senone_active,
+               sf->n_senone_active * sizeof(*sf->senone_active));
+        for (i = sen = 0; i < sf->n_senone_active; ++i) {
+            sen += sf->senone_active[i];
+            sf->senscr[i] = senscr[sen];
+        }
+    }
+    acmod->score_cache_size += size;
+}
+
+/* Is a CD senone outside the CI beam? */
+#define CI_GATED(acmod, sen, thresh)                   \
+    (bin_mdef_cd2cisen((acmod)->mdef, sen) >= 0        \
+     && (acmod)->ci_scores[bin_mdef_cd2cisen((acmod)->mdef, sen)] > (thresh))
+
+static int32
+append_delta(uint8 *list, int32 n, int32 delta)
+{
+    /* Bridge large gaps "lossily" as in acmod_flags2list(). */
+    while (delta > 255) {
+        list[n++] = 255;
+        delta -= 255;
+    }
+    list[n++] = delta;
+    return n;
+}
+
+/**
+ * Score the CI parents of the active senones, then the active CD
+ * senones whose CI parent is within ci_beam of the best one, and back
+ * off the rest to the score of their CI parent plus the beam.
+ */
+static void
+acmod_score_cigate(acmod_t *acmod, int frame_idx, int feat_idx)
+{
+    int16 *senscr = acmod->senone_scores;
+    int32 n_ci_sen = bin_mdef_n_ci_sen(acmod->mdef);
+    int32 i, n, n_ci, n_gated, l, sen, best, thresh, saved_frame_idx;
+
+    /* Find the CI parents, which are usually far fewer than all the
+     * CI senones, and for PTM models only need the codebooks that
+     * the active senones do. */
+    bitvec_clear_all(acmod->ci_active_vec, n_ci_sen);
+    for (i = sen = 0; i < acmod->n_senone_active; ++i) {
+        sen += acmod->senone_active[i];
+        if (bin_mdef_cd2cisen(acmod->mdef, sen) >= 0)
+            bitvec_set(acmod->ci_active_vec,
+                       bin_mdef_cd2cisen(acmod->mdef, sen));
+    }
+    n_ci = l = 0;
+    for (sen = 0; sen < n_ci_sen; ++sen) {
+        if (bitvec_is_set(acmod->ci_active_vec, sen)) {
+            n_ci = append_delta(acmod->senone_gated, n_ci, sen - l);
+            l = sen;
+        }
+    }
+    if (n_ci == 0) {
+        ps_mgau_frame_eval(acmod->mgau, senscr,
+                           acmod->senone_active, acmod->n_senone_active,
+                           acmod->feat_buf[feat_idx], frame_idx, FALSE);
+        return;
+    }
+    ps_mgau_frame_eval(acmod->mgau, senscr,
+                       acmod->senone_gated, n_ci,
+                       acmod->feat_buf[feat_idx],
+                       frame_idx, FALSE);
+    best = MAX_INT16;
+    for (sen = 0; sen < n_ci_sen; ++sen) {
+        if (bitvec_is_set(acmod->ci_active_vec, sen)) {
+            acmod->ci_scores[sen] = senscr[sen];
+            if (senscr[sen] < best)
+                best = senscr[sen];
+        }
+    }
+    /* Scores are negated, but the beam isn't. */
+    thresh = best - acmod->ci_beam;
+
+    /* Keep the CI parents, since they are the back-off scores. */
+    n = n_ci;
+    n_gated = 0;
+    for (i = sen = 0; i < acmod->n_senone_active; ++i) {
+        sen += acmod->senone_active[i];
+        if (sen < n_ci_sen)
+            continue;
+        if (CI_GATED(acmod, sen, thresh)) {
+            ++n_gated;
+            continue;
+        }
+        n = append_delta(acmod->senone_gated, n, sen - l);
+        l = sen;
+    }
+
+    /* Any codebooks were already computed for this frame above, so
+     * the mgau should treat it as a past frame.  If nothing is gated
+     * out, just score the active senones, as without the beam. */
+    saved_frame_idx = acmod->mgau->frame_idx;
+    if (acmod->mgau->frame_idx <= frame_idx)
+        acmod->mgau->frame_idx = frame_idx + 1;
+    if (n_gated == 0)
+        ps_mgau_frame_eval(acmod->mgau, senscr,
+                           acmod->senone_active, acmod->n_senone_active,
+                           acmod->feat_buf[feat_idx],
+                           frame_idx, FALSE);
+    else
+        ps_mgau_frame_eval(acmod->mgau, senscr,
+                           acmod->senone_gated, n,
+                           acmod->feat_buf[feat_idx],
+                           frame_idx, FALSE);
+    acmod->mgau->frame_idx = saved_frame_idx;
+    if (n_gated == 0)
+        return;
+
+    /* Back off the others, making sure they are no better than
+     * anything that was computed. */
+    best = MAX_INT32;
+    for (i = sen = 0; i < acmod->n_senone_active; ++i) {
+        sen += acmod->senone_active[i];
+        if (sen >= n_ci_sen && CI_GATED(acmod, sen, thresh)) {
+            int32 score = senscr[bin_mdef_cd2cisen(acmod->mdef, sen)]
+                          - acmod->ci_beam;
+            senscr[sen] = score > MAX_INT16 ? MAX_INT16 : score;
+            ++acmod->n_ci_gated;
+        }
+        if (senscr[sen] < best)
+            best = senscr[sen];
+    }
+
+    /* The mgau normalized the scores over the CI parents too, which
+     * are not necessarily active, so do it again over the senones
+     * that actually are. */
+    for (i = sen = 0; i < acmod->n_senone_active; ++i) {
+        int32 score;
+        sen += acmod->senone_active[i];
+        score = senscr[sen] - best;
+        senscr[sen] = score > MAX_INT16 ? MAX_INT16 : score;
+    }
+}
+
 int16 const *
 acmod_score(acmod_t *acmod, int *inout_frame_idx)
 {
-    int frame_idx, feat_idx;
+    int frame_idx, feat_idx, saved_frame_idx;
 
     /* Calculate the absolute frame index to be scored. */
     frame_idx = calc_frame_idx(acmod, inout_frame_idx);
@@ -836,21 +1327,59 @@ acmod_score(acmod_t *acmod, int *inout_frame_idx)
         return acmod->senone_scores;
     }
 
+    /* Or ones precomputed by acmod_score_batch(), which were not
+     * reused from the cache. */
+    if (acmod->compallsen
+        && frame_idx >= acmod->senscr_batch_frame
+        && frame_idx < acmod->senscr_batch_frame + acmod->n_senscr_batch) {
+        memcpy(acmod->senone_scores,
+               acmod->senscr_batch[frame_idx - acmod->senscr_batch_frame],
+               bin_mdef_n_sen(acmod->mdef) * sizeof(*acmod->senone_scores));
+        if (acmod->score_cache_max)
+            ++acmod->score_cache_misses;
+        if (inout_frame_idx)
+            *inout_frame_idx = frame_idx;
+        acmod->senscr_frame = frame_idx;
+        return acmod->senone_scores;
+    }
+
+    /* Build active senone list. */
+    acmod_flags2list(acmod);
+
+    /* Or ones kept from a previous pass over this utterance. */
+    if (score_cache_lookup(acmod, frame_idx)) {
+        if (inout_frame_idx)
+            *inout_frame_idx = frame_idx;
+        acmod->senscr_frame = frame_idx;
+        return acmod->senone_scores;
+    }
+
     /* Calculate position of requested frame in circular buffer. */
     if ((feat_idx = calc_feat_idx(acmod, frame_idx)) < 0)
         return NULL;
 
-    /* Build active senone list. */
-    acmod_flags2list(acmod);
+    /* If acmod_score_batch() already did the part that doesn't depend
+     * on the active senones, the mgau should treat this as a past
+     * frame. */
+    saved_frame_idx = acmod->mgau->frame_idx;
+    if (frame_idx >= acmod->senscr_batch_frame
+        && frame_idx < acmod->senscr_batch_frame + acmod->n_senscr_batch
+        && acmod->mgau->frame_idx <= frame_idx)
+        acmod->mgau->frame_idx = frame_idx + 1;
 
     /* Generate scores for the next available frame */
-    ps_mgau_frame_eval(acmod->mgau,
-                       acmod->senone_scores,
-                       acmod->senone_active,
-                       acmod->n_senone_active,
-                       acmod->feat_buf[feat_idx],
-                       frame_idx,
-                       acmod->compallsen);
+    if (acmod->ci_beam && !acmod->compallsen)
+        acmod_score_cigate(acmod, frame_idx, feat_idx);
+    else
+        ps_mgau_frame_eval(acmod->mgau,
+                           acmod->senone_scores,
+                           acmod->senone_active,
+                           acmod->n_senone_active,
+                           acmod->feat_buf[feat_idx],
+                           frame_idx,
+                           acmod->compallsen);
+    acmod->mgau->frame_idx = saved_frame_idx;
+    score_cache_store(acmod, frame_idx, acmod->senone_scores);
 
     if (inout_frame_idx)
         *inout_frame_idx = frame_idx;
@@ -859,6 +1388,81 @@ acmod_score(acmod_t *acmod, int *inout_frame_idx)
     return acmod->senone_scores;
 }
 
+int
+acmod_score_batch(acmod_t *acmod, int frame_idx, int n_frames)
+{
+    mfcc_t **feat[ACMOD_MAX_BATCH];
+    int k;
+
+    /* We don't know what senones will be active in the future, so
+     * unless we are computing all of them, the best we can do is the
+     * part of the work that doesn't depend on them, for the ones
+     * active now. */
+    if (!acmod->compallsen && acmod->mgau->vt->frame_prepare == NULL)
+        return 0;
+    /* Only score frames that are actually queued. */
+    if (n_frames > ACMOD_MAX_BATCH)
+        n_frames = ACMOD_MAX_BATCH;
+    if (n_frames > acmod->output_frame + acmod->n_feat_frame - frame_idx)
+        n_frames = acmod->output_frame + acmod->n_feat_frame - frame_idx;
+    /* Or that have not already been scored (which we only know if
+     * all senones are). */
+    if (acmod->compallsen) {
+        for (k = 0; k < n_frames; ++k) {
+            if (score_cache_get(acmod, frame_idx + k))
+                break;
+        }
+        n_frames = k;
+    }
+    if (n_frames <= 0)
+        return 0;
+    for (k = 0; k < n_frames; ++k) {
+        int feat_idx;
+        if ((feat_idx = calc_feat_idx(acmod, frame_idx + k)) < 0)
+            return -1;
+        feat[k] = acmod->feat_buf[feat_idx];
+    }
+
+    /* Build active senone list (not actually used with compallsen,
+     * but let's be consistent with acmod_score()) */
+    acmod_flags2list(acmod);
+    acmod->n_senscr_batch = 0;
+    if (!acmod->compallsen) {
+        if ((n_frames = ps_mgau_frame_prepare(acmod->mgau,
+                                              acmod->senone_active,
+                                              acmod->n_senone_active,
+                                              feat, frame_idx, n_frames))
+            < 0)
+            return -1;
+    } else if (acmod->mgau->vt->frame_eval_batch) {
+        if (ps_mgau_frame_eval_batch(acmod->mgau,
+                                     acmod->senscr_batch,
+                                     acmod->senone_active,
+                                     acmod->n_senone_active,
+                                     feat, frame_idx, n_frames,
+                                     TRUE)
+            < 0)
+            return -1;
+    } else {
+        for (k = 0; k < n_frames; ++k) {
+            ps_mgau_frame_eval(acmod->mgau,
+                               acmod->senscr_batch[k],
+                               acmod->senone_active,
+                               acmod->n_senone_active,
+                               feat[k], frame_idx + k,
+                               TRUE);
+        }
+    }
+    if (acmod->compallsen) {
+        for (k = 0; k < n_frames; ++k)
+            score_cache_store(acmod, frame_idx + k, acmod->senscr_batch[k]);
+    }
+    acmod->senscr_batch_frame = frame_idx;
+    acmod->n_senscr_batch = n_frames;
+
+    return n_frames;
+}
+
 int
 acmod_best_score(acmod_t *acmod, int *out_best_senid)
 {
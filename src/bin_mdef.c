@@ -58,6 +58,7 @@
 #include <soundswallower/err.h>
 #include <soundswallower/mdef.h>
 #include <soundswallower/prim_type.h>
+#include <soundswallower/refcount.h>
 
 static cd_tree_t *
 build_cd_tree_from_mdef(bin_mdef_t *bmdef, mdef_t *mdef)
@@ -271,17 +272,19 @@ bin_mdef_retain(bin_mdef_t *m)
 {
     if (m == NULL)
         return NULL;
-    ++m->refcnt;
+    refcount_inc(&m->refcnt);
     return m;
 }
 
 int
 bin_mdef_free(bin_mdef_t *m)
 {
+    int refcount;
+
     if (m == NULL)
         return 0;
-    if (--m->refcnt > 0)
-        return m->refcnt;
+    if ((refcount = refcount_dec(&m->refcnt)) > 0)
+        return refcount;
 
     switch (m->alloc_mode) {
     case BIN_MDEF_FROM_TEXT:
@@ -77,6 +77,7 @@
 #include <soundswallower/config_defs.h>
 #include <soundswallower/configuration.h>
 #include <soundswallower/err.h>
+#include <soundswallower/refcount.h>
 #include <soundswallower/strfuncs.h>
 
 #include "jsmn.h"
@@ -297,17 +298,19 @@ config_retain(config_t *config)
 {
     if (config == NULL)
         return NULL;
-    ++config->refcount;
+    refcount_inc(&config->refcount);
     return config;
 }
 
 int
 config_free(config_t *config)
 {
+    int refcount;
+
     if (config == NULL)
         return 0;
-    if (--config->refcount > 0)
-        return config->refcount;
+    if ((refcount = refcount_dec(&config->refcount)) > 0)
+        return refcount;
     if (config->ht) {
         glist_t entries;
         gnode_t *gn;
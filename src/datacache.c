@@ -0,0 +1,379 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+/**
+ * @file datacache.c Cache of derived model data.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#define mkdir(path, mode) _mkdir(path)
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/datacache.h>
+#include <soundswallower/err.h>
+#include <soundswallower/strfuncs.h>
+
+struct datacache_s {
+    int refcount;
+    int shared;
+    char *dir; /**< Cache directory (or NULL). */
+    model_bundle_t *bundle; /**< Model bundle (or NULL). */
+    int n_tables; /**< Number of tables kept in memory. */
+    char **names; /**< Names of tables kept in memory. */
+    s3file_t **tables; /**< Tables kept in memory (with headers). */
+};
+
+#define DATACACHE_MAGIC "SSDCACHE"
+#define DATACACHE_VERSION 1
+#define DATACACHE_BYTEORDER 0x11223344
+#define DATACACHE_SECTION "cache/"
+
+/* Keep this a multiple of 16 bytes so the tables are aligned. */
+typedef struct datacache_header_s {
+    char magic[8];
+    uint32 version;
+    uint32 byteorder;
+    uint64 key;
+    uint64 size;
+} datacache_header_t;
+
+datacache_t *
+datacache_init(const char *dir)
+{
+    datacache_t *dc;
+    struct stat st;
+
+    if (dir == NULL || dir[0] == '\0')
+        return NULL;
+    if (stat(dir, &st) < 0 && mkdir(dir, 0777) < 0) {
+        E_ERROR_SYSTEM("Failed to create cache directory %s", dir);
+        return NULL;
+    }
+    dc = ckd_calloc(1, sizeof(*dc));
+    dc->refcount = 1;
+    dc->dir = ckd_salloc(dir);
+    return dc;
+}
+
+datacache_t *
+datacache_init_bundle(model_bundle_t *bundle)
+{
+    datacache_t *dc;
+
+    if (bundle == NULL)
+        return NULL;
+    dc = ckd_calloc(1, sizeof(*dc));
+    dc->refcount = 1;
+    dc->bundle = model_bundle_retain(bundle);
+    /* Nothing else can write to it, so it's always safe to share. */
+    dc->shared = TRUE;
+    return dc;
+}
+
+datacache_t *
+datacache_init_memory(void)
+{
+    datacache_t *dc;
+
+    dc = ckd_calloc(1, sizeof(*dc));
+    dc->refcount = 1;
+    return dc;
+}
+
+datacache_t *
+datacache_retain(datacache_t *dc)
+{
+    if (dc == NULL)
+        return NULL;
+    ++dc->refcount;
+    return dc;
+}
+
+int
+datacache_free(datacache_t *dc)
+{
+    int i;
+
+    if (dc == NULL)
+        return 0;
+    if (--dc->refcount > 0)
+        return dc->refcount;
+    for (i = 0; i < dc->n_tables; ++i) {
+        ckd_free(dc->names[i]);
+        ckd_free((void *)dc->tables[i]->buf);
+        s3file_free(dc->tables[i]);
+    }
+    ckd_free(dc->names);
+    ckd_free(dc->tables);
+    model_bundle_free(dc->bundle);
+    ckd_free(dc->dir);
+    ckd_free(dc);
+    return 0;
+}
+
+void
+datacache_set_shared(datacache_t *dc, int shared)
+{
+    dc->shared = shared;
+}
+
+int
+datacache_shared(datacache_t *dc)
+{
+    return dc != NULL && dc->shared;
+}
+
+int
+datacache_can_store(datacache_t *dc)
+{
+    return dc != NULL && dc->bundle == NULL;
+}
+
+uint64
+datacache_hash(uint64 key, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    /* A word at a time, in native byte order (which doesn't matter
+     * since it's part of the file header anyway) */
+    while (len >= sizeof(uint64)) {
+        uint64 w;
+        memcpy(&w, p, sizeof(w));
+        key = (key ^ w) * (uint64)0x9e3779b97f4a7c15ULL;
+        key ^= key >> 32;
+        p += sizeof(w);
+        len -= sizeof(w);
+    }
+    while (len--)
+        key = (key ^ *p++) * (uint64)0x100000001b3ULL;
+    return key;
+}
+
+uint64
+datacache_hash_str(uint64 key, const char *str)
+{
+    return datacache_hash(key, str, strlen(str) + 1);
+}
+
+static void
+datacache_name(char *name, size_t len, const char *kind, uint64 key)
+{
+    snprintf(name, len, "%s-%08lx%08lx.bin", kind,
+             (unsigned long)(key >> 32), (unsigned long)(key & 0xffffffff));
+}
+
+/**
+ * Check that a table (from a file or a bundle) has a valid header
+ * and the right key, and find its data.
+ */
+static int
+datacache_check(s3file_t *s, uint64 key, const char *name,
+                const void **out_data, size_t *out_size)
+{
+    const datacache_header_t *hdr = s->buf;
+    size_t size = s->end - (const char *)s->buf;
+
+    if (size < sizeof(*hdr)
+        || memcmp(hdr->magic, DATACACHE_MAGIC, sizeof(hdr->magic)) != 0
+        || hdr->version != DATACACHE_VERSION
+        || hdr->byteorder != DATACACHE_BYTEORDER
+        || hdr->key != key
+        || hdr->size != size - sizeof(*hdr)) {
+        E_WARN("Ignoring invalid cache file %s\n", name);
+        return -1;
+    }
+    /* Could happen with a bundle loaded into memory. */
+    if ((size_t)(hdr + 1) % 16 != 0) {
+        E_WARN("Ignoring misaligned cache file %s\n", name);
+        return -1;
+    }
+    *out_data = hdr + 1;
+    *out_size = (size_t)hdr->size;
+    return 0;
+}
+
+s3file_t *
+datacache_map(datacache_t *dc, const char *kind, uint64 key,
+              const void **out_data, size_t *out_size)
+{
+    char name[64];
+    s3file_t *s;
+    struct stat st;
+    char *path;
+    int i;
+
+    if (dc == NULL)
+        return NULL;
+    datacache_name(name, sizeof(name), kind, key);
+    if (dc->bundle) {
+        path = string_join(DATACACHE_SECTION, name, NULL);
+        /* Not an error for it to not be there either. */
+        s = model_bundle_get(dc->bundle, path);
+    } else if (dc->dir) {
+        path = string_join(dc->dir, "/", name, NULL);
+        /* Not an error for it to not be there. */
+        if (stat(path, &st) < 0) {
+            ckd_free(path);
+            return NULL;
+        }
+        s = s3file_map_file(path);
+    } else {
+        path = string_join(DATACACHE_SECTION, name, NULL);
+        s = NULL;
+        for (i = 0; i < dc->n_tables; ++i) {
+            if (0 == strcmp(dc->names[i], path)) {
+                s = s3file_retain(dc->tables[i]);
+                break;
+            }
+        }
+    }
+    if (s == NULL) {
+        ckd_free(path);
+        return NULL;
+    }
+    if (datacache_check(s, key, path, out_data, out_size) < 0) {
+        s3file_free(s);
+        ckd_free(path);
+        return NULL;
+    }
+    E_INFO("Loaded %s from %s\n", kind, path);
+    ckd_free(path);
+    return s;
+}
+
+static void
+datacache_header_init(datacache_header_t *hdr, uint64 key, size_t size)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, DATACACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version = DATACACHE_VERSION;
+    hdr->byteorder = DATACACHE_BYTEORDER;
+    hdr->key = key;
+    hdr->size = size;
+}
+
+static int
+datacache_store_memory(datacache_t *dc, const char *kind, uint64 key,
+                       const void *data, size_t size)
+{
+    char name[64];
+    char *path, *buf;
+    int i;
+
+    datacache_name(name, sizeof(name), kind, key);
+    path = string_join(DATACACHE_SECTION, name, NULL);
+    /* Tables that are already there may be in use. */
+    for (i = 0; i < dc->n_tables; ++i) {
+        if (0 == strcmp(dc->names[i], path)) {
+            ckd_free(path);
+            return 0;
+        }
+    }
+    buf = ckd_malloc(sizeof(datacache_header_t) + size);
+    datacache_header_init((datacache_header_t *)buf, key, size);
+    memcpy(buf + sizeof(datacache_header_t), data, size);
+    dc->names = ckd_realloc(dc->names, (dc->n_tables + 1) * sizeof(*dc->names));
+    dc->tables = ckd_realloc(dc->tables, (dc->n_tables + 1) * sizeof(*dc->tables));
+    dc->names[dc->n_tables] = path;
+    dc->tables[dc->n_tables] = s3file_init(buf, sizeof(datacache_header_t) + size);
+    ++dc->n_tables;
+    E_INFO("Stored %s in memory as %s\n", kind, path);
+    return 0;
+}
+
+int
+datacache_store(datacache_t *dc, const char *kind, uint64 key,
+                const void *data, size_t size)
+{
+    datacache_header_t hdr;
+    char *path, *tmppath;
+    char name[64];
+    char suffix[32];
+    FILE *fh;
+    int rv = -1;
+
+    if (dc == NULL || dc->bundle)
+        return -1;
+    if (dc->dir == NULL)
+        return datacache_store_memory(dc, kind, key, data, size);
+    datacache_name(name, sizeof(name), kind, key);
+    path = string_join(dc->dir, "/", name, NULL);
+    snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+    tmppath = string_join(path, suffix, NULL);
+    if ((fh = fopen(tmppath, "wb")) == NULL) {
+        E_ERROR_SYSTEM("Failed to open %s for writing", tmppath);
+        goto error_out;
+    }
+    datacache_header_init(&hdr, key, size);
+    if (fwrite(&hdr, sizeof(hdr), 1, fh) != 1
+        || fwrite(data, 1, size, fh) != size) {
+        E_ERROR_SYSTEM("Failed to write %s", tmppath);
+        fclose(fh);
+        remove(tmppath);
+        goto error_out;
+    }
+    if (fclose(fh) != 0 || rename(tmppath, path) != 0) {
+        E_ERROR_SYSTEM("Failed to write %s", path);
+        remove(tmppath);
+        goto error_out;
+    }
+    E_INFO("Stored %s in %s\n", kind, path);
+    rv = 0;
+error_out:
+    ckd_free(tmppath);
+    ckd_free(path);
+    return rv;
+}
+
+int
+datacache_n_tables(datacache_t *dc)
+{
+    return dc->n_tables;
+}
+
+s3file_t *
+datacache_get_table(datacache_t *dc, int idx, const char **out_name)
+{
+    if (idx < 0 || idx >= dc->n_tables)
+        return NULL;
+    *out_name = dc->names[idx];
+    return s3file_retain(dc->tables[idx]);
+}
@@ -38,6 +38,7 @@
 #include "config.h"
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 
 #ifdef HAVE_UNISTD_H
@@ -109,7 +110,8 @@ config_expand(config_t *config)
 
     /* Get acoustic model filenames and add them to the command-line */
     hmmdir = config_str(config, "hmm");
-    if (hmmdir) {
+    /* A bundle replaces the model directory. */
+    if (hmmdir && config_str(config, "bundle") == NULL) {
         expand_file_config(config, "mdef", hmmdir, "mdef");
         expand_file_config(config, "mean", hmmdir, "means");
         expand_file_config(config, "var", hmmdir, "variances");
@@ -241,6 +243,37 @@ set_logfile(decoder_t *d, config_t *config)
 #endif
 }
 
+static int
+decoder_init_bundle(decoder_t *d)
+{
+    const char *path;
+    s3file_t *json;
+
+    model_bundle_free(d->bundle);
+    d->bundle = NULL;
+    if ((path = config_str(d->config, "bundle")) == NULL)
+        return 0;
+    if ((d->bundle = model_bundle_read(path)) == NULL) {
+        E_ERROR("Failed to read model bundle %s\n", path);
+        return -1;
+    }
+    /* Feature parameters from the bundle, unless given separately. */
+    if (config_str(d->config, "featparams") == NULL
+        && (json = model_bundle_get(d->bundle, "feat_params.json")) != NULL) {
+        size_t len = json->end - (const char *)json->buf;
+        char *jsontxt = ckd_malloc(len + 1);
+
+        memcpy(jsontxt, json->buf, len);
+        jsontxt[len] = '\0';
+        if (config_parse_json(d->config, jsontxt))
+            E_INFO("Parsed model-specific feature parameters from %s\n",
+                   path);
+        ckd_free(jsontxt);
+        s3file_free(json);
+    }
+    return 0;
+}
+
 int
 decoder_init_config(decoder_t *d, config_t *config)
 {
@@ -256,15 +289,22 @@ decoder_init_config(decoder_t *d, config_t *config)
     }
     /* Expand model parameters. */
     config_expand(d->config);
+    if (decoder_init_bundle(d) < 0)
+        return -1;
     /* Print out the config for logging. */
     config_log_values(d->config);
 
     /* Logmath computation (used in acmod and search) */
     if (d->lmath == NULL
         || (logmath_get_base(d->lmath) != (float64)config_float(d->config, "logbase"))) {
+        datacache_t *dc = datacache_init(config_str(d->config, "cachedir"));
+        if (dc == NULL)
+            dc = datacache_init_bundle(d->bundle);
         if (d->lmath)
             logmath_free(d->lmath);
-        d->lmath = logmath_init((float64)config_float(d->config, "logbase"), 0, TRUE);
+        d->lmath = logmath_init_cached((float64)config_float(d->config, "logbase"),
+                                       0, TRUE, dc);
+        datacache_free(dc);
     }
 
     /* Initialize performance timer. */
@@ -301,7 +341,12 @@ decoder_init_feat(decoder_t *d)
     if (d->config == NULL)
         return NULL;
     feat_free(d->fcb);
-    d->fcb = feat_init(d->config);
+    if (d->bundle && config_str(d->config, "lda") == NULL) {
+        s3file_t *lda = model_bundle_get(d->bundle, "feature_transform");
+        d->fcb = feat_init_s3file(d->config, lda);
+        s3file_free(lda);
+    } else
+        d->fcb = feat_init(d->config);
     return d->fcb;
 }
 
@@ -353,6 +398,17 @@ decoder_init_acmod(decoder_t *d)
     if (d->fcb == NULL)
         return NULL;
     acmod_free(d->acmod);
+    if (d->bundle) {
+        d->acmod = acmod_create(d->config, d->lmath, d->fe, d->fcb);
+        if (d->acmod == NULL)
+            return NULL;
+        if (acmod_load_am_bundle(d->acmod, d->bundle) < 0
+            || acmod_init_senscr(d->acmod) < 0) {
+            acmod_free(d->acmod);
+            d->acmod = NULL;
+        }
+        return d->acmod;
+    }
     d->acmod = acmod_init(d->config, d->lmath, d->fe, d->fcb);
     return d->acmod;
 }
@@ -370,9 +426,26 @@ decoder_init_dict(decoder_t *d)
     dict2pid_free(d->d2p);
     /* Dictionary and triphone mappings (depends on acmod). */
     /* FIXME: pass config, change arguments, implement LTS, etc. */
-    if ((d->dict = dict_init(d->config, d->acmod->mdef)) == NULL)
+    if (d->bundle) {
+        /* Dictionaries given separately override the bundle. */
+        const char *dictfile = config_str(d->config, "dict");
+        const char *fdictfile = config_str(d->config, "fdict");
+        s3file_t *dict, *fdict;
+
+        dict = dictfile ? s3file_map_file(dictfile)
+                        : model_bundle_get(d->bundle, "dict.txt");
+        fdict = fdictfile ? s3file_map_file(fdictfile)
+                          : model_bundle_get(d->bundle, "noisedict.txt");
+        d->dict = dict_init_s3file(d->config, d->acmod->mdef, dict, fdict);
+        s3file_free(dict);
+        s3file_free(fdict);
+    } else
+        d->dict = dict_init(d->config, d->acmod->mdef);
+    if (d->dict == NULL)
         return NULL;
-    if ((d->d2p = dict2pid_build(d->acmod->mdef, d->dict)) == NULL)
+    if ((d->d2p = dict2pid_build_cached(d->acmod->mdef, d->dict,
+                                        d->acmod->cache))
+        == NULL)
         return NULL;
     return d->dict;
 }
@@ -392,7 +465,9 @@ decoder_init_dict_s3file(decoder_t *d, s3file_t *dict, s3file_t *fdict)
     /* FIXME: pass config, change arguments, implement LTS, etc. */
     if ((d->dict = dict_init_s3file(d->config, d->acmod->mdef, dict, fdict)) == NULL)
         return NULL;
-    if ((d->d2p = dict2pid_build(d->acmod->mdef, d->dict)) == NULL)
+    if ((d->d2p = dict2pid_build_cached(d->acmod->mdef, d->dict,
+                                        d->acmod->cache))
+        == NULL)
         return NULL;
     return d->dict;
 }
@@ -463,9 +538,46 @@ decoder_reinit_feat(decoder_t *d, config_t *config)
     return acmod_reinit_feat(d->acmod, d->fe, d->fcb);
 }
 
+static int
+decoder_init_rtf(decoder_t *d)
+{
+    double target = config_float(d->config, "rtf");
+    int topn;
+
+    rtf_control_free(d->rtf);
+    d->rtf = NULL;
+    if (target <= 0)
+        return 0;
+    /* Restores the configured top-N, if it can be changed at all. */
+    topn = acmod_set_topn(d->acmod, config_int(d->config, "topn"));
+    if ((d->rtf = rtf_control_init(target, config_int(d->config, "frate"),
+                                   config_float(d->config, "rtfbeam"),
+                                   topn < 0 ? 0 : topn))
+        == NULL)
+        return -1;
+    if (topn < 0)
+        E_WARN("Acoustic model type does not support changing top-N, "
+               "only beams will be adjusted\n");
+    return 0;
+}
+
+/* Apply the controller's settings to the search and acoustic model. */
+static void
+decoder_apply_rtf(decoder_t *d)
+{
+    if (d->search && d->search->vt->set_beam_factor)
+        search_module_set_beam_factor(d->search, d->rtf->factor);
+    if (d->rtf->topn > 0)
+        acmod_set_topn(d->acmod, d->rtf->topn);
+}
+
 int
 decoder_reinit(decoder_t *d, config_t *config)
 {
+    ptmr_t tm;
+
+    ptmr_init(&tm);
+    ptmr_start(&tm);
     if (config)
         if (decoder_init_config(d, config) < 0)
             return -1;
@@ -481,6 +593,13 @@ decoder_reinit(decoder_t *d, config_t *config)
         return -1;
     if (decoder_init_grammar(d) < 0)
         return -1;
+    if (decoder_init_rtf(d) < 0)
+        return -1;
+    ptmr_stop(&tm);
+    E_INFO("Initialized decoder in %.3f sec CPU, %.3f sec wall (cachedir %s)\n",
+           tm.t_cpu, tm.t_elapsed,
+           config_str(d->config, "cachedir") ? config_str(d->config, "cachedir")
+                                             : "not set");
 
     return 0;
 }
@@ -528,6 +647,115 @@ decoder_init(config_t *config)
     return d;
 }
 
+decoder_t *
+decoder_clone(decoder_t *other)
+{
+    decoder_t *d;
+
+    if (other->acmod == NULL || other->dict == NULL) {
+        E_ERROR("Cannot clone a decoder which is not initialized\n");
+        return NULL;
+    }
+    d = ckd_calloc(1, sizeof(*d));
+    d->refcount = 1;
+    d->config = config_retain(other->config);
+    d->lmath = logmath_retain(other->lmath);
+    d->bundle = model_bundle_retain(other->bundle);
+    d->perf.name = "decode";
+    ptmr_init(&d->perf);
+
+    /* Feature extraction and acoustic scoring state are per-stream. */
+    if ((d->fe = fe_init(d->config)) == NULL)
+        goto error_out;
+    if ((d->fcb = feat_clone(d->config, other->fcb)) == NULL)
+        goto error_out;
+    if ((d->acmod = acmod_clone(other->acmod, d->fe, d->fcb)) == NULL)
+        goto error_out;
+    d->dict = dict_retain(other->dict);
+    d->d2p = dict2pid_retain(other->d2p);
+
+    /* The grammar is shared, but the search (including the lexicon
+     * tree, which contains the active HMMs) is not. */
+    if (other->search
+        && 0 == strcmp(search_module_type(other->search), PS_SEARCH_TYPE_FSG)) {
+        fsg_model_t *fsg = ((fsg_search_t *)other->search)->fsg;
+        if ((d->search = fsg_search_init(fsg->name, fsg_model_retain(fsg),
+                                         d->config, d->acmod,
+                                         d->dict, d->d2p))
+            == NULL)
+            goto error_out;
+    }
+    if (decoder_init_rtf(d) < 0)
+        goto error_out;
+    return d;
+
+error_out:
+    E_ERROR("Failed to clone decoder\n");
+    decoder_free(d);
+    return NULL;
+}
+
+int
+decoder_pack_model(config_t *config, const char *outfile)
+{
+    decoder_t *d;
+    datacache_t *dc = NULL;
+    const char **names = NULL;
+    s3file_t **tables = NULL;
+    int i, n_tables = 0, rv = -1;
+
+    if (config_str(config, "bundle")) {
+        E_ERROR("Cannot pack a model which is already in a bundle\n");
+        return -1;
+    }
+    if ((d = decoder_create(config_retain(config))) == NULL)
+        return -1;
+    if (config_str(d->config, "hmm") == NULL) {
+        E_ERROR("No model directory (hmm) to pack\n");
+        goto error_out;
+    }
+    /* Load the model as decoder_init() would, but put the tables
+     * computed from it in memory, so that they can be packed. */
+    dc = datacache_init_memory();
+    logmath_free(d->lmath);
+    d->lmath = logmath_init_cached((float64)config_float(d->config, "logbase"),
+                                   0, TRUE, dc);
+    if (d->lmath == NULL)
+        goto error_out;
+    if (decoder_init_fe(d) == NULL)
+        goto error_out;
+    if (decoder_init_feat(d) == NULL)
+        goto error_out;
+    if (decoder_init_acmod_pre(d) == NULL)
+        goto error_out;
+    datacache_free(d->acmod->cache);
+    d->acmod->cache = datacache_retain(dc);
+    if (acmod_load_am(d->acmod) < 0)
+        goto error_out;
+    if (decoder_init_acmod_post(d) < 0)
+        goto error_out;
+    if (decoder_init_dict(d) == NULL)
+        goto error_out;
+
+    n_tables = datacache_n_tables(dc);
+    names = ckd_calloc(n_tables, sizeof(*names));
+    tables = ckd_calloc(n_tables, sizeof(*tables));
+    for (i = 0; i < n_tables; ++i)
+        tables[i] = datacache_get_table(dc, i, &names[i]);
+    E_INFO("Packing %d precomputed tables into %s\n", n_tables, outfile);
+    rv = model_bundle_pack_tables(config_str(d->config, "hmm"), outfile,
+                                  names, tables, n_tables);
+
+error_out:
+    for (i = 0; i < n_tables; ++i)
+        s3file_free(tables[i]);
+    ckd_free(tables);
+    ckd_free(names);
+    datacache_free(dc);
+    decoder_free(d);
+    return rv;
+}
+
 decoder_t *
 decoder_retain(decoder_t *d)
 {
@@ -545,11 +773,13 @@ decoder_free(decoder_t *d)
     if (--d->refcount > 0)
         return d->refcount;
     decoder_free_searches(d);
+    rtf_control_free(d->rtf);
     dict_free(d->dict);
     dict2pid_free(d->d2p);
     feat_free(d->fcb);
     fe_free(d->fe);
     acmod_free(d->acmod);
+    model_bundle_free(d->bundle);
     logmath_free(d->lmath);
     config_free(d->config);
     ckd_free(d->json_result);
@@ -734,6 +964,24 @@ decoder_set_align_text(decoder_t *d, const char *text)
     return 0;
 }
 
+/**
+ * Score up to n_frames queued frames in one go, unless the current
+ * frame has already been scored this way.
+ */
+static void
+decoder_score_ahead(decoder_t *d, int n_frames)
+{
+    acmod_t *acmod = d->acmod;
+    int frame_idx = acmod->output_frame;
+
+    if (n_frames < 2)
+        return;
+    if (frame_idx >= acmod->senscr_batch_frame
+        && frame_idx < acmod->senscr_batch_frame + acmod->n_senscr_batch)
+        return;
+    acmod_score_batch(acmod, frame_idx, n_frames);
+}
+
 alignment_t *
 decoder_alignment(decoder_t *d)
 {
@@ -787,12 +1035,17 @@ decoder_alignment(decoder_t *d)
     if (search_module_start(d->align) < 0)
         return NULL;
     while (d->acmod->output_frame < output_frame) {
+        decoder_score_ahead(d, output_frame - d->acmod->output_frame);
         if (search_module_step(d->align, d->acmod->output_frame) < 0)
             return NULL;
         acmod_advance(d->acmod);
     }
     if (search_module_finish(d->align) < 0)
         return NULL;
+    if (d->acmod->score_cache_max)
+        E_INFO("Senone score cache: %d hits, %d misses (%zu KiB)\n",
+               d->acmod->score_cache_hits, d->acmod->score_cache_misses,
+               d->acmod->score_cache_size / 1024);
 
     return al;
 }
@@ -810,6 +1063,11 @@ decoder_add_word(decoder_t *d,
 
     assert(word != NULL);
     assert(phones != NULL);
+    /* The dictionary is shared along with the acoustic model. */
+    if (acmod_shared(d->acmod)) {
+        E_ERROR("Cannot add words to a dictionary shared with other decoders\n");
+        return -1;
+    }
     /* Cannot have more phones than chars... */
     pron = ckd_calloc(1, strlen(phones));
     /* Parse phones into an array of phone IDs. */
@@ -929,6 +1187,12 @@ decoder_start_utt(decoder_t *d)
     if ((rv = acmod_start_utt(d->acmod)) < 0)
         return rv;
 
+    /* The search may have changed since the last utterance. */
+    if (d->rtf) {
+        rtf_control_start_utt(d->rtf);
+        decoder_apply_rtf(d);
+    }
+
     return search_module_start(d->search);
 }
 
@@ -944,11 +1208,23 @@ search_module_forward(decoder_t *d)
     }
     nfr = 0;
     while (d->acmod->n_feat_frame > 0) {
+        ptmr_t tm;
         int k;
+
+        if (d->rtf) {
+            ptmr_init(&tm);
+            ptmr_start(&tm);
+        }
+        decoder_score_ahead(d, d->acmod->n_feat_frame);
         if ((k = search_module_step(d->search,
                                     d->acmod->output_frame))
             < 0)
             return k;
+        if (d->rtf) {
+            ptmr_stop(&tm);
+            if (rtf_control_update(d->rtf, tm.t_elapsed))
+                decoder_apply_rtf(d);
+        }
         acmod_advance(d->acmod);
         ++d->n_frame;
         ++nfr;
@@ -1273,6 +1549,30 @@ decoder_all_time(decoder_t *d, double *out_nspeech,
     *out_nwall = d->perf.t_tot_elapsed;
 }
 
+int
+decoder_rtf_stats(decoder_t *d, rtf_stats_t *out_stats)
+{
+    float32 factor = d->rtf ? d->rtf->factor : 1.0;
+    double nspeech;
+
+    memset(out_stats, 0, sizeof(*out_stats));
+    nspeech = (double)d->acmod->output_frame / config_int(d->config, "frate");
+    if (nspeech > 0)
+        out_stats->rtf = d->perf.t_elapsed / nspeech;
+    out_stats->beam = pow(config_float(d->config, "beam"), factor);
+    out_stats->pbeam = pow(config_float(d->config, "pbeam"), factor);
+    out_stats->wbeam = pow(config_float(d->config, "wbeam"), factor);
+    if (d->rtf == NULL) {
+        out_stats->topn = config_int(d->config, "topn");
+        return -1;
+    }
+    out_stats->target = d->rtf->target;
+    out_stats->topn = d->rtf->topn;
+    out_stats->n_frames = d->rtf->n_frames;
+    out_stats->n_miss = d->rtf->n_miss;
+    return 0;
+}
+
 void
 search_module_init(search_module_t *search, searchfuncs_t *vt,
                    const char *type,
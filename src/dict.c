@@ -38,6 +38,7 @@
 #include <string.h>
 
 #include <soundswallower/dict.h>
+#include <soundswallower/refcount.h>
 #include <soundswallower/strfuncs.h>
 
 #define DELIM " \t\n" /* Set of field separator characters */
@@ -422,20 +423,20 @@ dict_retain(dict_t *d)
 {
     if (d == NULL)
         return NULL;
-    ++d->refcnt;
+    refcount_inc(&d->refcnt);
     return d;
 }
 
 int
 dict_free(dict_t *d)
 {
-    int i;
+    int i, refcount;
     dictword_t *word;
 
     if (d == NULL)
         return 0;
-    if (--d->refcnt > 0)
-        return d->refcnt;
+    if ((refcount = refcount_dec(&d->refcnt)) > 0)
+        return refcount;
 
     /* First Step, free all memory allocated for each word */
     for (i = 0; i < d->n_word; i++) {
@@ -39,6 +39,7 @@
 
 #include <soundswallower/dict2pid.h>
 #include <soundswallower/hmm.h>
+#include <soundswallower/refcount.h>
 
 /**
  * @file dict2pid.c - dictionary word to senone sequence mappings
@@ -372,14 +373,288 @@ dict2pid_internal(dict2pid_t *d2p,
     return bin_mdef_pid2ssid(mdef, p);
 }
 
+/* Diphones and single phones are filled in on their first
+ * occurrence in the dictionary.  Since single-phone words also fill
+ * in some diphones, the order matters, so record it, which also
+ * gives us a compact description of the dictionary for caching. */
+enum {
+    D2P_LDIPH,
+    D2P_RDIPH,
+    D2P_SINGLE
+};
+
+static s3cipid_t *
+dict2pid_scan(bin_mdef_t *mdef, dict_t *dict, int32 *out_n_events)
+{
+    bitvec_t *ldiph, *rdiph, *single;
+    s3cipid_t *events;
+    int32 n_events, n_alloc, w;
+
+    ldiph = bitvec_alloc(mdef->n_ciphone * mdef->n_ciphone);
+    rdiph = bitvec_alloc(mdef->n_ciphone * mdef->n_ciphone);
+    single = bitvec_alloc(mdef->n_ciphone);
+    n_alloc = 256;
+    n_events = 0;
+    events = ckd_calloc(n_alloc * 3, sizeof(*events));
+    for (w = 0; w < dict_size(dict); w++) {
+        int32 pronlen = dict_pronlen(dict, w);
+        int32 b, x;
+
+        /* At most two per word */
+        if (n_events + 2 > n_alloc) {
+            n_alloc *= 2;
+            events = ckd_realloc(events, n_alloc * 3 * sizeof(*events));
+        }
+        if (pronlen >= 2) {
+            b = dict_first_phone(dict, w);
+            x = dict_second_phone(dict, w);
+            if (bitvec_is_clear(ldiph, b * mdef->n_ciphone + x)) {
+                bitvec_set(ldiph, b * mdef->n_ciphone + x);
+                events[n_events * 3] = D2P_LDIPH;
+                events[n_events * 3 + 1] = b;
+                events[n_events * 3 + 2] = x;
+                ++n_events;
+            }
+            x = dict_second_last_phone(dict, w);
+            b = dict_last_phone(dict, w);
+            if (bitvec_is_clear(rdiph, b * mdef->n_ciphone + x)) {
+                bitvec_set(rdiph, b * mdef->n_ciphone + x);
+                events[n_events * 3] = D2P_RDIPH;
+                events[n_events * 3 + 1] = b;
+                events[n_events * 3 + 2] = x;
+                ++n_events;
+            }
+        } else if (pronlen == 1) {
+            b = dict_pron(dict, w, 0);
+            if (bitvec_is_clear(single, b)) {
+                bitvec_set(single, b);
+                events[n_events * 3] = D2P_SINGLE;
+                events[n_events * 3 + 1] = b;
+                events[n_events * 3 + 2] = 0;
+                ++n_events;
+            }
+        }
+    }
+    bitvec_free(ldiph);
+    bitvec_free(rdiph);
+    bitvec_free(single);
+    *out_n_events = n_events;
+    return events;
+}
+
+static void
+dict2pid_fill(dict2pid_t *d2p, s3ssid_t ***rdiph_rc,
+              const s3cipid_t *events, int32 n_events)
+{
+    bin_mdef_t *mdef = d2p->mdef;
+    int32 i, b, l, r, p;
+
+    for (i = 0; i < n_events; ++i) {
+        const s3cipid_t *ev = events + i * 3;
+
+        b = ev[1];
+        switch (ev[0]) {
+        case D2P_LDIPH:
+            /* Record all possible ssids for b(?,r) */
+            r = ev[2];
+            for (l = 0; l < bin_mdef_n_ciphone(mdef); l++) {
+                p = bin_mdef_phone_id_nearest(mdef, (s3cipid_t)b,
+                                              (s3cipid_t)l, (s3cipid_t)r,
+                                              WORD_POSN_BEGIN);
+                d2p->ldiph_lc[b][r][l] = bin_mdef_pid2ssid(mdef, p);
+            }
+            break;
+        case D2P_RDIPH:
+            /* And for b(l,?) */
+            l = ev[2];
+            for (r = 0; r < bin_mdef_n_ciphone(mdef); r++) {
+                p = bin_mdef_phone_id_nearest(mdef, (s3cipid_t)b,
+                                              (s3cipid_t)l, (s3cipid_t)r,
+                                              WORD_POSN_END);
+                rdiph_rc[b][l][r] = bin_mdef_pid2ssid(mdef, p);
+            }
+            break;
+        case D2P_SINGLE:
+            E_DEBUG("Building tables for single phone word phone %d = %s\n",
+                    b, bin_mdef_ciphone_str(mdef, b));
+            /* Populate lrdiph_rc (and also ldiph_lc, rdiph_rc if needed) */
+            populate_lrdiph(d2p, rdiph_rc, b);
+            break;
+        }
+    }
+}
+
+static uint64
+dict2pid_cache_key(bin_mdef_t *mdef, const s3cipid_t *events, int32 n_events)
+{
+    int32 dims[4];
+    uint64 key;
+    int32 i;
+
+    dims[0] = mdef->n_ciphone;
+    dims[1] = mdef->n_phone;
+    dims[2] = mdef->n_cd_tree;
+    dims[3] = mdef->sil;
+    key = datacache_hash(DATACACHE_HASH_INIT, dims, sizeof(dims));
+    for (i = 0; i < mdef->n_ciphone; ++i)
+        key = datacache_hash_str(key, mdef->ciname[i]);
+    key = datacache_hash(key, mdef->phone, mdef->n_phone * sizeof(*mdef->phone));
+    key = datacache_hash(key, mdef->cd_tree,
+                         mdef->n_cd_tree * sizeof(*mdef->cd_tree));
+    key = datacache_hash(key, events, n_events * 3 * sizeof(*events));
+    return key;
+}
+
+/* Cached tables are n_ciphone, then the number of senone sequences
+ * for each entry of rssid and lrssid, then ldiph_lc and lrdiph_rc,
+ * then all the senone sequences, then all the non-empty cimaps. */
+#define D2P_CACHE_HDR 4
+
+static size_t
+dict2pid_tree_size(xwdssid_t **tree, int32 n_ci)
+{
+    size_t size = 0;
+    int32 b, l;
+
+    for (b = 0; b < n_ci; ++b) {
+        for (l = 0; l < n_ci; ++l) {
+            if (tree[b][l].n_ssid)
+                size += tree[b][l].n_ssid * sizeof(s3ssid_t)
+                        + n_ci * sizeof(s3cipid_t);
+        }
+    }
+    return size;
+}
+
+static int
+dict2pid_cache_load(dict2pid_t *d2p, datacache_t *dc, uint64 key)
+{
+    const uint8 *data, *ptr;
+    s3file_t *mf;
+    xwdssid_t **trees[2];
+    int32 n_ci = d2p->mdef->n_ciphone;
+    size_t size, n_cube, n_sq, expect;
+    int32 i, b, l, n_ssid;
+
+    if ((mf = datacache_map(dc, "dict2pid", key,
+                            (const void **)&data, &size))
+        == NULL)
+        return -1;
+    n_cube = (size_t)n_ci * n_ci * n_ci;
+    n_sq = (size_t)n_ci * n_ci;
+    expect = D2P_CACHE_HDR * sizeof(int32) + 2 * n_sq * sizeof(int32)
+             + 2 * n_cube * sizeof(s3ssid_t);
+    if (size < expect || ((const int32 *)data)[0] != n_ci)
+        goto error_out;
+    ptr = data + D2P_CACHE_HDR * sizeof(int32);
+    for (i = 0; i < 2 * (int32)n_sq; ++i) {
+        memcpy(&n_ssid, ptr + i * sizeof(int32), sizeof(n_ssid));
+        if (n_ssid < 0 || n_ssid > n_ci)
+            goto error_out;
+        if (n_ssid)
+            expect += n_ssid * sizeof(s3ssid_t) + n_ci * sizeof(s3cipid_t);
+    }
+    if (size != expect)
+        goto error_out;
+
+    d2p->ldiph_lc = (s3ssid_t ***)ckd_calloc_3d(n_ci, n_ci, n_ci,
+                                                sizeof(s3ssid_t));
+    d2p->lrdiph_rc = (s3ssid_t ***)ckd_calloc_3d(n_ci, n_ci, n_ci,
+                                                 sizeof(s3ssid_t));
+    memcpy(d2p->ldiph_lc[0][0], ptr + 2 * n_sq * sizeof(int32),
+           n_cube * sizeof(s3ssid_t));
+    memcpy(d2p->lrdiph_rc[0][0],
+           ptr + 2 * n_sq * sizeof(int32) + n_cube * sizeof(s3ssid_t),
+           n_cube * sizeof(s3ssid_t));
+    trees[0] = d2p->rssid = ckd_calloc(n_ci, sizeof(xwdssid_t *));
+    trees[1] = d2p->lrssid = ckd_calloc(n_ci, sizeof(xwdssid_t *));
+    data = ptr + 2 * n_sq * sizeof(int32) + 2 * n_cube * sizeof(s3ssid_t);
+    for (i = 0; i < 2; ++i) {
+        for (b = 0; b < n_ci; ++b) {
+            trees[i][b] = ckd_calloc(n_ci, sizeof(xwdssid_t));
+            for (l = 0; l < n_ci; ++l) {
+                xwdssid_t *x = &trees[i][b][l];
+                memcpy(&x->n_ssid, ptr, sizeof(x->n_ssid));
+                ptr += sizeof(int32);
+                if (x->n_ssid == 0)
+                    continue;
+                x->ssid = ckd_calloc(x->n_ssid, sizeof(*x->ssid));
+                memcpy(x->ssid, data, x->n_ssid * sizeof(*x->ssid));
+                data += x->n_ssid * sizeof(*x->ssid);
+                x->cimap = ckd_calloc(n_ci, sizeof(*x->cimap));
+                memcpy(x->cimap, data, n_ci * sizeof(*x->cimap));
+                data += n_ci * sizeof(*x->cimap);
+            }
+        }
+    }
+    s3file_free(mf);
+    return 0;
+
+error_out:
+    E_WARN("Cached dictionary tables have wrong size, recomputing\n");
+    s3file_free(mf);
+    return -1;
+}
+
+static void
+dict2pid_cache_store(dict2pid_t *d2p, datacache_t *dc, uint64 key)
+{
+    xwdssid_t **trees[2];
+    int32 n_ci = d2p->mdef->n_ciphone;
+    size_t size, n_cube, n_sq;
+    uint8 *data, *ptr, *seq;
+    int32 i, b, l;
+
+    trees[0] = d2p->rssid;
+    trees[1] = d2p->lrssid;
+    n_cube = (size_t)n_ci * n_ci * n_ci;
+    n_sq = (size_t)n_ci * n_ci;
+    size = D2P_CACHE_HDR * sizeof(int32) + 2 * n_sq * sizeof(int32)
+           + 2 * n_cube * sizeof(s3ssid_t)
+           + dict2pid_tree_size(trees[0], n_ci)
+           + dict2pid_tree_size(trees[1], n_ci);
+    data = ckd_calloc(1, size);
+    ((int32 *)data)[0] = n_ci;
+    ptr = data + D2P_CACHE_HDR * sizeof(int32);
+    memcpy(ptr + 2 * n_sq * sizeof(int32), d2p->ldiph_lc[0][0],
+           n_cube * sizeof(s3ssid_t));
+    memcpy(ptr + 2 * n_sq * sizeof(int32) + n_cube * sizeof(s3ssid_t),
+           d2p->lrdiph_rc[0][0], n_cube * sizeof(s3ssid_t));
+    seq = ptr + 2 * n_sq * sizeof(int32) + 2 * n_cube * sizeof(s3ssid_t);
+    for (i = 0; i < 2; ++i) {
+        for (b = 0; b < n_ci; ++b) {
+            for (l = 0; l < n_ci; ++l) {
+                xwdssid_t *x = &trees[i][b][l];
+                memcpy(ptr, &x->n_ssid, sizeof(x->n_ssid));
+                ptr += sizeof(int32);
+                if (x->n_ssid == 0)
+                    continue;
+                memcpy(seq, x->ssid, x->n_ssid * sizeof(*x->ssid));
+                seq += x->n_ssid * sizeof(*x->ssid);
+                memcpy(seq, x->cimap, n_ci * sizeof(*x->cimap));
+                seq += n_ci * sizeof(*x->cimap);
+            }
+        }
+    }
+    datacache_store(dc, "dict2pid", key, data, size);
+    ckd_free(data);
+}
+
 dict2pid_t *
 dict2pid_build(bin_mdef_t *mdef, dict_t *dict)
+{
+    return dict2pid_build_cached(mdef, dict, NULL);
+}
+
+dict2pid_t *
+dict2pid_build_cached(bin_mdef_t *mdef, dict_t *dict, datacache_t *dc)
 {
     dict2pid_t *dict2pid;
     s3ssid_t ***rdiph_rc;
-    bitvec_t *ldiph, *rdiph, *single;
-    int32 pronlen;
-    int32 b, l, r, w, p;
+    s3cipid_t *events;
+    int32 n_events;
+    uint64 key = 0;
+    int32 b, l, r;
 
     E_INFO("Building PID tables for dictionary\n");
     assert(mdef);
@@ -389,6 +664,17 @@ dict2pid_build(bin_mdef_t *mdef, dict_t *dict)
     dict2pid->refcount = 1;
     dict2pid->mdef = bin_mdef_retain(mdef);
     dict2pid->dict = dict_retain(dict);
+
+    /* Find which diphones / ciphones are needed. */
+    events = dict2pid_scan(mdef, dict, &n_events);
+    if (dc) {
+        key = dict2pid_cache_key(mdef, events, n_events);
+        if (dict2pid_cache_load(dict2pid, dc, key) == 0) {
+            ckd_free(events);
+            return dict2pid;
+        }
+    }
+
     E_INFO("Allocating %d^3 * %d bytes (%d KiB) for word-initial triphones\n",
            mdef->n_ciphone, sizeof(s3ssid_t),
            mdef->n_ciphone * mdef->n_ciphone * mdef->n_ciphone * sizeof(s3ssid_t) / 1024);
@@ -414,60 +700,8 @@ dict2pid_build(bin_mdef_t *mdef, dict_t *dict)
         }
     }
 
-    /* Track which diphones / ciphones have been seen. */
-    ldiph = bitvec_alloc(mdef->n_ciphone * mdef->n_ciphone);
-    rdiph = bitvec_alloc(mdef->n_ciphone * mdef->n_ciphone);
-    single = bitvec_alloc(mdef->n_ciphone);
-
-    for (w = 0; w < dict_size(dict2pid->dict); w++) {
-        pronlen = dict_pronlen(dict, w);
-
-        if (pronlen >= 2) {
-            b = dict_first_phone(dict, w);
-            r = dict_second_phone(dict, w);
-            /* Populate ldiph_lc */
-            if (bitvec_is_clear(ldiph, b * mdef->n_ciphone + r)) {
-                /* Mark this diphone as done */
-                bitvec_set(ldiph, b * mdef->n_ciphone + r);
-
-                /* Record all possible ssids for b(?,r) */
-                for (l = 0; l < bin_mdef_n_ciphone(mdef); l++) {
-                    p = bin_mdef_phone_id_nearest(mdef, (s3cipid_t)b,
-                                                  (s3cipid_t)l, (s3cipid_t)r,
-                                                  WORD_POSN_BEGIN);
-                    dict2pid->ldiph_lc[b][r][l] = bin_mdef_pid2ssid(mdef, p);
-                }
-            }
-
-            /* Populate rdiph_rc */
-            l = dict_second_last_phone(dict, w);
-            b = dict_last_phone(dict, w);
-            if (bitvec_is_clear(rdiph, b * mdef->n_ciphone + l)) {
-                /* Mark this diphone as done */
-                bitvec_set(rdiph, b * mdef->n_ciphone + l);
-
-                for (r = 0; r < bin_mdef_n_ciphone(mdef); r++) {
-                    p = bin_mdef_phone_id_nearest(mdef, (s3cipid_t)b,
-                                                  (s3cipid_t)l, (s3cipid_t)r,
-                                                  WORD_POSN_END);
-                    rdiph_rc[b][l][r] = bin_mdef_pid2ssid(mdef, p);
-                }
-            }
-        } else if (pronlen == 1) {
-            b = dict_pron(dict, w, 0);
-            E_DEBUG("Building tables for single phone word %s phone %d = %s\n",
-                    dict_wordstr(dict, w), b, bin_mdef_ciphone_str(mdef, b));
-            /* Populate lrdiph_rc (and also ldiph_lc, rdiph_rc if needed) */
-            if (bitvec_is_clear(single, b)) {
-                populate_lrdiph(dict2pid, rdiph_rc, b);
-                bitvec_set(single, b);
-            }
-        }
-    }
-
-    bitvec_free(ldiph);
-    bitvec_free(rdiph);
-    bitvec_free(single);
+    dict2pid_fill(dict2pid, rdiph_rc, events, n_events);
+    ckd_free(events);
 
     /* Try to compress rdiph_rc into rdiph_rc_compressed */
     compress_right_context_tree(dict2pid, rdiph_rc);
@@ -475,6 +709,8 @@ dict2pid_build(bin_mdef_t *mdef, dict_t *dict)
 
     ckd_free_3d(rdiph_rc);
 
+    if (dc)
+        dict2pid_cache_store(dict2pid, dc, key);
     return dict2pid;
 }
 
@@ -483,17 +719,19 @@ dict2pid_retain(dict2pid_t *d2p)
 {
     if (d2p == NULL)
         return NULL;
-    ++d2p->refcount;
+    refcount_inc(&d2p->refcount);
     return d2p;
 }
 
 int
 dict2pid_free(dict2pid_t *d2p)
 {
+    int refcount;
+
     if (d2p == NULL)
         return 0;
-    if (--d2p->refcount > 0)
-        return d2p->refcount;
+    if ((refcount = refcount_dec(&d2p->refcount)) > 0)
+        return refcount;
 
     if (d2p->ldiph_lc)
         ckd_free_3d((void ***)d2p->ldiph_lc);
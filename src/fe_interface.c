@@ -37,6 +37,9 @@
 #include "config.h"
 #include <assert.h>
 #include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include <soundswallower/byteorder.h>
 #include <soundswallower/ckd_alloc.h>
@@ -48,6 +51,17 @@
 
 #include <soundswallower/fe_warp.h>
 
+#ifdef HAVE_PTHREAD
+/* The warping functions keep their parameters in global variables, so
+ * filters can only be built in one thread at a time. */
+static pthread_mutex_t fe_warp_mtx = PTHREAD_MUTEX_INITIALIZER;
+#define fe_warp_lock() pthread_mutex_lock(&fe_warp_mtx)
+#define fe_warp_unlock() pthread_mutex_unlock(&fe_warp_mtx)
+#else
+#define fe_warp_lock()
+#define fe_warp_unlock()
+#endif
+
 static const config_param_t fe_args[] = {
     FE_OPTIONS,
     { NULL, 0, NULL, NULL }
@@ -294,9 +308,11 @@ fe_init(config_t *config)
     fe->mel_fb = ckd_calloc(1, sizeof(*fe->mel_fb));
 
     /* transfer params to mel fb */
+    fe_warp_lock();
     fe_parse_melfb_params(config, fe, fe->mel_fb);
 
     if (fe->mel_fb->upper_filt_freq > fe->sampling_rate / 2 + 1.0) {
+        fe_warp_unlock();
         E_ERROR("Upper frequency %.1f is higher than samprate/2 (%.1f)\n",
                 fe->mel_fb->upper_filt_freq, fe->sampling_rate / 2);
         fe_free(fe);
@@ -304,6 +320,7 @@ fe_init(config_t *config)
     }
 
     fe_build_melfilters(fe->mel_fb);
+    fe_warp_unlock();
     fe_compute_melcosine(fe->mel_fb);
     if (config_bool(config, "remove_noise"))
         fe->noise_stats = fe_init_noisestats(fe->mel_fb->num_filters);
@@ -926,6 +926,45 @@ error_out:
     return NULL;
 }
 
+feat_t *
+feat_clone(config_t *config, feat_t *other)
+{
+    feat_t *fcb;
+    uint32 i, j;
+
+    if ((fcb = feat_init_s3file(config, NULL)) == NULL)
+        return NULL;
+    if (other->lda) {
+        if (fcb->n_stream != 1 || fcb->stream_len[0] != other->stream_len[0]) {
+            E_ERROR("Feature type does not match the one being cloned\n");
+            feat_free(fcb);
+            return NULL;
+        }
+        /* Only the rows up to out_dim are ever used. */
+        fcb->n_lda = other->n_lda;
+        fcb->out_dim = other->out_dim;
+        fcb->lda = (mfcc_t ***)ckd_calloc_3d(fcb->n_lda, fcb->out_dim,
+                                             fcb->stream_len[0],
+                                             sizeof(***fcb->lda));
+        for (i = 0; i < fcb->n_lda; ++i)
+            for (j = 0; j < fcb->out_dim; ++j)
+                memcpy(fcb->lda[i][j], other->lda[i][j],
+                       fcb->stream_len[0] * sizeof(***fcb->lda));
+    }
+    /* Start from the current estimate of the cepstral mean. */
+    if (fcb->cmn_struct && other->cmn_struct
+        && fcb->cmn_struct->veclen == other->cmn_struct->veclen) {
+        cmn_t *cmn = fcb->cmn_struct;
+        memcpy(cmn->cmn_mean, other->cmn_struct->cmn_mean,
+               cmn->veclen * sizeof(*cmn->cmn_mean));
+        memcpy(cmn->sum, other->cmn_struct->sum,
+               cmn->veclen * sizeof(*cmn->sum));
+        cmn->nframe = other->cmn_struct->nframe;
+        cmn_update_repr(cmn);
+    }
+    return fcb;
+}
+
 static void
 feat_cmn(feat_t *fcb, mfcc_t **mfc, int32 nfr, int32 beginutt, int32 endutt)
 {
@@ -50,6 +50,7 @@
 
 #include "config.h"
 #include <assert.h>
+#include <stdlib.h>
 
 #include <soundswallower/ckd_alloc.h>
 #include <soundswallower/err.h>
@@ -59,6 +60,26 @@
 
 #define __FSG_DBG__ 0
 
+/* Number of history entries in each block (a power of 2) */
+#define FSG_HIST_BLKSHIFT 12
+#define FSG_HIST_BLKSIZE (1 << FSG_HIST_BLKSHIFT)
+/* Initial number of entries per frame (this grows as needed) */
+#define FSG_HIST_FRAME_INIT 256
+
+static void
+fsg_history_alloc_frame(fsg_history_t *h, fsg_model_t *fsg, dict_t *dict)
+{
+    int32 i, n_bucket;
+
+    h->n_ciphone = bin_mdef_n_ciphone(dict->mdef);
+    n_bucket = fsg_model_n_state(fsg) * h->n_ciphone;
+    h->frame_bucket = ckd_malloc(n_bucket * sizeof(*h->frame_bucket));
+    for (i = 0; i < n_bucket; ++i)
+        h->frame_bucket[i] = -1;
+    h->frame_dirty = ckd_calloc(n_bucket, sizeof(*h->frame_dirty));
+    h->n_frame_dirty = 0;
+}
+
 fsg_history_t *
 fsg_history_init(fsg_model_t *fsg, dict_t *dict)
 {
@@ -66,16 +87,13 @@ fsg_history_init(fsg_model_t *fsg, dict_t *dict)
 
     h = (fsg_history_t *)ckd_calloc(1, sizeof(fsg_history_t));
     h->fsg = fsg;
-    h->entries = blkarray_list_init();
-
-    if (fsg && dict) {
-        h->n_ciphone = bin_mdef_n_ciphone(dict->mdef);
-        h->frame_entries = (glist_t **)ckd_calloc_2d(fsg_model_n_state(fsg),
-                                                     bin_mdef_n_ciphone(dict->mdef),
-                                                     sizeof(**h->frame_entries));
-    } else {
-        h->frame_entries = NULL;
-    }
+    h->max_frame_entries = FSG_HIST_FRAME_INIT;
+    h->frame_entries = ckd_calloc(h->max_frame_entries,
+                                  sizeof(*h->frame_entries));
+    h->frame_next = ckd_calloc(h->max_frame_entries,
+                               sizeof(*h->frame_next));
+    if (fsg && dict)
+        fsg_history_alloc_frame(h, fsg, dict);
 
     return h;
 }
@@ -83,46 +101,50 @@ fsg_history_init(fsg_model_t *fsg, dict_t *dict)
 void
 fsg_history_free(fsg_history_t *h)
 {
-    int32 s, lc, ns, np;
-    gnode_t *gn;
-
-    if (h->fsg) {
-        ns = fsg_model_n_state(h->fsg);
-        np = h->n_ciphone;
-
-        for (s = 0; s < ns; s++) {
-            for (lc = 0; lc < np; lc++) {
-                for (gn = h->frame_entries[s][lc]; gn; gn = gnode_next(gn)) {
-                    ckd_free(gnode_ptr(gn));
-                }
-                glist_free(h->frame_entries[s][lc]);
-            }
-        }
-    }
-    ckd_free_2d(h->frame_entries);
-    blkarray_list_free(h->entries);
+    int32 i;
+
+    for (i = 0; i < h->n_blocks; ++i)
+        ckd_free(h->blocks[i]);
+    ckd_free(h->blocks);
+    ckd_free(h->frame_entries);
+    ckd_free(h->frame_next);
+    ckd_free(h->frame_bucket);
+    ckd_free(h->frame_dirty);
     ckd_free(h);
 }
 
 void
 fsg_history_set_fsg(fsg_history_t *h, fsg_model_t *fsg, dict_t *dict)
 {
-    if (blkarray_list_n_valid(h->entries) != 0) {
+    if (h->n_entries != 0) {
         E_WARN("Switching FSG while history not empty; history cleared\n");
-        blkarray_list_reset(h->entries);
+        h->n_entries = 0;
     }
 
-    if (h->frame_entries)
-        ckd_free_2d((void **)h->frame_entries);
-    h->frame_entries = NULL;
+    ckd_free(h->frame_bucket);
+    ckd_free(h->frame_dirty);
+    h->frame_bucket = h->frame_dirty = NULL;
+    h->n_frame_entries = h->n_frame_dirty = 0;
     h->fsg = fsg;
 
-    if (fsg && dict) {
-        h->n_ciphone = bin_mdef_n_ciphone(dict->mdef);
-        h->frame_entries = (glist_t **)ckd_calloc_2d(fsg_model_n_state(fsg),
-                                                     bin_mdef_n_ciphone(dict->mdef),
-                                                     sizeof(glist_t));
+    if (fsg && dict)
+        fsg_history_alloc_frame(h, fsg, dict);
+}
+
+/*
+ * Append an entry to the history table.
+ */
+static void
+fsg_history_append(fsg_history_t *h, fsg_hist_entry_t *entry)
+{
+    int32 blk = h->n_entries >> FSG_HIST_BLKSHIFT;
+
+    if (blk == h->n_blocks) {
+        h->blocks = ckd_realloc(h->blocks, (h->n_blocks + 1) * sizeof(*h->blocks));
+        h->blocks[h->n_blocks++] = ckd_malloc(FSG_HIST_BLKSIZE * sizeof(**h->blocks));
     }
+    h->blocks[blk][h->n_entries & (FSG_HIST_BLKSIZE - 1)] = *entry;
+    ++h->n_entries;
 }
 
 void
@@ -132,29 +154,29 @@ fsg_history_entry_add(fsg_history_t *h,
                       int32 lc, fsg_pnode_ctxt_t rc)
 {
     fsg_hist_entry_t *entry, *new_entry;
-    int32 s;
-    gnode_t *gn, *prev_gn;
+    int32 s, b, i, n, prev;
 
     /* Skip the optimization for the initial dummy entries; always enter them */
     if (frame < 0) {
-        new_entry = (fsg_hist_entry_t *)ckd_calloc(1, sizeof(fsg_hist_entry_t));
-        new_entry->fsglink = link;
-        new_entry->frame = frame;
-        new_entry->score = score;
-        new_entry->pred = pred;
-        new_entry->lc = lc;
-        new_entry->rc = rc;
-
-        blkarray_list_append(h->entries, (void *)new_entry);
+        fsg_hist_entry_t dummy;
+
+        dummy.fsglink = link;
+        dummy.frame = frame;
+        dummy.score = score;
+        dummy.pred = pred;
+        dummy.lc = lc;
+        dummy.rc = rc;
+        fsg_history_append(h, &dummy);
         return;
     }
 
     s = fsg_link_to_state(link);
+    b = s * h->n_ciphone + lc;
 
-    /* Locate where this entry should be inserted in frame_entries[s][lc] */
-    prev_gn = NULL;
-    for (gn = h->frame_entries[s][lc]; gn; gn = gnode_next(gn)) {
-        entry = (fsg_hist_entry_t *)gnode_ptr(gn);
+    /* Locate where this entry should be inserted in the list for (s, lc) */
+    prev = -1;
+    for (i = h->frame_bucket[b]; i != -1; i = h->frame_next[i]) {
+        entry = &h->frame_entries[i];
 
         if (score BETTER_THAN entry->score)
             break; /* Found where to insert new entry */
@@ -163,11 +185,21 @@ fsg_history_entry_add(fsg_history_t *h,
         if (FSG_PNODE_CTXT_SUB(&rc, &(entry->rc)) == 0)
             return; /* rc set reduced to 0; new entry can be ignored */
 
-        prev_gn = gn;
+        prev = i;
     }
 
-    /* Create new entry after prev_gn (if prev_gn is NULL, at head) */
-    new_entry = (fsg_hist_entry_t *)ckd_calloc(1, sizeof(fsg_hist_entry_t));
+    /* Create new entry after prev (if prev is -1, at head) */
+    if (h->n_frame_entries == h->max_frame_entries) {
+        h->max_frame_entries *= 2;
+        h->frame_entries = ckd_realloc(h->frame_entries,
+                                       h->max_frame_entries
+                                           * sizeof(*h->frame_entries));
+        h->frame_next = ckd_realloc(h->frame_next,
+                                    h->max_frame_entries
+                                        * sizeof(*h->frame_next));
+    }
+    n = h->n_frame_entries++;
+    new_entry = &h->frame_entries[n];
     new_entry->fsglink = link;
     new_entry->frame = frame;
     new_entry->score = score;
@@ -175,31 +207,40 @@ fsg_history_entry_add(fsg_history_t *h,
     new_entry->lc = lc;
     new_entry->rc = rc; /* Note: rc set must be non-empty at this point */
 
-    if (!prev_gn) {
-        h->frame_entries[s][lc] = glist_add_ptr(h->frame_entries[s][lc],
-                                                (void *)new_entry);
-        prev_gn = h->frame_entries[s][lc];
-    } else
-        prev_gn = glist_insert_ptr(prev_gn, (void *)new_entry);
+    if (prev == -1) {
+        if (h->frame_bucket[b] == -1)
+            h->frame_dirty[h->n_frame_dirty++] = b;
+        h->frame_next[n] = h->frame_bucket[b];
+        h->frame_bucket[b] = n;
+    } else {
+        h->frame_next[n] = h->frame_next[prev];
+        h->frame_next[prev] = n;
+    }
 
     /*
      * Update the rc set of all the remaining entries in the list.  At this
-     * point, gn is the entry, if any, immediately following new entry.
+     * point, i is the entry, if any, immediately following new entry.
      */
-    while (gn) {
-        entry = (fsg_hist_entry_t *)gnode_ptr(gn);
+    prev = n;
+    while (i != -1) {
+        entry = &h->frame_entries[i];
 
         if (FSG_PNODE_CTXT_SUB(&(entry->rc), &rc) == 0) {
             /* rc set of entry reduced to 0; can prune this entry */
-            ckd_free((void *)entry);
-            gn = gnode_free(gn, prev_gn);
+            h->frame_next[prev] = h->frame_next[i];
         } else {
-            prev_gn = gn;
-            gn = gnode_next(gn);
+            prev = i;
         }
+        i = h->frame_next[i];
     }
 }
 
+static int
+compare_bucket(const void *a, const void *b)
+{
+    return *(const int32 *)a - *(const int32 *)b;
+}
+
 /*
  * Transfer the surviving history entries for this frame into the permanent
  * history table.
@@ -207,60 +248,52 @@ fsg_history_entry_add(fsg_history_t *h,
 void
 fsg_history_end_frame(fsg_history_t *h)
 {
-    int32 s, lc, ns, np;
-    gnode_t *gn;
-    fsg_hist_entry_t *entry;
-
-    ns = fsg_model_n_state(h->fsg);
-    np = h->n_ciphone;
-
-    for (s = 0; s < ns; s++) {
-        for (lc = 0; lc < np; lc++) {
-            for (gn = h->frame_entries[s][lc]; gn; gn = gnode_next(gn)) {
-                entry = (fsg_hist_entry_t *)gnode_ptr(gn);
-                blkarray_list_append(h->entries, (void *)entry);
-            }
-
-            glist_free(h->frame_entries[s][lc]);
-            h->frame_entries[s][lc] = NULL;
-        }
+    int32 i, j;
+
+    /* Transfer them in order of state and lc, as if we had looked at
+     * all of them. */
+    qsort(h->frame_dirty, h->n_frame_dirty, sizeof(*h->frame_dirty),
+          compare_bucket);
+    for (i = 0; i < h->n_frame_dirty; ++i) {
+        int32 b = h->frame_dirty[i];
+
+        for (j = h->frame_bucket[b]; j != -1; j = h->frame_next[j])
+            fsg_history_append(h, &h->frame_entries[j]);
+        h->frame_bucket[b] = -1;
     }
+    h->n_frame_dirty = 0;
+    h->n_frame_entries = 0;
 }
 
 fsg_hist_entry_t *
 fsg_history_entry_get(fsg_history_t *h, int32 id)
 {
-    return ((fsg_hist_entry_t *)blkarray_list_get(h->entries, id));
+    if (id >= h->n_entries)
+        return NULL;
+    return &h->blocks[id >> FSG_HIST_BLKSHIFT][id & (FSG_HIST_BLKSIZE - 1)];
 }
 
 void
 fsg_history_reset(fsg_history_t *h)
 {
-    blkarray_list_reset(h->entries);
+    /* Blocks are kept for the next utterance. */
+    h->n_entries = 0;
 }
 
 int32
 fsg_history_n_entries(fsg_history_t *h)
 {
-    return (blkarray_list_n_valid(h->entries));
+    return h->n_entries;
 }
 
 void
 fsg_history_utt_start(fsg_history_t *h)
 {
-    int32 s, lc, ns, np;
-
-    assert(blkarray_list_n_valid(h->entries) == 0);
-    assert(h->frame_entries);
-
-    ns = fsg_model_n_state(h->fsg);
-    np = h->n_ciphone;
-
-    for (s = 0; s < ns; s++) {
-        for (lc = 0; lc < np; lc++) {
-            assert(h->frame_entries[s][lc] == NULL);
-        }
-    }
+    (void)h;
+    assert(h->n_entries == 0);
+    assert(h->frame_bucket);
+    assert(h->n_frame_dirty == 0);
+    assert(h->n_frame_entries == 0);
 }
 
 void
@@ -275,7 +308,7 @@ fsg_history_print(fsg_history_t *h, dict_t *dict)
     int bpidx, bp;
 
     (void)dict;
-    for (bpidx = 0; bpidx < blkarray_list_n_valid(h->entries); bpidx++) {
+    for (bpidx = 0; bpidx < h->n_entries; bpidx++) {
         bp = bpidx;
         printf("History entry: ");
         while (bp > 0) {
@@ -41,14 +41,85 @@
 /* System headers. */
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <soundswallower/ckd_alloc.h>
 #include <soundswallower/err.h>
 #include <soundswallower/fsg_lextree.h>
+#include <soundswallower/hash_table.h>
 
 #define __FSG_DBG__ 0
 
+/*
+ * Lextree node as built by psubtree_add_trans(), before it is compiled
+ * into the flat arrays in fsg_lextree_t.
+ *
+ * To conserve memory, the underlying HMMs with state-level information are
+ * allocated only as needed.  Root and leaf nodes must also account for all
+ * the possible phonetic contexts, with an independent HMM for each distinct
+ * context.
+ */
+typedef struct fsg_pnode_s {
+    /*
+     * If this is not a leaf node, the first successor (child) node.  Otherwise
+     * the parent FSG transition for which this is the leaf node (for figuring
+     * the FSG destination state, and word emitted by the transition).  A node
+     * may have several children.  The succ ptr gives just the first; the rest
+     * are linked via the sibling ptr below.
+     */
+    union {
+        struct fsg_pnode_s *succ;
+        fsg_link_t *fsglink;
+    } next;
+
+    /*
+     * For simplicity of memory management (i.e., freeing the pnodes), all
+     * pnodes allocated for all transitions out of a state are maintained in a
+     * linear linked list through the alloc_next pointer.
+     */
+    struct fsg_pnode_s *alloc_next;
+
+    /*
+     * The next node that is also a child of the parent of this node; NULL if
+     * none.
+     */
+    struct fsg_pnode_s *sibling;
+
+    /*
+     * The transition (log) probability to be incurred upon transitioning to
+     * this node.  (Transition probabilities are really associated with the
+     * transitions.  But a lextree node has exactly one incoming transition.
+     * Hence, the prob can be associated with the node.)
+     * This is a logs2(prob) value, and includes the language weight.
+     */
+    int32 logs2prob;
+
+    /*
+     * The root and leaf positions associated with any transition have to deal
+     * with multiple phonetic contexts.  However, different contexts may result
+     * in the same SSID (senone-seq ID), and can share a single pnode with that
+     * SSID.  But the pnode should track the set of context CI phones that share
+     * it.  Hence the fsg_pnode_ctxt_t bit-vector set-representation.  (For
+     * simplicity of implementation, its size is a compile-time constant for
+     * now.)  Single phone words would need a 2-D array of context, but that's
+     * too expensive.  For now, they simply use SIL as right context, so only
+     * the left context is properly modelled.
+     * (For word-internal phones, this field is unused, of course.)
+     */
+    fsg_pnode_ctxt_t ctxt;
+
+    int32 id; /* Node ID in the compiled lextree (-1 until numbered) */
+    int32 arc; /* For leaf nodes, index of fsglink in its state's sorted arcs */
+    uint16 ci_ext; /* This node's CIphone as viewed externally (context) */
+    uint8 ppos; /* Phoneme position in pronunciation */
+    uint8 leaf; /* Whether this is a leaf node */
+
+    /* HMM-state-level stuff here */
+    hmm_context_t *ctx;
+    hmm_t hmm;
+} fsg_pnode_t;
+
 /* A linklist structure that is actually used to build local lextrees at grammar nodes */
 typedef struct fsg_glist_linklist_t {
     int32 ci, rc;
@@ -65,6 +136,7 @@ typedef struct fsg_glist_linklist_t {
 static fsg_pnode_t *fsg_psubtree_init(fsg_lextree_t *tree,
                                       fsg_model_t *fsg,
                                       int32 from_state,
+                                      int32 const *arc_idx,
                                       fsg_pnode_t **alloc_head);
 
 /**
@@ -74,10 +146,18 @@ static fsg_pnode_t *fsg_psubtree_init(fsg_lextree_t *tree,
 static void fsg_psubtree_free(fsg_pnode_t *alloc_head);
 
 /**
- * Dump the list of nodes in the given lextree to the given file.  alloc_head:
- * head of linear list of allocated nodes updated by fsg_psubtree_init().
+ * Number the nodes of a lextree and append them to the flat arrays of
+ * the compiled lextree.  Returns the index of the new tree.
+ */
+static int32 fsg_lextree_add_tree(fsg_lextree_t *lextree,
+                                  fsg_pnode_t *root,
+                                  fsg_pnode_t *alloc_head);
+
+/**
+ * Append HMMs for a new instance of tree t.  Returns the index of the
+ * new instance.
  */
-static void fsg_psubtree_dump(fsg_lextree_t *tree, fsg_pnode_t *root, FILE *fp);
+static int32 fsg_lextree_add_inst(fsg_lextree_t *lextree, int32 t);
 
 /**
  * Compute the left and right context CIphone sets for each state.
@@ -203,24 +283,327 @@ fsg_lextree_lc_rc(fsg_lextree_t *lextree)
     }
 }
 
+/* Word transition out of a state, as compared between states. */
+typedef struct arc_sig_s {
+    int32 wid;
+    int32 logs2prob;
+    int32 dest; /* Destination state, or its right contexts when sharing */
+    int32 idx; /* Position in fsg_model_arcs() order */
+    fsg_link_t *link;
+} arc_sig_t;
+
+static int
+cmp_arc_sig(const void *a, const void *b)
+{
+    const arc_sig_t *x = (const arc_sig_t *)a;
+    const arc_sig_t *y = (const arc_sig_t *)b;
+
+    if (x->wid != y->wid)
+        return (x->wid < y->wid) ? -1 : 1;
+    if (x->logs2prob != y->logs2prob)
+        return (x->logs2prob < y->logs2prob) ? -1 : 1;
+    if (x->dest != y->dest)
+        return (x->dest < y->dest) ? -1 : 1;
+    return x->idx - y->idx;
+}
+
+/**
+ * Number the distinct right context sets, so that states can be
+ * compared by the contexts of their destinations.
+ */
+static int32 *
+fsg_lextree_rc_ids(fsg_lextree_t *lextree)
+{
+    hash_table_t *rc_ht;
+    int32 *rc_id, s, n_rc, n_id;
+
+    rc_id = ckd_calloc(fsg_model_n_state(lextree->fsg), sizeof(*rc_id));
+    rc_ht = hash_table_new(fsg_model_n_state(lextree->fsg), HASH_CASE_YES);
+    n_id = 0;
+    for (s = 0; s < fsg_model_n_state(lextree->fsg); s++) {
+        for (n_rc = 0; lextree->rc[s][n_rc] >= 0; n_rc++)
+            ;
+        rc_id[s] = hash_table_enter_bkey_int32(rc_ht, (char *)lextree->rc[s],
+                                               n_rc * sizeof(**lextree->rc),
+                                               n_id);
+        if (rc_id[s] == n_id)
+            ++n_id;
+    }
+    hash_table_free(rc_ht);
+
+    return rc_id;
+}
+
+/**
+ * Whether transition l goes in its state's lextree, i.e. it is not a
+ * null transition or a filler self-loop which uses the filler banks.
+ */
+static int
+fsg_lextree_tree_arc(fsg_lextree_t *lextree, fsg_link_t *l)
+{
+    if (fsg_link_wid(l) < 0)
+        return FALSE;
+    if (lextree->n_fill == 0
+        || fsg_link_from_state(l) != fsg_link_to_state(l))
+        return TRUE;
+    return lextree->fill_idx[fsg_link_wid(l)] < 0;
+}
+
+/**
+ * Find the single-phone fillers with self-loops, which will use the
+ * filler banks instead of the per-state trees.
+ */
+static void
+fsg_lextree_add_fillers(fsg_lextree_t *lextree)
+{
+    fsg_model_t *fsg = lextree->fsg;
+    fsg_arciter_t *itor;
+    int32 s, f, wid, dictwid;
+
+    lextree->fill_idx = ckd_calloc(fsg_model_n_word(fsg),
+                                   sizeof(*lextree->fill_idx));
+    lextree->fill_wid = ckd_calloc(fsg_model_n_word(fsg),
+                                   sizeof(*lextree->fill_wid));
+    for (wid = 0; wid < fsg_model_n_word(fsg); wid++) {
+        lextree->fill_idx[wid] = -1;
+        if (!fsg_model_is_filler(fsg, wid))
+            continue;
+        dictwid = dict_wordid(lextree->dict, fsg_model_word_str(fsg, wid));
+        if (dictwid == BAD_S3WID || !dict_filler_word(lextree->dict, dictwid)
+            || dict_pronlen(lextree->dict, dictwid) != 1)
+            continue;
+        lextree->fill_idx[wid] = lextree->n_fill;
+        lextree->fill_wid[lextree->n_fill++] = wid;
+    }
+    if (lextree->n_fill == 0)
+        return;
+
+    /* Find each state's self-loops (there should only be one for
+     * each filler, but take the best one if not). */
+    lextree->fill_link = ckd_calloc(fsg_model_n_state(fsg) * lextree->n_fill,
+                                    sizeof(*lextree->fill_link));
+    for (s = 0; s < fsg_model_n_state(fsg); s++) {
+        for (itor = fsg_model_arcs(fsg, s); itor;
+             itor = fsg_arciter_next(itor)) {
+            fsg_link_t *l = fsg_arciter_get(itor);
+            if (fsg_link_wid(l) < 0 || fsg_lextree_tree_arc(lextree, l))
+                continue;
+            f = lextree->fill_idx[fsg_link_wid(l)];
+            if (fsg_lextree_fill_link(lextree, s, f) == NULL
+                || (fsg_link_logs2prob(l)
+                    > fsg_link_logs2prob(fsg_lextree_fill_link(lextree, s, f))))
+                fsg_lextree_fill_link(lextree, s, f) = l;
+        }
+    }
+    lextree->state_fill = ckd_calloc(fsg_model_n_state(fsg),
+                                     sizeof(*lextree->state_fill));
+    for (s = 0; s < fsg_model_n_state(fsg); s++)
+        lextree->state_fill[s] = -1;
+    E_INFO("%d fillers shared by all states\n", lextree->n_fill);
+}
+
+/**
+ * Build a new filler bank, with filler f at its node f.
+ *
+ * @return Index of the bank.
+ */
+static int32
+fsg_lextree_add_fill_bank(fsg_lextree_t *lextree)
+{
+    fsg_model_t *fsg = lextree->fsg;
+    fsg_pnode_t *root, *alloc_head, *pnode;
+    int32 b, f, t, i, dictwid, ci;
+
+    /* The bank nodes are like filler roots (see psubtree_add_trans()),
+     * but the transition probability depends on the state, so it is
+     * added when they are entered. */
+    root = alloc_head = NULL;
+    for (f = lextree->n_fill - 1; f >= 0; f--) {
+        dictwid = dict_wordid(lextree->dict,
+                              fsg_model_word_str(fsg, lextree->fill_wid[f]));
+        ci = dict_first_phone(lextree->dict, dictwid);
+        pnode = ckd_calloc(1, sizeof(*pnode));
+        pnode->ctx = lextree->ctx;
+        pnode->arc = -1;
+        pnode->logs2prob = lextree->wip + lextree->pip;
+        pnode->ci_ext = bin_mdef_silphone(lextree->mdef);
+        pnode->leaf = TRUE;
+        fsg_pnode_add_all_ctxt(&pnode->ctxt);
+        pnode->sibling = root;
+        root = pnode;
+        pnode->alloc_next = alloc_head;
+        alloc_head = pnode;
+        hmm_init(lextree->ctx, &pnode->hmm, FALSE,
+                 bin_mdef_pid2ssid(lextree->mdef, ci),
+                 bin_mdef_pid2tmatid(lextree->mdef, ci));
+    }
+    t = fsg_lextree_add_tree(lextree, root, alloc_head);
+    fsg_psubtree_free(alloc_head);
+    i = fsg_lextree_add_inst(lextree, t);
+
+    b = lextree->n_fill_bank++;
+    lextree->fill_tree = ckd_realloc(lextree->fill_tree,
+                                     lextree->n_fill_bank
+                                         * sizeof(*lextree->fill_tree));
+    lextree->fill_inst = ckd_realloc(lextree->fill_inst,
+                                     lextree->n_fill_bank
+                                         * sizeof(*lextree->fill_inst));
+    lextree->fill_state = ckd_realloc(lextree->fill_state,
+                                      lextree->n_fill_bank
+                                          * sizeof(*lextree->fill_state));
+    lextree->fill_tree[b] = t;
+    lextree->fill_inst[b] = i;
+    lextree->fill_state[b] = -1;
+    /* No state's key can look like this, so it never gets shared. */
+    lextree->tree_sig[t] = ckd_calloc(2, sizeof(**lextree->tree_sig));
+    lextree->tree_sig[t][0] = -1;
+    lextree->tree_sig[t][1] = b;
+    lextree->tree_sig_len[t] = 2;
+    lextree->tree_utt[t] = lextree->utt;
+    (void)hash_table_enter_bkey_int32(lextree->tree_ht,
+                                      (char *)lextree->tree_sig[t],
+                                      2 * sizeof(**lextree->tree_sig), t);
+    lextree->inst_sig[i] = ckd_calloc(2, sizeof(**lextree->inst_sig));
+    lextree->inst_sig[i][0] = -1;
+    lextree->inst_sig[i][1] = b;
+    lextree->inst_sig_len[i] = 2;
+    lextree->inst_utt[i] = lextree->utt;
+    (void)hash_table_enter_bkey_int32(lextree->inst_ht,
+                                      (char *)lextree->inst_sig[i],
+                                      2 * sizeof(**lextree->inst_sig), i);
+
+    return b;
+}
+
+int32
+fsg_lextree_enter_fillers(fsg_lextree_t *lextree, int32 s)
+{
+    int32 b, f, q;
+
+    if ((b = lextree->state_fill[s]) < 0) {
+        for (b = 0; b < lextree->n_fill_bank; b++)
+            if (lextree->fill_state[b] < 0)
+                break;
+        if (b == lextree->n_fill_bank)
+            b = fsg_lextree_add_fill_bank(lextree);
+        lextree->fill_state[b] = s;
+        lextree->state_fill[s] = b;
+        q = lextree->root_off[lextree->fill_tree[b]];
+        for (f = 0; f < lextree->n_fill; f++)
+            lextree->fsglink[q + f] = fsg_lextree_fill_link(lextree, s, f);
+    }
+
+    return lextree->inst_off[lextree->fill_inst[b]];
+}
+
+void
+fsg_lextree_release_fillers(fsg_lextree_t *lextree, int32 frame)
+{
+    int32 b, f, p;
+
+    for (b = 0; b < lextree->n_fill_bank; b++) {
+        if (lextree->fill_state[b] < 0)
+            continue;
+        p = lextree->inst_off[lextree->fill_inst[b]];
+        for (f = 0; f < lextree->n_fill; f++)
+            if (hmm_frame(&lextree->hmm[p + f]) == frame)
+                break;
+        if (f < lextree->n_fill)
+            continue;
+        lextree->state_fill[lextree->fill_state[b]] = -1;
+        lextree->fill_state[b] = -1;
+    }
+}
+
+/**
+ * Collect the word transitions out of state s in a canonical order, and
+ * build a key which is identical for two states if and only if they
+ * can use the same lextree.  This requires the same left contexts and
+ * the same words with the same probabilities.  If rc_id is NULL, they
+ * must also go to the same destinations, which is what it takes to
+ * share HMMs; otherwise it is enough for the destinations to have the
+ * same right contexts, which is what it takes to share a tree.
+ */
+static arc_sig_t *
+fsg_lextree_state_arcs(fsg_lextree_t *lextree, int32 s,
+                       int32 const *rc_id, int32 *out_n_arc,
+                       int32 **out_sig, size_t *out_sig_len)
+{
+    fsg_arciter_t *itor;
+    arc_sig_t *arcs;
+    int32 *sig, n_lc, n_arc, i;
+
+    n_arc = 0;
+    for (itor = fsg_model_arcs(lextree->fsg, s); itor;
+         itor = fsg_arciter_next(itor))
+        if (fsg_lextree_tree_arc(lextree, fsg_arciter_get(itor)))
+            ++n_arc;
+    arcs = ckd_calloc(n_arc ? n_arc : 1, sizeof(*arcs));
+    n_arc = 0;
+    for (itor = fsg_model_arcs(lextree->fsg, s); itor;
+         itor = fsg_arciter_next(itor)) {
+        fsg_link_t *l = fsg_arciter_get(itor);
+        if (!fsg_lextree_tree_arc(lextree, l))
+            continue;
+        arcs[n_arc].wid = fsg_link_wid(l);
+        arcs[n_arc].logs2prob = fsg_link_logs2prob(l);
+        arcs[n_arc].dest = rc_id ? rc_id[fsg_link_to_state(l)]
+                                 : fsg_link_to_state(l);
+        arcs[n_arc].idx = n_arc;
+        arcs[n_arc].link = l;
+        ++n_arc;
+    }
+    qsort(arcs, n_arc, sizeof(*arcs), cmp_arc_sig);
+
+    for (n_lc = 0; lextree->lc[s][n_lc] >= 0; n_lc++)
+        ;
+    *out_sig_len = 1 + n_lc + n_arc * 3;
+    sig = ckd_calloc(*out_sig_len, sizeof(*sig));
+    sig[0] = n_lc;
+    for (i = 0; i < n_lc; i++)
+        sig[1 + i] = lextree->lc[s][i];
+    for (i = 0; i < n_arc; i++) {
+        sig[1 + n_lc + i * 3] = arcs[i].wid;
+        sig[1 + n_lc + i * 3 + 1] = arcs[i].logs2prob;
+        sig[1 + n_lc + i * 3 + 2] = arcs[i].dest;
+    }
+
+    *out_n_arc = n_arc;
+    *out_sig = sig;
+    return arcs;
+}
+
 /*
- * For now, allocate the entire lextree statically.
+ * Create the lextree structure for an FSG.  Unless lazy is TRUE, the
+ * trees for all states are built right away; otherwise each one is
+ * built by fsg_lextree_enter_state() when the search first needs it.
  */
 fsg_lextree_t *
 fsg_lextree_init(fsg_model_t *fsg, dict_t *dict, dict2pid_t *d2p,
                  bin_mdef_t *mdef, hmm_context_t *ctx,
-                 int32 wip, int32 pip)
+                 int32 wip, int32 pip, int share, int lazy,
+                 int share_filler)
 {
-    int32 s, n_leaves;
+    int32 s, t, q, n_leaves, n_shared, n_shared_tnode;
     fsg_lextree_t *lextree;
-    fsg_pnode_t *pn;
+    size_t n_bytes;
 
     lextree = ckd_calloc(1, sizeof(fsg_lextree_t));
     lextree->fsg = fsg;
-    lextree->root = ckd_calloc(fsg_model_n_state(fsg),
-                               sizeof(fsg_pnode_t *));
-    lextree->alloc_head = ckd_calloc(fsg_model_n_state(fsg),
-                                     sizeof(fsg_pnode_t *));
+    lextree->state_tree = ckd_calloc(fsg_model_n_state(fsg),
+                                     sizeof(*lextree->state_tree));
+    lextree->state_inst = ckd_calloc(fsg_model_n_state(fsg),
+                                     sizeof(*lextree->state_inst));
+    for (s = 0; s < fsg_model_n_state(fsg); s++)
+        lextree->state_tree[s] = lextree->state_inst[s] = -1;
+    lextree->arc_link = ckd_calloc(fsg_model_n_state(fsg),
+                                   sizeof(*lextree->arc_link));
+    lextree->root_off = ckd_calloc(1, sizeof(*lextree->root_off));
+    lextree->grp_off = ckd_calloc(1, sizeof(*lextree->grp_off));
+    lextree->succ_off = ckd_calloc(1, sizeof(*lextree->succ_off));
+    lextree->inst_off = ckd_calloc(1, sizeof(*lextree->inst_off));
+    lextree->tree_ht = hash_table_new(fsg_model_n_state(fsg), HASH_CASE_YES);
+    lextree->inst_ht = hash_table_new(fsg_model_n_state(fsg), HASH_CASE_YES);
     lextree->ctx = ctx;
     lextree->dict = dict;
     lextree->d2p = d2p;
@@ -228,32 +611,60 @@ fsg_lextree_init(fsg_model_t *fsg, dict_t *dict, dict2pid_t *d2p,
     lextree->wip = wip;
     lextree->pip = pip;
 
-    /* Compute lc and rc for fsg. */
+    /* Compute lc and rc for fsg.  These depend on the whole FSG, so
+     * they are always done up front, even if the trees are not. */
     fsg_lextree_lc_rc(lextree);
+    lextree->rc_id = share ? fsg_lextree_rc_ids(lextree) : NULL;
+    if (share_filler)
+        fsg_lextree_add_fillers(lextree);
+
+    if (lazy) {
+        E_INFO("Building lextrees for %d states on demand\n",
+               fsg_model_n_state(fsg));
+        return lextree;
+    }
 
     /* Create lextree for each state, i.e. an HMM network that
      * represents words for all arcs exiting that state.  Note that
      * for a dense grammar such as an N-gram model, this will
      * rapidly exhaust all available memory. */
-    lextree->n_pnode = 0;
-    n_leaves = 0;
-    for (s = 0; s < fsg_model_n_state(fsg); s++) {
-        lextree->root[s] = fsg_psubtree_init(lextree, fsg, s, &(lextree->alloc_head[s]));
+    for (s = 0; s < fsg_model_n_state(fsg); s++)
+        fsg_lextree_build_state(lextree, s);
 
-        for (pn = lextree->alloc_head[s]; pn; pn = pn->alloc_next) {
-            lextree->n_pnode++;
-            if (pn->leaf)
-                ++n_leaves;
-        }
+    n_leaves = n_shared = n_shared_tnode = 0;
+    for (q = 0; q < lextree->n_tnode; q++)
+        if (lextree->leaf[q])
+            ++n_leaves;
+    for (s = 0; s < fsg_model_n_state(fsg); s++) {
+        if (lextree->arc_link[s] == NULL)
+            continue;
+        t = lextree->state_tree[s];
+        n_shared++;
+        n_shared_tnode += lextree->root_off[t + 1] - lextree->root_off[t];
     }
-    E_INFO("%d HMM nodes in lextree (%d leaves)\n",
-           lextree->n_pnode, n_leaves);
+    n_bytes = lextree->n_tnode * (sizeof(*lextree->ssid)
+                                  + sizeof(*lextree->tmatid)
+                                  + sizeof(*lextree->logs2prob)
+                                  + sizeof(*lextree->succ_off)
+                                  + sizeof(*lextree->leaf)
+                                  + sizeof(*lextree->ci_ext)
+                                  + sizeof(*lextree->ctxt)
+                                  + sizeof(*lextree->fsglink)
+                                  + sizeof(*lextree->leaf_arc)
+                                  + sizeof(*lextree->ppos))
+        + lextree->succ_off[lextree->n_tnode] * sizeof(*lextree->succ)
+        + lextree->n_pnode * (sizeof(*lextree->hmm)
+                              + sizeof(*lextree->node));
+    E_INFO("%d nodes in %d lextrees (%d leaves, roots in %d groups)\n",
+           lextree->n_tnode, lextree->n_tree, n_leaves, lextree->n_grp);
+    E_INFO("%d HMM nodes in %d lextree instances\n",
+           lextree->n_pnode, lextree->n_inst);
+    if (n_shared)
+        E_INFO("%d of %d states share another state's lextree, "
+               "saving %d nodes\n",
+               n_shared, fsg_model_n_state(fsg), n_shared_tnode);
     E_INFO("Allocated %d bytes (%d KiB) for all lextree nodes\n",
-           lextree->n_pnode * sizeof(fsg_pnode_t),
-           lextree->n_pnode * sizeof(fsg_pnode_t) / 1024);
-    E_INFO("Allocated %d bytes (%d KiB) for lextree leafnodes\n",
-           n_leaves * sizeof(fsg_pnode_t),
-           n_leaves * sizeof(fsg_pnode_t) / 1024);
+           (int)n_bytes, (int)(n_bytes / 1024));
 
 #if __FSG_DBG__
     fsg_lextree_dump(lextree, stdout);
@@ -262,34 +673,616 @@ fsg_lextree_init(fsg_model_t *fsg, dict_t *dict, dict2pid_t *d2p,
     return lextree;
 }
 
+/*
+ * States with the same outgoing words and contexts share a single
+ * lextree.  If they also have the same destinations, it does not
+ * matter which of them a path came from, since everything after it is
+ * the same, so they share its HMMs too, and Viterbi can safely merge
+ * them.  Otherwise (only if sharing was requested) each of them gets
+ * its own instance of the tree, so that their paths never compete,
+ * and the search finds the actual transition from the history entry
+ * when a word exits.
+ */
+static int32
+fsg_lextree_build_tree(fsg_lextree_t *lextree, int32 s)
+{
+    int32 t, i, n_arc, *sig, *arc_idx;
+    arc_sig_t *arcs;
+    fsg_pnode_t *root, *alloc_head;
+    size_t sig_len;
+
+    arcs = fsg_lextree_state_arcs(lextree, s, lextree->rc_id, &n_arc,
+                                  &sig, &sig_len);
+    if (hash_table_lookup_bkey_int32(lextree->tree_ht, (char *)sig,
+                                     sig_len * sizeof(*sig), &t) == 0) {
+        /* Leaf nodes of tree t refer to its own state's arcs by
+         * position, which we map to the arcs of this state. */
+        ckd_free(sig);
+        lextree->state_tree[s] = t;
+        if (n_arc > 0) {
+            lextree->arc_link[s] = ckd_calloc(n_arc,
+                                              sizeof(**lextree->arc_link));
+            for (i = 0; i < n_arc; i++)
+                lextree->arc_link[s][i] = arcs[i].link;
+        }
+        ckd_free(arcs);
+        return t;
+    }
+
+    arc_idx = ckd_calloc(n_arc ? n_arc : 1, sizeof(*arc_idx));
+    for (i = 0; i < n_arc; i++)
+        arc_idx[arcs[i].idx] = i;
+    alloc_head = NULL;
+    root = fsg_psubtree_init(lextree, lextree->fsg, s, arc_idx, &alloc_head);
+    ckd_free(arc_idx);
+    ckd_free(arcs);
+
+    /* Flatten it for search, and throw away the linked version. */
+    t = fsg_lextree_add_tree(lextree, root, alloc_head);
+    fsg_psubtree_free(alloc_head);
+    lextree->tree_sig[t] = sig;
+    lextree->tree_sig_len[t] = sig_len;
+    lextree->tree_utt[t] = lextree->utt;
+    (void)hash_table_enter_bkey_int32(lextree->tree_ht, (char *)sig,
+                                      sig_len * sizeof(*sig), t);
+    lextree->state_tree[s] = t;
+
+    return t;
+}
+
+int32
+fsg_lextree_build_state(fsg_lextree_t *lextree, int32 s)
+{
+    int32 i, n_arc, *sig;
+    size_t sig_len;
+
+    if (lextree->state_tree[s] < 0)
+        fsg_lextree_build_tree(lextree, s);
+
+    ckd_free(fsg_lextree_state_arcs(lextree, s, NULL, &n_arc,
+                                    &sig, &sig_len));
+    if (hash_table_lookup_bkey_int32(lextree->inst_ht, (char *)sig,
+                                     sig_len * sizeof(*sig), &i) == 0) {
+        ckd_free(sig);
+        lextree->state_inst[s] = i;
+        return i;
+    }
+
+    i = fsg_lextree_add_inst(lextree, lextree->state_tree[s]);
+    lextree->inst_sig[i] = sig;
+    lextree->inst_sig_len[i] = sig_len;
+    lextree->inst_utt[i] = lextree->utt;
+    (void)hash_table_enter_bkey_int32(lextree->inst_ht, (char *)sig,
+                                      sig_len * sizeof(*sig), i);
+    lextree->state_inst[s] = i;
+
+    return i;
+}
+
+/* Grow a per-node or per-tree array to hold n entries. */
+#define GROW(lt, a, n) ((lt)->a = ckd_realloc((lt)->a, (n) * sizeof(*(lt)->a)))
+
+/* Order roots by first CI phone, then left context set, keeping them
+ * in their original order (given by id) otherwise. */
+static int
+cmp_root(const void *a, const void *b)
+{
+    const fsg_pnode_t *pa = *(const fsg_pnode_t **)a;
+    const fsg_pnode_t *pb = *(const fsg_pnode_t **)b;
+    int c;
+
+    if (pa->ci_ext != pb->ci_ext)
+        return pa->ci_ext < pb->ci_ext ? -1 : 1;
+    if ((c = memcmp(&pa->ctxt, &pb->ctxt, sizeof(pa->ctxt))) != 0)
+        return c;
+    return pa->id < pb->id ? -1 : (pa->id > pb->id);
+}
+
+/* Add the root groups for tree t, whose roots are node[0] to
+ * node[n_root-1], already sorted by cmp_root(). */
+static void
+fsg_lextree_add_groups(fsg_lextree_t *lextree, int32 t,
+                       fsg_pnode_t **node, int32 n_root)
+{
+    int32 p, g;
+
+    g = lextree->n_grp;
+    for (p = 0; p < n_root; p++) {
+        if (p > 0 && node[p - 1]->ci_ext == node[p]->ci_ext
+            && 0 == memcmp(&node[p - 1]->ctxt, &node[p]->ctxt,
+                           sizeof(node[p]->ctxt)))
+            continue;
+        if (g == lextree->n_grp_alloc) {
+            lextree->n_grp_alloc = lextree->n_grp_alloc
+                ? lextree->n_grp_alloc * 2 : 64;
+            GROW(lextree, grp_ci, lextree->n_grp_alloc);
+            GROW(lextree, grp_ctxt, lextree->n_grp_alloc);
+            GROW(lextree, grp_end, lextree->n_grp_alloc);
+        }
+        lextree->grp_ci[g] = node[p]->ci_ext;
+        lextree->grp_ctxt[g] = node[p]->ctxt;
+        if (g > lextree->n_grp)
+            lextree->grp_end[g - 1] = node[p]->id;
+        ++g;
+    }
+    if (g > lextree->n_grp)
+        lextree->grp_end[g - 1] = lextree->root_off[t] + n_root;
+    lextree->n_grp = g;
+    lextree->grp_off[t + 1] = g;
+}
+
+static int32
+fsg_lextree_add_tree(fsg_lextree_t *lextree, fsg_pnode_t *root,
+                     fsg_pnode_t *alloc_head)
+{
+    int32 t, p, base, n_id, n_succ;
+    fsg_pnode_t **node, *pn, *child;
+
+    t = lextree->n_tree;
+    if (t == lextree->n_tree_alloc) {
+        lextree->n_tree_alloc = lextree->n_tree_alloc
+            ? lextree->n_tree_alloc * 2 : 16;
+        GROW(lextree, root_off, lextree->n_tree_alloc + 1);
+        GROW(lextree, grp_off, lextree->n_tree_alloc + 1);
+        GROW(lextree, n_root, lextree->n_tree_alloc);
+        GROW(lextree, tree_utt, lextree->n_tree_alloc);
+        GROW(lextree, tree_sig, lextree->n_tree_alloc);
+        GROW(lextree, tree_sig_len, lextree->n_tree_alloc);
+    }
+
+    /* Number the nodes of the tree, roots first then their descendants
+     * in breadth-first order, so that nodes which are likely to be
+     * active together are also close together. */
+    n_id = 0;
+    for (pn = alloc_head; pn; pn = pn->alloc_next) {
+        pn->id = -1;
+        ++n_id;
+    }
+    node = ckd_calloc(n_id ? n_id : 1, sizeof(*node));
+    base = lextree->n_tnode;
+    n_id = n_succ = 0;
+    for (pn = root; pn; pn = pn->sibling) {
+        pn->id = n_id;
+        node[n_id++] = pn;
+    }
+    qsort(node, n_id, sizeof(*node), cmp_root);
+    for (p = 0; p < n_id; p++)
+        node[p]->id = base + p;
+    lextree->root_off[t] = base;
+    lextree->n_root[t] = n_id;
+    fsg_lextree_add_groups(lextree, t, node, n_id);
+    for (p = 0; p < n_id; p++) {
+        if (node[p]->leaf)
+            continue;
+        for (child = node[p]->next.succ; child; child = child->sibling) {
+            if (child->id == -1) {
+                child->id = base + n_id;
+                node[n_id++] = child;
+            }
+            ++n_succ;
+        }
+    }
+
+    if (base + n_id > lextree->n_tnode_alloc) {
+        int32 n_alloc = lextree->n_tnode_alloc ? lextree->n_tnode_alloc : 256;
+        while (n_alloc < base + n_id)
+            n_alloc *= 2;
+        lextree->n_tnode_alloc = n_alloc;
+        GROW(lextree, ssid, n_alloc);
+        GROW(lextree, tmatid, n_alloc);
+        GROW(lextree, logs2prob, n_alloc);
+        GROW(lextree, succ_off, n_alloc + 1);
+        GROW(lextree, leaf, n_alloc);
+        GROW(lextree, ci_ext, n_alloc);
+        GROW(lextree, ctxt, n_alloc);
+        GROW(lextree, fsglink, n_alloc);
+        GROW(lextree, leaf_arc, n_alloc);
+        GROW(lextree, ppos, n_alloc);
+    }
+    n_succ += lextree->succ_off[base];
+    if (n_succ > lextree->n_succ_alloc) {
+        int32 n_alloc = lextree->n_succ_alloc ? lextree->n_succ_alloc : 256;
+        while (n_alloc < n_succ)
+            n_alloc *= 2;
+        lextree->n_succ_alloc = n_alloc;
+        GROW(lextree, succ, n_alloc);
+    }
+
+    n_succ = lextree->succ_off[base];
+    for (p = base; p < base + n_id; p++) {
+        pn = node[p - base];
+        lextree->ssid[p] = hmm_nonmpx_ssid(&pn->hmm);
+        lextree->tmatid[p] = hmm_tmatid(&pn->hmm);
+        lextree->logs2prob[p] = pn->logs2prob;
+        lextree->leaf[p] = pn->leaf;
+        lextree->ci_ext[p] = pn->ci_ext;
+        lextree->ctxt[p] = pn->ctxt;
+        lextree->ppos[p] = pn->ppos;
+        lextree->succ_off[p] = n_succ;
+        if (pn->leaf) {
+            lextree->fsglink[p] = pn->next.fsglink;
+            lextree->leaf_arc[p] = pn->arc;
+        } else {
+            lextree->fsglink[p] = NULL;
+            lextree->leaf_arc[p] = -1;
+            for (child = pn->next.succ; child; child = child->sibling)
+                lextree->succ[n_succ++] = child->id;
+        }
+    }
+    lextree->n_tnode = base + n_id;
+    lextree->succ_off[lextree->n_tnode] = n_succ;
+    lextree->n_tree = t + 1;
+    lextree->root_off[t + 1] = lextree->n_tnode;
+    ckd_free(node);
+
+    return t;
+}
+
+static int32
+fsg_lextree_add_inst(fsg_lextree_t *lextree, int32 t)
+{
+    int32 i, p, q, n;
+
+    i = lextree->n_inst;
+    if (i == lextree->n_inst_alloc) {
+        lextree->n_inst_alloc = lextree->n_inst_alloc
+            ? lextree->n_inst_alloc * 2 : 16;
+        GROW(lextree, inst_off, lextree->n_inst_alloc + 1);
+        GROW(lextree, inst_tree, lextree->n_inst_alloc);
+        GROW(lextree, inst_utt, lextree->n_inst_alloc);
+        GROW(lextree, inst_sig, lextree->n_inst_alloc);
+        GROW(lextree, inst_sig_len, lextree->n_inst_alloc);
+    }
+    n = lextree->root_off[t + 1] - lextree->root_off[t];
+    if (lextree->n_pnode + n > lextree->n_pnode_alloc) {
+        int32 n_alloc = lextree->n_pnode_alloc ? lextree->n_pnode_alloc : 256;
+        while (n_alloc < lextree->n_pnode + n)
+            n_alloc *= 2;
+        lextree->n_pnode_alloc = n_alloc;
+        GROW(lextree, hmm, n_alloc);
+        GROW(lextree, node, n_alloc);
+    }
+
+    for (p = lextree->n_pnode, q = lextree->root_off[t];
+         q < lextree->root_off[t + 1]; p++, q++) {
+        hmm_init(lextree->ctx, &lextree->hmm[p], FALSE,
+                 lextree->ssid[q], lextree->tmatid[q]);
+        lextree->node[p] = q;
+    }
+    lextree->inst_tree[i] = t;
+    lextree->inst_off[i] = lextree->n_pnode;
+    lextree->n_pnode += n;
+    lextree->inst_off[i + 1] = lextree->n_pnode;
+    lextree->n_inst = i + 1;
+
+    return i;
+}
+
+int32
+fsg_lextree_enter_state(fsg_lextree_t *lextree, int32 s)
+{
+    int32 i = lextree->state_inst[s];
+
+    if (i < 0)
+        i = fsg_lextree_build_state(lextree, s);
+    lextree->tree_utt[lextree->inst_tree[i]] = lextree->utt;
+    lextree->inst_utt[i] = lextree->utt;
+
+    return i;
+}
+
+/* Move n entries of a per-node array from src down to dst. */
+#define MOVE(lt, a, dst, src, n) memmove((lt)->a + (dst), (lt)->a + (src), \
+                                         (n) * sizeof(*(lt)->a))
+
 void
-fsg_lextree_dump(fsg_lextree_t *lextree, FILE *fp)
+fsg_lextree_start_utt(fsg_lextree_t *lextree, int32 max_idle)
 {
-    int32 s;
+    int32 s, t, u, i, p, n, n_id, n_succ, n_grp, n_hmm, delta;
+    int32 n_evict, n_evict_inst, succ_start, succ_len, grp_start, grp_len;
+    int32 *remap, *inst_remap, *tree_delta;
+
+    ++lextree->utt;
+    /* No HMMs are active, so all the filler banks are free, but they
+     * are kept for reuse. */
+    for (u = 0; u < lextree->n_fill_bank; u++) {
+        if (lextree->fill_state[u] >= 0)
+            lextree->state_fill[lextree->fill_state[u]] = -1;
+        lextree->fill_state[u] = -1;
+        lextree->tree_utt[lextree->fill_tree[u]] = lextree->utt;
+        lextree->inst_utt[lextree->fill_inst[u]] = lextree->utt;
+    }
+    if (max_idle <= 0 || lextree->n_tree == 0)
+        return;
+
+    /* A tree is entered whenever any of its instances is, so evicting
+     * a tree also evicts all of its instances. */
+    remap = ckd_calloc(lextree->n_tree, sizeof(*remap));
+    n_evict = u = 0;
+    for (t = 0; t < lextree->n_tree; t++) {
+        if (lextree->utt - lextree->tree_utt[t] > max_idle) {
+            remap[t] = -1;
+            ++n_evict;
+        } else
+            remap[t] = u++;
+    }
+    inst_remap = ckd_calloc(lextree->n_inst ? lextree->n_inst : 1,
+                            sizeof(*inst_remap));
+    n_evict_inst = u = 0;
+    for (i = 0; i < lextree->n_inst; i++) {
+        if (lextree->utt - lextree->inst_utt[i] > max_idle) {
+            inst_remap[i] = -1;
+            ++n_evict_inst;
+        } else
+            inst_remap[i] = u++;
+    }
+    if (n_evict == 0 && n_evict_inst == 0) {
+        ckd_free(remap);
+        ckd_free(inst_remap);
+        return;
+    }
+    for (u = 0; u < lextree->n_fill_bank; u++) {
+        lextree->fill_tree[u] = remap[lextree->fill_tree[u]];
+        lextree->fill_inst[u] = inst_remap[lextree->fill_inst[u]];
+    }
 
     for (s = 0; s < fsg_model_n_state(lextree->fsg); s++) {
-        fprintf(fp, "State %5d root %p\n", s, lextree->root[s]);
-        fsg_psubtree_dump(lextree, lextree->root[s], fp);
+        i = lextree->state_inst[s];
+        if (i >= 0)
+            lextree->state_inst[s] = inst_remap[i];
+        t = lextree->state_tree[s];
+        if (t < 0)
+            continue;
+        lextree->state_tree[s] = remap[t];
+        if (remap[t] < 0) {
+            ckd_free(lextree->arc_link[s]);
+            lextree->arc_link[s] = NULL;
+        }
     }
+
+    /* Slide the surviving trees down over the evicted ones.  Trees
+     * keep their relative order, so everything only moves down. */
+    tree_delta = ckd_calloc(lextree->n_tree, sizeof(*tree_delta));
+    hash_table_empty(lextree->tree_ht);
+    n_id = n_succ = n_grp = 0;
+    for (t = 0; t < lextree->n_tree; t++) {
+        p = lextree->root_off[t];
+        n = lextree->root_off[t + 1] - p;
+        if (remap[t] < 0) {
+            ckd_free(lextree->tree_sig[t]);
+            continue;
+        }
+        delta = tree_delta[t] = p - n_id;
+        succ_start = lextree->succ_off[p];
+        succ_len = lextree->succ_off[p + n] - succ_start;
+        MOVE(lextree, ssid, n_id, p, n);
+        MOVE(lextree, tmatid, n_id, p, n);
+        MOVE(lextree, logs2prob, n_id, p, n);
+        MOVE(lextree, leaf, n_id, p, n);
+        MOVE(lextree, ci_ext, n_id, p, n);
+        MOVE(lextree, ctxt, n_id, p, n);
+        MOVE(lextree, fsglink, n_id, p, n);
+        MOVE(lextree, leaf_arc, n_id, p, n);
+        MOVE(lextree, ppos, n_id, p, n);
+        MOVE(lextree, succ, n_succ, succ_start, succ_len);
+        for (p = n_id; p < n_id + n; p++)
+            lextree->succ_off[p] = lextree->succ_off[p + delta]
+                - succ_start + n_succ;
+        for (p = n_succ; p < n_succ + succ_len; p++)
+            lextree->succ[p] -= delta;
+
+        grp_start = lextree->grp_off[t];
+        grp_len = lextree->grp_off[t + 1] - grp_start;
+        MOVE(lextree, grp_ci, n_grp, grp_start, grp_len);
+        MOVE(lextree, grp_ctxt, n_grp, grp_start, grp_len);
+        MOVE(lextree, grp_end, n_grp, grp_start, grp_len);
+        for (p = n_grp; p < n_grp + grp_len; p++)
+            lextree->grp_end[p] -= delta;
+
+        u = remap[t];
+        lextree->root_off[u] = n_id;
+        lextree->grp_off[u] = n_grp;
+        lextree->n_root[u] = lextree->n_root[t];
+        lextree->tree_utt[u] = lextree->tree_utt[t];
+        lextree->tree_sig[u] = lextree->tree_sig[t];
+        lextree->tree_sig_len[u] = lextree->tree_sig_len[t];
+        (void)hash_table_enter_bkey_int32(lextree->tree_ht,
+                                          (char *)lextree->tree_sig[u],
+                                          lextree->tree_sig_len[u]
+                                              * sizeof(**lextree->tree_sig),
+                                          u);
+        n_id += n;
+        n_succ += succ_len;
+        n_grp += grp_len;
+    }
+
+    /* Likewise for the instances, whose HMM nodes also have to follow
+     * their tree nodes. */
+    hash_table_empty(lextree->inst_ht);
+    n_hmm = 0;
+    for (i = 0; i < lextree->n_inst; i++) {
+        p = lextree->inst_off[i];
+        n = lextree->inst_off[i + 1] - p;
+        if (inst_remap[i] < 0) {
+            ckd_free(lextree->inst_sig[i]);
+            continue;
+        }
+        t = lextree->inst_tree[i];
+        MOVE(lextree, hmm, n_hmm, p, n);
+        MOVE(lextree, node, n_hmm, p, n);
+        for (p = n_hmm; p < n_hmm + n; p++)
+            lextree->node[p] -= tree_delta[t];
+
+        u = inst_remap[i];
+        lextree->inst_tree[u] = remap[t];
+        lextree->inst_off[u] = n_hmm;
+        lextree->inst_utt[u] = lextree->inst_utt[i];
+        lextree->inst_sig[u] = lextree->inst_sig[i];
+        lextree->inst_sig_len[u] = lextree->inst_sig_len[i];
+        (void)hash_table_enter_bkey_int32(lextree->inst_ht,
+                                          (char *)lextree->inst_sig[u],
+                                          lextree->inst_sig_len[u]
+                                              * sizeof(**lextree->inst_sig),
+                                          u);
+        n_hmm += n;
+    }
+    E_INFO("Evicted %d lextrees (%d nodes) and %d instances (%d HMM nodes) "
+           "unused for %d utterances\n",
+           n_evict, lextree->n_tnode - n_id,
+           n_evict_inst, lextree->n_pnode - n_hmm, max_idle);
+    lextree->n_tree -= n_evict;
+    lextree->n_tnode = n_id;
+    lextree->root_off[lextree->n_tree] = n_id;
+    lextree->grp_off[lextree->n_tree] = n_grp;
+    lextree->n_grp = n_grp;
+    lextree->succ_off[n_id] = n_succ;
+    lextree->n_inst -= n_evict_inst;
+    lextree->n_pnode = n_hmm;
+    lextree->inst_off[lextree->n_inst] = n_hmm;
+    ckd_free(tree_delta);
+    ckd_free(inst_remap);
+    ckd_free(remap);
+}
+
+void
+fsg_lextree_dump(fsg_lextree_t *lextree, FILE *fp)
+{
+    int32 s, t, p, i;
+    fsg_link_t *tl;
+    uint8 *dumped;
+
+    dumped = ckd_calloc(lextree->n_tree ? lextree->n_tree : 1, sizeof(*dumped));
+    for (p = 0; p < lextree->n_fill; p++)
+        fprintf(fp, "Filler %d %s\n", p,
+                fsg_model_word_str(lextree->fsg, lextree->fill_wid[p]));
+    for (t = 0; t < lextree->n_fill_bank; t++) {
+        fprintf(fp, "Filler bank %d nodes %d-%d HMMs %d-%d", t,
+                lextree->root_off[lextree->fill_tree[t]],
+                lextree->root_off[lextree->fill_tree[t] + 1] - 1,
+                lextree->inst_off[lextree->fill_inst[t]],
+                lextree->inst_off[lextree->fill_inst[t] + 1] - 1);
+        if (lextree->fill_state[t] >= 0)
+            fprintf(fp, " used by state %d", lextree->fill_state[t]);
+        fprintf(fp, "\n");
+    }
+    for (s = 0; s < fsg_model_n_state(lextree->fsg); s++) {
+        for (p = 0; p < lextree->n_fill; p++) {
+            tl = fsg_lextree_fill_link(lextree, s, p);
+            if (tl)
+                fprintf(fp, "State %5d filler %d {%s[%d->%d](%d)}\n", s, p,
+                        fsg_model_word_str(lextree->fsg, tl->wid),
+                        tl->from_state, tl->to_state, tl->logs2prob);
+        }
+        t = lextree->state_tree[s];
+        if (t < 0) {
+            fprintf(fp, "State %5d not built\n", s);
+            continue;
+        }
+        fprintf(fp, "State %5d tree %d roots %d-%d", s, t,
+                fsg_lextree_first_root(lextree, s),
+                fsg_lextree_end_root(lextree, s) - 1);
+        if ((i = lextree->state_inst[s]) >= 0)
+            fprintf(fp, " HMMs %d-%d", lextree->inst_off[i],
+                    lextree->inst_off[i + 1] - 1);
+        fprintf(fp, "\n");
+        if (dumped[t])
+            continue;
+        dumped[t] = TRUE;
+        for (p = lextree->root_off[t]; p < lextree->root_off[t + 1]; p++) {
+            /* Indentation */
+            for (i = 0; i <= lextree->ppos[p]; i++)
+                fprintf(fp, "  ");
+
+            fprintf(fp, "%d.@", p);
+            fprintf(fp, " %5d.SS", lextree->ssid[p]);
+            fprintf(fp, " %10d.LP", lextree->logs2prob[p]);
+            fprintf(fp, " %s.%d",
+                    bin_mdef_ciphone_str(lextree->mdef, lextree->ci_ext[p]),
+                    lextree->ppos[p]);
+            if ((lextree->ppos[p] == 0) || lextree->leaf[p]) {
+                fprintf(fp, " [");
+                for (i = 0; i < FSG_PNODE_CTXT_BVSZ; i++)
+                    fprintf(fp, "%08x", lextree->ctxt[p].bv[i]);
+                fprintf(fp, "]");
+            }
+            if (lextree->leaf[p]) {
+                tl = lextree->fsglink[p];
+                fprintf(fp, " {%s[%d->%d](%d)}",
+                        fsg_model_word_str(lextree->fsg, tl->wid),
+                        tl->from_state, tl->to_state, tl->logs2prob);
+            } else {
+                fprintf(fp, " NXT");
+                for (i = lextree->succ_off[p]; i < lextree->succ_off[p + 1]; i++)
+                    fprintf(fp, " %d", lextree->succ[i]);
+            }
+            fprintf(fp, "\n");
+        }
+    }
+    ckd_free(dumped);
     fflush(fp);
 }
 
 void
 fsg_lextree_free(fsg_lextree_t *lextree)
 {
-    int32 s;
+    int32 s, t, i, p;
 
     if (lextree == NULL)
         return;
 
-    if (lextree->fsg)
-        for (s = 0; s < fsg_model_n_state(lextree->fsg); s++)
-            fsg_psubtree_free(lextree->alloc_head[s]);
-
+    for (p = 0; p < lextree->n_pnode; p++)
+        hmm_deinit(&lextree->hmm[p]);
     ckd_free_2d(lextree->lc);
     ckd_free_2d(lextree->rc);
-    ckd_free(lextree->root);
-    ckd_free(lextree->alloc_head);
+    if (lextree->fsg)
+        for (s = 0; s < fsg_model_n_state(lextree->fsg); s++)
+            ckd_free(lextree->arc_link[s]);
+    ckd_free(lextree->arc_link);
+    for (t = 0; t < lextree->n_tree; t++)
+        ckd_free(lextree->tree_sig[t]);
+    ckd_free(lextree->tree_sig);
+    ckd_free(lextree->tree_sig_len);
+    ckd_free(lextree->tree_utt);
+    if (lextree->tree_ht)
+        hash_table_free(lextree->tree_ht);
+    for (i = 0; i < lextree->n_inst; i++)
+        ckd_free(lextree->inst_sig[i]);
+    ckd_free(lextree->inst_sig);
+    ckd_free(lextree->inst_sig_len);
+    ckd_free(lextree->inst_utt);
+    if (lextree->inst_ht)
+        hash_table_free(lextree->inst_ht);
+    ckd_free(lextree->rc_id);
+    ckd_free(lextree->fill_wid);
+    ckd_free(lextree->fill_idx);
+    ckd_free(lextree->fill_link);
+    ckd_free(lextree->fill_tree);
+    ckd_free(lextree->fill_inst);
+    ckd_free(lextree->fill_state);
+    ckd_free(lextree->state_fill);
+    ckd_free(lextree->state_tree);
+    ckd_free(lextree->state_inst);
+    ckd_free(lextree->inst_tree);
+    ckd_free(lextree->inst_off);
+    ckd_free(lextree->hmm);
+    ckd_free(lextree->node);
+    ckd_free(lextree->root_off);
+    ckd_free(lextree->n_root);
+    ckd_free(lextree->grp_off);
+    ckd_free(lextree->grp_ci);
+    ckd_free(lextree->grp_ctxt);
+    ckd_free(lextree->grp_end);
+    ckd_free(lextree->ssid);
+    ckd_free(lextree->tmatid);
+    ckd_free(lextree->logs2prob);
+    ckd_free(lextree->succ_off);
+    ckd_free(lextree->succ);
+    ckd_free(lextree->leaf);
+    ckd_free(lextree->ci_ext);
+    ckd_free(lextree->ctxt);
+    ckd_free(lextree->fsglink);
+    ckd_free(lextree->leaf_arc);
+    ckd_free(lextree->ppos);
     ckd_free(lextree);
 }
 
@@ -348,6 +1341,8 @@ fsg_pnode_ctxt_sub_generic(fsg_pnode_ctxt_t *src, fsg_pnode_ctxt_t *sub)
  * (rooted at root), and return the new lextree root.  (There may actually be
  * several root nodes, maintained in a linked list via fsg_pnode_t.sibling.
  * "root" is the head of this list.)
+ * arc: index of this link in the sorted arcs of its state (see
+ * fsg_lextree_state_arcs()).
  * lclist, rclist: sets of left and right context phones for this link.
  * alloc_head: head of a linear list of all allocated pnodes for the parent
  * FSG state, kept elsewhere and updated by this routine.
@@ -356,7 +1351,7 @@ static fsg_pnode_t *
 psubtree_add_trans(fsg_lextree_t *lextree,
                    fsg_pnode_t *root,
                    fsg_glist_linklist_t **curglist,
-                   fsg_link_t *fsglink,
+                   fsg_link_t *fsglink, int32 arc,
                    int16 *lclist, int16 *rclist,
                    fsg_pnode_t **alloc_head)
 {
@@ -418,6 +1413,7 @@ psubtree_add_trans(fsg_lextree_t *lextree,
                     pnode = (fsg_pnode_t *)ckd_calloc(1, sizeof(fsg_pnode_t));
                     pnode->ctx = lextree->ctx;
                     pnode->next.fsglink = fsglink;
+                    pnode->arc = arc;
                     pnode->logs2prob = (fsg_link_logs2prob(fsglink) >> SENSCR_SHIFT)
                         + lextree->wip + lextree->pip;
                     pnode->ci_ext = dict_first_phone(lextree->dict, dictwid);
@@ -444,6 +1440,7 @@ psubtree_add_trans(fsg_lextree_t *lextree,
             pnode = (fsg_pnode_t *)ckd_calloc(1, sizeof(fsg_pnode_t));
             pnode->ctx = lextree->ctx;
             pnode->next.fsglink = fsglink;
+            pnode->arc = arc;
             pnode->logs2prob = (fsg_link_logs2prob(fsglink) >> SENSCR_SHIFT)
                 + lextree->wip + lextree->pip;
             pnode->ci_ext = silcipid; /* Presents SIL as context to neighbors */
@@ -613,6 +1610,7 @@ psubtree_add_trans(fsg_lextree_t *lextree,
                         pnode->leaf = TRUE;
                         pnode->sibling = rc_pnodelist ? (fsg_pnode_t *)gnode_ptr(rc_pnodelist) : NULL;
                         pnode->next.fsglink = fsglink;
+                        pnode->arc = arc;
                         pnode->alloc_next = head;
                         head = pnode;
                         ++n_rc_alloc;
@@ -673,6 +1671,7 @@ psubtree_add_trans(fsg_lextree_t *lextree,
 static fsg_pnode_t *
 fsg_psubtree_init(fsg_lextree_t *lextree,
                   fsg_model_t *fsg, int32 from_state,
+                  int32 const *arc_idx,
                   fsg_pnode_t **alloc_head)
 {
     fsg_arciter_t *itor;
@@ -697,12 +1696,13 @@ fsg_psubtree_init(fsg_lextree_t *lextree,
         fsglink = fsg_arciter_get(itor);
         dst = fsglink->to_state;
 
-        if (fsg_link_wid(fsglink) < 0)
+        if (!fsg_lextree_tree_arc(lextree, fsglink))
             continue;
 
         E_DEBUG("Building lextree for arc from %d to %d: %s\n",
                 from_state, dst, fsg_model_word_str(fsg, fsg_link_wid(fsglink)));
         root = psubtree_add_trans(lextree, root, &glist, fsglink,
+                                  arc_idx[n_arc],
                                   lextree->lc[from_state],
                                   lextree->rc[dst],
                                   alloc_head);
@@ -727,82 +1727,3 @@ fsg_psubtree_free(fsg_pnode_t *head)
         head = next;
     }
 }
-
-void
-fsg_psubtree_dump_node(fsg_lextree_t *tree, fsg_pnode_t *node, FILE *fp)
-{
-    int32 i;
-    fsg_link_t *tl;
-
-    /* Indentation */
-    for (i = 0; i <= node->ppos; i++)
-        fprintf(fp, "  ");
-
-    fprintf(fp, "%p.@", node); /* Pointer used as node
-                                * ID */
-    fprintf(fp, " %5d.SS", hmm_nonmpx_ssid(&node->hmm));
-    fprintf(fp, " %10d.LP", node->logs2prob);
-    fprintf(fp, " %p.SIB", node->sibling);
-    fprintf(fp, " %s.%d", bin_mdef_ciphone_str(tree->mdef, node->ci_ext), node->ppos);
-    if ((node->ppos == 0) || node->leaf) {
-        fprintf(fp, " [");
-        for (i = 0; i < FSG_PNODE_CTXT_BVSZ; i++)
-            fprintf(fp, "%08x", node->ctxt.bv[i]);
-        fprintf(fp, "]");
-    }
-    if (node->leaf) {
-        tl = node->next.fsglink;
-        fprintf(fp, " {%s[%d->%d](%d)}",
-                fsg_model_word_str(tree->fsg, tl->wid),
-                tl->from_state, tl->to_state, tl->logs2prob);
-    } else {
-        fprintf(fp, " %p.NXT", node->next.succ);
-    }
-    fprintf(fp, "\n");
-
-    return;
-}
-
-void
-fsg_psubtree_dump(fsg_lextree_t *tree, fsg_pnode_t *root, FILE *fp)
-{
-    fsg_pnode_t *succ;
-
-    if (root == NULL)
-        return;
-    if (root->ppos == 0) {
-        while (root->sibling && root->sibling->next.succ == root->next.succ) {
-            fsg_psubtree_dump_node(tree, root, fp);
-            root = root->sibling;
-        }
-        fflush(fp);
-    }
-
-    fsg_psubtree_dump_node(tree, root, fp);
-
-    if (root->leaf) {
-        if (root->ppos == 0 && root->sibling) { /* For single-phone words */
-            fsg_psubtree_dump(tree, root->sibling, fp);
-        }
-        return;
-    }
-
-    succ = root->next.succ;
-    while (succ) {
-        fsg_psubtree_dump(tree, succ, fp);
-        succ = succ->sibling;
-    }
-
-    if (root->ppos == 0) {
-        fsg_psubtree_dump(tree, root->sibling, fp);
-        fflush(fp);
-    }
-
-    return;
-}
-
-void
-fsg_psubtree_pnode_deactivate(fsg_pnode_t *pnode)
-{
-    hmm_clear(&pnode->hmm);
-}
@@ -44,6 +44,7 @@
 #include <soundswallower/fsg_model.h>
 #include <soundswallower/hash_table.h>
 #include <soundswallower/prim_type.h>
+#include <soundswallower/refcount.h>
 #include <soundswallower/strfuncs.h>
 
 #define FSG_MODEL_BEGIN_DECL "FSG_BEGIN"
@@ -712,7 +713,7 @@ fsg_model_retain(fsg_model_t *fsg)
 {
     if (fsg == NULL)
         return NULL;
-    ++fsg->refcount;
+    refcount_inc(&fsg->refcount);
     return fsg;
 }
 
@@ -738,13 +739,13 @@ trans_list_free(fsg_model_t *fsg, int32 i)
 int
 fsg_model_free(fsg_model_t *fsg)
 {
-    int i;
+    int i, refcount;
 
     if (fsg == NULL)
         return 0;
 
-    if (--fsg->refcount > 0)
-        return fsg->refcount;
+    if ((refcount = refcount_dec(&fsg->refcount)) > 0)
+        return refcount;
 
     for (i = 0; i < fsg->n_word; ++i)
         ckd_free(fsg->vocab[i]);
@@ -64,9 +64,16 @@
 #define __FSG_DBG_CHAN__ 0
 #define __FSG_ALLOW_BESTPATH__ 0
 
+/* Initial size of the active lists (they grow as needed) */
+#define FSG_ACTIVE_INIT 256
+
+/* Number of bins used for histogram pruning */
+#define FSG_HIST_BINS 256
+
 static seg_iter_t *fsg_search_seg_iter(search_module_t *search);
 static lattice_t *fsg_search_lattice(search_module_t *search);
 static int fsg_search_prob(search_module_t *search);
+static int fsg_search_set_beam_factor(search_module_t *search, float32 factor);
 
 static searchfuncs_t fsg_funcs = {
     /* start: */ fsg_search_start,
@@ -78,6 +85,7 @@ static searchfuncs_t fsg_funcs = {
     /* hyp: */ fsg_search_hyp,
     /* prob: */ fsg_search_prob,
     /* seg_iter: */ fsg_search_seg_iter,
+    /* set_beam_factor: */ fsg_search_set_beam_factor,
 };
 
 static int
@@ -179,6 +187,13 @@ fsg_search_init(const char *name,
     fsg_search_t *fsgs = ckd_calloc(1, sizeof(*fsgs));
     search_module_init(search_module_base(fsgs), &fsg_funcs, PS_SEARCH_TYPE_FSG, name, config, acmod, dict, d2p);
 
+    /* Active lists, which grow as needed. */
+    fsgs->max_pnode_active = fsgs->max_pnode_active_next = FSG_ACTIVE_INIT;
+    fsgs->pnode_active = ckd_calloc(fsgs->max_pnode_active,
+                                    sizeof(*fsgs->pnode_active));
+    fsgs->pnode_active_next = ckd_calloc(fsgs->max_pnode_active_next,
+                                         sizeof(*fsgs->pnode_active_next));
+
     /* Note: Consuming semantics. */
     fsgs->fsg = fsg;
     /* Initialize HMM context. */
@@ -188,13 +203,13 @@ fsg_search_init(const char *name,
         search_module_free(search_module_base(fsgs));
         return NULL;
     }
+    fsgs->simd = hmm_simd_get(config_str(config, "simd"));
 
     /* Initialize the search history object */
     fsgs->history = fsg_history_init(NULL, dict);
     fsgs->frame = -1;
 
     /* Get search pruning parameters */
-    fsgs->beam_factor = 1.0f;
     fsgs->beam = fsgs->beam_orig
         = (int32)logmath_log(acmod->lmath, config_float(config, "beam"))
         >> SENSCR_SHIFT;
@@ -204,6 +219,9 @@ fsg_search_init(const char *name,
     fsgs->wbeam = fsgs->wbeam_orig
         = (int32)logmath_log(acmod->lmath, config_float(config, "wbeam"))
         >> SENSCR_SHIFT;
+    fsgs->beam_factor = 1.0;
+    fsgs->maxhmmpf = config_int(config, "maxhmmpf");
+    fsgs->maxwpf = config_int(config, "maxwpf");
 
     /* LM related weights/penalties */
     fsgs->lw = config_float(config, "lw");
@@ -217,6 +235,13 @@ fsg_search_init(const char *name,
     /* Acoustic score scale for posterior probabilities. */
     fsgs->ascale = (float32)(1.0 / config_float(config, "ascale"));
 
+    /* Lextree construction. */
+    fsgs->share = config_bool(config, "fsgshare");
+    fsgs->lazy = config_bool(config, "fsglazy");
+    fsgs->share_filler = config_bool(config, "fsgsharefiller");
+    fsgs->evict = config_int(config, "fsgevict");
+    fsgs->frate = config_int(config, "frate");
+
     E_INFO("FSG(beam: %d, pbeam: %d, wbeam: %d; wip: %d, pip: %d)\n",
            fsgs->beam_orig, fsgs->pbeam_orig, fsgs->wbeam_orig,
            fsgs->wip, fsgs->pip);
@@ -256,8 +281,7 @@ fsg_search_free(search_module_t *search)
 {
     fsg_search_t *fsgs = (fsg_search_t *)search;
 
-    double n_speech = (double)fsgs->n_tot_frame
-        / config_int(search_module_config(fsgs), "frate");
+    double n_speech = (double)fsgs->n_tot_frame / fsgs->frate;
 
     E_INFO("TOTAL fsg %.2f CPU %.3f xRT\n",
            fsgs->perf.t_tot_cpu,
@@ -276,6 +300,9 @@ fsg_search_free(search_module_t *search)
     hmm_context_free(fsgs->hmmctx);
     /* NOTE: Consuming semantics. */
     fsg_model_free(fsgs->fsg);
+    ckd_free(fsgs->pnode_active);
+    ckd_free(fsgs->pnode_active_next);
+    ckd_free(fsgs->hmm_eval);
     ckd_free(fsgs);
 }
 
@@ -283,6 +310,7 @@ int
 fsg_search_reinit(search_module_t *search, dict_t *dict, dict2pid_t *d2p)
 {
     fsg_search_t *fsgs = (fsg_search_t *)search;
+    ptmr_t tmr;
 
     /* Free the old lextree */
     if (fsgs->lextree)
@@ -295,9 +323,16 @@ fsg_search_reinit(search_module_t *search, dict_t *dict, dict2pid_t *d2p)
     search->n_words = dict_size(dict);
 
     /* Allocate new lextree for the given FSG */
+    ptmr_init(&tmr);
+    ptmr_start(&tmr);
     fsgs->lextree = fsg_lextree_init(fsgs->fsg, dict, d2p,
                                      search_module_acmod(fsgs)->mdef,
-                                     fsgs->hmmctx, fsgs->wip, fsgs->pip);
+                                     fsgs->hmmctx, fsgs->wip, fsgs->pip,
+                                     fsgs->share, fsgs->lazy,
+                                     fsgs->share_filler);
+    ptmr_stop(&tmr);
+    E_INFO("Lextree built in %.3f sec CPU, %.3f sec wall\n",
+           tmr.t_cpu, tmr.t_elapsed);
 
     /* Inform the history module of the new fsg */
     fsg_history_reset(fsgs->history);
@@ -306,23 +341,135 @@ fsg_search_reinit(search_module_t *search, dict_t *dict, dict2pid_t *d2p)
     return 0;
 }
 
+/*
+ * Add a pnode to the active list for the next frame.
+ */
+static void
+fsg_search_activate(fsg_search_t *fsgs, int32 pnode)
+{
+    if (fsgs->n_pnode_active_next == fsgs->max_pnode_active_next) {
+        fsgs->max_pnode_active_next *= 2;
+        fsgs->pnode_active_next
+            = ckd_realloc(fsgs->pnode_active_next,
+                          fsgs->max_pnode_active_next
+                              * sizeof(*fsgs->pnode_active_next));
+    }
+    fsgs->pnode_active_next[fsgs->n_pnode_active_next++] = pnode;
+}
+
+/*
+ * Make the next-frame active list the current one, and reuse the
+ * current one for the next frame.
+ */
+static void
+fsg_search_swap_active(fsg_search_t *fsgs)
+{
+    int32 *tmp = fsgs->pnode_active;
+    int32 max = fsgs->max_pnode_active;
+
+    fsgs->pnode_active = fsgs->pnode_active_next;
+    fsgs->max_pnode_active = fsgs->max_pnode_active_next;
+    fsgs->n_pnode_active = fsgs->n_pnode_active_next;
+    fsgs->pnode_active_next = tmp;
+    fsgs->max_pnode_active_next = max;
+    fsgs->n_pnode_active_next = 0;
+}
+
 static void
 fsg_search_sen_active(fsg_search_t *fsgs)
 {
-    gnode_t *gn;
-    fsg_pnode_t *pnode;
     hmm_t *hmm;
+    int32 i;
 
     acmod_clear_active(search_module_acmod(fsgs));
 
-    for (gn = fsgs->pnode_active; gn; gn = gnode_next(gn)) {
-        pnode = (fsg_pnode_t *)gnode_ptr(gn);
-        hmm = fsg_pnode_hmmptr(pnode);
+    for (i = 0; i < fsgs->n_pnode_active; ++i) {
+        hmm = fsg_lextree_hmm(fsgs->lextree, fsgs->pnode_active[i]);
         assert(hmm_frame(hmm) == fsgs->frame);
         acmod_activate_hmm(search_module_acmod(fsgs), hmm);
     }
 }
 
+/*
+ * Find the threshold which keeps at most max scores, given a histogram
+ * of how far they are below best in bins of width bw (the last bin
+ * holds everything further down).  The first bin is always kept, so
+ * there can be more than max scores above it if they are all that
+ * close to best.
+ */
+static int32
+fsg_search_hist_thresh(int32 const *bins, int32 best, int32 bw, int32 max)
+{
+    int32 i, n;
+
+    for (i = n = 0; i < FSG_HIST_BINS - 1; ++i) {
+        n += bins[i];
+        if (n > max)
+            break;
+    }
+    if (i == 0)
+        i = 1;
+    return best - i * bw + 1;
+}
+
+static int32
+fsg_search_hist_bin(int32 best, int32 score, int32 bw)
+{
+    int32 b = (best - score) / bw;
+    return (b >= FSG_HIST_BINS) ? FSG_HIST_BINS - 1 : b;
+}
+
+/*
+ * Score of an active HMM going into the next frame: either its best
+ * state after the last one, or the score it was just entered with.
+ */
+static int32
+fsg_search_hmm_score(hmm_t *hmm)
+{
+    return (hmm_in_score(hmm) > hmm_bestscore(hmm))
+        ? hmm_in_score(hmm) : hmm_bestscore(hmm);
+}
+
+/*
+ * Cut the active list down to at most maxhmmpf HMMs before evaluating
+ * them, keeping those with the best scores going into this frame.
+ */
+static void
+fsg_search_hist_prune(fsg_search_t *fsgs)
+{
+    int32 bins[FSG_HIST_BINS];
+    int32 i, n, bw, best, thresh;
+    hmm_t *hmm;
+
+    best = WORST_SCORE;
+    for (i = 0; i < fsgs->n_pnode_active; ++i) {
+        hmm = fsg_lextree_hmm(fsgs->lextree, fsgs->pnode_active[i]);
+        if (fsg_search_hmm_score(hmm) > best)
+            best = fsg_search_hmm_score(hmm);
+    }
+    bw = (-fsgs->beam + FSG_HIST_BINS - 1) / FSG_HIST_BINS;
+    if (bw < 1)
+        bw = 1;
+    memset(bins, 0, sizeof(bins));
+    for (i = 0; i < fsgs->n_pnode_active; ++i) {
+        hmm = fsg_lextree_hmm(fsgs->lextree, fsgs->pnode_active[i]);
+        ++bins[fsg_search_hist_bin(best, fsg_search_hmm_score(hmm), bw)];
+    }
+    thresh = fsg_search_hist_thresh(bins, best, bw, fsgs->maxhmmpf);
+
+    /* Keep the survivors in order, since that decides ties later. */
+    for (i = n = 0; i < fsgs->n_pnode_active; ++i) {
+        int32 pnode = fsgs->pnode_active[i];
+        hmm = fsg_lextree_hmm(fsgs->lextree, pnode);
+        if (fsg_search_hmm_score(hmm) >= thresh)
+            fsgs->pnode_active[n++] = pnode;
+        else
+            fsg_lextree_pnode_deactivate(fsgs->lextree, pnode);
+    }
+    fsgs->n_hmm_hist_prune += fsgs->n_pnode_active - n;
+    fsgs->n_pnode_active = n;
+}
+
 /*
  * Evaluate all the active HMMs.
  * (Executed once per frame.)
@@ -330,68 +477,53 @@ fsg_search_sen_active(fsg_search_t *fsgs)
 static void
 fsg_search_hmm_eval(fsg_search_t *fsgs)
 {
-    gnode_t *gn;
-    fsg_pnode_t *pnode;
+    int32 pnode;
     hmm_t *hmm;
     int32 bestscore;
-    int32 n, maxhmmpf;
+    int32 n;
 
     bestscore = WORST_SCORE;
 
-    if (!fsgs->pnode_active) {
+    if (fsgs->n_pnode_active == 0) {
         E_ERROR("Frame %d: No active HMM!!\n", fsgs->frame);
         return;
     }
 
-    for (n = 0, gn = fsgs->pnode_active; gn; gn = gnode_next(gn), n++) {
-        int32 score;
-
-        pnode = (fsg_pnode_t *)gnode_ptr(gn);
-        hmm = fsg_pnode_hmmptr(pnode);
+    if (fsgs->max_hmm_eval < fsgs->n_pnode_active) {
+        fsgs->max_hmm_eval = fsgs->max_pnode_active;
+        fsgs->hmm_eval = ckd_realloc(fsgs->hmm_eval,
+                                     fsgs->max_hmm_eval
+                                         * sizeof(*fsgs->hmm_eval));
+    }
+    for (n = 0; n < fsgs->n_pnode_active; n++) {
+        pnode = fsgs->pnode_active[n];
+        hmm = fsg_lextree_hmm(fsgs->lextree, pnode);
         assert(hmm_frame(hmm) == fsgs->frame);
 
 #if __FSG_DBG__
-        E_INFO("pnode(%08x) active @frm %5d\n", (int32)pnode,
+        E_INFO("pnode(%d) active @frm %5d\n", pnode,
                fsgs->frame);
 #if __FSG_DBG_CHAN__
         hmm_dump(hmm, stdout);
 #endif
 #endif
-        score = hmm_vit_eval(hmm);
+        fsgs->hmm_eval[n] = hmm;
+    }
+    bestscore = hmm_simd_vit_eval(fsgs->simd, fsgs->hmm_eval, n);
 #if __FSG_DBG_CHAN__
-        E_INFO("pnode(%08x) after eval @frm %5d\n",
-               (int32)pnode, fsgs->frame);
-        hmm_dump(hmm, stdout);
-#endif
-
-        if (score BETTER_THAN bestscore)
-            bestscore = score;
+    for (n = 0; n < fsgs->n_pnode_active; n++) {
+        E_INFO("pnode(%d) after eval @frm %5d\n",
+               fsgs->pnode_active[n], fsgs->frame);
+        hmm_dump(fsgs->hmm_eval[n], stdout);
     }
+#endif
 
 #if __FSG_DBG__
     E_INFO("[%5d] %6d HMM; bestscr: %11d\n", fsgs->frame, n, bestscore);
 #endif
     fsgs->n_hmm_eval += n;
-
-    /* Adjust beams if #active HMMs larger than absolute threshold */
-    maxhmmpf = config_int(search_module_config(fsgs), "maxhmmpf");
-    if (maxhmmpf != -1 && n > maxhmmpf) {
-        /*
-         * Too many HMMs active; reduce the beam factor applied to the default
-         * beams, but not if the factor is already at a floor (0.1).
-         */
-        if (fsgs->beam_factor > 0.1) { /* Hack!!  Hardwired constant 0.1 */
-            fsgs->beam_factor *= 0.9f; /* Hack!!  Hardwired constant 0.9 */
-            fsgs->beam = (int32)(fsgs->beam_orig * fsgs->beam_factor);
-            fsgs->pbeam = (int32)(fsgs->pbeam_orig * fsgs->beam_factor);
-            fsgs->wbeam = (int32)(fsgs->wbeam_orig * fsgs->beam_factor);
-        }
-    } else {
-        fsgs->beam_factor = 1.0f;
-        fsgs->beam = fsgs->beam_orig;
-        fsgs->pbeam = fsgs->pbeam_orig;
-        fsgs->wbeam = fsgs->wbeam_orig;
-    }
+    if (n > fsgs->max_hmm_eval_frame)
+        fsgs->max_hmm_eval_frame = n;
 
     if (n > fsg_lextree_n_pnode(fsgs->lextree))
         E_FATAL("PANIC! Frame %d: #HMM evaluated(%d) > #PNodes(%d)\n",
@@ -401,59 +533,67 @@ fsg_search_hmm_eval(fsg_search_t *fsgs)
 }
 
 static void
-fsg_search_pnode_trans(fsg_search_t *fsgs, fsg_pnode_t *pnode)
+fsg_search_pnode_trans(fsg_search_t *fsgs, int32 pnode)
 {
-    fsg_pnode_t *child;
-    hmm_t *hmm;
-    int32 newscore, thresh, nf;
+    fsg_lextree_t *lextree = fsgs->lextree;
+    hmm_t *hmm, *chmm;
+    int32 i, q, child, newscore, thresh, nf;
 
-    assert(pnode);
-    assert(!fsg_pnode_leaf(pnode));
+    assert(!fsg_lextree_leaf(lextree, pnode));
 
     nf = fsgs->frame + 1;
     thresh = fsgs->bestscore + fsgs->beam;
 
-    hmm = fsg_pnode_hmmptr(pnode);
+    hmm = fsg_lextree_hmm(lextree, pnode);
 
-    for (child = fsg_pnode_succ(pnode);
-         child; child = fsg_pnode_sibling(child)) {
-        newscore = hmm_out_score(hmm) + child->logs2prob;
+    /* Children in the tree are at the same offsets in this instance. */
+    q = fsg_lextree_node(lextree, pnode);
+    for (i = lextree->succ_off[q]; i < lextree->succ_off[q + 1]; i++) {
+        child = pnode + lextree->succ[i] - q;
+        chmm = fsg_lextree_hmm(lextree, child);
+        newscore = hmm_out_score(hmm) + lextree->logs2prob[lextree->succ[i]];
 
         if ((newscore BETTER_THAN thresh)
-            && (newscore BETTER_THAN hmm_in_score(&child->hmm))) {
+            && (newscore BETTER_THAN hmm_in_score(chmm))) {
             /* Incoming score > pruning threshold and > target's existing score */
-            if (hmm_frame(&child->hmm) < nf) {
+            if (hmm_frame(chmm) < nf) {
                 /* Child node not yet activated; do so */
-                fsgs->pnode_active_next = glist_add_ptr(fsgs->pnode_active_next,
-                                                        (void *)child);
+                fsg_search_activate(fsgs, child);
             }
 
-            hmm_enter(&child->hmm, newscore, hmm_out_history(hmm), nf);
+            hmm_enter(chmm, newscore, hmm_out_history(hmm), nf);
         }
     }
 }
 
 static void
-fsg_search_pnode_exit(fsg_search_t *fsgs, fsg_pnode_t *pnode)
+fsg_search_pnode_exit(fsg_search_t *fsgs, int32 pnode)
 {
+    fsg_lextree_t *lextree = fsgs->lextree;
     hmm_t *hmm;
     fsg_link_t *fl;
-    int32 wid;
+    int32 wid, s, q;
     fsg_pnode_ctxt_t ctxt;
 
-    assert(pnode);
-    assert(fsg_pnode_leaf(pnode));
+    assert(fsg_lextree_leaf(lextree, pnode));
 
-    hmm = fsg_pnode_hmmptr(pnode);
-    fl = fsg_pnode_fsglink(pnode);
+    hmm = fsg_lextree_hmm(lextree, pnode);
+    q = fsg_lextree_node(lextree, pnode);
+
+    /* The lextree may be shared with other states, so find the one
+     * this word actually started from. */
+    fl = fsg_hist_entry_fsglink(fsg_history_entry_get(fsgs->history,
+                                                      hmm_out_history(hmm)));
+    s = fl ? fsg_link_to_state(fl) : fsg_model_start_state(fsgs->fsg);
+    fl = fsg_lextree_fsglink(lextree, q, s);
     assert(fl);
 
     wid = fsg_link_wid(fl);
     assert(wid >= 0);
 
 #if __FSG_DBG__
-    E_INFO("[%5d] Exit(%08x) %10d(score) %5d(pred)\n",
-           fsgs->frame, (int32)pnode,
+    E_INFO("[%5d] Exit(%d) %10d(score) %5d(pred)\n",
+           fsgs->frame, pnode,
            hmm_out_score(hmm), hmm_out_history(hmm));
 #endif
 
@@ -475,7 +615,7 @@ fsg_search_pnode_exit(fsg_search_t *fsgs, fsg_pnode_t *pnode)
                               fsgs->frame,
                               hmm_out_score(hmm),
                               hmm_out_history(hmm),
-                              pnode->ci_ext, ctxt);
+                              lextree->ci_ext[q], ctxt);
 
     } else {
         /* Create history table entry for this word exit */
@@ -484,8 +624,53 @@ fsg_search_pnode_exit(fsg_search_t *fsgs, fsg_pnode_t *pnode)
                               fsgs->frame,
                               hmm_out_score(hmm),
                               hmm_out_history(hmm),
-                              pnode->ci_ext, pnode->ctxt);
+                              lextree->ci_ext[q], lextree->ctxt[q]);
+    }
+}
+
+/*
+ * Tighten word_thresh so that at most maxwpf words exit in this frame.
+ */
+static int32
+fsg_search_word_hist_thresh(fsg_search_t *fsgs, int32 thresh,
+                            int32 word_thresh)
+{
+    int32 bins[FSG_HIST_BINS];
+    int32 i, n, bw, best, new_thresh;
+    hmm_t *hmm;
+
+    n = 0;
+    best = WORST_SCORE;
+    for (i = 0; i < fsgs->n_pnode_active; ++i) {
+        int32 pnode = fsgs->pnode_active[i];
+        if (!fsg_lextree_leaf(fsgs->lextree, pnode))
+            continue;
+        hmm = fsg_lextree_hmm(fsgs->lextree, pnode);
+        if (hmm_bestscore(hmm) >= thresh && hmm_out_score(hmm) >= word_thresh) {
+            if (hmm_out_score(hmm) > best)
+                best = hmm_out_score(hmm);
+            ++n;
+        }
+    }
+    if (n <= fsgs->maxwpf)
+        return word_thresh;
+
+    bw = (best - word_thresh + FSG_HIST_BINS) / FSG_HIST_BINS;
+    memset(bins, 0, sizeof(bins));
+    for (i = 0; i < fsgs->n_pnode_active; ++i) {
+        int32 pnode = fsgs->pnode_active[i];
+        if (!fsg_lextree_leaf(fsgs->lextree, pnode))
+            continue;
+        hmm = fsg_lextree_hmm(fsgs->lextree, pnode);
+        if (hmm_bestscore(hmm) >= thresh && hmm_out_score(hmm) >= word_thresh)
+            ++bins[fsg_search_hist_bin(best, hmm_out_score(hmm), bw)];
     }
+    new_thresh = fsg_search_hist_thresh(bins, best, bw, fsgs->maxwpf);
+    for (i = 0; i < FSG_HIST_BINS; ++i)
+        if (best - i * bw < new_thresh)
+            fsgs->n_word_hist_prune += bins[i];
+
+    return new_thresh;
 }
 
 /*
@@ -497,32 +682,34 @@ fsg_search_pnode_exit(fsg_search_t *fsgs, fsg_pnode_t *pnode)
 static void
 fsg_search_hmm_prune_prop(fsg_search_t *fsgs)
 {
-    gnode_t *gn;
-    fsg_pnode_t *pnode;
+    int32 pnode;
     hmm_t *hmm;
-    int32 thresh, word_thresh, phone_thresh;
+    int32 i, thresh, word_thresh, phone_thresh;
 
-    assert(fsgs->pnode_active_next == NULL);
+    assert(fsgs->n_pnode_active_next == 0);
 
     thresh = fsgs->bestscore + fsgs->beam;
     phone_thresh = fsgs->bestscore + fsgs->pbeam;
     word_thresh = fsgs->bestscore + fsgs->wbeam;
+    if (fsgs->maxwpf != -1)
+        word_thresh = fsg_search_word_hist_thresh(fsgs, thresh, word_thresh);
 
-    for (gn = fsgs->pnode_active; gn; gn = gnode_next(gn)) {
-        pnode = (fsg_pnode_t *)gnode_ptr(gn);
-        hmm = fsg_pnode_hmmptr(pnode);
+    /* Most recently activated first, which determines the order of
+     * history entries and which of two equal scores wins. */
+    for (i = fsgs->n_pnode_active - 1; i >= 0; --i) {
+        pnode = fsgs->pnode_active[i];
+        hmm = fsg_lextree_hmm(fsgs->lextree, pnode);
 
         if (hmm_bestscore(hmm) >= thresh) {
             /* Keep this HMM active in the next frame */
             if (hmm_frame(hmm) == fsgs->frame) {
                 hmm_frame(hmm) = fsgs->frame + 1;
-                fsgs->pnode_active_next = glist_add_ptr(fsgs->pnode_active_next,
-                                                        (void *)pnode);
+                fsg_search_activate(fsgs, pnode);
             } else {
                 assert(hmm_frame(hmm) == fsgs->frame + 1);
             }
 
-            if (!fsg_pnode_leaf(pnode)) {
+            if (!fsg_lextree_leaf(fsgs->lextree, pnode)) {
                 if (hmm_out_score(hmm) >= phone_thresh) {
                     /* Transition out of this phone into its children */
                     fsg_search_pnode_trans(fsgs, pnode);
@@ -597,14 +784,17 @@ fsg_search_null_prop(fsg_search_t *fsgs)
 static void
 fsg_search_word_trans(fsg_search_t *fsgs)
 {
+    fsg_lextree_t *lextree = fsgs->lextree;
     int32 bpidx, n_entries;
     fsg_hist_entry_t *hist_entry;
     fsg_link_t *l;
-    int32 score, newscore, thresh, nf, d;
-    fsg_pnode_t *root;
-    int32 lc, rc;
+    int32 score, newscore, thresh, nf, d, i, t, g, f;
+    int32 root, end_root, delta;
+    hmm_t *hmm;
+    int32 lc, silcipid;
 
     n_entries = fsg_history_n_entries(fsgs->history);
+    silcipid = bin_mdef_silphone(search_module_acmod(fsgs)->mdef);
 
     thresh = fsgs->bestscore + fsgs->beam;
     nf = fsgs->frame + 1;
@@ -623,41 +813,71 @@ fsg_search_word_trans(fsg_search_t *fsgs)
         lc = fsg_hist_entry_lc(hist_entry);
 
         /* Transition to all root nodes attached to state d */
-        for (root = fsg_lextree_root(fsgs->lextree, d);
-             root; root = root->sibling) {
-            rc = root->ci_ext;
-
-            if ((root->ctxt.bv[lc >> 5] & (1 << (lc & 0x001f))) && (hist_entry->rc.bv[rc >> 5] & (1 << (rc & 0x001f)))) {
-                /*
-                 * Last CIphone of history entry is in left-context list supported by
-                 * target root node, and
-                 * first CIphone of target root node is in right context list supported
-                 * by history entry;
-                 * So the transition can go ahead (if new score is good enough).
-                 */
-                newscore = score + root->logs2prob;
+        i = fsg_lextree_enter_state(lextree, d);
+        t = lextree->inst_tree[i];
+        delta = lextree->inst_off[i] - lextree->root_off[t];
+        root = lextree->root_off[t];
+        for (g = lextree->grp_off[t]; g < lextree->grp_off[t + 1]; g++) {
+            end_root = lextree->grp_end[g];
+            /*
+             * Last CIphone of history entry must be in left-context list
+             * supported by target root nodes, and first CIphone of target
+             * root nodes must be in right context list supported by
+             * history entry, otherwise skip the whole group.
+             */
+            if (!fsg_pnode_ctxt_has(hist_entry->rc, lextree->grp_ci[g])
+                || !fsg_pnode_ctxt_has(lextree->grp_ctxt[g], lc)) {
+                root = end_root;
+                continue;
+            }
+            for (; root < end_root; root++) {
+                /* The transition can go ahead if the new score is good enough. */
+                newscore = score + lextree->logs2prob[root];
+                hmm = fsg_lextree_hmm(lextree, root + delta);
 
                 if ((newscore BETTER_THAN thresh)
-                    && (newscore BETTER_THAN hmm_in_score(&root->hmm))) {
-                    if (hmm_frame(&root->hmm) < nf) {
+                    && (newscore BETTER_THAN hmm_in_score(hmm))) {
+                    if (hmm_frame(hmm) < nf) {
                         /* Newly activated node; add to active list */
-                        fsgs->pnode_active_next = glist_add_ptr(fsgs->pnode_active_next,
-                                                                (void *)root);
+                        fsg_search_activate(fsgs, root + delta);
 #if __FSG_DBG__
-                        E_INFO("[%5d] WordTrans bpidx[%d] -> pnode[%08x] (activated)\n",
-                               fsgs->frame, bpidx, (int32)root);
+                        E_INFO("[%5d] WordTrans bpidx[%d] -> pnode[%d] (activated)\n",
+                               fsgs->frame, bpidx, root + delta);
 #endif
                     } else {
 #if __FSG_DBG__
-                        E_INFO("[%5d] WordTrans bpidx[%d] -> pnode[%08x]\n",
-                               fsgs->frame, bpidx, (int32)root);
+                        E_INFO("[%5d] WordTrans bpidx[%d] -> pnode[%d]\n",
+                               fsgs->frame, bpidx, root + delta);
 #endif
                     }
 
-                    hmm_enter(&root->hmm, newscore, bpidx, nf);
+                    hmm_enter(hmm, newscore, bpidx, nf);
                 }
             }
         }
+
+        /* Filler self-loops in state d go through its filler bank,
+         * which it only gets once one of them is good enough. */
+        if (lextree->n_fill == 0 || !fsg_pnode_ctxt_has(hist_entry->rc, silcipid))
+            continue;
+        root = -1;
+        for (f = 0; f < lextree->n_fill; f++) {
+            fsg_link_t *fl = fsg_lextree_fill_link(lextree, d, f);
+            if (fl == NULL)
+                continue;
+            newscore = score + (fsg_link_logs2prob(fl) >> SENSCR_SHIFT)
+                + lextree->wip + lextree->pip;
+            if (!(newscore BETTER_THAN thresh))
+                continue;
+            if (root < 0)
+                root = fsg_lextree_enter_fillers(lextree, d);
+            hmm = fsg_lextree_hmm(lextree, root + f);
+            if (newscore BETTER_THAN hmm_in_score(hmm)) {
+                if (hmm_frame(hmm) < nf)
+                    fsg_search_activate(fsgs, root + f);
+                hmm_enter(hmm, newscore, bpidx, nf);
+            }
+        }
     }
 }
 
@@ -667,11 +887,15 @@ fsg_search_step(search_module_t *search, int frame_idx)
     fsg_search_t *fsgs = (fsg_search_t *)search;
     int16 const *senscr;
     acmod_t *acmod = search->acmod;
-    gnode_t *gn;
-    fsg_pnode_t *pnode;
+    int32 pnode;
     hmm_t *hmm;
+    int32 i;
 
     assert(fsgs->frame == frame_idx);
+    /* Enforce the absolute limit on active HMMs, before their senones
+     * are activated so that pruned ones are not scored. */
+    if (fsgs->maxhmmpf != -1 && fsgs->n_pnode_active > fsgs->maxhmmpf)
+        fsg_search_hist_prune(fsgs);
     /* Activate our HMMs for the current frame if need be. */
     if (!acmod->compallsen)
         fsg_search_sen_active(fsgs);
@@ -713,24 +937,22 @@ fsg_search_step(search_module_t *search, int frame_idx)
      * Update the active lists, deactivate any currently active HMMs that
      * did not survive into the next frame
      */
-    for (gn = fsgs->pnode_active; gn; gn = gnode_next(gn)) {
-        pnode = (fsg_pnode_t *)gnode_ptr(gn);
-        hmm = fsg_pnode_hmmptr(pnode);
+    for (i = 0; i < fsgs->n_pnode_active; ++i) {
+        pnode = fsgs->pnode_active[i];
+        hmm = fsg_lextree_hmm(fsgs->lextree, pnode);
 
         if (hmm_frame(hmm) == fsgs->frame) {
             /* This HMM NOT activated for the next frame; reset it */
-            fsg_psubtree_pnode_deactivate(pnode);
+            fsg_lextree_pnode_deactivate(fsgs->lextree, pnode);
         } else {
             assert(hmm_frame(hmm) == (fsgs->frame + 1));
         }
     }
-
-    /* Free the currently active list */
-    glist_free(fsgs->pnode_active);
+    if (fsgs->lextree->n_fill)
+        fsg_lextree_release_fillers(fsgs->lextree, fsgs->frame + 1);
 
     /* Make the next-frame active list the current one */
-    fsgs->pnode_active = fsgs->pnode_active_next;
-    fsgs->pnode_active_next = NULL;
+    fsg_search_swap_active(fsgs);
 
     /* End of this frame; ready for the next */
     ++fsgs->frame;
@@ -738,6 +960,23 @@ fsg_search_step(search_module_t *search, int frame_idx)
     return 1;
 }
 
+/*
+ * Scale all the beams (which are negative, so a factor less than one
+ * narrows them), taking effect from the next frame.
+ */
+static int
+fsg_search_set_beam_factor(search_module_t *search, float32 factor)
+{
+    fsg_search_t *fsgs = (fsg_search_t *)search;
+
+    fsgs->beam_factor = factor;
+    fsgs->beam = (int32)(fsgs->beam_orig * factor);
+    fsgs->pbeam = (int32)(fsgs->pbeam_orig * factor);
+    fsgs->wbeam = (int32)(fsgs->wbeam_orig * factor);
+
+    return 0;
+}
+
 /*
  * Set all HMMs to inactive, clear active lists, initialize FSM start
  * state to be the only active node.
@@ -750,17 +989,15 @@ fsg_search_start(search_module_t *search)
     int32 silcipid;
     fsg_pnode_ctxt_t ctxt;
 
-    /* Reset dynamic adjustment factor for beams */
-    fsgs->beam_factor = 1.0f;
-    fsgs->beam = fsgs->beam_orig;
-    fsgs->pbeam = fsgs->pbeam_orig;
-    fsgs->wbeam = fsgs->wbeam_orig;
+    /* Reset effective beams */
+    fsg_search_set_beam_factor(search, fsgs->beam_factor);
 
     silcipid = bin_mdef_ciphone_id(search_module_acmod(fsgs)->mdef, "SIL");
 
     /* Initialize EVERYTHING to be inactive */
-    assert(fsgs->pnode_active == NULL);
-    assert(fsgs->pnode_active_next == NULL);
+    assert(fsgs->n_pnode_active == 0);
+    assert(fsgs->n_pnode_active_next == 0);
+    fsg_lextree_start_utt(fsgs->lextree, fsgs->evict);
 
     fsg_history_reset(fsgs->history);
     fsg_history_utt_start(fsgs->history);
@@ -783,12 +1020,14 @@ fsg_search_start(search_module_t *search)
     fsg_search_word_trans(fsgs);
 
     /* Make the next-frame active list the current one */
-    fsgs->pnode_active = fsgs->pnode_active_next;
-    fsgs->pnode_active_next = NULL;
+    fsg_search_swap_active(fsgs);
 
     ++fsgs->frame;
 
     fsgs->n_hmm_eval = 0;
+    fsgs->max_hmm_eval_frame = 0;
+    fsgs->n_hmm_hist_prune = 0;
+    fsgs->n_word_hist_prune = 0;
     fsgs->n_sen_eval = 0;
 
     ptmr_reset(&fsgs->perf);
@@ -804,24 +1043,15 @@ int
 fsg_search_finish(search_module_t *search)
 {
     fsg_search_t *fsgs = (fsg_search_t *)search;
-    gnode_t *gn;
-    fsg_pnode_t *pnode;
-    int32 n_hist, cf;
+    int32 i, n_hist, cf;
 
     /* Deactivate all nodes in the current and next-frame active lists */
-    for (gn = fsgs->pnode_active; gn; gn = gnode_next(gn)) {
-        pnode = (fsg_pnode_t *)gnode_ptr(gn);
-        fsg_psubtree_pnode_deactivate(pnode);
-    }
-    for (gn = fsgs->pnode_active_next; gn; gn = gnode_next(gn)) {
-        pnode = (fsg_pnode_t *)gnode_ptr(gn);
-        fsg_psubtree_pnode_deactivate(pnode);
-    }
-
-    glist_free(fsgs->pnode_active);
-    fsgs->pnode_active = NULL;
-    glist_free(fsgs->pnode_active_next);
-    fsgs->pnode_active_next = NULL;
+    for (i = 0; i < fsgs->n_pnode_active; ++i)
+        fsg_lextree_pnode_deactivate(fsgs->lextree, fsgs->pnode_active[i]);
+    for (i = 0; i < fsgs->n_pnode_active_next; ++i)
+        fsg_lextree_pnode_deactivate(fsgs->lextree, fsgs->pnode_active_next[i]);
+    fsgs->n_pnode_active = 0;
+    fsgs->n_pnode_active_next = 0;
 
     fsgs->final = TRUE;
 
@@ -839,8 +1069,7 @@ fsg_search_finish(search_module_t *search)
     /* This is the number of frames processed. */
     cf = search_module_acmod(fsgs)->output_frame;
     if (cf > 0) {
-        double n_speech = (double)(cf + 1)
-            / config_int(search_module_config(fsgs), "frate");
+        double n_speech = (double)(cf + 1) / fsgs->frate;
         E_INFO("fsg %.2f CPU %.3f xRT\n",
                fsgs->perf.t_cpu, fsgs->perf.t_cpu / n_speech);
         E_INFO("fsg %.2f wall %.3f xRT\n",
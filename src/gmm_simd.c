@@ -0,0 +1,1065 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+
+/**
+ * @file gmm_simd.c SIMD kernels for diagonal Gaussian evaluation.
+ *
+ * Each kernel computes, for each lane, exactly the same sequence of
+ * single-precision operations as the scalar code (subtract, square,
+ * multiply by precomputed inverse variance, subtract from the
+ * determinant, one dimension at a time), so results are identical.
+ * Note that this also requires that the compiler not contract these
+ * into fused multiply-adds, see src/CMakeLists.txt.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <float.h>
+#include <string.h>
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/err.h>
+#include <soundswallower/gmm_simd.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GMM_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GMM_SIMD_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GMM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#if defined(__wasm_simd128__)
+#define GMM_SIMD_WASM
+#include <wasm_simd128.h>
+#endif
+
+#ifdef GMM_SIMD_SSE2
+static int
+eval_block_sse2(const mfcc_t *z, const mfcc_t *mean, const mfcc_t *var,
+                const mfcc_t *det, int ceplen, mfcc_t thresh, mfcc_t *out)
+{
+    __m128 d = _mm_loadu_ps(det);
+    __m128 t = _mm_set1_ps(thresh);
+    int j;
+
+    for (j = 0; j < ceplen; ++j) {
+        __m128 diff = _mm_sub_ps(_mm_set1_ps(z[j]), _mm_loadu_ps(mean + j * 4));
+        __m128 compl = _mm_mul_ps(_mm_mul_ps(diff, diff), _mm_loadu_ps(var + j * 4));
+        d = _mm_sub_ps(d, compl);
+        /* Check for early termination every 4 dimensions */
+        if ((j & 3) == 3 && _mm_movemask_ps(_mm_cmpge_ps(d, t)) == 0) {
+            ++j;
+            break;
+        }
+    }
+    _mm_storeu_ps(out, d);
+    return j;
+}
+
+static void
+eval_list_sse2(const mfcc_t *z, const mfcc_t *mean, const mfcc_t *var,
+               const mfcc_t *det, const int32 *cw, int n,
+               int ceplen, mfcc_t *out)
+{
+    int i;
+
+    for (i = 0; i < n; i += 4) {
+        const mfcc_t *m[4], *v[4];
+        mfcc_t dd[4];
+        __m128 d;
+        int j, k;
+
+        /* Pad out a partial block with copies of the first density */
+        for (k = 0; k < 4; ++k) {
+            int c = (i + k < n) ? cw[i + k] : cw[i];
+            m[k] = mean + c * ceplen;
+            v[k] = var + c * ceplen;
+            dd[k] = det[c];
+        }
+        d = _mm_loadu_ps(dd);
+        for (j = 0; j < ceplen; ++j) {
+            __m128 diff = _mm_sub_ps(_mm_set1_ps(z[j]),
+                                     _mm_setr_ps(m[0][j], m[1][j], m[2][j], m[3][j]));
+            __m128 compl = _mm_mul_ps(_mm_mul_ps(diff, diff),
+                                      _mm_setr_ps(v[0][j], v[1][j], v[2][j], v[3][j]));
+            d = _mm_sub_ps(d, compl);
+        }
+        _mm_storeu_ps(dd, d);
+        for (k = 0; k < 4 && i + k < n; ++k)
+            out[i + k] = dd[k];
+    }
+}
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+
+/* Look up (saturated) byte indices in the non-zero part of a log-add table. */
+static inline __m128i
+logadd_lookup_ssse3(__m128i d, const __m128i *table, int n_chunk)
+{
+    __m128i t = _mm_setzero_si128();
+    int c;
+
+    for (c = 0; c < n_chunk; ++c) {
+        /* Indices outside this chunk get the high bit set, so
+         * pshufb gives zero for them. */
+        __m128i idx = _mm_adds_epu8(_mm_sub_epi8(d, _mm_set1_epi8((char)(c * 16))),
+                                    _mm_set1_epi8(0x70));
+        t = _mm_or_si128(t, _mm_shuffle_epi8(table[c], idx));
+    }
+    return t;
+}
+
+/* fast_logmath_add() for 16 senones, in two vectors of 8. */
+static inline void
+logadd_ssse3(__m128i *x0, __m128i *x1, __m128i y0, __m128i y1,
+             const __m128i *table, int n_chunk)
+{
+    __m128i d0 = _mm_abs_epi16(_mm_sub_epi16(*x0, y0));
+    __m128i d1 = _mm_abs_epi16(_mm_sub_epi16(*x1, y1));
+    __m128i t = logadd_lookup_ssse3(_mm_packus_epi16(d0, d1), table, n_chunk);
+
+    *x0 = _mm_sub_epi16(_mm_min_epi16(*x0, y0), _mm_unpacklo_epi8(t, _mm_setzero_si128()));
+    *x1 = _mm_sub_epi16(_mm_min_epi16(*x1, y1), _mm_unpackhi_epi8(t, _mm_setzero_si128()));
+}
+
+/* Load 16 8-bit mixture weights and add the density score. */
+static inline void
+mixw_load_ssse3(const uint8 *mixw, int32 score, __m128i *y0, __m128i *y1)
+{
+    __m128i w = _mm_loadu_si128((const __m128i *)mixw);
+    __m128i sc = _mm_set1_epi16((short)score);
+
+    *y0 = _mm_add_epi16(_mm_unpacklo_epi8(w, _mm_setzero_si128()), sc);
+    *y1 = _mm_add_epi16(_mm_unpackhi_epi8(w, _mm_setzero_si128()), sc);
+}
+
+static void
+mixw_ssse3(int16 *out, const uint8 *const *mixw, const int32 *score, int topn,
+           const uint8 *logadd, int n_logadd, int n)
+{
+    __m128i table[16];
+    int c, j, k, n_chunk = (n_logadd + 15) / 16;
+
+    for (c = 0; c < n_chunk; ++c)
+        table[c] = _mm_loadu_si128((const __m128i *)(logadd + c * 16));
+    for (j = 0; j < n; j += 16) {
+        __m128i x0, x1, y0, y1, o;
+
+        mixw_load_ssse3(mixw[0] + j, score[0], &x0, &x1);
+        for (k = 1; k < topn; ++k) {
+            mixw_load_ssse3(mixw[k] + j, score[k], &y0, &y1);
+            logadd_ssse3(&x0, &x1, y0, y1, table, n_chunk);
+        }
+        o = _mm_loadu_si128((const __m128i *)(out + j));
+        _mm_storeu_si128((__m128i *)(out + j), _mm_add_epi16(o, x0));
+        o = _mm_loadu_si128((const __m128i *)(out + j + 8));
+        _mm_storeu_si128((__m128i *)(out + j + 8), _mm_add_epi16(o, x1));
+    }
+}
+
+/* Load 16 4-bit mixture weights and look them up in the scaled weights. */
+static inline void
+mixw4_load_ssse3(const uint8 *mixw, const uint8 *w_den, __m128i *y0, __m128i *y1)
+{
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i b = _mm_loadl_epi64((const __m128i *)mixw);
+    __m128i cw = _mm_unpacklo_epi8(_mm_and_si128(b, mask),
+                                   _mm_and_si128(_mm_srli_epi16(b, 4), mask));
+    __m128i w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)w_den), cw);
+
+    *y0 = _mm_unpacklo_epi8(w, _mm_setzero_si128());
+    *y1 = _mm_unpackhi_epi8(w, _mm_setzero_si128());
+}
+
+static void
+mixw4_ssse3(int16 *out, const uint8 *const *mixw, const uint8 *w_den, int topn,
+            const uint8 *logadd, int n_logadd, int n)
+{
+    __m128i table[16];
+    int c, j, k, n_chunk = (n_logadd + 15) / 16;
+
+    for (c = 0; c < n_chunk; ++c)
+        table[c] = _mm_loadu_si128((const __m128i *)(logadd + c * 16));
+    for (j = 0; j < n; j += 16) {
+        __m128i x0, x1, y0, y1, o;
+
+        mixw4_load_ssse3(mixw[0] + j / 2, w_den, &x0, &x1);
+        for (k = 1; k < topn; ++k) {
+            mixw4_load_ssse3(mixw[k] + j / 2, w_den + k * 16, &y0, &y1);
+            logadd_ssse3(&x0, &x1, y0, y1, table, n_chunk);
+        }
+        o = _mm_loadu_si128((const __m128i *)(out + j));
+        _mm_storeu_si128((__m128i *)(out + j), _mm_add_epi16(o, x0));
+        o = _mm_loadu_si128((const __m128i *)(out + j + 8));
+        _mm_storeu_si128((__m128i *)(out + j + 8), _mm_add_epi16(o, x1));
+    }
+}
+
+static const gmm_simd_t gmm_simd_sse2 = {
+    "sse2", 4, eval_block_sse2, eval_list_sse2,
+    16, mixw_ssse3, mixw4_ssse3
+};
+#else
+/* Mixture weight kernels need pshufb, which SSE2 lacks. */
+static const gmm_simd_t gmm_simd_sse2 = {
+    "sse2", 4, eval_block_sse2, eval_list_sse2, 0, NULL, NULL
+};
+#endif /* __SSSE3__ */
+#endif /* GMM_SIMD_SSE2 */
+
+#ifdef GMM_SIMD_AVX2
+__attribute__((target("avx2"))) static int
+eval_block_avx2(const mfcc_t *z, const mfcc_t *mean, const mfcc_t *var,
+                const mfcc_t *det, int ceplen, mfcc_t thresh, mfcc_t *out)
+{
+    __m256 d = _mm256_loadu_ps(det);
+    __m256 t = _mm256_set1_ps(thresh);
+    int j;
+
+    for (j = 0; j < ceplen; ++j) {
+        __m256 diff = _mm256_sub_ps(_mm256_set1_ps(z[j]),
+                                    _mm256_loadu_ps(mean + j * 8));
+        __m256 compl = _mm256_mul_ps(_mm256_mul_ps(diff, diff),
+                                     _mm256_loadu_ps(var + j * 8));
+        d = _mm256_sub_ps(d, compl);
+        if ((j & 3) == 3
+            && _mm256_movemask_ps(_mm256_cmp_ps(d, t, _CMP_GE_OQ)) == 0) {
+            ++j;
+            break;
+        }
+    }
+    _mm256_storeu_ps(out, d);
+    return j;
+}
+
+__attribute__((target("avx2"))) static void
+eval_list_avx2(const mfcc_t *z, const mfcc_t *mean, const mfcc_t *var,
+               const mfcc_t *det, const int32 *cw, int n,
+               int ceplen, mfcc_t *out)
+{
+    int i;
+
+    for (i = 0; i < n; i += 8) {
+        int32 idx[8];
+        mfcc_t dd[8];
+        __m256i vidx;
+        __m256 d;
+        int j, k;
+
+        for (k = 0; k < 8; ++k) {
+            int c = (i + k < n) ? cw[i + k] : cw[i];
+            idx[k] = c * ceplen;
+            dd[k] = det[c];
+        }
+        vidx = _mm256_loadu_si256((const __m256i *)idx);
+        d = _mm256_loadu_ps(dd);
+        for (j = 0; j < ceplen; ++j) {
+            __m256 diff = _mm256_sub_ps(_mm256_set1_ps(z[j]),
+                                        _mm256_i32gather_ps(mean + j, vidx, 4));
+            __m256 compl = _mm256_mul_ps(_mm256_mul_ps(diff, diff),
+                                         _mm256_i32gather_ps(var + j, vidx, 4));
+            d = _mm256_sub_ps(d, compl);
+        }
+        _mm256_storeu_ps(dd, d);
+        for (k = 0; k < 8 && i + k < n; ++k)
+            out[i + k] = dd[k];
+    }
+}
+
+/* Look up (saturated) byte indices in the non-zero part of a log-add table. */
+__attribute__((target("avx2"))) static inline __m256i
+logadd_lookup_avx2(__m256i d, const __m256i *table, int n_chunk)
+{
+    __m256i t = _mm256_setzero_si256();
+    int c;
+
+    for (c = 0; c < n_chunk; ++c) {
+        /* Indices outside this chunk get the high bit set, so
+         * pshufb gives zero for them. */
+        __m256i idx = _mm256_adds_epu8(_mm256_sub_epi8(d, _mm256_set1_epi8((char)(c * 16))),
+                                       _mm256_set1_epi8(0x70));
+        t = _mm256_or_si256(t, _mm256_shuffle_epi8(table[c], idx));
+    }
+    return t;
+}
+
+/* fast_logmath_add() for 32 senones, in two vectors of 16. */
+__attribute__((target("avx2"))) static inline void
+logadd_avx2(__m256i *x0, __m256i *x1, __m256i y0, __m256i y1,
+            const __m256i *table, int n_chunk)
+{
+    __m256i d0 = _mm256_abs_epi16(_mm256_sub_epi16(*x0, y0));
+    __m256i d1 = _mm256_abs_epi16(_mm256_sub_epi16(*x1, y1));
+    /* Packing and unpacking both work within 128-bit lanes, so the
+     * unpacked results come out in the right order. */
+    __m256i t = logadd_lookup_avx2(_mm256_packus_epi16(d0, d1), table, n_chunk);
+
+    *x0 = _mm256_sub_epi16(_mm256_min_epi16(*x0, y0),
+                           _mm256_unpacklo_epi8(t, _mm256_setzero_si256()));
+    *x1 = _mm256_sub_epi16(_mm256_min_epi16(*x1, y1),
+                           _mm256_unpackhi_epi8(t, _mm256_setzero_si256()));
+}
+
+/* Load 32 8-bit mixture weights and add the density score. */
+__attribute__((target("avx2"))) static inline void
+mixw_load_avx2(const uint8 *mixw, int32 score, __m256i *y0, __m256i *y1)
+{
+    __m128i w0 = _mm_loadu_si128((const __m128i *)mixw);
+    __m128i w1 = _mm_loadu_si128((const __m128i *)(mixw + 16));
+    __m256i sc = _mm256_set1_epi16((short)score);
+
+    *y0 = _mm256_add_epi16(_mm256_cvtepu8_epi16(w0), sc);
+    *y1 = _mm256_add_epi16(_mm256_cvtepu8_epi16(w1), sc);
+}
+
+__attribute__((target("avx2"))) static void
+mixw_avx2(int16 *out, const uint8 *const *mixw, const int32 *score, int topn,
+          const uint8 *logadd, int n_logadd, int n)
+{
+    __m256i table[16];
+    int c, j, k, n_chunk = (n_logadd + 15) / 16;
+
+    for (c = 0; c < n_chunk; ++c)
+        table[c] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(logadd + c * 16)));
+    for (j = 0; j < n; j += 32) {
+        __m256i x0, x1, y0, y1, o;
+
+        mixw_load_avx2(mixw[0] + j, score[0], &x0, &x1);
+        for (k = 1; k < topn; ++k) {
+            mixw_load_avx2(mixw[k] + j, score[k], &y0, &y1);
+            logadd_avx2(&x0, &x1, y0, y1, table, n_chunk);
+        }
+        o = _mm256_loadu_si256((const __m256i *)(out + j));
+        _mm256_storeu_si256((__m256i *)(out + j), _mm256_add_epi16(o, x0));
+        o = _mm256_loadu_si256((const __m256i *)(out + j + 16));
+        _mm256_storeu_si256((__m256i *)(out + j + 16), _mm256_add_epi16(o, x1));
+    }
+}
+
+/* Load 32 4-bit mixture weights and look them up in the scaled weights. */
+__attribute__((target("avx2"))) static inline void
+mixw4_load_avx2(const uint8 *mixw, const uint8 *w_den, __m256i *y0, __m256i *y1)
+{
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i b = _mm_loadu_si128((const __m128i *)mixw);
+    __m128i lo = _mm_and_si128(b, mask);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(b, 4), mask);
+    __m128i wd = _mm_loadu_si128((const __m128i *)w_den);
+
+    *y0 = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(wd, _mm_unpacklo_epi8(lo, hi)));
+    *y1 = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(wd, _mm_unpackhi_epi8(lo, hi)));
+}
+
+__attribute__((target("avx2"))) static void
+mixw4_avx2(int16 *out, const uint8 *const *mixw, const uint8 *w_den, int topn,
+           const uint8 *logadd, int n_logadd, int n)
+{
+    __m256i table[16];
+    int c, j, k, n_chunk = (n_logadd + 15) / 16;
+
+    for (c = 0; c < n_chunk; ++c)
+        table[c] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(logadd + c * 16)));
+    for (j = 0; j < n; j += 32) {
+        __m256i x0, x1, y0, y1, o;
+
+        mixw4_load_avx2(mixw[0] + j / 2, w_den, &x0, &x1);
+        for (k = 1; k < topn; ++k) {
+            mixw4_load_avx2(mixw[k] + j / 2, w_den + k * 16, &y0, &y1);
+            logadd_avx2(&x0, &x1, y0, y1, table, n_chunk);
+        }
+        o = _mm256_loadu_si256((const __m256i *)(out + j));
+        _mm256_storeu_si256((__m256i *)(out + j), _mm256_add_epi16(o, x0));
+        o = _mm256_loadu_si256((const __m256i *)(out + j + 16));
+        _mm256_storeu_si256((__m256i *)(out + j + 16), _mm256_add_epi16(o, x1));
+    }
+}
+
+static const gmm_simd_t gmm_simd_avx2 = {
+    "avx2", 8, eval_block_avx2, eval_list_avx2,
+    32, mixw_avx2, mixw4_avx2
+};
+#endif /* GMM_SIMD_AVX2 */
+
+#ifdef GMM_SIMD_NEON
+static int
+eval_block_neon(const mfcc_t *z, const mfcc_t *mean, const mfcc_t *var,
+                const mfcc_t *det, int ceplen, mfcc_t thresh, mfcc_t *out)
+{
+    float32x4_t d = vld1q_f32(det);
+    float32x4_t t = vdupq_n_f32(thresh);
+    int j;
+
+    for (j = 0; j < ceplen; ++j) {
+        float32x4_t diff = vsubq_f32(vdupq_n_f32(z[j]), vld1q_f32(mean + j * 4));
+        float32x4_t compl = vmulq_f32(vmulq_f32(diff, diff), vld1q_f32(var + j * 4));
+        d = vsubq_f32(d, compl);
+        if ((j & 3) == 3) {
+            uint32x4_t ge = vcgeq_f32(d, t);
+            uint32x2_t any = vorr_u32(vget_low_u32(ge), vget_high_u32(ge));
+            if ((vget_lane_u32(any, 0) | vget_lane_u32(any, 1)) == 0) {
+                ++j;
+                break;
+            }
+        }
+    }
+    vst1q_f32(out, d);
+    return j;
+}
+
+static void
+eval_list_neon(const mfcc_t *z, const mfcc_t *mean, const mfcc_t *var,
+               const mfcc_t *det, const int32 *cw, int n,
+               int ceplen, mfcc_t *out)
+{
+    int i;
+
+    for (i = 0; i < n; i += 4) {
+        const mfcc_t *m[4], *v[4];
+        mfcc_t dd[4], mj[4], vj[4];
+        float32x4_t d;
+        int j, k;
+
+        for (k = 0; k < 4; ++k) {
+            int c = (i + k < n) ? cw[i + k] : cw[i];
+            m[k] = mean + c * ceplen;
+            v[k] = var + c * ceplen;
+            dd[k] = det[c];
+        }
+        d = vld1q_f32(dd);
+        for (j = 0; j < ceplen; ++j) {
+            float32x4_t diff, compl;
+            for (k = 0; k < 4; ++k) {
+                mj[k] = m[k][j];
+                vj[k] = v[k][j];
+            }
+            diff = vsubq_f32(vdupq_n_f32(z[j]), vld1q_f32(mj));
+            compl = vmulq_f32(vmulq_f32(diff, diff), vld1q_f32(vj));
+            d = vsubq_f32(d, compl);
+        }
+        vst1q_f32(dd, d);
+        for (k = 0; k < 4 && i + k < n; ++k)
+            out[i + k] = dd[k];
+    }
+}
+
+static const gmm_simd_t gmm_simd_neon = {
+    "neon", 4, eval_block_neon, eval_list_neon, 0, NULL, NULL
+};
+#endif /* GMM_SIMD_NEON */
+
+#ifdef GMM_SIMD_WASM
+static int
+eval_block_simd128(const mfcc_t *z, const mfcc_t *mean, const mfcc_t *var,
+                   const mfcc_t *det, int ceplen, mfcc_t thresh, mfcc_t *out)
+{
+    v128_t d = wasm_v128_load(det);
+    v128_t t = wasm_f32x4_splat(thresh);
+    int j;
+
+    for (j = 0; j < ceplen; ++j) {
+        v128_t diff = wasm_f32x4_sub(wasm_f32x4_splat(z[j]),
+                                     wasm_v128_load(mean + j * 4));
+        v128_t compl = wasm_f32x4_mul(wasm_f32x4_mul(diff, diff),
+                                      wasm_v128_load(var + j * 4));
+        d = wasm_f32x4_sub(d, compl);
+        if ((j & 3) == 3 && !wasm_v128_any_true(wasm_f32x4_ge(d, t))) {
+            ++j;
+            break;
+        }
+    }
+    wasm_v128_store(out, d);
+    return j;
+}
+
+static void
+eval_list_simd128(const mfcc_t *z, const mfcc_t *mean, const mfcc_t *var,
+                  const mfcc_t *det, const int32 *cw, int n,
+                  int ceplen, mfcc_t *out)
+{
+    int i;
+
+    for (i = 0; i < n; i += 4) {
+        const mfcc_t *m[4], *v[4];
+        mfcc_t dd[4];
+        v128_t d;
+        int j, k;
+
+        for (k = 0; k < 4; ++k) {
+            int c = (i + k < n) ? cw[i + k] : cw[i];
+            m[k] = mean + c * ceplen;
+            v[k] = var + c * ceplen;
+            dd[k] = det[c];
+        }
+        d = wasm_v128_load(dd);
+        for (j = 0; j < ceplen; ++j) {
+            v128_t diff = wasm_f32x4_sub(wasm_f32x4_splat(z[j]),
+                                         wasm_f32x4_make(m[0][j], m[1][j],
+                                                         m[2][j], m[3][j]));
+            v128_t compl = wasm_f32x4_mul(wasm_f32x4_mul(diff, diff),
+                                          wasm_f32x4_make(v[0][j], v[1][j],
+                                                          v[2][j], v[3][j]));
+            d = wasm_f32x4_sub(d, compl);
+        }
+        wasm_v128_store(dd, d);
+        for (k = 0; k < 4 && i + k < n; ++k)
+            out[i + k] = dd[k];
+    }
+}
+
+static const gmm_simd_t gmm_simd_simd128 = {
+    "simd128", 4, eval_block_simd128, eval_list_simd128, 0, NULL, NULL
+};
+#endif /* GMM_SIMD_WASM */
+
+/* In order of preference. */
+static const gmm_simd_t *const gmm_simd_kernels[] = {
+#ifdef GMM_SIMD_AVX2
+    &gmm_simd_avx2,
+#endif
+#ifdef GMM_SIMD_SSE2
+    &gmm_simd_sse2,
+#endif
+#ifdef GMM_SIMD_NEON
+    &gmm_simd_neon,
+#endif
+#ifdef GMM_SIMD_WASM
+    &gmm_simd_simd128,
+#endif
+    NULL
+};
+
+static int
+gmm_simd_supported(const gmm_simd_t *simd)
+{
+#ifdef GMM_SIMD_AVX2
+    if (simd == &gmm_simd_avx2) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    /* Everything else is determined at compile time. */
+    (void)simd;
+    return TRUE;
+}
+
+const gmm_simd_t *
+gmm_simd_get(const char *name)
+{
+    int i;
+
+    if (name == NULL || 0 == strcmp(name, "auto")) {
+        for (i = 0; gmm_simd_kernels[i]; ++i) {
+            if (gmm_simd_supported(gmm_simd_kernels[i]))
+                return gmm_simd_kernels[i];
+        }
+        return NULL;
+    }
+    if (0 == strcmp(name, "scalar"))
+        return NULL;
+    for (i = 0; gmm_simd_kernels[i]; ++i) {
+        if (0 == strcmp(name, gmm_simd_kernels[i]->name)) {
+            if (gmm_simd_supported(gmm_simd_kernels[i]))
+                return gmm_simd_kernels[i];
+            E_WARN("SIMD kernel %s not supported by this CPU\n", name);
+            return NULL;
+        }
+    }
+    E_WARN("SIMD kernel %s not available in this build\n", name);
+    return NULL;
+}
+
+/* Same as fast_logmath_add(), but safe for large differences. */
+static inline int32
+logadd_scalar(const uint8 *logadd, int n_logadd, int32 x, int32 y)
+{
+    int32 d = x > y ? x - y : y - x;
+    int32 r = x > y ? y : x;
+
+    /* Avoid a poorly predicted branch on the table bounds. */
+    return r - logadd[d < n_logadd ? d : n_logadd];
+}
+
+void
+gmm_simd_mixw(const gmm_simd_t *simd, int16 *out,
+              const uint8 *const *mixw, const int32 *score, int topn,
+              const uint8 *logadd, int n_logadd, int n)
+{
+    int32 tmp[GMM_SIMD_MAX_MIXW_WIDTH];
+    int j = 0, k, b, nb;
+
+    if (simd && simd->mixw) {
+        j = n - n % simd->mixw_width;
+        (*simd->mixw)(out, mixw, score, topn, logadd, n_logadd, j);
+    }
+    /* Blocks of senones, one density at a time, so that the weights
+     * and score for each density stay in registers. */
+    for (; j < n; j += nb) {
+        const uint8 *cw = mixw[0] + j;
+        int32 sc = score[0];
+
+        nb = n - j < GMM_SIMD_MAX_MIXW_WIDTH ? n - j : GMM_SIMD_MAX_MIXW_WIDTH;
+        for (b = 0; b < nb; ++b)
+            tmp[b] = cw[b] + sc;
+        for (k = 1; k < topn; ++k) {
+            cw = mixw[k] + j;
+            sc = score[k];
+            for (b = 0; b < nb; ++b)
+                tmp[b] = logadd_scalar(logadd, n_logadd, tmp[b], cw[b] + sc);
+        }
+        for (b = 0; b < nb; ++b)
+            out[j + b] += tmp[b];
+    }
+}
+
+void
+gmm_simd_mixw4(const gmm_simd_t *simd, int16 *out,
+               const uint8 *const *mixw, const uint8 *w_den, int topn,
+               const uint8 *logadd, int n_logadd, int n)
+{
+    int32 tmp[GMM_SIMD_MAX_MIXW_WIDTH];
+    int j = 0, k, b, nb;
+
+    if (simd && simd->mixw4) {
+        j = n - n % simd->mixw_width;
+        (*simd->mixw4)(out, mixw, w_den, topn, logadd, n_logadd, j);
+    }
+    /* As above, but note that j is always even here.  An odd last
+     * senone is scored along with its unused neighbour. */
+    for (; j < n; j += nb) {
+        const uint8 *cw = mixw[0] + j / 2;
+        const uint8 *den = w_den;
+
+        nb = n - j < GMM_SIMD_MAX_MIXW_WIDTH ? n - j : GMM_SIMD_MAX_MIXW_WIDTH;
+        for (b = 0; b < nb; b += 2) {
+            tmp[b] = den[cw[b / 2] & 0x0f];
+            tmp[b + 1] = den[cw[b / 2] >> 4];
+        }
+        for (k = 1; k < topn; ++k) {
+            cw = mixw[k] + j / 2;
+            den = w_den + k * 16;
+            for (b = 0; b < nb; b += 2) {
+                tmp[b] = logadd_scalar(logadd, n_logadd, tmp[b],
+                                       den[cw[b / 2] & 0x0f]);
+                tmp[b + 1] = logadd_scalar(logadd, n_logadd, tmp[b + 1],
+                                           den[cw[b / 2] >> 4]);
+            }
+        }
+        for (b = 0; b < nb; ++b)
+            out[j + b] += tmp[b];
+    }
+}
+
+/* Scalar scoring of active senones.  This is inlined with a constant
+ * topn for the default top-N, which the compiler can then unroll. */
+static inline void
+mixw_active_scalar(int16 *out, const uint8 *const *mixw,
+                   const int32 *score, int topn,
+                   const uint8 *logadd, int n_logadd,
+                   const uint8 *senone_active, int n_senone_active)
+{
+    int i, k, j = 0;
+
+    for (i = 0; i < n_senone_active; ++i) {
+        int32 tmp;
+
+        j += senone_active[i];
+        tmp = mixw[0][j] + score[0];
+        for (k = 1; k < topn; ++k)
+            tmp = logadd_scalar(logadd, n_logadd, tmp, mixw[k][j] + score[k]);
+        out[j] += tmp;
+    }
+}
+
+static inline void
+mixw4_active_scalar(int16 *out, const uint8 *const *mixw,
+                    const uint8 *w_den, int topn,
+                    const uint8 *logadd, int n_logadd,
+                    const uint8 *senone_active, int n_senone_active)
+{
+    int i, k, j = 0;
+
+    for (i = 0; i < n_senone_active; ++i) {
+        int shift;
+        int32 tmp;
+
+        j += senone_active[i];
+        shift = (j & 1) * 4;
+        tmp = w_den[(mixw[0][j / 2] >> shift) & 0x0f];
+        for (k = 1; k < topn; ++k)
+            tmp = logadd_scalar(logadd, n_logadd, tmp,
+                                w_den[k * 16 + ((mixw[k][j / 2] >> shift) & 0x0f)]);
+        out[j] += tmp;
+    }
+}
+
+void
+gmm_simd_mixw_active(int16 *out, const uint8 *const *mixw,
+                     const int32 *score, int topn,
+                     const uint8 *logadd, int n_logadd,
+                     const uint8 *senone_active, int n_senone_active)
+{
+    if (topn == 4)
+        mixw_active_scalar(out, mixw, score, 4, logadd, n_logadd,
+                           senone_active, n_senone_active);
+    else
+        mixw_active_scalar(out, mixw, score, topn, logadd, n_logadd,
+                           senone_active, n_senone_active);
+}
+
+void
+gmm_simd_mixw4_active(int16 *out, const uint8 *const *mixw,
+                      const uint8 *w_den, int topn,
+                      const uint8 *logadd, int n_logadd,
+                      const uint8 *senone_active, int n_senone_active)
+{
+    if (topn == 4)
+        mixw4_active_scalar(out, mixw, w_den, 4, logadd, n_logadd,
+                            senone_active, n_senone_active);
+    else
+        mixw4_active_scalar(out, mixw, w_den, topn, logadd, n_logadd,
+                            senone_active, n_senone_active);
+}
+
+/* Number of shortlisted densities evaluated at once. */
+#define GS_LIST_CHUNK 64
+
+int32
+gmm_simd_gauden_dist_gs(const gmm_simd_t *simd, gauden_t *g, gauden_gs_t *gs,
+                        int mgau, int32 n_top, mfcc_t **obs,
+                        gauden_dist_t **out_dist)
+{
+    int32 f;
+
+    assert((n_top > 0) && (n_top <= gs->n_list));
+    for (f = 0; f < g->n_feat; f++) {
+        const int32 *list = gauden_gs_shortlist(gs, g, mgau, f, obs[f]);
+        gauden_dist_t *topn = out_dist[f];
+        int32 i, j;
+
+        for (i = 0; i < n_top; i++)
+            topn[i].dist = GAUDEN_WORST_DIST;
+        /* The shortlist is in increasing order, so this inserts them
+         * in the same order as gauden_dist_gs(). */
+        for (j = 0; j < gs->n_list; j += GS_LIST_CHUNK) {
+            mfcc_t d[GS_LIST_CHUNK];
+            int32 n = gs->n_list - j;
+            if (n > GS_LIST_CHUNK)
+                n = GS_LIST_CHUNK;
+            simd->eval_list(obs[f], g->mean[mgau][f][0], g->var[mgau][f][0],
+                            g->det[mgau][f], list + j, n, g->featlen[f], d);
+            for (i = 0; i < n; ++i) {
+                if (d[i] < topn[n_top - 1].dist)
+                    continue;
+                gauden_dist_insert(topn, n_top, list[j + i], d[i]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Round up to a multiple of 64 bytes worth of floats. */
+#define LAYOUT_ALIGN(n) (((n) + 15) & ~15)
+
+/**
+ * Set up pointers to the interleaved parameters in buf (which should
+ * be 64-byte aligned).
+ *
+ * @return number of values used in buf.
+ */
+static size_t
+gmm_simd_layout_set(gmm_simd_layout_t *layout, gauden_t *g, mfcc_t *buf)
+{
+    size_t off = 0;
+    int m, f, n_pad;
+
+    n_pad = layout->n_block * layout->width;
+    for (m = 0; m < g->n_mgau; ++m) {
+        for (f = 0; f < g->n_feat; ++f) {
+            int ceplen = g->featlen[f];
+
+            layout->mean[m][f] = buf + off;
+            off += LAYOUT_ALIGN(n_pad * ceplen);
+            layout->var[m][f] = buf + off;
+            off += LAYOUT_ALIGN(n_pad * ceplen);
+            layout->det[m][f] = buf + off;
+            off += LAYOUT_ALIGN(n_pad);
+        }
+    }
+    return off;
+}
+
+static gmm_simd_layout_t *
+gmm_simd_layout_create(const gmm_simd_t *simd, gauden_t *g)
+{
+    gmm_simd_layout_t *layout;
+
+    layout = ckd_calloc(1, sizeof(*layout));
+    layout->width = simd->width;
+    layout->n_block = (g->n_density + simd->width - 1) / simd->width;
+    layout->mean = (mfcc_t ***)ckd_calloc_2d(g->n_mgau, g->n_feat, sizeof(mfcc_t *));
+    layout->var = (mfcc_t ***)ckd_calloc_2d(g->n_mgau, g->n_feat, sizeof(mfcc_t *));
+    layout->det = (mfcc_t ***)ckd_calloc_2d(g->n_mgau, g->n_feat, sizeof(mfcc_t *));
+    return layout;
+}
+
+gmm_simd_layout_t *
+gmm_simd_layout_init(const gmm_simd_t *simd, gauden_t *g)
+{
+    gmm_simd_layout_t *layout;
+    size_t total, off;
+    int m, f, n_pad;
+
+    layout = gmm_simd_layout_create(simd, g);
+    n_pad = layout->n_block * layout->width;
+    /* Means, variances and determinants for each codebook and
+     * feature are stored together in one 64-byte aligned region. */
+    total = 0;
+    for (f = 0; f < g->n_feat; ++f)
+        total += 2 * LAYOUT_ALIGN(n_pad * g->featlen[f]) + LAYOUT_ALIGN(n_pad);
+    total *= g->n_mgau;
+    layout->buf = ckd_calloc(total + 16, sizeof(mfcc_t));
+    off = (64 - ((size_t)layout->buf & 63)) % 64 / sizeof(mfcc_t);
+    gmm_simd_layout_set(layout, g, layout->buf + off);
+    for (m = 0; m < g->n_mgau; ++m) {
+        for (f = 0; f < g->n_feat; ++f) {
+            int ceplen = g->featlen[f];
+            int c, j;
+
+            for (c = 0; c < n_pad; ++c) {
+                int b = c / layout->width, k = c % layout->width;
+                mfcc_t *mean = layout->mean[m][f] + b * ceplen * layout->width + k;
+                mfcc_t *var = layout->var[m][f] + b * ceplen * layout->width + k;
+
+                if (c >= g->n_density) {
+                    /* Padding never gets into the top-N. */
+                    layout->det[m][f][c] = -FLT_MAX;
+                    continue;
+                }
+                layout->det[m][f][c] = g->det[m][f][c];
+                for (j = 0; j < ceplen; ++j) {
+                    mean[j * layout->width] = g->mean[m][f][c][j];
+                    var[j * layout->width] = g->var[m][f][c][j];
+                }
+            }
+        }
+    }
+    return layout;
+}
+
+/* Cached layouts have a 32-byte header (width, number of blocks, and
+ * number of values) so that the values, after the 32-byte cache file
+ * header, are 64-byte aligned in the mapping. */
+#define LAYOUT_CACHE_HDR 8
+
+static uint64
+gmm_simd_layout_key(const gmm_simd_t *simd, gauden_t *g)
+{
+    uint64 key;
+    int32 width = simd->width;
+
+    key = datacache_hash(g->key, &width, sizeof(width));
+    return datacache_hash_str(key, simd->name);
+}
+
+static gmm_simd_layout_t *
+gmm_simd_layout_load(const gmm_simd_t *simd, gauden_t *g,
+                     datacache_t *dc, uint64 key)
+{
+    gmm_simd_layout_t *layout;
+    const int32 *data;
+    s3file_t *mf;
+    mfcc_t *params;
+    size_t size, total;
+
+    if ((mf = datacache_map(dc, "gmm_simd", key,
+                            (const void **)&data, &size))
+        == NULL)
+        return NULL;
+    layout = gmm_simd_layout_create(simd, g);
+    params = (mfcc_t *)(data + LAYOUT_CACHE_HDR);
+    if (size < LAYOUT_CACHE_HDR * sizeof(*data)
+        || data[0] != layout->width
+        || data[1] != layout->n_block) {
+        E_WARN("Cached interleaved Gaussians do not match, rebuilding\n");
+        goto error_out;
+    }
+    total = gmm_simd_layout_set(layout, g, params);
+    if ((size_t)data[2] != total
+        || size != LAYOUT_CACHE_HDR * sizeof(*data) + total * sizeof(mfcc_t)) {
+        E_WARN("Cached interleaved Gaussians have wrong size, rebuilding\n");
+        goto error_out;
+    }
+    if (datacache_shared(dc)) {
+        layout->mmap = mf;
+        return layout;
+    }
+    /* Same thing, but a private copy. */
+    layout->buf = ckd_calloc(total + 16, sizeof(mfcc_t));
+    params = layout->buf + (64 - ((size_t)layout->buf & 63)) % 64 / sizeof(mfcc_t);
+    memcpy(params, data + LAYOUT_CACHE_HDR, total * sizeof(mfcc_t));
+    gmm_simd_layout_set(layout, g, params);
+    s3file_free(mf);
+    return layout;
+
+error_out:
+    s3file_free(mf);
+    gmm_simd_layout_free(layout);
+    return NULL;
+}
+
+static void
+gmm_simd_layout_store(gmm_simd_layout_t *layout, gauden_t *g,
+                      datacache_t *dc, uint64 key)
+{
+    size_t total, size;
+    int32 *data;
+
+    /* This just recomputes the size, the pointers don't change. */
+    total = gmm_simd_layout_set(layout, g, layout->mean[0][0]);
+    size = LAYOUT_CACHE_HDR * sizeof(*data) + total * sizeof(mfcc_t);
+    data = ckd_calloc(1, size);
+    data[0] = layout->width;
+    data[1] = layout->n_block;
+    data[2] = (int32)total;
+    memcpy(data + LAYOUT_CACHE_HDR, layout->mean[0][0], total * sizeof(mfcc_t));
+    datacache_store(dc, "gmm_simd", key, data, size);
+    ckd_free(data);
+}
+
+gmm_simd_layout_t *
+gmm_simd_layout_init_cached(const gmm_simd_t *simd, gauden_t *g,
+                            datacache_t *dc)
+{
+    gmm_simd_layout_t *layout, *shared;
+    uint64 key;
+
+    /* Parameters which aren't cached (e.g. after MLLR) can't be
+     * identified, so neither can their layout. */
+    if (dc == NULL || g->key == 0)
+        return gmm_simd_layout_init(simd, g);
+    key = gmm_simd_layout_key(simd, g);
+    if ((layout = gmm_simd_layout_load(simd, g, dc, key)) != NULL)
+        return layout;
+    layout = gmm_simd_layout_init(simd, g);
+    gmm_simd_layout_store(layout, g, dc, key);
+    /* Use the stored copy, like everyone else will. */
+    if (datacache_shared(dc)
+        && (shared = gmm_simd_layout_load(simd, g, dc, key)) != NULL) {
+        gmm_simd_layout_free(layout);
+        layout = shared;
+    }
+    return layout;
+}
+
+int32
+gmm_simd_gauden_dist(const gmm_simd_t *simd, const gmm_simd_layout_t *layout,
+                     gauden_t *g, int mgau, int32 n_top, mfcc_t **obs,
+                     gauden_dist_t **out_dist)
+{
+    int32 f;
+
+    assert((n_top > 0) && (n_top <= g->n_density));
+    for (f = 0; f < g->n_feat; f++) {
+        gauden_dist_t *topn = out_dist[f];
+        const mfcc_t *mean = layout->mean[mgau][f];
+        const mfcc_t *var = layout->var[mgau][f];
+        const mfcc_t *det = layout->det[mgau][f];
+        int32 ceplen = g->featlen[f];
+        int32 stride = ceplen * layout->width;
+        int32 b, i;
+
+        if (n_top >= g->n_density) {
+            /* Just compute them all, in order. */
+            for (b = 0; b < layout->n_block; ++b) {
+                mfcc_t d[GMM_SIMD_MAX_WIDTH];
+                int32 k;
+
+                simd->eval_block(obs[f], mean + b * stride, var + b * stride,
+                                 det + b * layout->width, ceplen, -FLT_MAX, d);
+                for (k = 0; k < layout->width; ++k) {
+                    int32 c = b * layout->width + k;
+                    if (c >= g->n_density)
+                        break;
+                    topn[c].dist = d[k];
+                    topn[c].id = c;
+                }
+            }
+            continue;
+        }
+
+        for (i = 0; i < n_top; i++)
+            topn[i].dist = GAUDEN_WORST_DIST;
+        for (b = 0; b < layout->n_block; ++b) {
+            mfcc_t d[GMM_SIMD_MAX_WIDTH];
+            int32 k;
+
+            /* As in eval_cb_simd() in ptm_mgau.c, if the whole block
+             * falls below the threshold now, the scalar code would
+             * not have inserted any of it either. */
+            if (simd->eval_block(obs[f], mean + b * stride, var + b * stride,
+                                 det + b * layout->width, ceplen,
+                                 topn[n_top - 1].dist, d)
+                < ceplen)
+                continue;
+            for (k = 0; k < layout->width; ++k) {
+                int32 c = b * layout->width + k;
+                if (c >= g->n_density)
+                    break;
+                if (d[k] < topn[n_top - 1].dist)
+                    continue;
+                gauden_dist_insert(topn, n_top, c, d[k]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+void
+gmm_simd_layout_free(gmm_simd_layout_t *layout)
+{
+    if (layout == NULL)
+        return;
+    ckd_free_2d(layout->mean);
+    ckd_free_2d(layout->var);
+    ckd_free_2d(layout->det);
+    ckd_free(layout->buf);
+    if (layout->mmap)
+        s3file_free(layout->mmap);
+    ckd_free(layout);
+}
@@ -0,0 +1,366 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+
+/**
+ * @file hmm_simd.c SIMD kernels for Viterbi evaluation of HMMs.
+ *
+ * The kernels themselves are in hmm_simd_kernel.h, which is written
+ * in terms of a few vector operations, defined below for each
+ * instruction set.
+ */
+
+#include "config.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include <soundswallower/err.h>
+#include <soundswallower/hmm_simd.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HMM_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HMM_SIMD_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HMM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#if defined(__wasm_simd128__)
+#define HMM_SIMD_WASM
+#include <wasm_simd128.h>
+#endif
+
+#ifdef HMM_SIMD_SSE2
+#define HMM_SIMD_FN(name) name##_sse2
+#define HMM_SIMD_ATTR
+#define HV __m128i
+#define HV_LANES 4
+#define hv_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define hv_store(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define hv_set1(x) _mm_set1_epi32(x)
+#define hv_add(a, b) _mm_add_epi32(a, b)
+#define hv_gt(a, b) _mm_cmpgt_epi32(a, b)
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#define hv_sel(m, a, b) _mm_blendv_epi8(b, a, m)
+#define hv_max(a, b) _mm_max_epi32(a, b)
+#else
+/* No blend or signed 32-bit max before SSE4.1. */
+#define hv_sel(m, a, b) _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b))
+#define hv_max(a, b) hv_sel(hv_gt(a, b), a, b)
+#endif
+#include "hmm_simd_kernel.h"
+#undef HMM_SIMD_FN
+#undef HMM_SIMD_ATTR
+#undef HV
+#undef HV_LANES
+#undef hv_load
+#undef hv_store
+#undef hv_set1
+#undef hv_add
+#undef hv_gt
+#undef hv_sel
+#undef hv_max
+
+static const hmm_simd_t hmm_simd_sse2 = {
+    "sse2", eval_3st_sse2, eval_5st_sse2
+};
+#endif /* HMM_SIMD_SSE2 */
+
+#ifdef HMM_SIMD_AVX2
+#define HMM_SIMD_FN(name) name##_avx2
+#define HMM_SIMD_ATTR __attribute__((target("avx2")))
+#define HV __m256i
+#define HV_LANES 8
+#define hv_load(p) _mm256_loadu_si256((const __m256i *)(p))
+#define hv_store(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define hv_set1(x) _mm256_set1_epi32(x)
+#define hv_add(a, b) _mm256_add_epi32(a, b)
+#define hv_gt(a, b) _mm256_cmpgt_epi32(a, b)
+#define hv_sel(m, a, b) _mm256_blendv_epi8(b, a, m)
+#define hv_max(a, b) _mm256_max_epi32(a, b)
+#include "hmm_simd_kernel.h"
+#undef HMM_SIMD_FN
+#undef HMM_SIMD_ATTR
+#undef HV
+#undef HV_LANES
+#undef hv_load
+#undef hv_store
+#undef hv_set1
+#undef hv_add
+#undef hv_gt
+#undef hv_sel
+#undef hv_max
+
+static const hmm_simd_t hmm_simd_avx2 = {
+    "avx2", eval_3st_avx2, eval_5st_avx2
+};
+#endif /* HMM_SIMD_AVX2 */
+
+#ifdef HMM_SIMD_NEON
+#define HMM_SIMD_FN(name) name##_neon
+#define HMM_SIMD_ATTR
+#define HV int32x4_t
+#define HV_LANES 4
+#define hv_load(p) vld1q_s32(p)
+#define hv_store(p, v) vst1q_s32(p, v)
+#define hv_set1(x) vdupq_n_s32(x)
+#define hv_add(a, b) vaddq_s32(a, b)
+#define hv_gt(a, b) vreinterpretq_s32_u32(vcgtq_s32(a, b))
+#define hv_sel(m, a, b) vbslq_s32(vreinterpretq_u32_s32(m), a, b)
+#define hv_max(a, b) vmaxq_s32(a, b)
+#include "hmm_simd_kernel.h"
+#undef HMM_SIMD_FN
+#undef HMM_SIMD_ATTR
+#undef HV
+#undef HV_LANES
+#undef hv_load
+#undef hv_store
+#undef hv_set1
+#undef hv_add
+#undef hv_gt
+#undef hv_sel
+#undef hv_max
+
+static const hmm_simd_t hmm_simd_neon = {
+    "neon", eval_3st_neon, eval_5st_neon
+};
+#endif /* HMM_SIMD_NEON */
+
+#ifdef HMM_SIMD_WASM
+#define HMM_SIMD_FN(name) name##_simd128
+#define HMM_SIMD_ATTR
+#define HV v128_t
+#define HV_LANES 4
+#define hv_load(p) wasm_v128_load(p)
+#define hv_store(p, v) wasm_v128_store(p, v)
+#define hv_set1(x) wasm_i32x4_splat(x)
+#define hv_add(a, b) wasm_i32x4_add(a, b)
+#define hv_gt(a, b) wasm_i32x4_gt(a, b)
+#define hv_sel(m, a, b) wasm_v128_bitselect(a, b, m)
+#define hv_max(a, b) wasm_i32x4_max(a, b)
+#include "hmm_simd_kernel.h"
+#undef HMM_SIMD_FN
+#undef HMM_SIMD_ATTR
+#undef HV
+#undef HV_LANES
+#undef hv_load
+#undef hv_store
+#undef hv_set1
+#undef hv_add
+#undef hv_gt
+#undef hv_sel
+#undef hv_max
+
+static const hmm_simd_t hmm_simd_simd128 = {
+    "simd128", eval_3st_simd128, eval_5st_simd128
+};
+#endif /* HMM_SIMD_WASM */
+
+/* In order of preference. */
+static const hmm_simd_t *const hmm_simd_kernels[] = {
+#ifdef HMM_SIMD_AVX2
+    &hmm_simd_avx2,
+#endif
+#ifdef HMM_SIMD_SSE2
+    &hmm_simd_sse2,
+#endif
+#ifdef HMM_SIMD_NEON
+    &hmm_simd_neon,
+#endif
+#ifdef HMM_SIMD_WASM
+    &hmm_simd_simd128,
+#endif
+    NULL
+};
+
+static int
+hmm_simd_supported(const hmm_simd_t *simd)
+{
+#ifdef HMM_SIMD_AVX2
+    if (simd == &hmm_simd_avx2) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    /* Everything else is determined at compile time. */
+    (void)simd;
+    return TRUE;
+}
+
+const hmm_simd_t *
+hmm_simd_get(const char *name)
+{
+    int i;
+
+    if (name == NULL || 0 == strcmp(name, "auto")) {
+        for (i = 0; hmm_simd_kernels[i]; ++i) {
+            if (hmm_simd_supported(hmm_simd_kernels[i]))
+                return hmm_simd_kernels[i];
+        }
+        return NULL;
+    }
+    if (0 == strcmp(name, "scalar"))
+        return NULL;
+    for (i = 0; hmm_simd_kernels[i]; ++i) {
+        if (0 == strcmp(name, hmm_simd_kernels[i]->name)) {
+            if (hmm_simd_supported(hmm_simd_kernels[i]))
+                return hmm_simd_kernels[i];
+            /* Not warning here, as gmm_simd_get() uses the same
+             * option and will already have done so. */
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/* How many HMMs ahead to prefetch. */
+#define HMM_SIMD_PREFETCH (2 * HMM_SIMD_WIDTH)
+
+/* Gather a block of HMMs with n_emit emitting states into lanes. */
+static inline void
+hmm_simd_gather(hmm_simd_lanes_t *l, hmm_t *const *block, int n_emit)
+{
+    /* All of them share the same context. */
+    int16 const *senscore = block[0]->ctx->senscore;
+    uint8 **const *tmat = block[0]->ctx->tp;
+    int k, st;
+
+    for (k = 0; k < HMM_SIMD_WIDTH; ++k) {
+        const hmm_t *hmm = block[k];
+        uint8 const *tp = tmat[hmm->tmatid][0];
+
+        for (st = 0; st < n_emit; ++st) {
+            uint8 const *row = tp + st * (n_emit + 1) + st;
+            l->score[st][k] = hmm->score[st];
+            l->history[st][k] = hmm->history[st];
+            l->senscr[st][k] = -senscore[hmm->senid[st]];
+            l->tprob[st][0][k] = -row[0];
+            l->tprob[st][1][k] = -row[1];
+            if (st + 2 <= n_emit)
+                l->tprob[st][2][k] = -row[2];
+        }
+        l->score[n_emit][k] = hmm->out_score;
+        l->history[n_emit][k] = hmm->out_history;
+    }
+}
+
+/* Scatter a block of evaluated HMMs, returning the best score. */
+static inline int32
+hmm_simd_scatter(const hmm_simd_lanes_t *l, hmm_t *const *block,
+                 int n_emit, int32 best)
+{
+    int k, st;
+
+    for (k = 0; k < HMM_SIMD_WIDTH; ++k) {
+        hmm_t *hmm = block[k];
+
+        for (st = 0; st < n_emit; ++st) {
+            hmm->score[st] = l->score[st][k];
+            hmm->history[st] = l->history[st][k];
+        }
+        hmm->out_score = l->score[n_emit][k];
+        hmm->out_history = l->history[n_emit][k];
+        hmm->bestscore = l->best[k];
+        if (l->best[k] BETTER_THAN best)
+            best = l->best[k];
+    }
+    return best;
+}
+
+static int32
+hmm_simd_eval_block(const hmm_simd_t *simd, hmm_simd_lanes_t *l,
+                    hmm_t *const *block, int n_emit, int32 best)
+{
+    /* Constant n_emit lets the compiler unroll these loops. */
+    if (n_emit == 5) {
+        hmm_simd_gather(l, block, 5);
+        (*simd->eval_5st)(l);
+        return hmm_simd_scatter(l, block, 5, best);
+    } else {
+        hmm_simd_gather(l, block, 3);
+        (*simd->eval_3st)(l);
+        return hmm_simd_scatter(l, block, 3, best);
+    }
+}
+
+int32
+hmm_simd_vit_eval(const hmm_simd_t *simd, hmm_t *const *hmms, int n)
+{
+    hmm_simd_lanes_t lanes;
+    hmm_t *block[HMM_SIMD_WIDTH];
+    int32 best = WORST_SCORE;
+    int i, n_emit = 0, n_block = 0;
+
+    /* Small batches are faster one at a time (see hmm_simd.h). */
+    if (simd == NULL || n < HMM_SIMD_MIN_BATCH) {
+        for (i = 0; i < n; ++i) {
+            int32 score = hmm_vit_eval(hmms[i]);
+            if (score BETTER_THAN best)
+                best = score;
+        }
+        return best;
+    }
+    n_emit = hmm_n_emit_state(hmms[0]);
+    if (n_emit != 3 && n_emit != 5)
+        n_emit = 0;
+    for (i = 0; i < n; ++i) {
+        hmm_t *hmm = hmms[i];
+
+#ifdef __GNUC__
+        /* HMMs are all over the place, so fetch them well ahead of
+         * time (and several blocks' worth at once). */
+        if (i + HMM_SIMD_PREFETCH < n)
+            __builtin_prefetch(hmms[i + HMM_SIMD_PREFETCH]);
+#endif
+        if (n_emit == 0 || hmm_is_mpx(hmm)) {
+            int32 score = hmm_vit_eval(hmm);
+            if (score BETTER_THAN best)
+                best = score;
+            continue;
+        }
+        block[n_block++] = hmm;
+        if (n_block == HMM_SIMD_WIDTH) {
+            best = hmm_simd_eval_block(simd, &lanes, block, n_emit, best);
+            n_block = 0;
+        }
+    }
+    /* Evaluate the remainder with scalar code. */
+    for (i = 0; i < n_block; ++i) {
+        int32 score = hmm_vit_eval(block[i]);
+        if (score BETTER_THAN best)
+            best = score;
+    }
+    return best;
+}
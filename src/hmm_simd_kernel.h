@@ -0,0 +1,203 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+
+/*
+ * Viterbi kernels for hmm_simd.c, which includes this once for each
+ * instruction set, after defining:
+ *
+ *   HMM_SIMD_FN(name)  Name of a function for this instruction set.
+ *   HMM_SIMD_ATTR      Attributes needed to use it (or nothing).
+ *   HV                 Vector of int32.
+ *   HV_LANES           Number of lanes in HV.
+ *   hv_load(p), hv_store(p, v), hv_set1(x), hv_add(a, b)
+ *   hv_gt(a, b)        All ones in lanes where a > b, zero elsewhere.
+ *   hv_sel(m, a, b)    a in lanes where m is set, b elsewhere.
+ *   hv_max(a, b)
+ *
+ * The comparisons are the same as in hmm.c: a transition only wins
+ * if it is strictly better than the ones evaluated before it, the
+ * self-transition first, so ties go the same way.
+ */
+
+#define LANE(a) hv_load(&(a)[k])
+
+/* Best of three transitions, and the history that goes with it. */
+HMM_SIMD_ATTR static inline HV
+HMM_SIMD_FN(best3)(HV t0, HV t1, HV t2, HV h0, HV h1, HV h2, HV *out_h)
+{
+    HV m = hv_gt(t0, t1);
+    HV t = hv_sel(m, t0, t1);
+    HV h = hv_sel(m, h0, h1);
+
+    m = hv_gt(t2, t);
+    *out_h = hv_sel(m, h2, h);
+    return hv_sel(m, t2, t);
+}
+
+HMM_SIMD_ATTR static void
+HMM_SIMD_FN(eval_3st)(hmm_simd_lanes_t *l)
+{
+    int k;
+
+    for (k = 0; k < HMM_SIMD_WIDTH; k += HV_LANES) {
+        HV worst = hv_set1(WORST_SCORE);
+        HV tmat_worst = hv_set1(TMAT_WORST_SCORE);
+        HV none = hv_set1(INT_MIN);
+        HV s0 = hv_add(LANE(l->score[0]), LANE(l->senscr[0]));
+        HV s1 = hv_add(LANE(l->score[1]), LANE(l->senscr[1]));
+        HV s2 = hv_add(LANE(l->score[2]), LANE(l->senscr[2]));
+        HV h0 = LANE(l->history[0]);
+        HV h1 = LANE(l->history[1]);
+        HV h2 = LANE(l->history[2]);
+        HV active, best, m, t, t1, t2, h;
+
+        /* Non-emitting state 3, only if state 1 is active. */
+        active = hv_gt(s1, worst);
+        t1 = hv_add(s2, LANE(l->tprob[2][1]));
+        t2 = hv_sel(hv_gt(LANE(l->tprob[1][2]), tmat_worst),
+                    hv_add(s1, LANE(l->tprob[1][2])), none);
+        m = hv_gt(t1, t2);
+        t = hv_max(hv_sel(m, t1, t2), worst);
+        hv_store(&l->score[3][k], hv_sel(active, t, LANE(l->score[3])));
+        hv_store(&l->history[3][k],
+                 hv_sel(active, hv_sel(m, h2, h1), LANE(l->history[3])));
+        best = hv_sel(active, t, worst);
+        /* Without a skip into state 2, the scalar code compares
+         * against whatever it computed for the skip out of state 1. */
+        t2 = hv_sel(active, t2, none);
+
+        /* State 2. */
+        t2 = hv_sel(hv_gt(LANE(l->tprob[0][2]), tmat_worst),
+                    hv_add(s0, LANE(l->tprob[0][2])), t2);
+        t = HMM_SIMD_FN(best3)(hv_add(s2, LANE(l->tprob[2][0])),
+                               hv_add(s1, LANE(l->tprob[1][1])),
+                               t2, h2, h1, h0, &h);
+        t = hv_max(t, worst);
+        best = hv_max(best, t);
+        hv_store(&l->score[2][k], t);
+        hv_store(&l->history[2][k], h);
+
+        /* State 1. */
+        t = hv_add(s1, LANE(l->tprob[1][0]));
+        t1 = hv_add(s0, LANE(l->tprob[0][1]));
+        m = hv_gt(t, t1);
+        t = hv_max(hv_sel(m, t, t1), worst);
+        best = hv_max(best, t);
+        hv_store(&l->score[1][k], t);
+        hv_store(&l->history[1][k], hv_sel(m, h1, h0));
+
+        /* State 0. */
+        t = hv_max(hv_add(s0, LANE(l->tprob[0][0])), worst);
+        best = hv_max(best, t);
+        hv_store(&l->score[0][k], t);
+        hv_store(&l->best[k], best);
+    }
+}
+
+HMM_SIMD_ATTR static void
+HMM_SIMD_FN(eval_5st)(hmm_simd_lanes_t *l)
+{
+    int k;
+
+    for (k = 0; k < HMM_SIMD_WIDTH; k += HV_LANES) {
+        HV worst = hv_set1(WORST_SCORE);
+        HV s0 = hv_add(LANE(l->score[0]), LANE(l->senscr[0]));
+        HV s1 = hv_add(LANE(l->score[1]), LANE(l->senscr[1]));
+        HV s2 = hv_add(LANE(l->score[2]), LANE(l->senscr[2]));
+        HV s3 = hv_add(LANE(l->score[3]), LANE(l->senscr[3]));
+        HV s4 = hv_add(LANE(l->score[4]), LANE(l->senscr[4]));
+        HV h0 = LANE(l->history[0]);
+        HV h1 = LANE(l->history[1]);
+        HV h2 = LANE(l->history[2]);
+        HV h3 = LANE(l->history[3]);
+        HV h4 = LANE(l->history[4]);
+        HV active, best, m, t, t1, h;
+
+        /* Non-emitting state 5, only if state 3 is active. */
+        active = hv_gt(s3, worst);
+        t = hv_add(s4, LANE(l->tprob[4][1]));
+        t1 = hv_add(s3, LANE(l->tprob[3][2]));
+        m = hv_gt(t, t1);
+        t = hv_max(hv_sel(m, t, t1), worst);
+        hv_store(&l->score[5][k], hv_sel(active, t, LANE(l->score[5])));
+        hv_store(&l->history[5][k],
+                 hv_sel(active, hv_sel(m, h4, h3), LANE(l->history[5])));
+        best = hv_sel(active, t, worst);
+
+        /* State 4, only if state 2 is active. */
+        active = hv_gt(s2, worst);
+        t = HMM_SIMD_FN(best3)(hv_add(s4, LANE(l->tprob[4][0])),
+                               hv_add(s3, LANE(l->tprob[3][1])),
+                               hv_add(s2, LANE(l->tprob[2][2])),
+                               h4, h3, h2, &h);
+        t = hv_max(t, worst);
+        best = hv_max(best, hv_sel(active, t, worst));
+        hv_store(&l->score[4][k], hv_sel(active, t, LANE(l->score[4])));
+        hv_store(&l->history[4][k], hv_sel(active, h, h4));
+
+        /* State 3, only if state 1 is active. */
+        active = hv_gt(s1, worst);
+        t = HMM_SIMD_FN(best3)(hv_add(s3, LANE(l->tprob[3][0])),
+                               hv_add(s2, LANE(l->tprob[2][1])),
+                               hv_add(s1, LANE(l->tprob[1][2])),
+                               h3, h2, h1, &h);
+        t = hv_max(t, worst);
+        best = hv_max(best, hv_sel(active, t, worst));
+        hv_store(&l->score[3][k], hv_sel(active, t, LANE(l->score[3])));
+        hv_store(&l->history[3][k], hv_sel(active, h, h3));
+
+        /* State 2. */
+        t = HMM_SIMD_FN(best3)(hv_add(s2, LANE(l->tprob[2][0])),
+                               hv_add(s1, LANE(l->tprob[1][1])),
+                               hv_add(s0, LANE(l->tprob[0][2])),
+                               h2, h1, h0, &h);
+        t = hv_max(t, worst);
+        best = hv_max(best, t);
+        hv_store(&l->score[2][k], t);
+        hv_store(&l->history[2][k], h);
+
+        /* State 1. */
+        t = hv_add(s1, LANE(l->tprob[1][0]));
+        t1 = hv_add(s0, LANE(l->tprob[0][1]));
+        m = hv_gt(t, t1);
+        t = hv_max(hv_sel(m, t, t1), worst);
+        best = hv_max(best, t);
+        hv_store(&l->score[1][k], t);
+        hv_store(&l->history[1][k], hv_sel(m, h1, h0));
+
+        /* State 0. */
+        t = hv_max(hv_add(s0, LANE(l->tprob[0][0])), worst);
+        best = hv_max(best, t);
+        hv_store(&l->score[0][k], t);
+        hv_store(&l->best[k], best);
+    }
+}
+
+#undef LANE
@@ -42,13 +42,14 @@
 #include <soundswallower/ckd_alloc.h>
 #include <soundswallower/err.h>
 #include <soundswallower/logmath.h>
-#include <soundswallower/mmio.h>
+#include <soundswallower/refcount.h>
+#include <soundswallower/s3file.h>
 #include <soundswallower/strfuncs.h>
 
 struct logmath_s {
     logadd_t t;
     int refcount;
-    mmio_file_t *filemap;
+    s3file_t *filemap;
     float64 base;
     float64 log_of_base;
     float64 log10_of_base;
@@ -163,24 +164,72 @@ logmath_init(float64 base, int shift, int use_table)
     return lmath;
 }
 
+logmath_t *
+logmath_init_cached(float64 base, int shift, int use_table,
+                    datacache_t *dc)
+{
+    logmath_t *lmath;
+    const uint32 *data;
+    s3file_t *mf;
+    uint32 *buf;
+    uint64 key;
+    size_t size;
+
+    if (dc == NULL || !use_table)
+        return logmath_init(base, shift, use_table);
+    key = datacache_hash(DATACACHE_HASH_INIT, &base, sizeof(base));
+    key = datacache_hash(key, &shift, sizeof(shift));
+    /* Table is preceded by its width and size. */
+    if ((mf = datacache_map(dc, "logmath", key,
+                            (const void **)&data, &size))) {
+        if ((lmath = logmath_init(base, shift, FALSE)) == NULL) {
+            s3file_free(mf);
+            return NULL;
+        }
+        if (size >= 2 * sizeof(*data)
+            && size == 2 * sizeof(*data) + (size_t)data[0] * data[1]) {
+            lmath->t.width = data[0];
+            lmath->t.table_size = data[1];
+            lmath->t.table = (void *)(data + 2);
+            lmath->filemap = mf;
+            return lmath;
+        }
+        E_WARN("Cached log-add table has wrong size, recomputing\n");
+        s3file_free(mf);
+        logmath_free(lmath);
+    }
+    if ((lmath = logmath_init(base, shift, TRUE)) == NULL)
+        return NULL;
+    size = (size_t)lmath->t.width * lmath->t.table_size;
+    buf = ckd_malloc(2 * sizeof(*buf) + size);
+    buf[0] = lmath->t.width;
+    buf[1] = lmath->t.table_size;
+    memcpy(buf + 2, lmath->t.table, size);
+    datacache_store(dc, "logmath", key, buf, 2 * sizeof(*buf) + size);
+    ckd_free(buf);
+    return lmath;
+}
+
 logmath_t *
 logmath_retain(logmath_t *lmath)
 {
     if (lmath == NULL)
         return NULL;
-    ++lmath->refcount;
+    refcount_inc(&lmath->refcount);
     return lmath;
 }
 
 int
 logmath_free(logmath_t *lmath)
 {
+    int refcount;
+
     if (lmath == NULL)
         return 0;
-    if (--lmath->refcount > 0)
-        return lmath->refcount;
+    if ((refcount = refcount_dec(&lmath->refcount)) > 0)
+        return refcount;
     if (lmath->filemap)
-        mmio_file_unmap(lmath->filemap);
+        s3file_free(lmath->filemap);
     else
         ckd_free(lmath->t.table);
     ckd_free(lmath);
@@ -0,0 +1,373 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+/**
+ * @file model_bundle.c Single-file packed acoustic models.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <soundswallower/bin_mdef.h>
+#include <soundswallower/byteorder.h>
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/err.h>
+#include <soundswallower/model_bundle.h>
+#include <soundswallower/refcount.h>
+#include <soundswallower/strfuncs.h>
+
+#define MODEL_BUNDLE_MAGIC "SSBUNDLE"
+#define MODEL_BUNDLE_VERSION 1
+
+/* All integers are little-endian on disk. */
+typedef struct model_bundle_header_s {
+    char magic[8];
+    uint32 version;
+    uint32 n_sections;
+    uint32 align;
+    uint32 reserved[3];
+} model_bundle_header_t;
+
+typedef struct model_bundle_section_s {
+    char name[MODEL_BUNDLE_NAMELEN];
+    uint64 offset;
+    uint64 size;
+} model_bundle_section_t;
+
+struct model_bundle_s {
+    int refcount;
+    s3file_t *s3f;
+    int n_sections;
+    model_bundle_section_t *sections;
+};
+
+/* Files in a model directory, as found by config_expand(). */
+static const char *model_files[] = {
+    "mdef",
+    "means",
+    "variances",
+    "transition_matrices",
+    "mixture_weights",
+    "sendump",
+    "feature_transform",
+    "feat_params.json",
+    "senmgau",
+    "dict.txt",
+    "noisedict.txt",
+};
+#define N_MODEL_FILES (sizeof(model_files) / sizeof(model_files[0]))
+
+model_bundle_t *
+model_bundle_read(const char *path)
+{
+    model_bundle_t *bundle;
+    s3file_t *s3f;
+
+    if ((s3f = s3file_map_file(path)) == NULL)
+        return NULL;
+    bundle = model_bundle_init_s3file(s3f);
+    s3file_free(s3f);
+    if (bundle)
+        E_INFO("Mapped %d sections from model bundle %s\n",
+               bundle->n_sections, path);
+    return bundle;
+}
+
+model_bundle_t *
+model_bundle_init_s3file(s3file_t *s3f)
+{
+    model_bundle_header_t hdr;
+    model_bundle_t *bundle;
+    size_t size;
+    int i;
+
+    size = s3f->end - (const char *)s3f->buf;
+    if (size < sizeof(hdr)) {
+        E_ERROR("Model bundle is too small\n");
+        return NULL;
+    }
+    memcpy(&hdr, s3f->buf, sizeof(hdr));
+    SWAP_LE_32(&hdr.version);
+    SWAP_LE_32(&hdr.n_sections);
+    SWAP_LE_32(&hdr.align);
+    if (memcmp(hdr.magic, MODEL_BUNDLE_MAGIC, sizeof(hdr.magic)) != 0) {
+        E_ERROR("Not a model bundle (bad magic number)\n");
+        return NULL;
+    }
+    if (hdr.version != MODEL_BUNDLE_VERSION) {
+        E_ERROR("Unsupported model bundle version %u\n", hdr.version);
+        return NULL;
+    }
+    if (hdr.n_sections > (size - sizeof(hdr)) / sizeof(model_bundle_section_t)) {
+        E_ERROR("Model bundle section table is truncated\n");
+        return NULL;
+    }
+
+    bundle = ckd_calloc(1, sizeof(*bundle));
+    bundle->refcount = 1;
+    bundle->n_sections = hdr.n_sections;
+    bundle->sections = ckd_calloc(hdr.n_sections, sizeof(*bundle->sections));
+    memcpy(bundle->sections, (const char *)s3f->buf + sizeof(hdr),
+           hdr.n_sections * sizeof(*bundle->sections));
+    for (i = 0; i < bundle->n_sections; ++i) {
+        model_bundle_section_t *sec = &bundle->sections[i];
+        SWAP_LE_64(&sec->offset);
+        SWAP_LE_64(&sec->size);
+        if (sec->name[MODEL_BUNDLE_NAMELEN - 1] != '\0'
+            || sec->offset > size || sec->size > size - sec->offset) {
+            E_ERROR("Model bundle section %d is invalid\n", i);
+            model_bundle_free(bundle);
+            return NULL;
+        }
+    }
+    bundle->s3f = s3file_retain(s3f);
+    return bundle;
+}
+
+model_bundle_t *
+model_bundle_retain(model_bundle_t *bundle)
+{
+    if (bundle == NULL)
+        return NULL;
+    refcount_inc(&bundle->refcount);
+    return bundle;
+}
+
+int
+model_bundle_free(model_bundle_t *bundle)
+{
+    int refcount;
+
+    if (bundle == NULL)
+        return 0;
+    if ((refcount = refcount_dec(&bundle->refcount)) > 0)
+        return refcount;
+    s3file_free(bundle->s3f);
+    ckd_free(bundle->sections);
+    ckd_free(bundle);
+    return 0;
+}
+
+int
+model_bundle_n_sections(model_bundle_t *bundle)
+{
+    return bundle->n_sections;
+}
+
+const char *
+model_bundle_section_name(model_bundle_t *bundle, int idx)
+{
+    if (idx < 0 || idx >= bundle->n_sections)
+        return NULL;
+    return bundle->sections[idx].name;
+}
+
+s3file_t *
+model_bundle_get(model_bundle_t *bundle, const char *name)
+{
+    int i;
+
+    if (bundle == NULL)
+        return NULL;
+    for (i = 0; i < bundle->n_sections; ++i) {
+        model_bundle_section_t *sec = &bundle->sections[i];
+        if (0 == strcmp(sec->name, name))
+            return s3file_slice(bundle->s3f, sec->offset, sec->size);
+    }
+    return NULL;
+}
+
+static int
+write_padding(FILE *fh, long align)
+{
+    static const char zeros[MODEL_BUNDLE_ALIGN];
+    long pos = ftell(fh);
+
+    if (pos < 0)
+        return -1;
+    if (pos % align == 0)
+        return 0;
+    return fwrite(zeros, 1, align - pos % align, fh) == (size_t)(align - pos % align)
+               ? 0
+               : -1;
+}
+
+int
+model_bundle_write_s3file(const char *outfile, const char *const *names,
+                          s3file_t *const *files, int n_sections)
+{
+    model_bundle_header_t hdr;
+    model_bundle_section_t *sections;
+    FILE *fh = NULL;
+    uint64 offset;
+    int i, rv = -1;
+
+    sections = ckd_calloc(n_sections, sizeof(*sections));
+    offset = sizeof(hdr) + n_sections * sizeof(*sections);
+    for (i = 0; i < n_sections; ++i) {
+        if (strlen(names[i]) >= MODEL_BUNDLE_NAMELEN) {
+            E_ERROR("Section name %s is too long\n", names[i]);
+            goto error_out;
+        }
+        strcpy(sections[i].name, names[i]);
+        offset = (offset + MODEL_BUNDLE_ALIGN - 1)
+                 / MODEL_BUNDLE_ALIGN * MODEL_BUNDLE_ALIGN;
+        sections[i].offset = offset;
+        sections[i].size = files[i]->end - (const char *)files[i]->buf;
+        offset += sections[i].size;
+        SWAP_LE_64(&sections[i].offset);
+        SWAP_LE_64(&sections[i].size);
+    }
+
+    if ((fh = fopen(outfile, "wb")) == NULL) {
+        E_ERROR_SYSTEM("Failed to open %s for writing", outfile);
+        goto error_out;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MODEL_BUNDLE_MAGIC, sizeof(hdr.magic));
+    hdr.version = MODEL_BUNDLE_VERSION;
+    hdr.n_sections = n_sections;
+    hdr.align = MODEL_BUNDLE_ALIGN;
+    SWAP_LE_32(&hdr.version);
+    SWAP_LE_32(&hdr.n_sections);
+    SWAP_LE_32(&hdr.align);
+    if (fwrite(&hdr, sizeof(hdr), 1, fh) != 1
+        || fwrite(sections, sizeof(*sections), n_sections, fh) != (size_t)n_sections)
+        goto write_error;
+    for (i = 0; i < n_sections; ++i) {
+        size_t size = files[i]->end - (const char *)files[i]->buf;
+        if (write_padding(fh, MODEL_BUNDLE_ALIGN) < 0
+            || fwrite(files[i]->buf, 1, size, fh) != size)
+            goto write_error;
+        E_INFO("Packed %s (%ld bytes)\n", names[i], (long)size);
+    }
+    if (fclose(fh) != 0) {
+        fh = NULL;
+        goto write_error;
+    }
+    fh = NULL;
+    rv = 0;
+    goto error_out;
+
+write_error:
+    E_ERROR_SYSTEM("Failed to write %s", outfile);
+error_out:
+    if (fh)
+        fclose(fh);
+    ckd_free(sections);
+    return rv;
+}
+
+int
+model_bundle_write(const char *outfile, const char *const *names,
+                   const char *const *paths, int n_sections)
+{
+    s3file_t **files;
+    int i, rv = -1;
+
+    files = ckd_calloc(n_sections, sizeof(*files));
+    for (i = 0; i < n_sections; ++i) {
+        if ((files[i] = s3file_map_file(paths[i])) == NULL)
+            goto error_out;
+    }
+    rv = model_bundle_write_s3file(outfile, names, files, n_sections);
+error_out:
+    for (i = 0; i < n_sections; ++i)
+        s3file_free(files[i]);
+    ckd_free(files);
+    return rv;
+}
+
+int
+model_bundle_pack(const char *hmmdir, const char *outfile)
+{
+    return model_bundle_pack_tables(hmmdir, outfile, NULL, NULL, 0);
+}
+
+int
+model_bundle_pack_tables(const char *hmmdir, const char *outfile,
+                         const char *const *table_names,
+                         s3file_t *const *tables, int n_tables)
+{
+    const char **names;
+    s3file_t **files;
+    int n_sections = 0;
+    size_t i;
+    int rv = -1;
+
+    names = ckd_calloc(N_MODEL_FILES + n_tables, sizeof(*names));
+    files = ckd_calloc(N_MODEL_FILES + n_tables, sizeof(*files));
+    for (i = 0; i < N_MODEL_FILES; ++i) {
+        char *path = string_join(hmmdir, "/", model_files[i], NULL);
+        FILE *fh;
+
+        if ((fh = fopen(path, "rb")) == NULL) {
+            ckd_free(path);
+            continue;
+        }
+        if (0 == strcmp(model_files[i], "mdef")) {
+            uint32 magic = 0;
+            if (fread(&magic, sizeof(magic), 1, fh) != 1
+                || (magic != BIN_MDEF_NATIVE_ENDIAN
+                    && magic != BIN_MDEF_OTHER_ENDIAN)) {
+                E_ERROR("%s is not a binary model definition\n", path);
+                fclose(fh);
+                ckd_free(path);
+                goto error_out;
+            }
+        }
+        fclose(fh);
+        if ((files[n_sections] = s3file_map_file(path)) == NULL) {
+            ckd_free(path);
+            goto error_out;
+        }
+        E_INFO("Packing %s from %s\n", model_files[i], path);
+        ckd_free(path);
+        names[n_sections] = model_files[i];
+        ++n_sections;
+    }
+    if (n_sections == 0 || strcmp(names[0], "mdef") != 0) {
+        E_ERROR("No model definition found in %s\n", hmmdir);
+        goto error_out;
+    }
+    for (i = 0; i < (size_t)n_tables; ++i) {
+        names[n_sections] = table_names[i];
+        files[n_sections] = s3file_retain(tables[i]);
+        ++n_sections;
+    }
+    rv = model_bundle_write_s3file(outfile, names, files, n_sections);
+error_out:
+    for (i = 0; i < (size_t)n_sections; ++i)
+        s3file_free(files[i]);
+    ckd_free(files);
+    ckd_free(names);
+    return rv;
+}
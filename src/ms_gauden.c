@@ -43,6 +43,7 @@
 #include <soundswallower/ckd_alloc.h>
 #include <soundswallower/err.h>
 #include <soundswallower/mllr.h>
+#include <soundswallower/model_bundle.h>
 #include <soundswallower/ms_gauden.h>
 
 #define GAUDEN_PARAM_VERSION "1.0"
@@ -51,8 +52,6 @@
 #define M_PI 3.1415926535897932385e0
 #endif
 
-#define WORST_DIST (int32)(0x80000000)
-
 void
 gauden_dump(const gauden_t *g)
 {
@@ -93,6 +92,47 @@ gauden_dump_ind(const gauden_t *g, int senidx)
     fflush(stderr);
 }
 
+/**
+ * Create a 3-d array of pointers to gaussian parameters stored
+ * contiguously in buf.
+ */
+static mfcc_t ****
+gauden_param_wrap(int32 n_mgau, int32 n_feat, int32 n_density,
+                  const int32 *veclen, mfcc_t *buf)
+{
+    mfcc_t ****out;
+    int32 i, j, k, l;
+
+    out = (mfcc_t ****)ckd_calloc_3d(n_mgau, n_feat, n_density,
+                                     sizeof(mfcc_t *));
+    for (i = 0, l = 0; i < n_mgau; i++) {
+        for (j = 0; j < n_feat; j++) {
+            for (k = 0; k < n_density; k++) {
+                out[i][j][k] = &buf[l];
+                l += veclen[j];
+            }
+        }
+    }
+    return out;
+}
+
+/**
+ * Allocate gaussian parameters as a 3-d array of pointers into one
+ * contiguous block of n_mgau * n_density * sum(veclen) values.
+ */
+static mfcc_t ****
+gauden_param_alloc(int32 n_mgau, int32 n_feat, int32 n_density,
+                   const int32 *veclen)
+{
+    int32 i, blk;
+
+    for (i = 0, blk = 0; i < n_feat; i++)
+        blk += veclen[i];
+    return gauden_param_wrap(n_mgau, n_feat, n_density, veclen,
+                             ckd_calloc((size_t)n_mgau * n_density * blk,
+                                        sizeof(mfcc_t)));
+}
+
 /**
  * Reads gaussian parameters from a file
  *
@@ -109,7 +149,7 @@ gauden_param_read(s3file_t *s,
                   int32 *out_n_density,
                   int32 **out_veclen)
 {
-    int32 i, j, k, l, n, blk;
+    int32 i, n, blk;
     int32 n_mgau;
     int32 n_feat;
     int32 n_density;
@@ -168,17 +208,8 @@ gauden_param_read(s3file_t *s,
     }
 
     /* Allocate memory for mixture gaussian densities if not already allocated */
-    out = (float32 ****)ckd_calloc_3d(n_mgau, n_feat, n_density,
-                                      sizeof(float32 *));
-    buf = (float32 *)ckd_calloc(n, sizeof(float32));
-    for (i = 0, l = 0; i < n_mgau; i++) {
-        for (j = 0; j < n_feat; j++) {
-            for (k = 0; k < n_density; k++) {
-                out[i][j][k] = &buf[l];
-                l += veclen[j];
-            }
-        }
-    }
+    out = (float32 ****)gauden_param_alloc(n_mgau, n_feat, n_density, veclen);
+    buf = out[0][0][0];
 
     /* Read mixture gaussian densities data */
     if (s3file_get(buf, sizeof(float32), n, s) != (size_t)n) {
@@ -201,13 +232,27 @@ gauden_param_read(s3file_t *s,
     return out;
 }
 
+static void gauden_quant_free(gauden_t *g);
+
 static void
-gauden_param_free(mfcc_t ****p)
+gauden_param_free(gauden_t *g, mfcc_t ****p)
 {
-    ckd_free(p[0][0][0]);
+    /* Parameters used in place are freed with the mapping. */
+    if (g->mmap == NULL)
+        ckd_free(p[0][0][0]);
     ckd_free_3d(p);
 }
 
+static void
+gauden_det_free(gauden_t *g)
+{
+    if (g->mmap)
+        ckd_free_3d_ptr(g->det);
+    else
+        ckd_free_3d(g->det);
+    g->det = NULL;
+}
+
 /*
  * Some of the gaussian density computation can be carried out in advance:
  * 	log(determinant) calculation,
@@ -262,10 +307,143 @@ gauden_init_s3file(s3file_t *means, /**< Input: File containing means of mixture
                    s3file_t *vars, /**< Input: File containing variances of mixture gaussians */
                    float32 varfloor, /**< Input: Floor value to be applied to variances */
                    logmath_t *lmath)
+{
+    return gauden_init_s3file_cached(means, vars, varfloor, lmath, NULL);
+}
+
+/* Cached parameters are the dimensions, then the feature lengths
+ * (padded to an even number), then means, precomputed variances, and
+ * determinants. */
+#define GAUDEN_CACHE_HDR 4
+
+static uint64
+gauden_cache_key(s3file_t *means, s3file_t *vars, float32 varfloor,
+                 logmath_t *lmath)
+{
+    float64 base = logmath_get_base(lmath);
+    int32 mfcc_size = sizeof(mfcc_t);
+    uint64 key;
+
+    key = datacache_hash(DATACACHE_HASH_INIT, means->buf,
+                         means->end - (const char *)means->buf);
+    key = datacache_hash(key, vars->buf,
+                         vars->end - (const char *)vars->buf);
+    key = datacache_hash(key, &varfloor, sizeof(varfloor));
+    key = datacache_hash(key, &base, sizeof(base));
+    key = datacache_hash(key, &mfcc_size, sizeof(mfcc_size));
+#ifdef FIXED_POINT
+    key = datacache_hash_str(key, "FIXED_POINT");
+#endif
+    return key;
+}
+
+static gauden_t *
+gauden_cache_load(datacache_t *dc, uint64 key, logmath_t *lmath)
+{
+    const int32 *data;
+    mfcc_t *params;
+    s3file_t *mf;
+    gauden_t *g;
+    size_t size, n_param, n_det;
+    int32 i, n_feat, n_hdr, blk;
+
+    if ((mf = datacache_map(dc, "gauden", key,
+                            (const void **)&data, &size))
+        == NULL)
+        return NULL;
+    if (size < GAUDEN_CACHE_HDR * sizeof(*data))
+        goto error_out;
+    n_feat = data[1];
+    n_hdr = GAUDEN_CACHE_HDR + ((n_feat + 1) & ~1);
+    if (n_feat <= 0 || size < n_hdr * sizeof(*data))
+        goto error_out;
+    for (i = 0, blk = 0; i < n_feat; ++i)
+        blk += data[GAUDEN_CACHE_HDR + i];
+    n_det = (size_t)data[0] * n_feat * data[2];
+    n_param = (size_t)data[0] * data[2] * blk;
+    if (blk != data[3]
+        || size != n_hdr * sizeof(*data)
+                + (2 * n_param + n_det) * sizeof(mfcc_t))
+        goto error_out;
+
+    g = (gauden_t *)ckd_calloc(1, sizeof(gauden_t));
+    g->lmath = logmath_retain(lmath);
+    g->n_mgau = data[0];
+    g->n_feat = n_feat;
+    g->n_density = data[2];
+    g->featlen = ckd_calloc(n_feat, sizeof(*g->featlen));
+    memcpy(g->featlen, data + GAUDEN_CACHE_HDR, n_feat * sizeof(*g->featlen));
+    g->key = key;
+    params = (mfcc_t *)(data + n_hdr);
+    if (datacache_shared(dc)) {
+        /* The mapping is read-only, and nothing modifies these
+         * without freeing them first. */
+        g->mmap = mf;
+        g->mean = gauden_param_wrap(g->n_mgau, n_feat, g->n_density,
+                                    g->featlen, params);
+        g->var = gauden_param_wrap(g->n_mgau, n_feat, g->n_density,
+                                   g->featlen, params + n_param);
+        g->det = ckd_alloc_3d_ptr(g->n_mgau, n_feat, g->n_density,
+                                  params + 2 * n_param, sizeof(mfcc_t));
+        return g;
+    }
+    g->mean = gauden_param_alloc(g->n_mgau, n_feat, g->n_density, g->featlen);
+    memcpy(g->mean[0][0][0], params, n_param * sizeof(mfcc_t));
+    g->var = gauden_param_alloc(g->n_mgau, n_feat, g->n_density, g->featlen);
+    memcpy(g->var[0][0][0], params + n_param, n_param * sizeof(mfcc_t));
+    g->det = ckd_calloc_3d(g->n_mgau, n_feat, g->n_density, sizeof(***g->det));
+    memcpy(g->det[0][0], params + 2 * n_param, n_det * sizeof(mfcc_t));
+    s3file_free(mf);
+    return g;
+
+error_out:
+    E_WARN("Cached Gaussian parameters have wrong size, recomputing\n");
+    s3file_free(mf);
+    return NULL;
+}
+
+static void
+gauden_cache_store(gauden_t *g, datacache_t *dc, uint64 key)
+{
+    size_t size, n_param, n_det;
+    int32 i, n_hdr, blk, *data;
+    mfcc_t *params;
+
+    n_hdr = GAUDEN_CACHE_HDR + ((g->n_feat + 1) & ~1);
+    for (i = 0, blk = 0; i < g->n_feat; ++i)
+        blk += g->featlen[i];
+    n_det = (size_t)g->n_mgau * g->n_feat * g->n_density;
+    n_param = (size_t)g->n_mgau * g->n_density * blk;
+    size = n_hdr * sizeof(*data) + (2 * n_param + n_det) * sizeof(mfcc_t);
+    data = ckd_calloc(1, size);
+    data[0] = g->n_mgau;
+    data[1] = g->n_feat;
+    data[2] = g->n_density;
+    data[3] = blk;
+    memcpy(data + GAUDEN_CACHE_HDR, g->featlen, g->n_feat * sizeof(*g->featlen));
+    params = (mfcc_t *)(data + n_hdr);
+    memcpy(params, g->mean[0][0][0], n_param * sizeof(mfcc_t));
+    memcpy(params + n_param, g->var[0][0][0], n_param * sizeof(mfcc_t));
+    memcpy(params + 2 * n_param, g->det[0][0], n_det * sizeof(mfcc_t));
+    datacache_store(dc, "gauden", key, data, size);
+    ckd_free(data);
+}
+
+gauden_t *
+gauden_init_s3file_cached(s3file_t *means, s3file_t *vars,
+                          float32 varfloor, logmath_t *lmath,
+                          datacache_t *dc)
 {
     int32 i, m, f, d, *flen = NULL;
+    uint64 key = 0;
     gauden_t *g;
 
+    if (dc) {
+        key = gauden_cache_key(means, vars, varfloor, lmath);
+        if ((g = gauden_cache_load(dc, key, lmath)) != NULL)
+            return g;
+    }
+
     g = (gauden_t *)ckd_calloc(1, sizeof(gauden_t));
     g->lmath = logmath_retain(lmath);
 
@@ -291,6 +469,18 @@ gauden_init_s3file(s3file_t *means, /**< Input: File containing means of mixture
     }
     ckd_free(flen);
     gauden_dist_precompute(g, lmath, varfloor);
+    if (dc) {
+        gauden_t *shared;
+
+        gauden_cache_store(g, dc, key);
+        g->key = key;
+        /* Use the stored copy, like everyone else will. */
+        if (datacache_shared(dc)
+            && (shared = gauden_cache_load(dc, key, lmath)) != NULL) {
+            gauden_free(g);
+            g = shared;
+        }
+    }
     return g;
 
 error_out:
@@ -333,18 +523,204 @@ gauden_free(gauden_t *g)
     if (g == NULL)
         return;
     if (g->mean)
-        gauden_param_free(g->mean);
+        gauden_param_free(g, g->mean);
     if (g->var)
-        gauden_param_free(g->var);
+        gauden_param_free(g, g->var);
     if (g->det)
-        ckd_free_3d(g->det);
+        gauden_det_free(g);
+    if (g->mmap)
+        s3file_free(g->mmap);
     if (g->featlen)
         ckd_free(g->featlen);
     if (g->lmath)
         logmath_free(g->lmath);
+    gauden_quant_free(g);
     ckd_free(g);
 }
 
+static void
+gauden_quant_free(gauden_t *g)
+{
+    ckd_free_3d(g->qmean);
+    ckd_free_3d(g->qvar);
+    ckd_free_3d(g->qscale);
+    ckd_free_3d(g->qoffset);
+    ckd_free_3d(g->qvscale);
+    g->qmean = g->qvar = NULL;
+    g->qscale = g->qoffset = g->qvscale = NULL;
+}
+
+int32
+gauden_quantize(gauden_t *g, int bits)
+{
+    int32 m, f, d, i, maxlen;
+    int32 qmin, qmax;
+
+    if (bits != 8 && bits != 16) {
+        E_ERROR("Can only quantize Gaussians to 8 or 16 bits, not %d\n", bits);
+        return -1;
+    }
+    gauden_quant_free(g);
+    qmin = -(1 << (bits - 1));
+    qmax = (1 << (bits - 1)) - 1;
+    maxlen = 0;
+    for (f = 0; f < g->n_feat; ++f)
+        if (g->featlen[f] > maxlen)
+            maxlen = g->featlen[f];
+    g->quant_bits = bits;
+    g->qmean = ckd_calloc_3d(g->n_mgau, g->n_feat, g->n_density * maxlen,
+                             bits / 8);
+    g->qvar = ckd_calloc_3d(g->n_mgau, g->n_feat, g->n_density * maxlen,
+                            bits / 8);
+    g->qscale = ckd_calloc_3d(g->n_mgau, g->n_feat, maxlen, sizeof(mfcc_t));
+    g->qoffset = ckd_calloc_3d(g->n_mgau, g->n_feat, maxlen, sizeof(mfcc_t));
+    g->qvscale = ckd_calloc_3d(g->n_mgau, g->n_feat, g->n_density,
+                               sizeof(mfcc_t));
+
+    for (m = 0; m < g->n_mgau; ++m) {
+        for (f = 0; f < g->n_feat; ++f) {
+            int32 flen = g->featlen[f];
+
+            /* Per-dimension scale and offset for means, chosen so
+             * that they cover [qmin, qmax]. */
+            for (i = 0; i < flen; ++i) {
+                float64 min, max;
+
+                min = max = g->mean[m][f][0][i];
+                for (d = 1; d < g->n_density; ++d) {
+                    if (g->mean[m][f][d][i] < min)
+                        min = g->mean[m][f][d][i];
+                    if (g->mean[m][f][d][i] > max)
+                        max = g->mean[m][f][d][i];
+                }
+                if (max > min)
+                    g->qscale[m][f][i] = (mfcc_t)((max - min) / (qmax - qmin));
+                else
+                    g->qscale[m][f][i] = 1.0;
+                g->qoffset[m][f][i] = (mfcc_t)(min - qmin * g->qscale[m][f][i]);
+            }
+            /* Variances, rescaled to quantized mean units, with a
+             * per-density scale, since a few very sharp densities
+             * can otherwise swamp all the others. */
+            for (d = 0; d < g->n_density; ++d) {
+                float64 wmax = 0.0;
+                mfcc_t vscale;
+
+                for (i = 0; i < flen; ++i) {
+                    float64 w = g->var[m][f][d][i]
+                                * g->qscale[m][f][i] * g->qscale[m][f][i];
+                    if (w > wmax)
+                        wmax = w;
+                }
+                vscale = g->qvscale[m][f][d] = (mfcc_t)(wmax > 0 ? wmax / qmax : 1.0);
+                for (i = 0; i < flen; ++i) {
+                    float64 qm = floor((g->mean[m][f][d][i] - g->qoffset[m][f][i])
+                                           / g->qscale[m][f][i]
+                                       + 0.5);
+                    float64 qv = floor(g->var[m][f][d][i]
+                                           * g->qscale[m][f][i] * g->qscale[m][f][i]
+                                           / vscale
+                                       + 0.5);
+                    if (qm < qmin)
+                        qm = qmin;
+                    if (qm > qmax)
+                        qm = qmax;
+                    if (qv > qmax)
+                        qv = qmax;
+                    if (bits == 8) {
+                        ((int8 *)g->qmean[m][f])[d * flen + i] = (int8)qm;
+                        ((int8 *)g->qvar[m][f])[d * flen + i] = (int8)qv;
+                    } else {
+                        ((int16 *)g->qmean[m][f])[d * flen + i] = (int16)qm;
+                        ((int16 *)g->qvar[m][f])[d * flen + i] = (int16)qv;
+                    }
+                }
+            }
+        }
+    }
+    E_INFO("Quantized %d x %d x %d Gaussians to %d bits\n",
+           g->n_mgau, g->n_feat, g->n_density, bits);
+
+    /* Don't need these anymore. */
+    gauden_param_free(g, g->mean);
+    gauden_param_free(g, g->var);
+    g->mean = g->var = NULL;
+    return 0;
+}
+
+void
+gauden_quant_obs(gauden_t *g, int mgau, int feat,
+                 const mfcc_t *obs, int32 *out_qobs)
+{
+    mfcc_t *scale = g->qscale[mgau][feat];
+    mfcc_t *offset = g->qoffset[mgau][feat];
+    /* Allow observations to fall outside the range of the means by
+     * half of that range on either side. */
+    int32 lim = 1 << g->quant_bits;
+    int32 i;
+
+    for (i = 0; i < g->featlen[feat]; ++i) {
+        float64 q = floor((obs[i] - offset[i]) / scale[i] + 0.5);
+        if (q < -lim)
+            q = -lim;
+        if (q > lim - 1)
+            q = lim - 1;
+        out_qobs[i] = (int32)q;
+    }
+}
+
+mfcc_t
+gauden_quant_dist(gauden_t *g, int mgau, int feat,
+                  const int32 *qobs, int32 cw, mfcc_t thresh)
+{
+    int32 ceplen = g->featlen[feat];
+    mfcc_t vscale = g->qvscale[mgau][feat][cw];
+    mfcc_t det = g->det[mgau][feat][cw];
+    float64 flimit = (det - thresh) / vscale;
+    int64 dist = 0, limit;
+    int32 j;
+
+    /* Convert threshold to a limit on the integer distance. */
+    limit = flimit > 1e18 ? (int64)1e18 : (int64)flimit;
+    if (g->quant_bits == 8) {
+        /* Observations are clamped such that each term fits in 32 bits. */
+        int8 *mean = (int8 *)g->qmean[mgau][feat] + cw * ceplen;
+        int8 *var = (int8 *)g->qvar[mgau][feat] + cw * ceplen;
+        for (j = 0; j < ceplen; ++j) {
+            int32 diff = qobs[j] - mean[j];
+            dist += diff * diff * var[j];
+            if ((j & 3) == 3 && dist > limit)
+                break;
+        }
+    } else {
+        int16 *mean = (int16 *)g->qmean[mgau][feat] + cw * ceplen;
+        int16 *var = (int16 *)g->qvar[mgau][feat] + cw * ceplen;
+        for (j = 0; j < ceplen; ++j) {
+            int64 diff = qobs[j] - mean[j];
+            dist += diff * diff * var[j];
+            if ((j & 3) == 3 && dist > limit)
+                break;
+        }
+    }
+    return det - vscale * (mfcc_t)dist;
+}
+
+void
+gauden_dist_insert(gauden_dist_t *topn, int32 n_top, int32 id, mfcc_t dist)
+{
+    int32 i, pos;
+
+    /* The list is sorted, so the position is just the number of
+     * entries that are strictly better, and counting them is cheaper
+     * than a data-dependent branch for every one.  The last one is
+     * not better, or we wouldn't be here. */
+    for (pos = i = 0; i < n_top - 1; ++i)
+        pos += (topn[i].dist > dist);
+    memmove(topn + pos + 1, topn + pos, (n_top - 1 - pos) * sizeof(*topn));
+    topn[pos].dist = dist;
+    topn[pos].id = id;
+}
+
 /* See compute_dist below */
 static int32
 compute_dist_all(gauden_dist_t *out_dist, mfcc_t *obs, int32 featlen,
@@ -387,7 +763,7 @@ compute_dist(gauden_dist_t *out_dist, int32 n_top,
              mfcc_t **mean, mfcc_t **var, mfcc_t *det,
              int32 n_density)
 {
-    int32 i, j, d;
+    int32 i, d;
     gauden_dist_t *worst;
 
     /* Special case optimization when n_density <= n_top */
@@ -395,7 +771,7 @@ compute_dist(gauden_dist_t *out_dist, int32 n_top,
         return (compute_dist_all(out_dist, obs, featlen, mean, var, det, n_density));
 
     for (i = 0; i < n_top; i++)
-        out_dist[i].dist = WORST_DIST;
+        out_dist[i].dist = GAUDEN_WORST_DIST;
     worst = &(out_dist[n_top - 1]);
 
     for (d = 0; d < n_density; d++) {
@@ -419,13 +795,7 @@ compute_dist(gauden_dist_t *out_dist, int32 n_top,
             continue;
 
         /* Codeword d at least as good as worst so far; insert in the ordered list */
-        for (i = 0; (i < n_top) && (dval < out_dist[i].dist); i++)
-            ;
-        assert(i < n_top);
-        for (j = n_top - 1; j > i; --j)
-            out_dist[j] = out_dist[j - 1];
-        out_dist[i].dist = dval;
-        out_dist[i].id = d;
+        gauden_dist_insert(out_dist, n_top, d, dval);
     }
 
     return 0;
@@ -456,41 +826,316 @@ gauden_dist(gauden_t *g,
     return 0;
 }
 
+/* Number of k-means iterations used to build Gaussian selection codewords. */
+#define GS_KMEANS_ITER 10
+
+/* Weighted squared distance from a codeword. */
+static mfcc_t
+gs_vq_dist(const mfcc_t *x, const mfcc_t *cw, const mfcc_t *w, int32 featlen)
+{
+    mfcc_t dval = 0;
+    int32 i;
+
+    for (i = 0; i < featlen; ++i) {
+        mfcc_t diff = x[i] - cw[i];
+        dval += diff * diff * w[i];
+    }
+    return dval;
+}
+
+static int32
+gs_vq_nearest(const mfcc_t *x, mfcc_t *vq, const mfcc_t *w,
+              int32 n_vq, int32 featlen)
+{
+    mfcc_t best = FLT_MAX;
+    int32 c, best_c = 0;
+
+    for (c = 0; c < n_vq; ++c) {
+        mfcc_t dval = gs_vq_dist(x, vq + c * featlen, w, featlen);
+        if (dval < best) {
+            best = dval;
+            best_c = c;
+        }
+    }
+    return best_c;
+}
+
+static int
+gs_cmp_id(const void *a, const void *b)
+{
+    return *(const int32 *)a - *(const int32 *)b;
+}
+
+/* Cluster the means of one codebook and feature, then find the most
+ * likely densities at each codeword. */
+static void
+gs_build(gauden_gs_t *gs, gauden_t *g, int32 m, int32 f,
+         int32 *assign, int32 *count, gauden_dist_t *topn)
+{
+    mfcc_t **mean = g->mean[m][f];
+    mfcc_t **var = g->var[m][f];
+    mfcc_t *vq = gs->vq[m][f];
+    mfcc_t *w = gs->weight[m][f];
+    int32 featlen = g->featlen[f];
+    int32 c, d, i, iter;
+
+    /* Weight dimensions by their average inverse variance. */
+    for (d = 0; d < g->n_density; ++d)
+        for (i = 0; i < featlen; ++i)
+            w[i] += var[d][i];
+    for (i = 0; i < featlen; ++i)
+        w[i] /= g->n_density;
+
+    /* Plain k-means, starting from evenly spaced densities. */
+    for (c = 0; c < gs->n_vq; ++c)
+        memcpy(vq + c * featlen, mean[c * g->n_density / gs->n_vq],
+               featlen * sizeof(*vq));
+    for (iter = 0; iter < GS_KMEANS_ITER; ++iter) {
+        int32 changed = 0;
+        for (d = 0; d < g->n_density; ++d) {
+            c = gs_vq_nearest(mean[d], vq, w, gs->n_vq, featlen);
+            if (iter == 0 || c != assign[d])
+                ++changed;
+            assign[d] = c;
+        }
+        if (changed == 0)
+            break;
+        memset(count, 0, gs->n_vq * sizeof(*count));
+        for (d = 0; d < g->n_density; ++d)
+            ++count[assign[d]];
+        for (c = 0; c < gs->n_vq; ++c)
+            if (count[c])
+                memset(vq + c * featlen, 0, featlen * sizeof(*vq));
+        for (d = 0; d < g->n_density; ++d)
+            for (i = 0; i < featlen; ++i)
+                vq[assign[d] * featlen + i] += mean[d][i];
+        /* Empty clusters just keep their old codeword. */
+        for (c = 0; c < gs->n_vq; ++c)
+            for (i = 0; count[c] && i < featlen; ++i)
+                vq[c * featlen + i] /= count[c];
+    }
+
+    /* Shortlist the densities with the highest likelihood at each
+     * codeword, in increasing order so that ties come out the same
+     * as in gauden_dist(). */
+    for (c = 0; c < gs->n_vq; ++c) {
+        int32 *list = gs->list[m][f] + c * gs->n_list;
+        for (i = 0; i < gs->n_list; ++i)
+            topn[i].dist = GAUDEN_WORST_DIST;
+        for (d = 0; d < g->n_density; ++d) {
+            mfcc_t dval = g->det[m][f][d];
+            for (i = 0; i < featlen; ++i) {
+                mfcc_t diff = vq[c * featlen + i] - mean[d][i];
+                dval -= diff * diff * var[d][i];
+            }
+            if (dval >= topn[gs->n_list - 1].dist)
+                gauden_dist_insert(topn, gs->n_list, d, dval);
+        }
+        for (i = 0; i < gs->n_list; ++i)
+            list[i] = topn[i].id;
+        qsort(list, gs->n_list, sizeof(*list), gs_cmp_id);
+    }
+}
+
+gauden_gs_t *
+gauden_gs_init(gauden_t *g, int32 n_vq, int32 n_list)
+{
+    gauden_gs_t *gs;
+    int32 *assign, *count;
+    gauden_dist_t *topn;
+    size_t veclen, off;
+    int32 m, f;
+
+    if (g->mean == NULL) {
+        E_WARN("Gaussian selection is not supported for quantized Gaussians\n");
+        return NULL;
+    }
+    if (n_list <= 0 || n_list >= g->n_density) {
+        E_INFO("Shortlist size %d is not smaller than %d densities, "
+               "not using Gaussian selection\n",
+               n_list, g->n_density);
+        return NULL;
+    }
+    if (n_vq <= 0 || n_vq > g->n_density) {
+        E_ERROR("Number of Gaussian selection codewords %d must be in 1..%d\n",
+                n_vq, g->n_density);
+        return NULL;
+    }
+
+    gs = ckd_calloc(1, sizeof(*gs));
+    gs->n_vq = n_vq;
+    gs->n_list = n_list;
+    for (veclen = f = 0; f < g->n_feat; ++f)
+        veclen += g->featlen[f];
+    /* Codewords and weights for all codebooks and features, then
+     * shortlists. */
+    gs->buf = ckd_calloc(g->n_mgau * ((n_vq + 1) * veclen * sizeof(mfcc_t)
+                                      + g->n_feat * n_vq * n_list * sizeof(int32)),
+                         1);
+    gs->vq = (mfcc_t ***)ckd_calloc_2d(g->n_mgau, g->n_feat, sizeof(mfcc_t *));
+    gs->weight = (mfcc_t ***)ckd_calloc_2d(g->n_mgau, g->n_feat, sizeof(mfcc_t *));
+    gs->list = (int32 ***)ckd_calloc_2d(g->n_mgau, g->n_feat, sizeof(int32 *));
+    off = 0;
+    for (m = 0; m < g->n_mgau; ++m) {
+        for (f = 0; f < g->n_feat; ++f) {
+            gs->vq[m][f] = (mfcc_t *)((char *)gs->buf + off);
+            off += n_vq * g->featlen[f] * sizeof(mfcc_t);
+            gs->weight[m][f] = (mfcc_t *)((char *)gs->buf + off);
+            off += g->featlen[f] * sizeof(mfcc_t);
+        }
+    }
+    for (m = 0; m < g->n_mgau; ++m) {
+        for (f = 0; f < g->n_feat; ++f) {
+            gs->list[m][f] = (int32 *)((char *)gs->buf + off);
+            off += n_vq * n_list * sizeof(int32);
+        }
+    }
+
+    assign = ckd_calloc(g->n_density, sizeof(*assign));
+    count = ckd_calloc(n_vq, sizeof(*count));
+    topn = ckd_calloc(n_list, sizeof(*topn));
+    for (m = 0; m < g->n_mgau; ++m)
+        for (f = 0; f < g->n_feat; ++f)
+            gs_build(gs, g, m, f, assign, count, topn);
+    ckd_free(assign);
+    ckd_free(count);
+    ckd_free(topn);
+    E_INFO("Gaussian selection: %d codewords, %d of %d densities each\n",
+           n_vq, n_list, g->n_density);
+
+    return gs;
+}
+
+void
+gauden_gs_free(gauden_gs_t *gs)
+{
+    if (gs == NULL)
+        return;
+    ckd_free_2d(gs->vq);
+    ckd_free_2d(gs->weight);
+    ckd_free_2d(gs->list);
+    ckd_free(gs->buf);
+    ckd_free(gs);
+}
+
+const int32 *
+gauden_gs_shortlist(gauden_gs_t *gs, gauden_t *g,
+                    int mgau, int feat, const mfcc_t *obs)
+{
+    int32 c = gs_vq_nearest(obs, gs->vq[mgau][feat], gs->weight[mgau][feat],
+                            gs->n_vq, g->featlen[feat]);
+    return gs->list[mgau][feat] + c * gs->n_list;
+}
+
+int32
+gauden_dist_gs(gauden_t *g, gauden_gs_t *gs,
+               int mgau, int n_top, mfcc_t **obs, gauden_dist_t **out_dist)
+{
+    int32 f;
+
+    assert((n_top > 0) && (n_top <= gs->n_list));
+
+    for (f = 0; f < g->n_feat; f++) {
+        const int32 *list = gauden_gs_shortlist(gs, g, mgau, f, obs[f]);
+        mfcc_t **mean = g->mean[mgau][f];
+        mfcc_t **var = g->var[mgau][f];
+        mfcc_t *det = g->det[mgau][f];
+        gauden_dist_t *topn = out_dist[f];
+        int32 featlen = g->featlen[f];
+        int32 i, j;
+
+        for (i = 0; i < n_top; i++)
+            topn[i].dist = GAUDEN_WORST_DIST;
+        /* Same as compute_dist(), for the shortlist. */
+        for (j = 0; j < gs->n_list; ++j) {
+            int32 d = list[j];
+            mfcc_t *m = mean[d];
+            mfcc_t *v = var[d];
+            mfcc_t dval = det[d];
+
+            for (i = 0; (i < featlen) && (dval >= topn[n_top - 1].dist); i++) {
+                mfcc_t diff;
+                diff = obs[f][i] - m[i];
+                dval -= diff * diff * v[i];
+            }
+            if ((i < featlen) || (dval < topn[n_top - 1].dist))
+                continue;
+            gauden_dist_insert(topn, n_top, d, dval);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Open the untransformed means or variances, either from the file given
+ * by option name, or if there is none, from the model bundle.
+ */
+static s3file_t *
+gauden_param_source(config_t *config, const char *name, const char *section)
+{
+    model_bundle_t *bundle;
+    const char *path;
+    s3file_t *s;
+
+    if ((path = config_str(config, name)) != NULL) {
+        if ((s = s3file_map_file(path)) == NULL)
+            E_ERROR_SYSTEM("Failed to open %s file '%s' for reading",
+                           name, path);
+        return s;
+    }
+    if ((path = config_str(config, "bundle")) == NULL) {
+        E_ERROR("No %s file or model bundle to reload %s from\n",
+                name, section);
+        return NULL;
+    }
+    if ((bundle = model_bundle_read(path)) == NULL)
+        return NULL;
+    /* The section keeps the mapping alive on its own. */
+    s = model_bundle_get(bundle, section);
+    model_bundle_free(bundle);
+    if (s == NULL)
+        E_ERROR("Model bundle %s has no %s\n", path, section);
+    return s;
+}
+
 int32
 gauden_mllr_transform(gauden_t *g, mllr_t *mllr, config_t *config)
 {
     int32 i, m, f, d, *flen;
-    const char *meanfile, *varfile;
-    s3file_t *s;
+    s3file_t *means, *vars;
 
-    /* Free data if already here */
+    /* Find the original parameters first, so that nothing is lost if
+     * they are not there. */
+    if ((means = gauden_param_source(config, "mean", "means")) == NULL)
+        return -1;
+    if ((vars = gauden_param_source(config, "var", "variances")) == NULL) {
+        s3file_free(means);
+        return -1;
+    }
+
+    /* Free data if already here (the transformed parameters are
+     * private to this process, and no longer match the cache) */
     if (g->mean)
-        gauden_param_free(g->mean);
+        gauden_param_free(g, g->mean);
     if (g->var)
-        gauden_param_free(g->var);
+        gauden_param_free(g, g->var);
     if (g->det)
-        ckd_free_3d(g->det);
+        gauden_det_free(g);
+    if (g->mmap)
+        s3file_free(g->mmap);
     if (g->featlen)
         ckd_free(g->featlen);
-    g->det = NULL;
+    g->mmap = NULL;
+    g->key = 0;
     g->featlen = NULL;
 
     /* Reload means and variances (un-precomputed). */
-    meanfile = config_str(config, "mean");
-    if ((s = s3file_map_file(meanfile)) == NULL) {
-        E_ERROR_SYSTEM("Failed to open mean file '%s' for reading", meanfile);
-        return -1;
-    }
-    g->mean = (mfcc_t ****)gauden_param_read(s, &g->n_mgau, &g->n_feat, &g->n_density,
+    g->mean = (mfcc_t ****)gauden_param_read(means, &g->n_mgau, &g->n_feat, &g->n_density,
                                              &g->featlen);
-    s3file_free(s);
-    varfile = config_str(config, "var");
-    if ((s = s3file_map_file(varfile)) == NULL) {
-        E_ERROR_SYSTEM("Failed to open mean file '%s' for reading", varfile);
-        return -1;
-    }
-    g->var = (mfcc_t ****)gauden_param_read(s, &m, &f, &d, &flen);
-    s3file_free(s);
+    s3file_free(means);
+    g->var = (mfcc_t ****)gauden_param_read(vars, &m, &f, &d, &flen);
+    s3file_free(vars);
     /* Verify mean and variance parameter dimensions */
     if ((m != g->n_mgau) || (f != g->n_feat) || (d != g->n_density)) {
         E_ERROR("Mixture-gaussians dimensions for means and variances differ\n");
@@ -68,16 +68,49 @@
  *
  */
 
+#include <string.h>
+
 /* Local headers. */
 #include <soundswallower/ms_mgau.h>
 
 static mgaufuncs_t ms_mgau_funcs = {
     "ms",
     ms_cont_mgau_frame_eval, /* frame_eval */
+    ms_cont_mgau_frame_eval_batch, /* frame_eval_batch */
+    NULL, /* frame_prepare */
     ms_mgau_mllr_transform, /* transform */
+    ms_mgau_clone, /* clone */
+    NULL, /* set_topn */
     ms_mgau_free /* free */
 };
 
+static gauden_gs_t *
+ms_mgau_gs_init(ms_mgau_model_t *msg)
+{
+    int32 n_list = config_int(msg->config, "gslist");
+
+    if (n_list < msg->topn) {
+        E_WARN("Gaussian selection shortlist (%d) smaller than topn (%d), using %d\n",
+               n_list, msg->topn, msg->topn);
+        n_list = msg->topn;
+    }
+    return gauden_gs_init(msg->g, config_int(msg->config, "gsvq"), n_list);
+}
+
+/**
+ * Allocate intermediate results, which are specific to one stream of
+ * input, unlike the rest of the model.
+ */
+static void
+ms_mgau_alloc_scratch(ms_mgau_model_t *msg)
+{
+    msg->dist = (gauden_dist_t ***)
+        ckd_calloc_3d(ACMOD_MAX_BATCH * msg->g->n_mgau, msg->g->n_feat,
+                      msg->topn, sizeof(gauden_dist_t));
+    msg->mgau_active = ckd_calloc(msg->g->n_mgau, sizeof(int8));
+    msg->sen_active = ckd_calloc(msg->s->n_sen, sizeof(*msg->sen_active));
+}
+
 mgau_t *
 ms_mgau_init_s3file(acmod_t *acmod,
                     s3file_t *means, s3file_t *vars, s3file_t *mixw,
@@ -98,9 +131,9 @@ ms_mgau_init_s3file(acmod_t *acmod,
     msg->g = NULL;
     msg->s = NULL;
 
-    if ((g = msg->g = gauden_init_s3file(means, vars,
-                                         config_float(config, "varfloor"),
-                                         lmath))
+    if ((g = msg->g = gauden_init_s3file_cached(means, vars,
+                                                config_float(config, "varfloor"),
+                                                lmath, acmod->cache))
         == NULL) {
         E_ERROR("Failed to read means and variances\n");
         goto error_out;
@@ -149,13 +182,19 @@ ms_mgau_init_s3file(acmod_t *acmod,
         msg->topn = msg->g->n_density;
     }
 
-    msg->dist = (gauden_dist_t ***)
-        ckd_calloc_3d(g->n_mgau, g->n_feat, msg->topn,
-                      sizeof(gauden_dist_t));
-    msg->mgau_active = ckd_calloc(g->n_mgau, sizeof(int8));
+    ms_mgau_alloc_scratch(msg);
+    msg->pool = acmod->pool;
+    if ((msg->simd = gmm_simd_get(config_str(config, "simd")))) {
+        E_INFO("Using %s SIMD kernels for Gaussian evaluation\n", msg->simd->name);
+        msg->simd_layout = gmm_simd_layout_init_cached(msg->simd, g,
+                                                       acmod->cache);
+    }
+    if (config_int(config, "gslist"))
+        msg->gs = ms_mgau_gs_init(msg);
 
     mg = (mgau_t *)msg;
     mg->vt = &ms_mgau_funcs;
+    mg->refcount = 1;
     return mg;
 error_out:
     ms_mgau_free(ps_mgau_base(msg));
@@ -235,19 +274,45 @@ ms_mgau_init(acmod_t *acmod)
         msg->topn = msg->g->n_density;
     }
 
-    msg->dist = (gauden_dist_t ***)
-        ckd_calloc_3d(g->n_mgau, g->n_feat, msg->topn,
-                      sizeof(gauden_dist_t));
-    msg->mgau_active = ckd_calloc(g->n_mgau, sizeof(int8));
+    ms_mgau_alloc_scratch(msg);
+    msg->pool = acmod->pool;
+    if ((msg->simd = gmm_simd_get(config_str(config, "simd")))) {
+        E_INFO("Using %s SIMD kernels for Gaussian evaluation\n", msg->simd->name);
+        msg->simd_layout = gmm_simd_layout_init_cached(msg->simd, g,
+                                                       acmod->cache);
+    }
+    if (config_int(config, "gslist"))
+        msg->gs = ms_mgau_gs_init(msg);
 
     mg = (mgau_t *)msg;
     mg->vt = &ms_mgau_funcs;
+    mg->refcount = 1;
     return mg;
 error_out:
     ms_mgau_free(ps_mgau_base(msg));
     return NULL;
 }
 
+mgau_t *
+ms_mgau_clone(mgau_t *mg, acmod_t *acmod)
+{
+    ms_mgau_model_t *other = (ms_mgau_model_t *)mg;
+    ms_mgau_model_t *msg;
+
+    /* Everything but the intermediate results is shared. */
+    msg = ckd_malloc(sizeof(*msg));
+    memcpy(msg, other, sizeof(*msg));
+    msg->config = acmod->config;
+    msg->pool = acmod->pool;
+    ms_mgau_alloc_scratch(msg);
+
+    mg = (mgau_t *)msg;
+    mg->frame_idx = 0;
+    mg->refcount = 1;
+    mg->shared = mgau_retain(ps_mgau_base(other));
+    return mg;
+}
+
 void
 ms_mgau_free(mgau_t *mg)
 {
@@ -255,14 +320,22 @@ ms_mgau_free(mgau_t *mg)
     if (msg == NULL)
         return;
 
-    if (msg->g)
-        gauden_free(msg->g);
-    if (msg->s)
-        senone_free(msg->s);
     if (msg->dist)
         ckd_free_3d((void *)msg->dist);
     if (msg->mgau_active)
         ckd_free(msg->mgau_active);
+    ckd_free(msg->sen_active);
+    if (mg->shared) {
+        mgau_free(mg->shared);
+        ckd_free(msg);
+        return;
+    }
+    if (msg->g)
+        gauden_free(msg->g);
+    if (msg->s)
+        senone_free(msg->s);
+    gmm_simd_layout_free(msg->simd_layout);
+    gauden_gs_free(msg->gs);
 
     ckd_free(msg);
 }
@@ -272,55 +345,137 @@ ms_mgau_mllr_transform(mgau_t *s,
                        mllr_t *mllr)
 {
     ms_mgau_model_t *msg = (ms_mgau_model_t *)s;
-    return gauden_mllr_transform(msg->g, mllr, msg->config);
+
+    if (gauden_mllr_transform(msg->g, mllr, msg->config) < 0)
+        return -1;
+    if (msg->simd) {
+        gmm_simd_layout_free(msg->simd_layout);
+        msg->simd_layout = gmm_simd_layout_init(msg->simd, msg->g);
+    }
+    if (msg->gs) {
+        gauden_gs_free(msg->gs);
+        msg->gs = ms_mgau_gs_init(msg);
+    }
+    return 0;
+}
+
+/* Work shared between threads for ms_cont_mgau_frame_eval_batch(). */
+typedef struct ms_mgau_job_s {
+    ms_mgau_model_t *msg;
+    int16 **senscr; /**< Senone scores for each frame */
+    mfcc_t ***feat; /**< Features for each frame */
+    int32 n_frames; /**< Number of frames */
+    int32 n_sen; /**< Number of senones to evaluate (in sen_active) */
+    int32 compallsen; /**< Evaluate all codebooks and senones */
+} ms_mgau_job_t;
+
+static void
+ms_mgau_dist_thread(void *data, int tid, int n_threads)
+{
+    ms_mgau_job_t *job = (ms_mgau_job_t *)data;
+    ms_mgau_model_t *msg = job->msg;
+    gauden_t *g = ms_mgau_gauden(msg);
+    int32 gid, k;
+
+    /* Do all frames for each codebook while it is in cache. */
+    for (gid = tid; gid < g->n_mgau; gid += n_threads) {
+        if (!job->compallsen && !msg->mgau_active[gid])
+            continue;
+        for (k = 0; k < job->n_frames; ++k) {
+            if (msg->gs && msg->simd)
+                gmm_simd_gauden_dist_gs(msg->simd, g, msg->gs, gid,
+                                        ms_mgau_topn(msg), job->feat[k],
+                                        msg->dist[k * g->n_mgau + gid]);
+            else if (msg->gs)
+                gauden_dist_gs(g, msg->gs, gid, ms_mgau_topn(msg), job->feat[k],
+                               msg->dist[k * g->n_mgau + gid]);
+            else if (msg->simd)
+                gmm_simd_gauden_dist(msg->simd, msg->simd_layout,
+                                     g, gid, ms_mgau_topn(msg), job->feat[k],
+                                     msg->dist[k * g->n_mgau + gid]);
+            else
+                gauden_dist(g, gid, ms_mgau_topn(msg), job->feat[k],
+                            msg->dist[k * g->n_mgau + gid]);
+        }
+    }
+}
+
+static void
+ms_mgau_senone_thread(void *data, int tid, int n_threads)
+{
+    ms_mgau_job_t *job = (ms_mgau_job_t *)data;
+    ms_mgau_model_t *msg = job->msg;
+    senone_t *sen = ms_mgau_senone(msg);
+    int32 n_mgau = ms_mgau_gauden(msg)->n_mgau;
+    int32 i, k;
+
+    for (i = tid; i < job->n_sen; i += n_threads) {
+        int32 s = job->compallsen ? i : msg->sen_active[i];
+        for (k = 0; k < job->n_frames; ++k)
+            job->senscr[k][s] = senone_eval(sen, s,
+                                            msg->dist[k * n_mgau + sen->mgau[s]],
+                                            ms_mgau_topn(msg));
+    }
+}
+
+static void
+ms_mgau_normalize(ms_mgau_model_t *msg, int16 *senscr, int32 n_sen,
+                  int32 compallsen)
+{
+    int32 i, best;
+
+    best = MAX_INT32;
+    for (i = 0; i < n_sen; i++) {
+        int32 s = compallsen ? i : msg->sen_active[i];
+        if (best > senscr[s]) {
+            best = senscr[s];
+        }
+    }
+    for (i = 0; i < n_sen; i++) {
+        int32 s = compallsen ? i : msg->sen_active[i];
+        int32 bs = senscr[s] - best;
+        if (bs > 32767)
+            bs = 32767;
+        if (bs < -32768)
+            bs = -32768;
+        senscr[s] = bs;
+    }
 }
 
 int32
-ms_cont_mgau_frame_eval(mgau_t *mg,
-                        int16 *senscr,
-                        uint8 *senone_active,
-                        int32 n_senone_active,
-                        mfcc_t **feat,
-                        int32 frame,
-                        int32 compallsen)
+ms_cont_mgau_frame_eval_batch(mgau_t *mg,
+                              int16 **senscr,
+                              uint8 *senone_active,
+                              int32 n_senone_active,
+                              mfcc_t ***feat,
+                              int32 frame,
+                              int32 n_frames,
+                              int32 compallsen)
 {
     ms_mgau_model_t *msg = (ms_mgau_model_t *)mg;
-    int32 gid;
-    int32 topn;
-    int32 best;
+    ms_mgau_job_t job;
     gauden_t *g;
     senone_t *sen;
+    int32 k;
 
     (void)frame;
-    topn = ms_mgau_topn(msg);
+    if (n_frames > ACMOD_MAX_BATCH) {
+        E_ERROR("Cannot evaluate %d frames at once (maximum %d)\n",
+                n_frames, ACMOD_MAX_BATCH);
+        return -1;
+    }
     g = ms_mgau_gauden(msg);
     sen = ms_mgau_senone(msg);
-
-    if (compallsen) {
-        int32 s;
-
-        for (gid = 0; gid < g->n_mgau; gid++)
-            gauden_dist(g, gid, topn, feat, msg->dist[gid]);
-
-        best = MAX_INT32;
-        for (s = 0; (uint32)s < sen->n_sen; s++) {
-            senscr[s] = senone_eval(sen, s, msg->dist[sen->mgau[s]], topn);
-            if (best > senscr[s]) {
-                best = senscr[s];
-            }
-        }
-
-        /* Normalize senone scores */
-        for (s = 0; (uint32)s < sen->n_sen; s++) {
-            int32 bs = senscr[s] - best;
-            if (bs > 32767)
-                bs = 32767;
-            if (bs < -32768)
-                bs = -32768;
-            senscr[s] = bs;
-        }
-    } else {
-        int32 i, n;
+    job.msg = msg;
+    job.senscr = senscr;
+    job.feat = feat;
+    job.n_frames = n_frames;
+    job.compallsen = compallsen;
+
+    if (compallsen)
+        job.n_sen = sen->n_sen;
+    else {
+        int32 gid, i, n;
         /* Flag all active mixture-gaussian codebooks */
         for (gid = 0; gid < g->n_mgau; gid++)
             msg->mgau_active[gid] = 0;
@@ -330,39 +485,35 @@ ms_cont_mgau_frame_eval(mgau_t *mg,
             /* senone_active consists of deltas. */
             int32 s = senone_active[i] + n;
             msg->mgau_active[sen->mgau[s]] = 1;
+            msg->sen_active[i] = s;
             n = s;
         }
+        job.n_sen = n_senone_active;
+    }
 
-        /* Compute topn gaussian density values (for active codebooks) */
-        for (gid = 0; gid < g->n_mgau; gid++) {
-            if (msg->mgau_active[gid])
-                gauden_dist(g, gid, topn, feat, msg->dist[gid]);
-        }
-
-        best = MAX_INT32;
-        n = 0;
-        for (i = 0; i < n_senone_active; i++) {
-            int32 s = senone_active[i] + n;
-            senscr[s] = senone_eval(sen, s, msg->dist[sen->mgau[s]], topn);
-            if (best > senscr[s]) {
-                best = senscr[s];
-            }
-            n = s;
-        }
+    /* Compute topn gaussian density values (for active codebooks),
+     * then senone scores (the pool waits for all threads between
+     * the two) */
+    thread_pool_run(msg->pool, ms_mgau_dist_thread, &job);
+    thread_pool_run(msg->pool, ms_mgau_senone_thread, &job);
 
-        /* Normalize senone scores */
-        n = 0;
-        for (i = 0; i < n_senone_active; i++) {
-            int32 s = senone_active[i] + n;
-            int32 bs = senscr[s] - best;
-            if (bs > 32767)
-                bs = 32767;
-            if (bs < -32768)
-                bs = -32768;
-            senscr[s] = bs;
-            n = s;
-        }
-    }
+    /* Normalize senone scores */
+    for (k = 0; k < n_frames; ++k)
+        ms_mgau_normalize(msg, senscr[k], job.n_sen, compallsen);
 
     return 0;
 }
+
+int32
+ms_cont_mgau_frame_eval(mgau_t *mg,
+                        int16 *senscr,
+                        uint8 *senone_active,
+                        int32 n_senone_active,
+                        mfcc_t **feat,
+                        int32 frame,
+                        int32 compallsen)
+{
+    return ms_cont_mgau_frame_eval_batch(mg, &senscr,
+                                         senone_active, n_senone_active,
+                                         &feat, frame, 1, compallsen);
+}
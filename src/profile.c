@@ -149,6 +149,11 @@ ptmr_start(ptmr_t *tm)
 {
 #if !defined(_WIN32)
     struct timeval e_start; /* Elapsed time */
+#if defined(HAVE_GETRUSAGE) && !defined(__EMSCRIPTEN__)
+    struct rusage start; /* CPU time */
+    getrusage(RUSAGE_SELF, &start);
+    tm->start_cpu = make_sec(&start.ru_utime) + make_sec(&start.ru_stime);
+#endif
     gettimeofday(&e_start, 0);
     tm->start_elapsed = make_sec(&e_start);
 #else
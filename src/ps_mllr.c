@@ -43,6 +43,7 @@
 
 #include <soundswallower/acmod.h>
 #include <soundswallower/ckd_alloc.h>
+#include <soundswallower/refcount.h>
 
 mllr_t *
 mllr_read(const char *regmatfile)
@@ -131,19 +132,19 @@ mllr_retain(mllr_t *mllr)
 {
     if (mllr == NULL)
         return NULL;
-    ++mllr->refcnt;
+    refcount_inc(&mllr->refcnt);
     return mllr;
 }
 
 int
 mllr_free(mllr_t *mllr)
 {
-    int i;
+    int i, refcount;
 
     if (mllr == NULL)
         return 0;
-    if (--mllr->refcnt > 0)
-        return mllr->refcnt;
+    if ((refcount = refcount_dec(&mllr->refcnt)) > 0)
+        return refcount;
 
     for (i = 0; i < mllr->n_feat; ++i) {
         if (mllr->A)
@@ -56,7 +56,11 @@
 static mgaufuncs_t ptm_mgau_funcs = {
     "ptm",
     ptm_mgau_frame_eval, /* frame_eval */
+    ptm_mgau_frame_eval_batch, /* frame_eval_batch */
+    ptm_mgau_frame_prepare, /* frame_prepare */
     ptm_mgau_mllr_transform, /* transform */
+    ptm_mgau_clone, /* clone */
+    ptm_mgau_set_topn, /* set_topn */
     ptm_mgau_free /* free */
 };
 
@@ -84,15 +88,15 @@ insertion_sort_topn(ptm_topn_t *topn, int i, int32 d)
 }
 
 static int
-eval_topn(ptm_mgau_t *s, int cb, int feat, mfcc_t *z)
+eval_topn(ptm_mgau_t *s, ptm_fast_eval_t *f, int cb, int feat, mfcc_t *z)
 {
     ptm_topn_t *topn;
     int i, ceplen;
 
-    topn = s->f->topn[cb][feat];
+    topn = f->topn[cb][feat];
     ceplen = s->g->featlen[feat];
 
-    for (i = 0; i < s->max_topn; i++) {
+    for (i = 0; i < s->topn; i++) {
         mfcc_t *mean, diff[4], sqdiff[4], compl[4]; /* diff, diff^2, component likelihood */
         mfcc_t *var, d;
         mfcc_t *obs;
@@ -134,6 +138,35 @@ eval_topn(ptm_mgau_t *s, int cb, int feat, mfcc_t *z)
     return topn[0].score;
 }
 
+/* Same as eval_topn() but using SIMD kernels (tid is the thread
+ * index, for scratch space). */
+static int
+eval_topn_simd(ptm_mgau_t *s, ptm_fast_eval_t *f, int cb, int feat, mfcc_t *z, int tid)
+{
+    ptm_topn_t *topn;
+    int32 *cw = s->simd_cw[tid];
+    mfcc_t *dist = s->simd_dist[tid];
+    int i;
+
+    topn = f->topn[cb][feat];
+    /* Insertion only ever moves entries before i, so we can collect
+     * all the codewords up front and evaluate them together. */
+    for (i = 0; i < s->topn; i++)
+        cw[i] = topn[i].cw;
+    s->simd->eval_list(z, s->g->mean[cb][feat][0], s->g->var[cb][feat][0],
+                       s->g->det[cb][feat], cw, s->topn,
+                       s->g->featlen[feat], dist);
+    for (i = 0; i < s->topn; i++) {
+        mfcc_t d = dist[i];
+        if (d < (mfcc_t)MAX_NEG_INT32)
+            insertion_sort_topn(topn, i, MAX_NEG_INT32);
+        else
+            insertion_sort_topn(topn, i, (int32)d);
+    }
+
+    return topn[0].score;
+}
+
 /* This looks bad, but it actually isn't.  Less than 1% of eval_cb's
  * time is spent doing this. */
 static void
@@ -148,15 +181,15 @@ insertion_sort_cb(ptm_topn_t **cur, ptm_topn_t *worst, ptm_topn_t *best,
 }
 
 static int
-eval_cb(ptm_mgau_t *s, int cb, int feat, mfcc_t *z)
+eval_cb(ptm_mgau_t *s, ptm_fast_eval_t *f, int cb, int feat, mfcc_t *z)
 {
     ptm_topn_t *worst, *best, *topn;
     mfcc_t *mean;
     mfcc_t *var, *det, *detP, *detE;
     int32 i, ceplen;
 
-    best = topn = s->f->topn[cb][feat];
-    worst = topn + (s->max_topn - 1);
+    best = topn = f->topn[cb][feat];
+    worst = topn + (s->topn - 1);
     mean = s->g->mean[cb][feat][0];
     var = s->g->var[cb][feat][0];
     det = s->g->det[cb][feat];
@@ -208,12 +241,12 @@ eval_cb(ptm_mgau_t *s, int cb, int feat, mfcc_t *z)
         }
         if (d < thresh)
             continue;
-        for (i = 0; i < s->max_topn; i++) {
+        for (i = 0; i < s->topn; i++) {
             /* already there, so don't need to insert */
             if (topn[i].cw == cw)
                 break;
         }
-        if (i < s->max_topn)
+        if (i < s->topn)
             continue; /* already there.  Don't insert */
         if (d < (mfcc_t)MAX_NEG_INT32)
             insertion_sort_cb(&cur, worst, best, cw, MAX_NEG_INT32);
@@ -224,73 +257,267 @@ eval_cb(ptm_mgau_t *s, int cb, int feat, mfcc_t *z)
     return best->score;
 }
 
-/**
- * Compute top-N densities for active codebooks (and prune)
- */
+/* Same as eval_cb() but using SIMD kernels. */
 static int
-ptm_mgau_codebook_eval(ptm_mgau_t *s, mfcc_t **z, int frame)
+eval_cb_simd(ptm_mgau_t *s, ptm_fast_eval_t *f, int cb, int feat, mfcc_t *z)
 {
-    int i, j;
+    const gmm_simd_t *simd = s->simd;
+    gmm_simd_layout_t *layout = s->simd_layout;
+    ptm_topn_t *worst, *best, *topn;
+    mfcc_t *mean, *var, *det;
+    int32 b, i, ceplen, stride;
+
+    best = topn = f->topn[cb][feat];
+    worst = topn + (s->topn - 1);
+    mean = layout->mean[cb][feat];
+    var = layout->var[cb][feat];
+    det = layout->det[cb][feat];
+    ceplen = s->g->featlen[feat];
+    stride = ceplen * simd->width;
+
+    for (b = 0; b < layout->n_block; ++b) {
+        mfcc_t d[GMM_SIMD_MAX_WIDTH];
+        int32 k;
+
+        /* The threshold can only go up as we insert things, so if the
+         * whole block falls below it here, none of it would have been
+         * inserted by the scalar code either. */
+        if (simd->eval_block(z, mean + b * stride, var + b * stride,
+                             det + b * simd->width, ceplen,
+                             (mfcc_t)worst->score, d)
+            < ceplen)
+            continue;
+        for (k = 0; k < simd->width; ++k) {
+            ptm_topn_t *cur;
+            int32 cw = b * simd->width + k;
 
-    /* First evaluate top-N from previous frame. */
-    for (i = 0; i < s->g->n_mgau; ++i)
-        for (j = 0; j < s->g->n_feat; ++j)
-            eval_topn(s, i, j, z[j]);
+            if (cw >= s->g->n_density)
+                break;
+            if (d[k] < (mfcc_t)worst->score)
+                continue;
+            for (i = 0; i < s->topn; i++) {
+                /* already there, so don't need to insert */
+                if (topn[i].cw == cw)
+                    break;
+            }
+            if (i < s->topn)
+                continue; /* already there.  Don't insert */
+            if (d[k] < (mfcc_t)MAX_NEG_INT32)
+                insertion_sort_cb(&cur, worst, best, cw, MAX_NEG_INT32);
+            else
+                insertion_sort_cb(&cur, worst, best, cw, (int32)d[k]);
+        }
+    }
 
-    /* If frame downsampling is in effect, possibly do nothing else. */
-    if (frame % s->ds_ratio)
-        return 0;
+    return best->score;
+}
 
-    /* Evaluate remaining codebooks. */
-    for (i = 0; i < s->g->n_mgau; ++i) {
-        if (bitvec_is_clear(s->f->mgau_active, i))
+/* Same as eval_topn() but using quantized Gaussians. */
+static int
+eval_topn_quant(ptm_mgau_t *s, ptm_fast_eval_t *f, int cb, int feat, mfcc_t *z, int tid)
+{
+    ptm_topn_t *topn;
+    int32 *qobs = s->qobs[tid];
+    int i;
+
+    topn = f->topn[cb][feat];
+    gauden_quant_obs(s->g, cb, feat, z, qobs);
+    for (i = 0; i < s->topn; i++) {
+        int32 cw = topn[i].cw;
+        mfcc_t d = gauden_quant_dist(s->g, cb, feat, qobs, cw,
+                                     (mfcc_t)MAX_NEG_INT32);
+        if (d < (mfcc_t)MAX_NEG_INT32)
+            insertion_sort_topn(topn, i, MAX_NEG_INT32);
+        else
+            insertion_sort_topn(topn, i, (int32)d);
+    }
+
+    return topn[0].score;
+}
+
+/* Same as eval_cb() but using quantized Gaussians. */
+static int
+eval_cb_quant(ptm_mgau_t *s, ptm_fast_eval_t *f, int cb, int feat, mfcc_t *z, int tid)
+{
+    ptm_topn_t *worst, *best, *topn;
+    int32 *qobs = s->qobs[tid];
+    mfcc_t *det;
+    int32 i, cw;
+
+    best = topn = f->topn[cb][feat];
+    worst = topn + (s->topn - 1);
+    det = s->g->det[cb][feat];
+    gauden_quant_obs(s->g, cb, feat, z, qobs);
+
+    for (cw = 0; cw < s->g->n_density; ++cw) {
+        ptm_topn_t *cur;
+        mfcc_t d, thresh;
+
+        thresh = (mfcc_t)worst->score;
+        if (det[cw] < thresh)
+            continue;
+        d = gauden_quant_dist(s->g, cb, feat, qobs, cw, thresh);
+        if (d < thresh)
             continue;
-        for (j = 0; j < s->g->n_feat; ++j) {
-            eval_cb(s, i, j, z[j]);
+        for (i = 0; i < s->topn; i++) {
+            /* already there, so don't need to insert */
+            if (topn[i].cw == cw)
+                break;
         }
+        if (i < s->topn)
+            continue; /* already there.  Don't insert */
+        if (d < (mfcc_t)MAX_NEG_INT32)
+            insertion_sort_cb(&cur, worst, best, cw, MAX_NEG_INT32);
+        else
+            insertion_sort_cb(&cur, worst, best, cw, (int32)d);
     }
-    return 0;
+
+    return best->score;
 }
 
-/**
- * Normalize densities to produce "posterior probabilities",
- * i.e. things with a reasonable dynamic range, then scale and
- * clamp them to the acceptable range.  This is actually done
- * solely to ensure that we can use fast_logmath_add().  Note that
- * unless we share the same normalizer across all codebooks for
- * each feature stream we get defective scores (that's why these
- * loops are inside out - doing it per-feature should give us
- * greater precision). */
-static int
-ptm_mgau_codebook_norm(ptm_mgau_t *s, mfcc_t **z, int frame)
+/* Evaluate all codewords of a codebook for every feature stream,
+ * with whichever kernel is in use. */
+static void
+eval_cb_all(ptm_mgau_t *s, ptm_fast_eval_t *f, int cb, mfcc_t **z, int tid)
 {
-    int i, j;
+    int j;
 
-    (void)z;
-    (void)frame;
     for (j = 0; j < s->g->n_feat; ++j) {
-        int32 norm = WORST_SCORE;
-        for (i = 0; i < s->g->n_mgau; ++i) {
-            if (bitvec_is_clear(s->f->mgau_active, i))
+        if (s->g->quant_bits)
+            eval_cb_quant(s, f, cb, j, z[j], tid);
+        else if (s->simd)
+            eval_cb_simd(s, f, cb, j, z[j]);
+        else
+            eval_cb(s, f, cb, j, z[j]);
+    }
+}
+
+/* Work shared between threads for ptm_mgau_codebook_eval(). */
+typedef struct ptm_cb_job_s {
+    ptm_mgau_t *s;
+    mfcc_t ***z; /**< Features for each frame */
+    int frame; /**< First frame */
+    int n_frames; /**< Number of frames */
+} ptm_cb_job_t;
+
+static void
+ptm_mgau_codebook_eval_thread(void *data, int tid, int n_threads)
+{
+    ptm_cb_job_t *job = (ptm_cb_job_t *)data;
+    ptm_mgau_t *s = job->s;
+    size_t cb_size = s->g->n_feat * s->max_topn * sizeof(ptm_topn_t);
+    int i, j, k;
+
+    /* Codebooks are independent, so each thread takes every
+     * n_threads'th one (which balances the load better than
+     * contiguous ranges, as active codebooks tend to cluster).
+     * Likewise each codebook only depends on its own top-N from the
+     * previous frame, so we do all the frames for one codebook at
+     * once, while its parameters are in cache. */
+    for (i = tid; i < s->g->n_mgau; i += n_threads) {
+        for (k = 0; k < job->n_frames; ++k) {
+            int frame = job->frame + k;
+            ptm_fast_eval_t *f, *lastf;
+            mfcc_t **z = job->z[k];
+
+            /* Get the previous frame's top-N information (on the
+             * first frame of the input this is just all WORST_DIST,
+             * no harm in that) */
+            f = s->hist + frame % s->n_fast_hist;
+            lastf = s->hist + (frame + s->n_fast_hist - 1) % s->n_fast_hist;
+            memcpy(f->topn[i][0], lastf->topn[i][0], cb_size);
+            /* First evaluate top-N from previous frame. */
+            for (j = 0; j < s->g->n_feat; ++j)
+                if (s->g->quant_bits)
+                    eval_topn_quant(s, f, i, j, z[j], tid);
+                else if (s->simd)
+                    eval_topn_simd(s, f, i, j, z[j], tid);
+                else
+                    eval_topn(s, f, i, j, z[j]);
+            /* If frame downsampling is in effect, possibly do nothing else. */
+            if (!f->full_eval)
                 continue;
-            if (norm < s->f->topn[i][j][0].score >> SENSCR_SHIFT)
-                norm = s->f->topn[i][j][0].score >> SENSCR_SHIFT;
-        }
-        assert(norm != WORST_SCORE);
-        for (i = 0; i < s->g->n_mgau; ++i) {
-            int32 k;
-            if (bitvec_is_clear(s->f->mgau_active, i))
+            /* Evaluate remaining codewords if active. */
+            if (bitvec_is_clear(f->mgau_active, i))
                 continue;
-            for (k = 0; k < s->max_topn; ++k) {
-                s->f->topn[i][j][k].score >>= SENSCR_SHIFT;
-                s->f->topn[i][j][k].score -= norm;
-                s->f->topn[i][j][k].score = -s->f->topn[i][j][k].score;
-                if (s->f->topn[i][j][k].score > MAX_NEG_ASCR)
-                    s->f->topn[i][j][k].score = MAX_NEG_ASCR;
-            }
+            eval_cb_all(s, f, i, z, tid);
         }
     }
+}
+
+/**
+ * Weight the first feature stream by the inverse of its average
+ * variance over all densities, divided by its dimensionality, so
+ * that the distance used for adaptive downsampling is the mean
+ * squared change in standard deviations.
+ */
+static void
+ptm_mgau_ds_weight(ptm_mgau_t *s)
+{
+    /* Undo the scaling from gauden_dist_precompute(). */
+    double lnbase = log(logmath_get_base(s->lmath));
+    int i, m, d;
+
+    s->ds_weight = ckd_calloc(s->g->featlen[0], sizeof(*s->ds_weight));
+    for (i = 0; i < s->g->featlen[0]; ++i) {
+        double var = 0;
+        for (m = 0; m < s->g->n_mgau; ++m)
+            for (d = 0; d < s->g->n_density; ++d)
+                var += 1.0 / (2.0 * lnbase * s->g->var[m][0][d][i]);
+        var /= s->g->n_mgau * s->g->n_density;
+        s->ds_weight[i] = (mfcc_t)(1.0 / (var * s->g->featlen[0]));
+    }
+}
 
+/**
+ * Decide whether to evaluate all codewords in a frame, or just the
+ * previous top-N.  In adaptive mode, this is done when the cepstra
+ * have moved far enough from the last frame where it was done.
+ */
+static int
+ptm_mgau_full_eval(ptm_mgau_t *s, mfcc_t **z, int frame)
+{
+    mfcc_t dist = 0;
+    int i;
+
+    if (s->ds_thresh == 0)
+        return frame % s->ds_ratio == 0;
+    if (frame > 0 && s->ds_skip < s->ds_max) {
+        for (i = 0; i < s->g->featlen[0]; ++i) {
+            mfcc_t diff = z[0][i] - s->ds_ref[i];
+            dist += diff * diff * s->ds_weight[i];
+        }
+        if (dist < s->ds_thresh * s->ds_thresh) {
+            ++s->ds_skip;
+            return FALSE;
+        }
+    }
+    memcpy(s->ds_ref, z[0], s->g->featlen[0] * sizeof(*s->ds_ref));
+    s->ds_skip = 0;
+    return TRUE;
+}
+
+/**
+ * Compute top-N densities for active codebooks (and prune) for
+ * n_frames frames starting at frame.
+ */
+static int
+ptm_mgau_codebook_eval(ptm_mgau_t *s, mfcc_t ***z, int frame, int n_frames)
+{
+    ptm_cb_job_t job;
+    int k;
+
+    /* This depends on the previous frame, so decide before
+     * splitting up the work. */
+    for (k = 0; k < n_frames; ++k)
+        s->hist[(frame + k) % s->n_fast_hist].full_eval
+            = ptm_mgau_full_eval(s, z[k], frame + k);
+
+    job.s = s;
+    job.z = z;
+    job.frame = frame;
+    job.n_frames = n_frames;
+    thread_pool_run(s->pool, ptm_mgau_codebook_eval_thread, &job);
     return 0;
 }
 
@@ -320,28 +547,117 @@ ptm_mgau_calc_cb_active(ptm_mgau_t *s, uint8 *senone_active,
     return 0;
 }
 
+/* Work shared between threads for ptm_mgau_senone_eval(). */
+typedef struct ptm_sen_job_s {
+    ptm_mgau_t *s;
+    int16 *senone_scores; /**< Output senone scores */
+    int32 n_active; /**< Total number of active senones */
+} ptm_sen_job_t;
+
+static void
+ptm_mgau_senone_eval_thread(void *data, int tid, int n_threads)
+{
+    ptm_sen_job_t *job = (ptm_sen_job_t *)data;
+    ptm_mgau_t *s = job->s;
+    int16 *senone_scores = job->senone_scores;
+    int32 *fden = s->cb_fden[tid], *ascore = s->cb_ascore[tid];
+    int32 cb, bestscore, n_before;
+
+    /* Each thread takes a contiguous range of codebooks (and thus of
+     * cb_sen) with about the same number of active senones, which
+     * are what the work is proportional to.  A codebook goes to the
+     * thread whose share contains its middle senone. */
+    bestscore = MAX_INT32;
+    n_before = 0;
+    for (cb = 0; cb < s->g->n_mgau; ++cb) {
+        int32 *active = s->cb_active + s->cb_sen_start[cb];
+        int32 n_active = s->n_cb_active[cb];
+        int32 n_cbsen = s->cb_sen_start[cb + 1] - s->cb_sen_start[cb];
+        int32 rowlen = s->mixw_cb ? (n_cbsen + 1) / 2 : n_cbsen;
+        int32 mid;
+        int f, j, k;
+
+        if (n_active == 0)
+            continue;
+        mid = n_before + n_active / 2;
+        n_before += n_active;
+        if ((int64)mid * n_threads / job->n_active != tid)
+            continue;
+        /* For each feature, log-sum codeword scores + mixw to get
+         * feature density, then sum (multiply) to get ascore */
+        memset(ascore, 0, n_active * sizeof(*ascore));
+        for (f = 0; f < s->g->n_feat; ++f) {
+            ptm_topn_t *topn = s->f->topn[cb][f];
+            for (j = 0; j < s->topn; ++j) {
+                uint8 *mixw = s->cb_mixw
+                                  ? s->cb_mixw[f][cb] + topn[j].cw * rowlen
+                                  : s->mixw[f][topn[j].cw];
+                /* Normalize densities to produce "posterior
+                 * probabilities", i.e. things with a reasonable
+                 * dynamic range, then clamp them to the acceptable
+                 * range.  This is actually done solely to ensure that
+                 * we can use fast_logmath_add(). */
+                int32 score = s->feat_norm[f] - (topn[j].score >> SENSCR_SHIFT);
+
+                if (score > MAX_NEG_ASCR)
+                    score = MAX_NEG_ASCR;
+
+                if (s->mixw_cb) {
+                    for (k = 0; k < n_active; ++k) {
+                        int32 idx = active[k];
+                        int32 dcw = (mixw[idx / 2] >> ((idx & 1) * 4)) & 0x0f;
+                        if (j == 0)
+                            fden[k] = s->mixw_cb[dcw] + score;
+                        else
+                            fden[k] = fast_logmath_add(s->lmath_8b, fden[k],
+                                                       s->mixw_cb[dcw] + score);
+                    }
+                } else if (j == 0) {
+                    for (k = 0; k < n_active; ++k)
+                        fden[k] = mixw[active[k]] + score;
+                } else {
+                    for (k = 0; k < n_active; ++k)
+                        fden[k] = fast_logmath_add(s->lmath_8b, fden[k],
+                                                   mixw[active[k]] + score);
+                }
+            }
+            for (k = 0; k < n_active; ++k)
+                ascore[k] += fden[k];
+        }
+        for (k = 0; k < n_active; ++k) {
+            int sen = s->cb_mixw
+                          ? s->cb_sen[s->cb_sen_start[cb] + active[k]]
+                          : active[k];
+            if (ascore[k] < bestscore)
+                bestscore = ascore[k];
+            senone_scores[sen] = ascore[k];
+        }
+    }
+    s->sen_best[tid] = bestscore;
+}
+
 /**
  * Compute senone scores from top-N densities for active codebooks.
  */
 static int
 ptm_mgau_senone_eval(ptm_mgau_t *s, int16 *senone_scores,
                      uint8 *senone_active, int32 n_senone_active,
-                     int compall)
+                     mfcc_t **z, int compall)
 {
-    int32 i, lastsen, bestscore;
+    ptm_sen_job_t job;
+    int32 i, j, cb, lastsen, bestscore;
 
     memset(senone_scores, 0, s->n_sen * sizeof(*senone_scores));
-    /* FIXME: This is the non-cache-efficient way to do this.  We want
-     * to evaluate one codeword at a time but this requires us to have
-     * a reverse codebook to senone mapping, which we don't have
-     * (yet), since different codebooks have different top-N
-     * codewords. */
+    /* Sort active senones by codebook, so that we can evaluate one
+     * codeword at a time, accessing its mixture weights in order.
+     * What we store is the column in a row of mixture weights, which
+     * is the position in the codebook if they were reordered, or the
+     * senone itself if they are used in place. */
+    memset(s->n_cb_active, 0, s->g->n_mgau * sizeof(*s->n_cb_active));
     if (compall)
         n_senone_active = s->n_sen;
-    bestscore = MAX_INT32;
     for (lastsen = i = 0; i < n_senone_active; ++i) {
-        int sen, f, cb;
-        int ascore;
+        int sen;
 
         if (compall)
             sen = i;
@@ -349,52 +665,51 @@ ptm_mgau_senone_eval(ptm_mgau_t *s, int16 *senone_scores,
             sen = senone_active[i] + lastsen;
         lastsen = sen;
         cb = s->sen2cb[sen];
+        s->cb_active[s->cb_sen_start[cb] + s->n_cb_active[cb]++]
+            = s->cb_mixw ? s->sen2cbidx[sen] : sen;
+    }
+    if (n_senone_active == 0)
+        return 0;
 
-        if (bitvec_is_clear(s->f->mgau_active, cb)) {
-            int j;
-            /* Because senone_active is deltas we can't really "knock
-             * out" senones from pruned codebooks, and in any case,
-             * it wouldn't make any difference to the search code,
-             * which doesn't expect senone_active to change. */
-            for (f = 0; f < s->g->n_feat; ++f) {
-                for (j = 0; j < s->max_topn; ++j) {
-                    s->f->topn[cb][f][j].score = MAX_NEG_ASCR;
-                }
-            }
-        }
-        /* For each feature, log-sum codeword scores + mixw to get
-         * feature density, then sum (multiply) to get ascore */
-        ascore = 0;
-        for (f = 0; f < s->g->n_feat; ++f) {
-            ptm_topn_t *topn;
-            int j, fden = 0;
-            topn = s->f->topn[cb][f];
-            for (j = 0; j < s->max_topn; ++j) {
-                int mixw;
-                /* Find mixture weight for this codeword. */
-                if (s->mixw_cb) {
-                    int dcw = s->mixw[f][topn[j].cw][sen / 2];
-                    dcw = (dcw & 1) ? dcw >> 4 : dcw & 0x0f;
-                    mixw = s->mixw_cb[dcw];
-                } else {
-                    mixw = s->mixw[f][topn[j].cw][sen];
-                }
-                if (j == 0)
-                    fden = mixw + topn[j].score;
-                else
-                    fden = fast_logmath_add(s->lmath_8b, fden,
-                                            mixw + topn[j].score);
-                E_DEBUG("fden[%d][%d] l+= %d + %d = %d\n",
-                        sen, f, mixw, topn[j].score, fden);
-            }
-            ascore += fden;
+    /* If top-N for this frame was computed with a different set of
+     * active senones (see ptm_mgau_frame_prepare()), some of the
+     * codebooks we need now may not have been fully evaluated.  Do
+     * that now, since they are as good as new once that is done. */
+    for (cb = 0; cb < s->g->n_mgau; ++cb) {
+        if (s->n_cb_active[cb] == 0
+            || bitvec_is_set(s->f->mgau_active, cb))
+            continue;
+        if (s->f->full_eval)
+            eval_cb_all(s, s->f, cb, z, 0);
+        bitvec_set(s->f->mgau_active, cb);
+    }
+    /* Use the same normalizer across all codebooks for each feature
+     * stream, otherwise we get defective scores.  It is taken over
+     * the codebooks we are scoring, not all the ones evaluated, so
+     * that scores only depend on the active senones. */
+    for (j = 0; j < s->g->n_feat; ++j) {
+        int32 norm = WORST_SCORE;
+        for (cb = 0; cb < s->g->n_mgau; ++cb) {
+            if (s->n_cb_active[cb] == 0)
+                continue;
+            if (norm < s->f->topn[cb][j][0].score >> SENSCR_SHIFT)
+                norm = s->f->topn[cb][j][0].score >> SENSCR_SHIFT;
         }
-        if (ascore < bestscore)
-            bestscore = ascore;
-        senone_scores[sen] = ascore;
+        s->feat_norm[j] = norm;
     }
+
+    /* Codebooks are independent once their senones are sorted. */
+    job.s = s;
+    job.senone_scores = senone_scores;
+    job.n_active = n_senone_active;
+    thread_pool_run(s->pool, ptm_mgau_senone_eval_thread, &job);
+    bestscore = MAX_INT32;
+    for (i = 0; i < thread_pool_n_threads(s->pool); ++i)
+        if (s->sen_best[i] < bestscore)
+            bestscore = s->sen_best[i];
+
     /* Normalize the scores again (finishing the job we started above
-     * in ptm_mgau_codebook_eval...) */
+     * with feat_norm...) */
     for (i = 0; i < s->n_sen; ++i) {
         senone_scores[i] -= bestscore;
     }
@@ -403,56 +718,100 @@ ptm_mgau_senone_eval(ptm_mgau_t *s, int16 *senone_scores,
 }
 
 /**
- * Compute senone scores for the active senones.
+ * Compute senone scores for the active senones in several frames.
  */
 int32
-ptm_mgau_frame_eval(mgau_t *ps,
-                    int16 *senone_scores,
-                    uint8 *senone_active,
-                    int32 n_senone_active,
-                    mfcc_t **featbuf, int32 frame,
-                    int32 compallsen)
+ptm_mgau_frame_eval_batch(mgau_t *ps,
+                          int16 **senone_scores,
+                          uint8 *senone_active,
+                          int32 n_senone_active,
+                          mfcc_t ***featbuf, int32 frame,
+                          int32 n_frames,
+                          int32 compallsen)
 {
     ptm_mgau_t *s = (ptm_mgau_t *)ps;
-    int fast_eval_idx;
-
-    /* Find the appropriate frame in the rotating history buffer
-     * corresponding to the requested input frame.  No bounds checking
-     * is done here, which just means you'll get semi-random crap if
-     * you request a frame in the future or one that's too far in the
-     * past.  Since the history buffer is just used for fast match
-     * that might not be fatal. */
-    fast_eval_idx = frame % s->n_fast_hist;
-    s->f = s->hist + fast_eval_idx;
-    /* Compute the top-N codewords for every codebook, unless this
-     * is a past frame, in which case we already have them (we
-     * hope!) */
+    int k;
+
+    /* We can only keep the top-N for so many frames. */
+    if (n_frames >= s->n_fast_hist) {
+        E_ERROR("Cannot evaluate %d frames at once (maximum %d)\n",
+                n_frames, s->n_fast_hist - 1);
+        return -1;
+    }
+    /* Compute the top-N codewords for every codebook, unless these
+     * are past frames, in which case we already have them (we
+     * hope!).  The rotating history buffer is indexed by frame, with
+     * no bounds checking, which just means you'll get semi-random
+     * crap if you request a frame in the future or one that's too far
+     * in the past.  Since the history buffer is just used for fast
+     * match that might not be fatal. */
     if (frame >= ps_mgau_base(ps)->frame_idx) {
-        ptm_fast_eval_t *lastf;
-        /* Get the previous frame's top-N information (on the
-         * first frame of the input this is just all WORST_DIST,
-         * no harm in that) */
-        if (fast_eval_idx == 0)
-            lastf = s->hist + s->n_fast_hist - 1;
-        else
-            lastf = s->hist + fast_eval_idx - 1;
-        /* Copy in initial top-N info */
-        memcpy(s->f->topn[0][0], lastf->topn[0][0],
-               s->g->n_mgau * s->g->n_feat * s->max_topn * sizeof(ptm_topn_t));
-        /* Generate initial active codebook list (this might not be
+        /* Generate initial active codebook lists (this might not be
          * necessary) */
-        ptm_mgau_calc_cb_active(s, senone_active, n_senone_active, compallsen);
-        /* Now evaluate top-N, prune, and evaluate remaining codebooks. */
-        ptm_mgau_codebook_eval(s, featbuf, frame);
-        ptm_mgau_codebook_norm(s, featbuf, frame);
+        for (k = 0; k < n_frames; ++k) {
+            s->f = s->hist + (frame + k) % s->n_fast_hist;
+            ptm_mgau_calc_cb_active(s, senone_active, n_senone_active, compallsen);
+        }
+        /* Now evaluate top-N and evaluate remaining codebooks. */
+        ptm_mgau_codebook_eval(s, featbuf, frame, n_frames);
     }
     /* Evaluate intersection of active senones and active codebooks. */
-    ptm_mgau_senone_eval(s, senone_scores, senone_active,
-                         n_senone_active, compallsen);
+    for (k = 0; k < n_frames; ++k) {
+        s->f = s->hist + (frame + k) % s->n_fast_hist;
+        ptm_mgau_senone_eval(s, senone_scores[k], senone_active,
+                             n_senone_active, featbuf[k], compallsen);
+    }
 
     return 0;
 }
 
+/**
+ * Compute top-N codewords for several frames, for the codebooks of a
+ * guess at the active senones.
+ */
+int32
+ptm_mgau_frame_prepare(mgau_t *ps,
+                       uint8 *senone_active,
+                       int32 n_senone_active,
+                       mfcc_t ***featbuf, int32 frame,
+                       int32 n_frames)
+{
+    ptm_mgau_t *s = (ptm_mgau_t *)ps;
+    int k;
+
+    /* With frame downsampling, the top-N of skipped frames depends on
+     * which codebooks were fully evaluated in the last frame that
+     * wasn't, and this has to match what those frames are scored
+     * with, so we can't guess. */
+    if (s->ds_ratio > 1 || s->ds_thresh > 0)
+        return 0;
+    if (n_frames >= s->n_fast_hist)
+        n_frames = s->n_fast_hist - 1;
+    for (k = 0; k < n_frames; ++k) {
+        s->f = s->hist + (frame + k) % s->n_fast_hist;
+        ptm_mgau_calc_cb_active(s, senone_active, n_senone_active, FALSE);
+    }
+    ptm_mgau_codebook_eval(s, featbuf, frame, n_frames);
+
+    return n_frames;
+}
+
+/**
+ * Compute senone scores for the active senones.
+ */
+int32
+ptm_mgau_frame_eval(mgau_t *ps,
+                    int16 *senone_scores,
+                    uint8 *senone_active,
+                    int32 n_senone_active,
+                    mfcc_t **featbuf, int32 frame,
+                    int32 compallsen)
+{
+    return ptm_mgau_frame_eval_batch(ps, &senone_scores,
+                                     senone_active, n_senone_active,
+                                     &featbuf, frame, 1, compallsen);
+}
+
 int
 read_sendump(s3file_t *s3f, gauden_t *g,
              int32 mdef_n_sen, uint8 **out_mixw_cb,
@@ -691,6 +1050,325 @@ read_mixw(s3file_t *s3f, gauden_t *g, logmath_t *lmath,
     return n_sen;
 }
 
+static void
+ptm_mgau_free_mixw(ptm_mgau_t *s)
+{
+    if (s->sendump_mmap) {
+        ckd_free_2d(s->mixw);
+        s3file_free(s->sendump_mmap);
+    } else {
+        ckd_free_3d(s->mixw);
+    }
+    s->mixw = NULL;
+    s->sendump_mmap = NULL;
+}
+
+/**
+ * Build the mapping of senones to codebooks (assumed to be their base
+ * phones) and the reverse mapping.
+ *
+ * @return number of bytes of reordered mixture weights per feature.
+ */
+static size_t
+ptm_mgau_build_cb_map(ptm_mgau_t *s, bin_mdef_t *mdef)
+{
+    size_t n_bytes;
+    int32 i, cb, *n_cbsen;
+
+    s->sen2cb = ckd_calloc(s->n_sen, sizeof(*s->sen2cb));
+    for (i = 0; i < s->n_sen; ++i)
+        s->sen2cb[i] = (uint8)bin_mdef_sen2cimap(mdef, i);
+    s->cb_sen_start = ckd_calloc(s->g->n_mgau + 1, sizeof(*s->cb_sen_start));
+    s->cb_sen = ckd_calloc(s->n_sen, sizeof(*s->cb_sen));
+    s->sen2cbidx = ckd_calloc(s->n_sen, sizeof(*s->sen2cbidx));
+    for (i = 0; i < s->n_sen; ++i)
+        ++s->cb_sen_start[s->sen2cb[i] + 1];
+    for (cb = 0; cb < s->g->n_mgau; ++cb)
+        s->cb_sen_start[cb + 1] += s->cb_sen_start[cb];
+    n_cbsen = ckd_calloc(s->g->n_mgau, sizeof(*n_cbsen));
+    for (i = 0; i < s->n_sen; ++i) {
+        cb = s->sen2cb[i];
+        s->sen2cbidx[i] = n_cbsen[cb]++;
+        s->cb_sen[s->cb_sen_start[cb] + s->sen2cbidx[i]] = i;
+    }
+    ckd_free(n_cbsen);
+
+    n_bytes = 0;
+    for (cb = 0; cb < s->g->n_mgau; ++cb) {
+        int32 n_cbsen = s->cb_sen_start[cb + 1] - s->cb_sen_start[cb];
+        n_bytes += (size_t)s->g->n_density
+                   * (s->mixw_cb ? (n_cbsen + 1) / 2 : n_cbsen);
+    }
+    return n_bytes;
+}
+
+static void
+ptm_mgau_free_cb_map(ptm_mgau_t *s)
+{
+    ckd_free(s->sen2cb);
+    ckd_free(s->cb_sen_start);
+    ckd_free(s->cb_sen);
+    ckd_free(s->sen2cbidx);
+    s->sen2cb = NULL;
+    s->cb_sen_start = s->cb_sen = s->sen2cbidx = NULL;
+}
+
+/**
+ * Allocate scratch space and fast-match history, which are specific
+ * to one stream of input, unlike the rest of the model.
+ */
+static void
+ptm_mgau_alloc_scratch(ptm_mgau_t *s)
+{
+    int n_threads = thread_pool_n_threads(s->pool);
+    int32 cb, i, max_cbsen = 0;
+
+    for (cb = 0; cb < s->g->n_mgau; ++cb) {
+        int32 n_cbsen = s->cb_sen_start[cb + 1] - s->cb_sen_start[cb];
+        if (n_cbsen > max_cbsen)
+            max_cbsen = n_cbsen;
+    }
+    s->cb_active = ckd_calloc(s->n_sen, sizeof(*s->cb_active));
+    s->n_cb_active = ckd_calloc(s->g->n_mgau, sizeof(*s->n_cb_active));
+    s->cb_fden = ckd_calloc_2d(n_threads, max_cbsen, sizeof(**s->cb_fden));
+    s->cb_ascore = ckd_calloc_2d(n_threads, max_cbsen, sizeof(**s->cb_ascore));
+    s->sen_best = ckd_calloc(n_threads, sizeof(*s->sen_best));
+    s->feat_norm = ckd_calloc(s->g->n_feat, sizeof(*s->feat_norm));
+    if (s->ds_thresh > 0)
+        s->ds_ref = ckd_calloc(s->g->featlen[0], sizeof(*s->ds_ref));
+    s->ds_skip = 0;
+    if (s->g->quant_bits) {
+        int32 maxlen = 0;
+        for (i = 0; i < s->g->n_feat; ++i)
+            if (s->g->featlen[i] > maxlen)
+                maxlen = s->g->featlen[i];
+        s->qobs = ckd_calloc_2d(n_threads, maxlen, sizeof(**s->qobs));
+    } else if (s->simd) {
+        s->simd_cw = ckd_calloc_2d(n_threads, s->max_topn,
+                                   sizeof(**s->simd_cw));
+        s->simd_dist = ckd_calloc_2d(n_threads, s->max_topn,
+                                     sizeof(**s->simd_dist));
+    }
+
+    /* Allocate fast-match history buffers.  We need enough for the
+     * phoneme lookahead window, plus the current frame, plus one for
+     * good measure? (FIXME: I don't remember why) */
+    s->n_fast_hist = ACMOD_MAX_BATCH + 1;
+    s->hist = ckd_calloc(s->n_fast_hist, sizeof(*s->hist));
+    /* s->f will be a rotating pointer into s->hist. */
+    s->f = s->hist;
+    ptm_mgau_reset_fast_hist(ps_mgau_base(s));
+}
+
+static void
+ptm_mgau_free_scratch(ptm_mgau_t *s)
+{
+    int i;
+
+    ckd_free(s->cb_active);
+    ckd_free(s->n_cb_active);
+    ckd_free_2d(s->cb_fden);
+    ckd_free_2d(s->cb_ascore);
+    ckd_free(s->sen_best);
+    ckd_free(s->feat_norm);
+    ckd_free(s->ds_ref);
+    ckd_free_2d(s->simd_cw);
+    ckd_free_2d(s->qobs);
+    ckd_free_2d(s->simd_dist);
+    for (i = 0; i < s->n_fast_hist; i++) {
+        ckd_free_3d(s->hist[i].topn);
+        bitvec_free(s->hist[i].mgau_active);
+    }
+    ckd_free(s->hist);
+}
+
+/**
+ * Set up pointers to the rows of reordered mixture weights for each
+ * feature and codebook.
+ */
+static void
+ptm_mgau_set_cb_mixw(ptm_mgau_t *s, uint8 *cb_mixw)
+{
+    int32 cb, f;
+
+    s->cb_mixw = ckd_calloc_2d(s->g->n_feat, s->g->n_mgau, sizeof(uint8 *));
+    for (f = 0; f < s->g->n_feat; ++f) {
+        for (cb = 0; cb < s->g->n_mgau; ++cb) {
+            int32 n_cbsen = s->cb_sen_start[cb + 1] - s->cb_sen_start[cb];
+            int32 rowlen = s->mixw_cb ? (n_cbsen + 1) / 2 : n_cbsen;
+
+            s->cb_mixw[f][cb] = cb_mixw;
+            cb_mixw += (size_t)s->g->n_density * rowlen;
+        }
+    }
+}
+
+/**
+ * Reorder mixture weights so that the weights for a given codeword
+ * are contiguous for all the senones in its codebook.  The original
+ * mixture weights are no longer needed after this.
+ */
+static void
+ptm_mgau_build_cb_mixw(ptm_mgau_t *s, size_t n_bytes)
+{
+    uint8 *cb_mixw;
+    int32 cb, f;
+
+    E_INFO("Reordering %d x %ld bytes of mixture weights by codebook\n",
+           s->g->n_feat, (long)n_bytes);
+    ptm_mgau_set_cb_mixw(s, ckd_calloc(s->g->n_feat * n_bytes, 1));
+    for (f = 0; f < s->g->n_feat; ++f) {
+        for (cb = 0; cb < s->g->n_mgau; ++cb) {
+            int32 *cb_sen = s->cb_sen + s->cb_sen_start[cb];
+            int32 n_cbsen = s->cb_sen_start[cb + 1] - s->cb_sen_start[cb];
+            int32 rowlen = s->mixw_cb ? (n_cbsen + 1) / 2 : n_cbsen;
+            int32 cw, k;
+
+            cb_mixw = s->cb_mixw[f][cb];
+            for (cw = 0; cw < s->g->n_density; ++cw) {
+                for (k = 0; k < n_cbsen; ++k) {
+                    int sen = cb_sen[k];
+                    if (s->mixw_cb) {
+                        /* Odd senones are in the high nibble. */
+                        int dcw = s->mixw[f][cw][sen / 2];
+                        dcw = (sen & 1) ? dcw >> 4 : dcw & 0x0f;
+                        cb_mixw[k / 2] |= dcw << ((k & 1) * 4);
+                    } else {
+                        cb_mixw[k] = s->mixw[f][cw][sen];
+                    }
+                }
+                cb_mixw += rowlen;
+            }
+        }
+    }
+    /* Keep our own copy of the codebook, if any. */
+    if (s->mixw_cb) {
+        uint8 *mixw_cb = ckd_malloc(16);
+        memcpy(mixw_cb, s->mixw_cb, 16);
+        s->mixw_cb = mixw_cb;
+    }
+    ptm_mgau_free_mixw(s);
+}
+
+/**
+ * Free reordered mixture weights and the codebook mapping.
+ */
+static void
+ptm_mgau_free_cb_mixw(ptm_mgau_t *s)
+{
+    if (s->cb_mixw) {
+        /* Only we own the codebook once mixw is reordered. */
+        ckd_free(s->mixw_cb);
+        if (s->cb_mixw_mmap)
+            s3file_free(s->cb_mixw_mmap);
+        else
+            ckd_free(s->cb_mixw[0][0]);
+        ckd_free_2d(s->cb_mixw);
+    }
+    ptm_mgau_free_cb_map(s);
+    s->mixw_cb = NULL;
+    s->cb_mixw = NULL;
+    s->cb_mixw_mmap = NULL;
+}
+
+/* Cached mixture weights are n_feat, n_mgau, n_density, n_sen,
+ * presence of a codebook, bytes per feature, then the codebook (or
+ * zeros), then the reordered weights. */
+#define PTM_CACHE_HDR 8
+#define PTM_CACHE_HDR_SIZE (PTM_CACHE_HDR * sizeof(int32) + 16)
+
+static uint64
+ptm_mgau_cache_key(ptm_mgau_t *s, bin_mdef_t *mdef,
+                   s3file_t *mixw, s3file_t *sendump)
+{
+    s3file_t *s3f = sendump ? sendump : mixw;
+    float64 base = logmath_get_base(s->lmath_8b);
+    int32 dims[4];
+    uint64 key;
+
+    dims[0] = s->g->n_feat;
+    dims[1] = s->g->n_mgau;
+    dims[2] = s->g->n_density;
+    dims[3] = bin_mdef_n_sen(mdef);
+    key = datacache_hash_str(DATACACHE_HASH_INIT,
+                             sendump ? "sendump" : "mixw");
+    key = datacache_hash(key, s3f->buf, s3f->end - (const char *)s3f->buf);
+    if (!sendump) {
+        float32 mixw_floor = config_float(s->config, "mixwfloor");
+        key = datacache_hash(key, &mixw_floor, sizeof(mixw_floor));
+    }
+    key = datacache_hash(key, &base, sizeof(base));
+    key = datacache_hash(key, dims, sizeof(dims));
+    key = datacache_hash(key, mdef->sen2cimap,
+                         dims[3] * sizeof(*mdef->sen2cimap));
+    return key;
+}
+
+static int
+ptm_mgau_cache_load(ptm_mgau_t *s, bin_mdef_t *mdef,
+                    datacache_t *dc, uint64 key)
+{
+    const int32 *data;
+    s3file_t *mf;
+    size_t size, n_bytes;
+
+    if ((mf = datacache_map(dc, "ptm_mixw", key,
+                            (const void **)&data, &size))
+        == NULL)
+        return -1;
+    if (size < PTM_CACHE_HDR_SIZE
+        || data[0] != s->g->n_feat
+        || data[1] != s->g->n_mgau
+        || data[2] != s->g->n_density
+        || data[3] <= 0 || data[3] > bin_mdef_n_sen(mdef)
+        || size != PTM_CACHE_HDR_SIZE + (size_t)data[0] * data[5])
+        goto error_out;
+
+    s->n_sen = data[3];
+    if (data[4]) {
+        s->mixw_cb = ckd_malloc(16);
+        memcpy(s->mixw_cb, data + PTM_CACHE_HDR, 16);
+    }
+    n_bytes = ptm_mgau_build_cb_map(s, mdef);
+    if (n_bytes != (size_t)data[5]) {
+        ptm_mgau_free_cb_map(s);
+        ckd_free(s->mixw_cb);
+        s->mixw_cb = NULL;
+        goto error_out;
+    }
+    ptm_mgau_set_cb_mixw(s, (uint8 *)data + PTM_CACHE_HDR_SIZE);
+    s->cb_mixw_mmap = mf;
+    return 0;
+
+error_out:
+    E_WARN("Cached mixture weights have wrong size, recomputing\n");
+    s3file_free(mf);
+    return -1;
+}
+
+static int
+ptm_mgau_cache_store(ptm_mgau_t *s, datacache_t *dc, uint64 key,
+                     size_t n_bytes)
+{
+    size_t size = PTM_CACHE_HDR_SIZE + s->g->n_feat * n_bytes;
+    int32 *data = ckd_calloc(1, size);
+    int rv;
+
+    data[0] = s->g->n_feat;
+    data[1] = s->g->n_mgau;
+    data[2] = s->g->n_density;
+    data[3] = s->n_sen;
+    data[4] = (s->mixw_cb != NULL);
+    data[5] = (int32)n_bytes;
+    if (s->mixw_cb)
+        memcpy(data + PTM_CACHE_HDR, s->mixw_cb, 16);
+    memcpy((uint8 *)data + PTM_CACHE_HDR_SIZE, s->cb_mixw[0][0],
+           s->g->n_feat * n_bytes);
+    rv = datacache_store(dc, "ptm_mixw", key, data, size);
+    ckd_free(data);
+    return rv;
+}
+
 void
 ptm_mgau_reset_fast_hist(mgau_t *ps)
 {
@@ -725,14 +1403,17 @@ ptm_mgau_init_s3file(acmod_t *acmod, s3file_t *means, s3file_t *vars,
 {
     ptm_mgau_t *s;
     mgau_t *ps;
+    uint64 key = 0;
     int i;
 
     s = ckd_calloc(1, sizeof(*s));
     s->config = acmod->config;
+    s->pool = acmod->pool;
 
     s->lmath = logmath_retain(acmod->lmath);
     /* Log-add table. */
-    s->lmath_8b = logmath_init(logmath_get_base(acmod->lmath), SENSCR_SHIFT, TRUE);
+    s->lmath_8b = logmath_init_cached(logmath_get_base(acmod->lmath),
+                                      SENSCR_SHIFT, TRUE, acmod->cache);
     if (s->lmath_8b == NULL)
         goto error_out;
     /* Ensure that it is only 8 bits wide so that fast_logmath_add() works. */
@@ -743,9 +1424,9 @@ ptm_mgau_init_s3file(acmod_t *acmod, s3file_t *means, s3file_t *vars,
     }
 
     /* Read means and variances. */
-    if ((s->g = gauden_init_s3file(means, vars,
-                                   config_float(s->config, "varfloor"),
-                                   s->lmath))
+    if ((s->g = gauden_init_s3file_cached(means, vars,
+                                          config_float(s->config, "varfloor"),
+                                          s->lmath, acmod->cache))
         == NULL) {
         E_ERROR("Failed to read means and variances\n");
         goto error_out;
@@ -775,40 +1456,75 @@ ptm_mgau_init_s3file(acmod_t *acmod, s3file_t *means, s3file_t *vars,
             goto error_out;
         }
     }
-    /* Read mixture weights. */
-    if (sendump) {
-        s->n_sen = bin_mdef_n_sen(acmod->mdef);
-        if (read_sendump(sendump, s->g, s->n_sen,
-                         &s->mixw_cb, &s->mixw)
-            < 0)
-            goto error_out;
-        s->sendump_mmap = s3file_retain(sendump);
-    } else {
-        float32 mixw_floor = config_float(s->config, "mixwfloor");
-        if (read_mixw(mixw, s->g, s->lmath_8b, &s->n_sen, &s->mixw, mixw_floor) < 0)
-            goto error_out;
+    /* Read mixture weights, build the reverse mapping and reorder
+     * them, unless this was already done. */
+    if (acmod->cache)
+        key = ptm_mgau_cache_key(s, acmod->mdef, mixw, sendump);
+    if (acmod->cache == NULL
+        || ptm_mgau_cache_load(s, acmod->mdef, acmod->cache, key) < 0) {
+        size_t n_bytes;
+
+        if (sendump) {
+            s->n_sen = bin_mdef_n_sen(acmod->mdef);
+            if (read_sendump(sendump, s->g, s->n_sen,
+                             &s->mixw_cb, &s->mixw)
+                < 0)
+                goto error_out;
+            s->sendump_mmap = s3file_retain(sendump);
+        } else {
+            float32 mixw_floor = config_float(s->config, "mixwfloor");
+            if (read_mixw(mixw, s->g, s->lmath_8b, &s->n_sen, &s->mixw, mixw_floor) < 0)
+                goto error_out;
+        }
+        /* Assume mapping of senones to their base phones, though this
+         * will become more flexible in the future. */
+        n_bytes = ptm_mgau_build_cb_map(s, acmod->mdef);
+        /* Reordering makes a private copy of the weights, which is
+         * only worth it if it replaces one we would have anyway, or
+         * if it is stored to be mapped next time.  Otherwise use the
+         * memory-mapped sendump in place, rows and all. */
+        if (sendump && !datacache_can_store(acmod->cache)) {
+            E_INFO("Using mixture weights in place without reordering\n");
+        } else {
+            ptm_mgau_build_cb_mixw(s, n_bytes);
+            /* Use the stored copy, like everyone else will. */
+            if (acmod->cache
+                && ptm_mgau_cache_store(s, acmod->cache, key, n_bytes) == 0
+                && datacache_shared(acmod->cache)) {
+                ptm_mgau_free_cb_mixw(s);
+                if (ptm_mgau_cache_load(s, acmod->mdef, acmod->cache, key) < 0)
+                    goto error_out;
+            }
+        }
     }
     s->ds_ratio = config_int(s->config, "ds");
-    s->max_topn = config_int(s->config, "topn");
+    s->ds_thresh = config_float(s->config, "ds_thresh");
+    s->ds_max = config_int(s->config, "ds_max");
+    if (s->ds_thresh > 0) {
+        E_INFO("Adaptive frame downsampling: threshold %f, at most %d frames\n",
+               s->ds_thresh, s->ds_max);
+        ptm_mgau_ds_weight(s);
+    }
+    s->topn = s->max_topn = config_int(s->config, "topn");
     E_INFO("Maximum top-N: %d\n", s->max_topn);
 
-    /* Assume mapping of senones to their base phones, though this
-     * will become more flexible in the future. */
-    s->sen2cb = ckd_calloc(s->n_sen, sizeof(*s->sen2cb));
-    for (i = 0; i < s->n_sen; ++i)
-        s->sen2cb[i] = (uint8)bin_mdef_sen2cimap(acmod->mdef, i);
-
-    /* Allocate fast-match history buffers.  We need enough for the
-     * phoneme lookahead window, plus the current frame, plus one for
-     * good measure? (FIXME: I don't remember why) */
-    s->n_fast_hist = 2;
-    s->hist = ckd_calloc(s->n_fast_hist, sizeof(*s->hist));
-    /* s->f will be a rotating pointer into s->hist. */
-    s->f = s->hist;
+    /* Quantize Gaussians if requested (this frees the original ones,
+     * so no SIMD kernels in that case), otherwise pick the fastest
+     * Gaussian evaluation kernel we can. */
+    if (config_int(s->config, "gquant")) {
+        if (gauden_quantize(s->g, config_int(s->config, "gquant")) < 0)
+            goto error_out;
+    } else if ((s->simd = gmm_simd_get(config_str(s->config, "simd")))) {
+        E_INFO("Using %s SIMD kernels for Gaussian evaluation\n", s->simd->name);
+        s->simd_layout = gmm_simd_layout_init_cached(s->simd, s->g,
+                                                     acmod->cache);
+    } else
+        E_INFO("Using scalar code for Gaussian evaluation\n");
+    ptm_mgau_alloc_scratch(s);
 
     ps = (mgau_t *)s;
-    ptm_mgau_reset_fast_hist(ps);
     ps->vt = &ptm_mgau_funcs;
+    ps->refcount = 1;
     return ps;
 error_out:
     ptm_mgau_free(ps_mgau_base(s));
@@ -867,31 +1583,110 @@ ptm_mgau_mllr_transform(mgau_t *ps,
                         mllr_t *mllr)
 {
     ptm_mgau_t *s = (ptm_mgau_t *)ps;
-    return gauden_mllr_transform(s->g, mllr, s->config);
+    int32 rv;
+
+    if ((rv = gauden_mllr_transform(s->g, mllr, s->config)) < 0)
+        return rv;
+    /* Interleaved copies need to be regenerated. */
+    if (s->simd) {
+        gmm_simd_layout_free(s->simd_layout);
+        s->simd_layout = gmm_simd_layout_init(s->simd, s->g);
+    }
+    /* So do the downsampling weights, since the variances changed
+     * (from the floating-point ones, before they are quantized). */
+    if (s->ds_weight) {
+        ckd_free(s->ds_weight);
+        ptm_mgau_ds_weight(s);
+    }
+    if (s->g->quant_bits)
+        return gauden_quantize(s->g, s->g->quant_bits);
+    return rv;
+}
+
+mgau_t *
+ptm_mgau_clone(mgau_t *ps, acmod_t *acmod)
+{
+    ptm_mgau_t *other = (ptm_mgau_t *)ps;
+    ptm_mgau_t *s;
+
+    /* Everything but the scratch space is shared. */
+    s = ckd_malloc(sizeof(*s));
+    memcpy(s, other, sizeof(*s));
+    s->config = acmod->config;
+    s->pool = acmod->pool;
+    s->cb_active = s->n_cb_active = NULL;
+    s->cb_fden = s->cb_ascore = NULL;
+    s->sen_best = s->feat_norm = NULL;
+    s->ds_ref = NULL;
+    s->simd_cw = s->qobs = NULL;
+    s->simd_dist = NULL;
+    ptm_mgau_alloc_scratch(s);
+
+    ps = (mgau_t *)s;
+    ps->frame_idx = 0;
+    ps->refcount = 1;
+    ps->shared = mgau_retain(ps_mgau_base(other));
+    return ps;
+}
+
+int
+ptm_mgau_set_topn(mgau_t *ps, int topn)
+{
+    ptm_mgau_t *s = (ptm_mgau_t *)ps;
+    int i, j, k, m;
+
+    if (topn < 1)
+        topn = 1;
+    if (topn > s->max_topn)
+        topn = s->max_topn;
+    if (topn <= s->topn) {
+        s->topn = topn;
+        return topn;
+    }
+    /* The entries past the old top-N are stale and may duplicate
+     * ones before it, which eval_topn() would then count twice, so
+     * give them codewords which aren't there yet. */
+    for (i = 0; i < s->n_fast_hist; ++i) {
+        for (j = 0; j < s->g->n_mgau; ++j) {
+            for (k = 0; k < s->g->n_feat; ++k) {
+                ptm_topn_t *tn = s->hist[i].topn[j][k];
+                int32 cw = 0;
+
+                for (m = s->topn; m < topn; ++m) {
+                    int n;
+                    for (n = 0; n < m; ++n) {
+                        if (tn[n].cw == cw) {
+                            ++cw;
+                            n = -1;
+                        }
+                    }
+                    tn[m].cw = cw++;
+                    tn[m].score = WORST_DIST;
+                }
+            }
+        }
+    }
+    s->topn = topn;
+    return topn;
 }
 
 void
 ptm_mgau_free(mgau_t *ps)
 {
-    int i;
     ptm_mgau_t *s = (ptm_mgau_t *)ps;
 
+    ptm_mgau_free_scratch(s);
+    if (ps->shared) {
+        mgau_free(ps->shared);
+        ckd_free(s);
+        return;
+    }
     logmath_free(s->lmath);
     logmath_free(s->lmath_8b);
-    if (s->sendump_mmap) {
-        ckd_free_2d(s->mixw);
-        s3file_free(s->sendump_mmap);
-    } else {
-        ckd_free_3d(s->mixw);
-    }
-    ckd_free(s->sen2cb);
-
-    for (i = 0; i < s->n_fast_hist; i++) {
-        ckd_free_3d(s->hist[i].topn);
-        bitvec_free(s->hist[i].mgau_active);
-    }
-    ckd_free(s->hist);
-
+    ptm_mgau_free_mixw(s);
+    ptm_mgau_free_cb_mixw(s);
+    gmm_simd_layout_free(s->simd_layout);
+    ckd_free(s->ds_weight);
     gauden_free(s->g);
     ckd_free(s);
 }
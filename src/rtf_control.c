@@ -0,0 +1,119 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+/**
+ * @file rtf_control.c
+ * @brief Adjust pruning to track a target real-time factor
+ */
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/err.h>
+#include <soundswallower/rtf_control.h>
+
+rtf_control_t *
+rtf_control_init(double target, int frate, float32 min_factor, int max_topn)
+{
+    rtf_control_t *rc;
+
+    if (target <= 0 || frate <= 0) {
+        E_ERROR("Invalid real-time factor %f or frame rate %d\n",
+                target, frate);
+        return NULL;
+    }
+    if (min_factor <= 0 || min_factor > 1) {
+        E_ERROR("Minimum beam scale %f must be between 0 and 1\n",
+                min_factor);
+        return NULL;
+    }
+    rc = ckd_calloc(1, sizeof(*rc));
+    rc->target = target;
+    rc->budget = target / frate;
+    rc->min_factor = min_factor;
+    rc->factor = 1.0;
+    rc->max_topn = rc->topn = max_topn;
+    E_INFO("Targeting real-time factor %g (%g ms per frame)\n",
+           target, rc->budget * 1000);
+
+    return rc;
+}
+
+void
+rtf_control_free(rtf_control_t *rc)
+{
+    ckd_free(rc);
+}
+
+void
+rtf_control_start_utt(rtf_control_t *rc)
+{
+    rc->n_frames = rc->n_miss = 0;
+    rc->n_since = 0;
+}
+
+int
+rtf_control_update(rtf_control_t *rc, double secs)
+{
+    ++rc->n_frames;
+    if (secs > rc->budget)
+        ++rc->n_miss;
+    if (rc->avg == 0)
+        rc->avg = secs;
+    else
+        rc->avg += RTF_CONTROL_ALPHA * (secs - rc->avg);
+    if (++rc->n_since < RTF_CONTROL_INTERVAL)
+        return FALSE;
+    rc->n_since = 0;
+
+    if (rc->avg > rc->budget) {
+        /* Narrower beams also leave fewer senones to score, so try
+         * them first. */
+        if (rc->factor > rc->min_factor) {
+            rc->factor *= RTF_CONTROL_STEP;
+            if (rc->factor < rc->min_factor)
+                rc->factor = rc->min_factor;
+            return TRUE;
+        }
+        if (rc->topn > 1) {
+            --rc->topn;
+            return TRUE;
+        }
+    } else if (rc->avg < rc->budget * RTF_CONTROL_SLACK) {
+        if (rc->topn < rc->max_topn) {
+            ++rc->topn;
+            return TRUE;
+        }
+        if (rc->factor < 1.0) {
+            rc->factor /= RTF_CONTROL_STEP;
+            if (rc->factor > 1.0)
+                rc->factor = 1.0;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
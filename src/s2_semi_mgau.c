@@ -56,15 +56,14 @@
 static mgaufuncs_t s2_semi_mgau_funcs = {
     "s2_semi",
     s2_semi_mgau_frame_eval, /* frame_eval */
+    NULL, /* frame_eval_batch */
+    s2_semi_mgau_frame_prepare, /* frame_prepare */
     s2_semi_mgau_mllr_transform, /* transform */
+    s2_semi_mgau_clone, /* clone */
+    NULL, /* set_topn */
     s2_semi_mgau_free /* free */
 };
 
-struct vqFeature_s {
-    int32 score; /* score or distance */
-    int32 codeword; /* codeword (vector index) */
-};
-
 static void
 eval_topn(s2_semi_mgau_t *s, int32 feat, mfcc_t *z)
 {
@@ -168,17 +167,96 @@ eval_cb(s2_semi_mgau_t *s, int32 feat, mfcc_t *z)
     }
 }
 
+static void
+eval_topn_quant(s2_semi_mgau_t *s, int32 feat, mfcc_t *z)
+{
+    vqFeature_t *topn;
+    int i;
+
+    topn = s->f[feat];
+    gauden_quant_obs(s->g, 0, feat, z, s->qobs);
+    for (i = 0; i < s->max_topn; i++) {
+        vqFeature_t vtmp;
+        int32 cw, j;
+        mfcc_t d;
+
+        cw = topn[i].codeword;
+        d = gauden_quant_dist(s->g, 0, feat, s->qobs, cw,
+                              (mfcc_t)MAX_NEG_INT32);
+        if (d < (mfcc_t)MAX_NEG_INT32)
+            topn[i].score = MAX_NEG_INT32;
+        else
+            topn[i].score = (int32)d;
+        if (i == 0)
+            continue;
+        vtmp = topn[i];
+        for (j = i - 1; j >= 0 && vtmp.score > topn[j].score; j--) {
+            topn[j + 1] = topn[j];
+        }
+        topn[j + 1] = vtmp;
+    }
+}
+
+static void
+eval_cb_quant(s2_semi_mgau_t *s, int32 feat, mfcc_t *z)
+{
+    vqFeature_t *worst, *best, *topn;
+    mfcc_t *det;
+    int32 i, cw;
+
+    best = topn = s->f[feat];
+    worst = topn + (s->max_topn - 1);
+    det = s->g->det[0][feat];
+    gauden_quant_obs(s->g, 0, feat, z, s->qobs);
+
+    for (cw = 0; cw < s->g->n_density; ++cw) {
+        vqFeature_t *cur;
+        int32 d_int;
+        mfcc_t d;
+
+        if (det[cw] < worst->score)
+            continue;
+        d = gauden_quant_dist(s->g, 0, feat, s->qobs, cw,
+                              (mfcc_t)worst->score);
+        if (d < (mfcc_t)MAX_NEG_INT32)
+            d_int = MAX_NEG_INT32;
+        else
+            d_int = (int32)d;
+        if (d_int < worst->score)
+            continue;
+        for (i = 0; i < s->max_topn; i++) {
+            /* already there, so don't need to insert */
+            if (topn[i].codeword == cw)
+                break;
+        }
+        if (i < s->max_topn)
+            continue; /* already there.  Don't insert */
+        /* remaining code inserts codeword and dist in correct spot */
+        for (cur = worst - 1; cur >= best && d_int >= cur->score; --cur)
+            memcpy(cur + 1, cur, sizeof(vqFeature_t));
+        ++cur;
+        cur->codeword = cw;
+        cur->score = d_int;
+    }
+}
+
 static void
 mgau_dist(s2_semi_mgau_t *s, int32 frame, int32 feat, mfcc_t *z)
 {
-    eval_topn(s, feat, z);
+    if (s->g->quant_bits)
+        eval_topn_quant(s, feat, z);
+    else
+        eval_topn(s, feat, z);
 
     /* If this frame is skipped, do nothing else. */
     if (frame % s->ds_ratio)
         return;
 
     /* Evaluate the rest of the codebook (or subset thereof). */
-    eval_cb(s, feat, z);
+    if (s->g->quant_bits)
+        eval_cb_quant(s, feat, z);
+    else
+        eval_cb(s, feat, z);
 }
 
 static int
@@ -201,626 +279,86 @@ mgau_norm(s2_semi_mgau_t *s, int feat)
     return j;
 }
 
-static int32
-get_scores_8b_feat_6(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0, *pid_cw1, *pid_cw2, *pid_cw3, *pid_cw4, *pid_cw5;
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    pid_cw1 = s->mixw[i][s->f[i][1].codeword];
-    pid_cw2 = s->mixw[i][s->f[i][2].codeword];
-    pid_cw3 = s->mixw[i][s->f[i][3].codeword];
-    pid_cw4 = s->mixw[i][s->f[i][4].codeword];
-    pid_cw5 = s->mixw[i][s->f[i][5].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int sen = senone_active[j] + l;
-        int32 tmp = pid_cw0[sen] + s->f[i][0].score;
-
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw1[sen] + s->f[i][1].score);
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw2[sen] + s->f[i][2].score);
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw3[sen] + s->f[i][3].score);
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw4[sen] + s->f[i][4].score);
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw5[sen] + s->f[i][5].score);
-
-        senone_scores[sen] += tmp;
-        l = sen;
-    }
-    return 0;
-}
+/* Score all senones with SIMD kernels if at least 1/MIXW_DENSE_RATIO
+ * of them are active. */
+#define MIXW_DENSE_RATIO 8
 
-static int32
-get_scores_8b_feat_5(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0, *pid_cw1, *pid_cw2, *pid_cw3, *pid_cw4;
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    pid_cw1 = s->mixw[i][s->f[i][1].codeword];
-    pid_cw2 = s->mixw[i][s->f[i][2].codeword];
-    pid_cw3 = s->mixw[i][s->f[i][3].codeword];
-    pid_cw4 = s->mixw[i][s->f[i][4].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int sen = senone_active[j] + l;
-        int32 tmp = pid_cw0[sen] + s->f[i][0].score;
-
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw1[sen] + s->f[i][1].score);
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw2[sen] + s->f[i][2].score);
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw3[sen] + s->f[i][3].score);
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw4[sen] + s->f[i][4].score);
-
-        senone_scores[sen] += tmp;
-        l = sen;
-    }
-    return 0;
-}
-
-static int32
-get_scores_8b_feat_4(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0, *pid_cw1, *pid_cw2, *pid_cw3;
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    pid_cw1 = s->mixw[i][s->f[i][1].codeword];
-    pid_cw2 = s->mixw[i][s->f[i][2].codeword];
-    pid_cw3 = s->mixw[i][s->f[i][3].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int sen = senone_active[j] + l;
-        int32 tmp = pid_cw0[sen] + s->f[i][0].score;
-
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw1[sen] + s->f[i][1].score);
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw2[sen] + s->f[i][2].score);
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw3[sen] + s->f[i][3].score);
-
-        senone_scores[sen] += tmp;
-        l = sen;
-    }
-    return 0;
-}
-
-static int32
-get_scores_8b_feat_3(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0, *pid_cw1, *pid_cw2;
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    pid_cw1 = s->mixw[i][s->f[i][1].codeword];
-    pid_cw2 = s->mixw[i][s->f[i][2].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int sen = senone_active[j] + l;
-        int32 tmp = pid_cw0[sen] + s->f[i][0].score;
-
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw1[sen] + s->f[i][1].score);
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw2[sen] + s->f[i][2].score);
-
-        senone_scores[sen] += tmp;
-        l = sen;
-    }
-    return 0;
-}
-
-static int32
-get_scores_8b_feat_2(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0, *pid_cw1;
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    pid_cw1 = s->mixw[i][s->f[i][1].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int sen = senone_active[j] + l;
-        int32 tmp = pid_cw0[sen] + s->f[i][0].score;
-
-        tmp = fast_logmath_add(s->lmath_8b, tmp,
-                               pid_cw1[sen] + s->f[i][1].score);
-
-        senone_scores[sen] += tmp;
-        l = sen;
-    }
-    return 0;
-}
-
-static int32
-get_scores_8b_feat_1(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0;
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    for (l = j = 0; j < n_senone_active; j++) {
-        int sen = senone_active[j] + l;
-        int32 tmp = pid_cw0[sen] + s->f[i][0].score;
-        senone_scores[sen] += tmp;
-        l = sen;
-    }
-    return 0;
-}
-
-static int32
-get_scores_8b_feat_any(s2_semi_mgau_t *s, int i, int topn,
-                       int16 *senone_scores, uint8 *senone_active,
-                       int32 n_senone_active)
+/*
+ * Compute senone scores for one feature stream, for all senones if
+ * senone_active is NULL.
+ */
+static void
+get_scores_feat(s2_semi_mgau_t *s, int i, int topn, int16 *senone_scores,
+                uint8 *senone_active, int32 n_senone_active)
 {
+    const uint8 *logadd = (const uint8 *)LOGMATH_TABLE(s->lmath_8b)->table;
     int32 j, k, l;
 
-    for (l = j = 0; j < n_senone_active; j++) {
-        int sen = senone_active[j] + l;
-        uint8 *pid_cw;
-        int32 tmp;
-        pid_cw = s->mixw[i][s->f[i][0].codeword];
-        tmp = pid_cw[sen] + s->f[i][0].score;
-        for (k = 1; k < topn; ++k) {
-            pid_cw = s->mixw[i][s->f[i][k].codeword];
-            tmp = fast_logmath_add(s->lmath_8b, tmp,
-                                   pid_cw[sen] + s->f[i][k].score);
-        }
-        senone_scores[sen] += tmp;
-        l = sen;
-    }
-    return 0;
-}
-
-static int32
-get_scores_8b_feat(s2_semi_mgau_t *s, int i, int topn,
-                   int16 *senone_scores, uint8 *senone_active, int32 n_senone_active)
-{
-    switch (topn) {
-    case 6:
-        return get_scores_8b_feat_6(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    case 5:
-        return get_scores_8b_feat_5(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    case 4:
-        return get_scores_8b_feat_4(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    case 3:
-        return get_scores_8b_feat_3(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    case 2:
-        return get_scores_8b_feat_2(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    case 1:
-        return get_scores_8b_feat_1(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    default:
-        return get_scores_8b_feat_any(s, i, topn, senone_scores,
-                                      senone_active, n_senone_active);
-    }
-}
-
-static int32
-get_scores_8b_feat_all(s2_semi_mgau_t *s, int i, int topn, int16 *senone_scores)
-{
-    int32 j, k;
-
-    for (j = 0; j < s->n_sen; j++) {
-        uint8 *pid_cw;
-        int32 tmp;
-        pid_cw = s->mixw[i][s->f[i][0].codeword];
-        tmp = pid_cw[j] + s->f[i][0].score;
-        for (k = 1; k < topn; ++k) {
-            pid_cw = s->mixw[i][s->f[i][k].codeword];
-            tmp = fast_logmath_add(s->lmath_8b, tmp,
-                                   pid_cw[j] + s->f[i][k].score);
-        }
-        senone_scores[j] += tmp;
-    }
-    return 0;
-}
-
-static int32
-get_scores_4b_feat_6(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0, *pid_cw1, *pid_cw2, *pid_cw3, *pid_cw4, *pid_cw5;
-    uint8 w_den[6][16];
-
-    /* Precompute scaled densities. */
-    for (j = 0; j < 16; ++j) {
-        w_den[0][j] = s->mixw_cb[j] + s->f[i][0].score;
-        w_den[1][j] = s->mixw_cb[j] + s->f[i][1].score;
-        w_den[2][j] = s->mixw_cb[j] + s->f[i][2].score;
-        w_den[3][j] = s->mixw_cb[j] + s->f[i][3].score;
-        w_den[4][j] = s->mixw_cb[j] + s->f[i][4].score;
-        w_den[5][j] = s->mixw_cb[j] + s->f[i][5].score;
-    }
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    pid_cw1 = s->mixw[i][s->f[i][1].codeword];
-    pid_cw2 = s->mixw[i][s->f[i][2].codeword];
-    pid_cw3 = s->mixw[i][s->f[i][3].codeword];
-    pid_cw4 = s->mixw[i][s->f[i][4].codeword];
-    pid_cw5 = s->mixw[i][s->f[i][5].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int n = senone_active[j] + l;
-        int tmp, cw;
-
-        if (n & 1) {
-            cw = pid_cw0[n / 2] >> 4;
-            tmp = w_den[0][cw];
-            cw = pid_cw1[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[1][cw]);
-            cw = pid_cw2[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[2][cw]);
-            cw = pid_cw3[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[3][cw]);
-            cw = pid_cw4[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[4][cw]);
-            cw = pid_cw5[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[5][cw]);
-        } else {
-            cw = pid_cw0[n / 2] & 0x0f;
-            tmp = w_den[0][cw];
-            cw = pid_cw1[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[1][cw]);
-            cw = pid_cw2[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[2][cw]);
-            cw = pid_cw3[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[3][cw]);
-            cw = pid_cw4[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[4][cw]);
-            cw = pid_cw5[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[5][cw]);
-        }
-        senone_scores[n] += tmp;
-        l = n;
-    }
-    return 0;
-}
-
-static int32
-get_scores_4b_feat_5(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0, *pid_cw1, *pid_cw2, *pid_cw3, *pid_cw4;
-    uint8 w_den[5][16];
-
-    /* Precompute scaled densities. */
-    for (j = 0; j < 16; ++j) {
-        w_den[0][j] = s->mixw_cb[j] + s->f[i][0].score;
-        w_den[1][j] = s->mixw_cb[j] + s->f[i][1].score;
-        w_den[2][j] = s->mixw_cb[j] + s->f[i][2].score;
-        w_den[3][j] = s->mixw_cb[j] + s->f[i][3].score;
-        w_den[4][j] = s->mixw_cb[j] + s->f[i][4].score;
-    }
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    pid_cw1 = s->mixw[i][s->f[i][1].codeword];
-    pid_cw2 = s->mixw[i][s->f[i][2].codeword];
-    pid_cw3 = s->mixw[i][s->f[i][3].codeword];
-    pid_cw4 = s->mixw[i][s->f[i][4].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int n = senone_active[j] + l;
-        int tmp, cw;
-
-        if (n & 1) {
-            cw = pid_cw0[n / 2] >> 4;
-            tmp = w_den[0][cw];
-            cw = pid_cw1[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[1][cw]);
-            cw = pid_cw2[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[2][cw]);
-            cw = pid_cw3[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[3][cw]);
-            cw = pid_cw4[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[4][cw]);
-        } else {
-            cw = pid_cw0[n / 2] & 0x0f;
-            tmp = w_den[0][cw];
-            cw = pid_cw1[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[1][cw]);
-            cw = pid_cw2[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[2][cw]);
-            cw = pid_cw3[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[3][cw]);
-            cw = pid_cw4[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[4][cw]);
-        }
-        senone_scores[n] += tmp;
-        l = n;
-    }
-    return 0;
-}
-
-static int32
-get_scores_4b_feat_4(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0, *pid_cw1, *pid_cw2, *pid_cw3;
-    uint8 w_den[4][16];
-
-    /* Precompute scaled densities. */
-    for (j = 0; j < 16; ++j) {
-        w_den[0][j] = s->mixw_cb[j] + s->f[i][0].score;
-        w_den[1][j] = s->mixw_cb[j] + s->f[i][1].score;
-        w_den[2][j] = s->mixw_cb[j] + s->f[i][2].score;
-        w_den[3][j] = s->mixw_cb[j] + s->f[i][3].score;
-    }
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    pid_cw1 = s->mixw[i][s->f[i][1].codeword];
-    pid_cw2 = s->mixw[i][s->f[i][2].codeword];
-    pid_cw3 = s->mixw[i][s->f[i][3].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int n = senone_active[j] + l;
-        int tmp, cw;
-
-        if (n & 1) {
-            cw = pid_cw0[n / 2] >> 4;
-            tmp = w_den[0][cw];
-            cw = pid_cw1[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[1][cw]);
-            cw = pid_cw2[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[2][cw]);
-            cw = pid_cw3[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[3][cw]);
-        } else {
-            cw = pid_cw0[n / 2] & 0x0f;
-            tmp = w_den[0][cw];
-            cw = pid_cw1[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[1][cw]);
-            cw = pid_cw2[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[2][cw]);
-            cw = pid_cw3[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[3][cw]);
-        }
-        senone_scores[n] += tmp;
-        l = n;
-    }
-    return 0;
-}
-
-static int32
-get_scores_4b_feat_3(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0, *pid_cw1, *pid_cw2;
-    uint8 w_den[3][16];
-
-    /* Precompute scaled densities. */
-    for (j = 0; j < 16; ++j) {
-        w_den[0][j] = s->mixw_cb[j] + s->f[i][0].score;
-        w_den[1][j] = s->mixw_cb[j] + s->f[i][1].score;
-        w_den[2][j] = s->mixw_cb[j] + s->f[i][2].score;
-    }
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    pid_cw1 = s->mixw[i][s->f[i][1].codeword];
-    pid_cw2 = s->mixw[i][s->f[i][2].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int n = senone_active[j] + l;
-        int tmp, cw;
-
-        if (n & 1) {
-            cw = pid_cw0[n / 2] >> 4;
-            tmp = w_den[0][cw];
-            cw = pid_cw1[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[1][cw]);
-            cw = pid_cw2[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[2][cw]);
-        } else {
-            cw = pid_cw0[n / 2] & 0x0f;
-            tmp = w_den[0][cw];
-            cw = pid_cw1[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[1][cw]);
-            cw = pid_cw2[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[2][cw]);
-        }
-        senone_scores[n] += tmp;
-        l = n;
-    }
-    return 0;
-}
-
-static int32
-get_scores_4b_feat_2(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0, *pid_cw1;
-    uint8 w_den[2][16];
-
-    /* Precompute scaled densities. */
-    for (j = 0; j < 16; ++j) {
-        w_den[0][j] = s->mixw_cb[j] + s->f[i][0].score;
-        w_den[1][j] = s->mixw_cb[j] + s->f[i][1].score;
-    }
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-    pid_cw1 = s->mixw[i][s->f[i][1].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int n = senone_active[j] + l;
-        int tmp, cw;
-
-        if (n & 1) {
-            cw = pid_cw0[n / 2] >> 4;
-            tmp = w_den[0][cw];
-            cw = pid_cw1[n / 2] >> 4;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[1][cw]);
-        } else {
-            cw = pid_cw0[n / 2] & 0x0f;
-            tmp = w_den[0][cw];
-            cw = pid_cw1[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp, w_den[1][cw]);
-        }
-        senone_scores[n] += tmp;
-        l = n;
-    }
-    return 0;
-}
-
-static int32
-get_scores_4b_feat_1(s2_semi_mgau_t *s, int i,
-                     int16 *senone_scores, uint8 *senone_active,
-                     int32 n_senone_active)
-{
-    int32 j, l;
-    uint8 *pid_cw0;
-    uint8 w_den[16];
-
-    /* Precompute scaled densities. */
-    for (j = 0; j < 16; ++j) {
-        w_den[j] = s->mixw_cb[j] + s->f[i][0].score;
-    }
-
-    pid_cw0 = s->mixw[i][s->f[i][0].codeword];
-
-    for (l = j = 0; j < n_senone_active; j++) {
-        int n = senone_active[j] + l;
-        int tmp, cw;
-
-        if (n & 1) {
-            cw = pid_cw0[n / 2] >> 4;
-            tmp = w_den[cw];
-        } else {
-            cw = pid_cw0[n / 2] & 0x0f;
-            tmp = w_den[cw];
+    for (k = 0; k < topn; ++k) {
+        s->mixw_cw[k] = s->mixw[i][s->f[i][k].codeword];
+        s->mixw_score[k] = s->f[i][k].score;
+        /* Precompute scaled densities. */
+        if (s->mixw_cb) {
+            for (j = 0; j < 16; ++j)
+                s->w_den[k * 16 + j] = s->mixw_cb[j] + s->f[i][k].score;
         }
-        senone_scores[n] += tmp;
-        l = n;
     }
-    return 0;
-}
-
-static int32
-get_scores_4b_feat_any(s2_semi_mgau_t *s, int i, int topn,
-                       int16 *senone_scores, uint8 *senone_active,
-                       int32 n_senone_active)
-{
-    int32 j, k, l;
 
-    for (l = j = 0; j < n_senone_active; j++) {
-        int n = senone_active[j] + l;
-        int tmp, cw;
-        uint8 *pid_cw;
-
-        pid_cw = s->mixw[i][s->f[i][0].codeword];
-        if (n & 1)
-            cw = pid_cw[n / 2] >> 4;
+    if (senone_active == NULL) {
+        if (s->mixw_cb)
+            gmm_simd_mixw4(s->simd, senone_scores, s->mixw_cw, s->w_den,
+                           topn, logadd, s->n_logadd, s->n_sen);
+        else
+            gmm_simd_mixw(s->simd, senone_scores, s->mixw_cw, s->mixw_score,
+                          topn, logadd, s->n_logadd, s->n_sen);
+    } else if (s->simd && s->simd->mixw
+               && n_senone_active * MIXW_DENSE_RATIO >= s->n_sen) {
+        /* With enough active senones, it is faster to score all of
+         * them in parallel and throw most of them away. */
+        memset(s->mixw_dense, 0, s->n_sen * sizeof(*s->mixw_dense));
+        if (s->mixw_cb)
+            gmm_simd_mixw4(s->simd, s->mixw_dense, s->mixw_cw, s->w_den,
+                           topn, logadd, s->n_logadd, s->n_sen);
         else
-            cw = pid_cw[n / 2] & 0x0f;
-        tmp = s->mixw_cb[cw] + s->f[i][0].score;
-        for (k = 1; k < topn; ++k) {
-            pid_cw = s->mixw[i][s->f[i][k].codeword];
-            if (n & 1)
-                cw = pid_cw[n / 2] >> 4;
-            else
-                cw = pid_cw[n / 2] & 0x0f;
-            tmp = fast_logmath_add(s->lmath_8b, tmp,
-                                   s->mixw_cb[cw] + s->f[i][k].score);
+            gmm_simd_mixw(s->simd, s->mixw_dense, s->mixw_cw, s->mixw_score,
+                          topn, logadd, s->n_logadd, s->n_sen);
+        for (l = j = 0; j < n_senone_active; ++j) {
+            l += senone_active[j];
+            senone_scores[l] += s->mixw_dense[l];
         }
-        senone_scores[n] += tmp;
-        l = n;
+    } else {
+        if (s->mixw_cb)
+            gmm_simd_mixw4_active(senone_scores, s->mixw_cw, s->w_den, topn,
+                                  logadd, s->n_logadd,
+                                  senone_active, n_senone_active);
+        else
+            gmm_simd_mixw_active(senone_scores, s->mixw_cw, s->mixw_score, topn,
+                                 logadd, s->n_logadd,
+                                 senone_active, n_senone_active);
     }
-    return 0;
 }
 
-static int32
-get_scores_4b_feat(s2_semi_mgau_t *s, int i, int topn,
-                   int16 *senone_scores, uint8 *senone_active, int32 n_senone_active)
+/*
+ * Compute top-N codewords for one frame, which depend only on the
+ * previous frame and not on the active senones.
+ */
+static void
+s2_semi_mgau_topn(s2_semi_mgau_t *s, mfcc_t **featbuf, int32 frame)
 {
-    switch (topn) {
-    case 6:
-        return get_scores_4b_feat_6(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    case 5:
-        return get_scores_4b_feat_5(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    case 4:
-        return get_scores_4b_feat_4(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    case 3:
-        return get_scores_4b_feat_3(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    case 2:
-        return get_scores_4b_feat_2(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    case 1:
-        return get_scores_4b_feat_1(s, i, senone_scores,
-                                    senone_active, n_senone_active);
-    default:
-        return get_scores_4b_feat_any(s, i, topn, senone_scores,
-                                      senone_active, n_senone_active);
-    }
-}
+    int i, topn_idx;
+    vqFeature_t **lastf;
 
-static int32
-get_scores_4b_feat_all(s2_semi_mgau_t *s, int i, int topn, int16 *senone_scores)
-{
-    int j, last_sen;
-
-    j = 0;
-    /* Number of senones is always even, but don't overrun if it isn't. */
-    last_sen = s->n_sen & ~1;
-    while (j < last_sen) {
-        uint8 *pid_cw;
-        int32 tmp0, tmp1;
-        int k;
-
-        pid_cw = s->mixw[i][s->f[i][0].codeword];
-        tmp0 = s->mixw_cb[pid_cw[j / 2] & 0x0f] + s->f[i][0].score;
-        tmp1 = s->mixw_cb[pid_cw[j / 2] >> 4] + s->f[i][0].score;
-        for (k = 1; k < topn; ++k) {
-            int32 w_den0, w_den1;
-
-            pid_cw = s->mixw[i][s->f[i][k].codeword];
-            w_den0 = s->mixw_cb[pid_cw[j / 2] & 0x0f] + s->f[i][k].score;
-            w_den1 = s->mixw_cb[pid_cw[j / 2] >> 4] + s->f[i][k].score;
-            tmp0 = fast_logmath_add(s->lmath_8b, tmp0, w_den0);
-            tmp1 = fast_logmath_add(s->lmath_8b, tmp1, w_den1);
-        }
-        senone_scores[j++] += tmp0;
-        senone_scores[j++] += tmp1;
+    topn_idx = frame % s->n_topn_hist;
+    s->f = s->topn_hist[topn_idx];
+    if (topn_idx == 0)
+        lastf = s->topn_hist[s->n_topn_hist - 1];
+    else
+        lastf = s->topn_hist[topn_idx - 1];
+    for (i = 0; i < s->g->n_feat; ++i) {
+        memcpy(s->f[i], lastf[i], sizeof(vqFeature_t) * s->max_topn);
+        mgau_dist(s, frame, i, featbuf[i]);
+        s->topn_hist_n[topn_idx][i] = mgau_norm(s, i);
     }
-    return 0;
 }
 
 /*
@@ -843,37 +381,41 @@ s2_semi_mgau_frame_eval(mgau_t *ps,
      * semi-random crap if you request a frame in the future or one
      * that's too far in the past. */
     topn_idx = frame % s->n_topn_hist;
+    /* For past frames this will already be computed. */
+    if (frame >= ps_mgau_base(ps)->frame_idx)
+        s2_semi_mgau_topn(s, featbuf, frame);
     s->f = s->topn_hist[topn_idx];
     for (i = 0; i < n_feat; ++i) {
-        /* For past frames this will already be computed. */
-        if (frame >= ps_mgau_base(ps)->frame_idx) {
-            vqFeature_t **lastf;
-            if (topn_idx == 0)
-                lastf = s->topn_hist[s->n_topn_hist - 1];
-            else
-                lastf = s->topn_hist[topn_idx - 1];
-            memcpy(s->f[i], lastf[i], sizeof(vqFeature_t) * s->max_topn);
-            mgau_dist(s, frame, i, featbuf[i]);
-            s->topn_hist_n[topn_idx][i] = mgau_norm(s, i);
-        }
-        if (s->mixw_cb) {
-            if (compallsen)
-                get_scores_4b_feat_all(s, i, s->topn_hist_n[topn_idx][i], senone_scores);
-            else
-                get_scores_4b_feat(s, i, s->topn_hist_n[topn_idx][i], senone_scores,
-                                   senone_active, n_senone_active);
-        } else {
-            if (compallsen)
-                get_scores_8b_feat_all(s, i, s->topn_hist_n[topn_idx][i], senone_scores);
-            else
-                get_scores_8b_feat(s, i, s->topn_hist_n[topn_idx][i], senone_scores,
-                                   senone_active, n_senone_active);
-        }
+        get_scores_feat(s, i, s->topn_hist_n[topn_idx][i], senone_scores,
+                        compallsen ? NULL : senone_active, n_senone_active);
     }
 
     return 0;
 }
 
+/*
+ * Compute top-N codewords for several future frames.
+ */
+int32
+s2_semi_mgau_frame_prepare(mgau_t *ps,
+                           uint8 *senone_active,
+                           int32 n_senone_active,
+                           mfcc_t ***featbuf, int32 frame,
+                           int32 n_frames)
+{
+    s2_semi_mgau_t *s = (s2_semi_mgau_t *)ps;
+    int k;
+
+    (void)senone_active;
+    (void)n_senone_active;
+    if (n_frames >= s->n_topn_hist)
+        n_frames = s->n_topn_hist - 1;
+    for (k = 0; k < n_frames; ++k)
+        s2_semi_mgau_topn(s, featbuf[k], frame + k);
+
+    return n_frames;
+}
+
 static int
 split_topn(const char *str, uint8 *out, int nfeat)
 {
@@ -905,6 +447,60 @@ split_topn(const char *str, uint8 *out, int nfeat)
     return maxn;
 }
 
+/**
+ * Allocate scratch space and top-N history, which are specific to
+ * one stream of input, unlike the rest of the model.
+ */
+static void
+s2_semi_mgau_alloc_scratch(s2_semi_mgau_t *s)
+{
+    int n_feat = s->g->n_feat;
+    int i;
+
+    if (s->g->quant_bits) {
+        int32 maxlen = 0;
+        for (i = 0; i < n_feat; ++i)
+            if (s->g->featlen[i] > maxlen)
+                maxlen = s->g->featlen[i];
+        s->qobs = ckd_calloc(maxlen, sizeof(*s->qobs));
+    }
+    s->mixw_cw = ckd_calloc(s->max_topn, sizeof(*s->mixw_cw));
+    s->mixw_score = ckd_calloc(s->max_topn, sizeof(*s->mixw_score));
+    s->w_den = ckd_calloc(s->max_topn * 16, sizeof(*s->w_den));
+    s->mixw_dense = ckd_calloc(s->n_sen, sizeof(*s->mixw_dense));
+
+    /* Top-N scores from recent frames, enough for a batch plus the
+     * one before it */
+    s->n_topn_hist = ACMOD_MAX_BATCH + 1;
+    s->topn_hist = (vqFeature_t ***)
+        ckd_calloc_3d(s->n_topn_hist, n_feat, s->max_topn,
+                      sizeof(***s->topn_hist));
+    s->topn_hist_n = ckd_calloc_2d(s->n_topn_hist, n_feat,
+                                   sizeof(**s->topn_hist_n));
+    for (i = 0; i < s->n_topn_hist; ++i) {
+        int j;
+        for (j = 0; j < n_feat; ++j) {
+            int k;
+            for (k = 0; k < s->max_topn; ++k) {
+                s->topn_hist[i][j][k].score = WORST_DIST;
+                s->topn_hist[i][j][k].codeword = k;
+            }
+        }
+    }
+}
+
+static void
+s2_semi_mgau_free_scratch(s2_semi_mgau_t *s)
+{
+    ckd_free(s->qobs);
+    ckd_free(s->mixw_cw);
+    ckd_free(s->mixw_score);
+    ckd_free(s->w_den);
+    ckd_free(s->mixw_dense);
+    ckd_free_2d(s->topn_hist_n);
+    ckd_free_3d((void **)s->topn_hist);
+}
+
 mgau_t *
 s2_semi_mgau_init_s3file(acmod_t *acmod, s3file_t *means, s3file_t *vars,
                          s3file_t *mixw, s3file_t *sendump)
@@ -919,7 +515,8 @@ s2_semi_mgau_init_s3file(acmod_t *acmod, s3file_t *means, s3file_t *vars,
 
     s->lmath = logmath_retain(acmod->lmath);
     /* Log-add table. */
-    s->lmath_8b = logmath_init(logmath_get_base(acmod->lmath), SENSCR_SHIFT, TRUE);
+    s->lmath_8b = logmath_init_cached(logmath_get_base(acmod->lmath),
+                                      SENSCR_SHIFT, TRUE, acmod->cache);
     if (s->lmath_8b == NULL)
         goto error_out;
     /* Ensure that it is only 8 bits wide so that fast_logmath_add() works. */
@@ -930,9 +527,9 @@ s2_semi_mgau_init_s3file(acmod_t *acmod, s3file_t *means, s3file_t *vars,
     }
 
     /* Read means and variances. */
-    if ((s->g = gauden_init_s3file(means, vars,
-                                   config_float(s->config, "varfloor"),
-                                   s->lmath))
+    if ((s->g = gauden_init_s3file_cached(means, vars,
+                                          config_float(s->config, "varfloor"),
+                                          s->lmath, acmod->cache))
         == NULL) {
         E_ERROR("Failed to read means and variances\n");
         goto error_out;
@@ -972,6 +569,12 @@ s2_semi_mgau_init_s3file(acmod_t *acmod, s3file_t *means, s3file_t *vars,
     }
     s->ds_ratio = config_int(s->config, "ds");
 
+    /* Quantize Gaussians if requested. */
+    if (config_int(s->config, "gquant")) {
+        if (gauden_quantize(s->g, config_int(s->config, "gquant")) < 0)
+            goto error_out;
+    }
+
     /* Determine top-N for each feature */
     s->topn_beam = ckd_calloc(n_feat, sizeof(*s->topn_beam));
     s->max_topn = config_int(s->config, "topn");
@@ -983,26 +586,19 @@ s2_semi_mgau_init_s3file(acmod_t *acmod, s3file_t *means, s3file_t *vars,
     }
     E_INFOCONT("\n");
 
-    /* Top-N scores from recent frames */
-    s->n_topn_hist = 2;
-    s->topn_hist = (vqFeature_t ***)
-        ckd_calloc_3d(s->n_topn_hist, n_feat, s->max_topn,
-                      sizeof(***s->topn_hist));
-    s->topn_hist_n = ckd_calloc_2d(s->n_topn_hist, n_feat,
-                                   sizeof(**s->topn_hist_n));
-    for (i = 0; i < s->n_topn_hist; ++i) {
-        int j;
-        for (j = 0; j < n_feat; ++j) {
-            int k;
-            for (k = 0; k < s->max_topn; ++k) {
-                s->topn_hist[i][j][k].score = WORST_DIST;
-                s->topn_hist[i][j][k].codeword = k;
-            }
-        }
+    /* Scratch space for senone scoring */
+    if ((s->simd = gmm_simd_get(config_str(s->config, "simd")))
+        && s->simd->mixw)
+        E_INFO("Using %s SIMD kernels for mixture weights\n", s->simd->name);
+    for (i = 0; i < (int)LOGMATH_TABLE(s->lmath_8b)->table_size; ++i) {
+        if (((uint8 *)LOGMATH_TABLE(s->lmath_8b)->table)[i])
+            s->n_logadd = i + 1;
     }
+    s2_semi_mgau_alloc_scratch(s);
 
     ps = (mgau_t *)s;
     ps->vt = &s2_semi_mgau_funcs;
+    ps->refcount = 1;
     return ps;
 error_out:
     s2_semi_mgau_free(ps_mgau_base(s));
@@ -1062,7 +658,32 @@ s2_semi_mgau_mllr_transform(mgau_t *ps,
                             mllr_t *mllr)
 {
     s2_semi_mgau_t *s = (s2_semi_mgau_t *)ps;
-    return gauden_mllr_transform(s->g, mllr, s->config);
+
+    if (gauden_mllr_transform(s->g, mllr, s->config) < 0)
+        return -1;
+    if (s->g->quant_bits)
+        return gauden_quantize(s->g, s->g->quant_bits);
+    return 0;
+}
+
+mgau_t *
+s2_semi_mgau_clone(mgau_t *ps, acmod_t *acmod)
+{
+    s2_semi_mgau_t *other = (s2_semi_mgau_t *)ps;
+    s2_semi_mgau_t *s;
+
+    /* Everything but the scratch space is shared. */
+    s = ckd_malloc(sizeof(*s));
+    memcpy(s, other, sizeof(*s));
+    s->config = acmod->config;
+    s->qobs = NULL;
+    s2_semi_mgau_alloc_scratch(s);
+
+    ps = (mgau_t *)s;
+    ps->frame_idx = 0;
+    ps->refcount = 1;
+    ps->shared = mgau_retain(ps_mgau_base(other));
+    return ps;
 }
 
 void
@@ -1070,6 +691,12 @@ s2_semi_mgau_free(mgau_t *ps)
 {
     s2_semi_mgau_t *s = (s2_semi_mgau_t *)ps;
 
+    s2_semi_mgau_free_scratch(s);
+    if (ps->shared) {
+        mgau_free(ps->shared);
+        ckd_free(s);
+        return;
+    }
     logmath_free(s->lmath);
     logmath_free(s->lmath_8b);
     if (s->sendump_mmap) {
@@ -1082,7 +709,5 @@ s2_semi_mgau_free(mgau_t *ps)
     }
     gauden_free(s->g);
     ckd_free(s->topn_beam);
-    ckd_free_2d(s->topn_hist_n);
-    ckd_free_3d((void **)s->topn_hist);
     ckd_free(s);
 }
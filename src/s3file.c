@@ -51,6 +51,7 @@
 
 #include <soundswallower/ckd_alloc.h>
 #include <soundswallower/err.h>
+#include <soundswallower/refcount.h>
 #include <soundswallower/s3file.h>
 #include <soundswallower/strfuncs.h>
 
@@ -87,24 +88,41 @@ s3file_map_file(const char *filename)
     return s;
 }
 
+s3file_t *
+s3file_slice(s3file_t *parent, size_t offset, size_t len)
+{
+    size_t size = (const char *)parent->end - (const char *)parent->buf;
+    s3file_t *s;
+
+    if (offset > size || len > size - offset)
+        return NULL;
+    s = s3file_init((const char *)parent->buf + offset, len);
+    s->parent = s3file_retain(parent);
+
+    return s;
+}
+
 s3file_t *
 s3file_retain(s3file_t *s)
 {
     if (s == NULL)
         return NULL;
-    ++s->refcount;
+    refcount_inc(&s->refcount);
     return s;
 }
 
 int
 s3file_free(s3file_t *s)
 {
+    int refcount;
+
     if (s == NULL)
         return 0;
-    if (--s->refcount > 0)
-        return s->refcount;
+    if ((refcount = refcount_dec(&s->refcount)) > 0)
+        return refcount;
     if (s->mf)
         mmio_file_unmap(s->mf);
+    s3file_free(s->parent);
     ckd_free(s->headers);
     ckd_free(s);
     return 0;
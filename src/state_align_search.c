@@ -66,23 +66,18 @@ renormalize_hmms(state_align_search_t *sas, int frame_idx, int32 norm)
 static int32
 evaluate_hmms(state_align_search_t *sas, int16 const *senscr, int frame_idx)
 {
-    int32 bs = WORST_SCORE;
-    int i;
+    int i, n;
 
     hmm_context_set_senscore(sas->hmmctx, senscr);
 
-    for (i = 0; i < sas->n_phones; ++i) {
+    for (i = n = 0; i < sas->n_phones; ++i) {
         hmm_t *hmm = sas->hmms + i;
-        int32 score;
 
         if (hmm_frame(hmm) < frame_idx)
             continue;
-        score = hmm_vit_eval(hmm);
-        if (score BETTER_THAN bs) {
-            bs = score;
-        }
+        sas->hmm_eval[n++] = hmm;
     }
-    return bs;
+    return hmm_simd_vit_eval(sas->simd, sas->hmm_eval, n);
 }
 
 static void
@@ -283,6 +278,7 @@ state_align_search_free(search_module_t *search)
     state_align_search_t *sas = (state_align_search_t *)search;
     search_module_base_free(search);
     ckd_free(sas->hmms);
+    ckd_free(sas->hmm_eval);
     ckd_free(sas->tokens);
     ckd_free(sas->sf);
     ckd_free(sas->ef);
@@ -424,6 +420,7 @@ static searchfuncs_t state_align_search_funcs = {
     /* hyp: */ state_align_search_hyp,
     /* prob: */ NULL,
     /* seg_iter: */ state_align_search_seg_iter,
+    /* set_beam_factor: */ NULL,
 };
 
 search_module_t *
@@ -453,6 +450,8 @@ state_align_search_init(const char *name,
     sas->n_phones = alignment_n_phones(al);
     sas->n_emit_state = alignment_n_states(al);
     sas->hmms = ckd_calloc(sas->n_phones, sizeof(*sas->hmms));
+    sas->hmm_eval = ckd_calloc(sas->n_phones, sizeof(*sas->hmm_eval));
+    sas->simd = hmm_simd_get(config_str(config, "simd"));
     sas->sf = ckd_calloc(sas->n_phones, sizeof(*sas->sf));
     sas->ef = ckd_calloc(sas->n_phones, sizeof(*sas->ef));
     for (i = 0, itor = alignment_phones(al);
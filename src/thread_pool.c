@@ -0,0 +1,207 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/err.h>
+#include <soundswallower/thread_pool.h>
+
+#ifdef HAVE_PTHREAD
+struct thread_pool_s {
+    int n_threads; /**< Number of threads including the caller. */
+    pthread_t *threads; /**< Worker threads (n_threads - 1). */
+    pthread_mutex_t mtx; /**< Protects everything below. */
+    pthread_cond_t start; /**< Signalled when a job is posted. */
+    pthread_cond_t done; /**< Signalled when the last worker finishes. */
+    thread_pool_func_t func; /**< Current job. */
+    void *data; /**< Data for current job. */
+    unsigned long generation; /**< Incremented for each job. */
+    int n_running; /**< Number of workers still running the current job. */
+    int shutdown; /**< Set to stop workers. */
+};
+
+struct thread_arg_s {
+    thread_pool_t *pool;
+    int idx;
+};
+
+static void *
+thread_pool_worker(void *arg)
+{
+    struct thread_arg_s *targ = arg;
+    thread_pool_t *pool = targ->pool;
+    int idx = targ->idx;
+    unsigned long generation = 0;
+
+    ckd_free(targ);
+    pthread_mutex_lock(&pool->mtx);
+    while (1) {
+        thread_pool_func_t func;
+        void *data;
+
+        while (!pool->shutdown && pool->generation == generation)
+            pthread_cond_wait(&pool->start, &pool->mtx);
+        if (pool->shutdown)
+            break;
+        generation = pool->generation;
+        func = pool->func;
+        data = pool->data;
+        pthread_mutex_unlock(&pool->mtx);
+
+        (*func)(data, idx, pool->n_threads);
+
+        pthread_mutex_lock(&pool->mtx);
+        if (--pool->n_running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mtx);
+    return NULL;
+}
+
+thread_pool_t *
+thread_pool_init(int n_threads)
+{
+    thread_pool_t *pool;
+    int i;
+
+    if (n_threads < 2)
+        return NULL;
+    pool = ckd_calloc(1, sizeof(*pool));
+    pthread_mutex_init(&pool->mtx, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->threads = ckd_calloc(n_threads - 1, sizeof(*pool->threads));
+    for (i = 1; i < n_threads; ++i) {
+        struct thread_arg_s *targ = ckd_calloc(1, sizeof(*targ));
+        targ->pool = pool;
+        targ->idx = i;
+        if (pthread_create(&pool->threads[i - 1], NULL,
+                           thread_pool_worker, targ)
+            != 0) {
+            E_ERROR("Failed to create thread %d, using %d threads\n", i, i);
+            ckd_free(targ);
+            break;
+        }
+    }
+    pool->n_threads = i;
+    if (pool->n_threads < 2) {
+        thread_pool_free(pool);
+        return NULL;
+    }
+    E_INFO("Created pool of %d threads\n", pool->n_threads);
+    return pool;
+}
+
+int
+thread_pool_n_threads(thread_pool_t *pool)
+{
+    if (pool == NULL)
+        return 1;
+    return pool->n_threads;
+}
+
+void
+thread_pool_run(thread_pool_t *pool, thread_pool_func_t func, void *data)
+{
+    if (pool == NULL) {
+        (*func)(data, 0, 1);
+        return;
+    }
+    pthread_mutex_lock(&pool->mtx);
+    pool->func = func;
+    pool->data = data;
+    pool->n_running = pool->n_threads - 1;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mtx);
+
+    (*func)(data, 0, pool->n_threads);
+
+    pthread_mutex_lock(&pool->mtx);
+    while (pool->n_running > 0)
+        pthread_cond_wait(&pool->done, &pool->mtx);
+    pthread_mutex_unlock(&pool->mtx);
+}
+
+void
+thread_pool_free(thread_pool_t *pool)
+{
+    int i;
+
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->mtx);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mtx);
+    for (i = 1; i < pool->n_threads; ++i)
+        pthread_join(pool->threads[i - 1], NULL);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mtx);
+    ckd_free(pool->threads);
+    ckd_free(pool);
+}
+#else /* !HAVE_PTHREAD */
+thread_pool_t *
+thread_pool_init(int n_threads)
+{
+    if (n_threads > 1)
+        E_WARN("Threads not supported, using only one\n");
+    return NULL;
+}
+
+int
+thread_pool_n_threads(thread_pool_t *pool)
+{
+    (void)pool;
+    return 1;
+}
+
+void
+thread_pool_run(thread_pool_t *pool, thread_pool_func_t func, void *data)
+{
+    (void)pool;
+    (*func)(data, 0, 1);
+}
+
+void
+thread_pool_free(thread_pool_t *pool)
+{
+    (void)pool;
+}
+#endif /* !HAVE_PTHREAD */
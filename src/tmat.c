@@ -41,6 +41,7 @@
 #include <soundswallower/err.h>
 #include <soundswallower/hmm.h>
 #include <soundswallower/logmath.h>
+#include <soundswallower/refcount.h>
 #include <soundswallower/tmat.h>
 #include <soundswallower/vector.h>
 
@@ -130,6 +131,7 @@ tmat_init_s3file(s3file_t *s, logmath_t *lmath, float64 tpfloor)
     tmat_t *t;
 
     t = (tmat_t *)ckd_calloc(1, sizeof(tmat_t));
+    t->refcount = 1;
 
     /* Read header, including argument-value info and 32-bit byteorder magic */
     if (s3file_parse_header(s, TMAT_PARAM_VERSION) < 0) {
@@ -226,15 +228,29 @@ error_out:
     return NULL;
 }
 
+tmat_t *
+tmat_retain(tmat_t *t)
+{
+    if (t == NULL)
+        return NULL;
+    refcount_inc(&t->refcount);
+    return t;
+}
+
 /*
  *  RAH, Free memory allocated in tmat_init ()
  */
-void
+int
 tmat_free(tmat_t *t)
 {
-    if (t) {
-        if (t->tp)
-            ckd_free_3d(t->tp);
-        ckd_free(t);
-    }
+    int refcount;
+
+    if (t == NULL)
+        return 0;
+    if ((refcount = refcount_dec(&t->refcount)) > 0)
+        return refcount;
+    if (t->tp)
+        ckd_free_3d(t->tp);
+    ckd_free(t);
+    return 0;
 }
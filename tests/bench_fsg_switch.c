@@ -0,0 +1,194 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+
+/*
+ * Benchmark for grammar switching.  Loads large generated grammars
+ * with and without lazy lextree construction, and reports the time
+ * taken to switch to each one and to decode the first utterance after
+ * the switch.  Not run as part of the test suite.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/decoder.h>
+#include <soundswallower/fsg_search.h>
+#include <soundswallower/strfuncs.h>
+
+#include "test_macros.h"
+#include "test_fixtures.h"
+
+/* Pick n words spread evenly through the dictionary, skipping
+ * alternate pronunciations and anything JSGF won't like. */
+static char **
+pick_words(dict_t *dict, int32 n)
+{
+    char **words;
+    int32 w, i, stride;
+
+    words = ckd_calloc(n, sizeof(*words));
+    stride = dict_size(dict) / (n * 2);
+    if (stride < 1)
+        stride = 1;
+    i = 0;
+    for (w = 0; w < dict_size(dict) && i < n; w += stride) {
+        const char *c;
+        if (dict_basewid(dict, w) != w || dict_filler_word(dict, w))
+            continue;
+        for (c = dict_wordstr(dict, w); *c; ++c)
+            if (!islower((unsigned char)*c))
+                break;
+        if (*c == '\0')
+            words[i++] = ckd_salloc(dict_wordstr(dict, w));
+    }
+    TEST_EQUAL(n, i);
+    return words;
+}
+
+/* Four slots with n words each. */
+static char *
+chain_grammar(char **words, int32 n)
+{
+    char *gram, *tmp;
+    int32 i;
+
+    gram = ckd_salloc("#JSGF V1.0; grammar chain;\n"
+                      "public <s> = <w> <w> <w> <w>;\n<w> = ");
+    for (i = 0; i < n; ++i) {
+        tmp = string_join(gram, i ? " | " : "", words[i], NULL);
+        ckd_free(gram);
+        gram = tmp;
+    }
+    tmp = string_join(gram, ";\n", NULL);
+    ckd_free(gram);
+    return tmp;
+}
+
+/* n / 3 distinct three-word commands. */
+static char *
+phrase_grammar(char **words, int32 n)
+{
+    char *gram, *tmp;
+    int32 i;
+
+    gram = ckd_salloc("#JSGF V1.0; grammar phrases;\npublic <s> = ");
+    for (i = 0; i + 2 < n; i += 3) {
+        tmp = string_join(gram, i ? " | " : "", words[i], " ",
+                          words[i + 1], " ", words[i + 2], NULL);
+        ckd_free(gram);
+        gram = tmp;
+    }
+    tmp = string_join(gram, ";\n", NULL);
+    ckd_free(gram);
+    return tmp;
+}
+
+static void
+bench(decoder_t *ps, const char *name, const char *gram,
+      int16 *data, size_t nsamp)
+{
+    int lazy;
+
+    for (lazy = 0; lazy < 2; ++lazy) {
+        fsg_lextree_t *lextree;
+        clock_t start;
+        double t_switch, t_first, t_second;
+        int32 n_pnode;
+        int score;
+
+        config_set_bool(ps->config, "fsglazy", lazy);
+        start = clock();
+        TEST_EQUAL(0, decoder_set_jsgf_string(ps, gram));
+        t_switch = (double)(clock() - start) / CLOCKS_PER_SEC;
+        start = clock();
+        decoder_start_utt(ps);
+        decoder_process_int16(ps, data, nsamp, FALSE, TRUE);
+        decoder_end_utt(ps);
+        t_first = (double)(clock() - start) / CLOCKS_PER_SEC;
+        lextree = ((fsg_search_t *)ps->search)->lextree;
+        n_pnode = lextree->n_pnode;
+        start = clock();
+        decoder_start_utt(ps);
+        decoder_process_int16(ps, data, nsamp, FALSE, TRUE);
+        decoder_end_utt(ps);
+        t_second = (double)(clock() - start) / CLOCKS_PER_SEC;
+        decoder_hyp(ps, &score);
+        printf("%-8s %-5s %8.3f %8.3f %8.3f %8.3f %8d %6d/%-6d %d\n",
+               name, lazy ? "lazy" : "eager", t_switch, t_first,
+               t_switch + t_first, t_second, n_pnode,
+               lextree->n_tree, fsg_model_n_state(lextree->fsg), score);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    decoder_t *ps;
+    config_t *config;
+    int16 *data;
+    size_t nsamp;
+    char **words, *gram;
+    int32 i, n_words;
+
+    n_words = (argc > 1) ? atoi(argv[1]) : 3000;
+    err_set_loglevel(ERR_ERROR);
+    data = read_raw(TESTDATADIR "/goforward.raw", &nsamp);
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    config_set_str(config, "samprate", "16000");
+    config_set_str(config, "cmn", "batch");
+    config_set_str(config, "loglevel", "ERROR");
+    TEST_ASSERT(ps = decoder_init(config));
+    words = pick_words(ps->dict, n_words);
+
+    printf("%d words, times in seconds CPU\n", n_words);
+    printf("%-8s %-5s %8s %8s %8s %8s %8s %13s %s\n", "grammar", "mode",
+           "switch", "first", "total", "second", "nodes", "trees/states",
+           "score");
+    gram = chain_grammar(words, n_words);
+    bench(ps, "chain", gram, data, nsamp);
+    ckd_free(gram);
+    gram = phrase_grammar(words, n_words);
+    bench(ps, "phrases", gram, data, nsamp);
+    ckd_free(gram);
+
+    for (i = 0; i < n_words; ++i)
+        ckd_free(words[i]);
+    ckd_free(words);
+    decoder_free(ps);
+    ckd_free(data);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+
+/*
+ * Benchmark for cross-word transitions.  Decodes with a grammar
+ * whose rule has a very large number of alternatives, so that the
+ * state they leave from has a lot of roots, and reports how many of
+ * them a word exit into that state actually has to look at.  Not run
+ * as part of the test suite.
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/decoder.h>
+#include <soundswallower/fsg_search.h>
+
+#include "test_macros.h"
+#include "test_fixtures.h"
+
+/* A rule with up to n distinct words from the dictionary (skipping
+ * alternate pronunciations and anything JSGF won't like), repeated
+ * twice so that its words are entered from its own word exits. */
+static char *
+alternatives_grammar(dict_t *dict, int32 n, int32 *out_n)
+{
+    const char *head = "#JSGF V1.0; grammar alts;\n"
+                       "public <s> = <w> <w>;\n<w> = ";
+    char *gram, *p;
+    size_t len;
+    int32 w, i;
+
+    len = strlen(head) + 3;
+    for (w = 0; w < dict_size(dict); ++w)
+        len += strlen(dict->word[w].word) + 3;
+    gram = ckd_calloc(len, 1);
+    p = gram + sprintf(gram, "%s", head);
+    i = 0;
+    for (w = 0; w < dict_size(dict) && i < n; ++w) {
+        const char *c;
+        if (dict_basewid(dict, w) != w || dict_filler_word(dict, w))
+            continue;
+        for (c = dict_wordstr(dict, w); *c; ++c)
+            if (!islower((unsigned char)*c))
+                break;
+        if (*c != '\0')
+            continue;
+        p += sprintf(p, "%s%s", i ? " | " : "", dict_wordstr(dict, w));
+        ++i;
+    }
+    strcpy(p, ";\n");
+    *out_n = i;
+    return gram;
+}
+
+int
+main(int argc, char *argv[])
+{
+    decoder_t *ps;
+    config_t *config;
+    fsg_search_t *fsgs;
+    fsg_lextree_t *lextree;
+    int16 *data;
+    size_t nsamp;
+    char *gram;
+    clock_t start;
+    double t_first, t_second;
+    int32 n_words, n_ci, n_touched, t, lc, max_tree;
+    int score;
+
+    n_words = (argc > 1) ? atoi(argv[1]) : 50000;
+    err_set_loglevel(ERR_ERROR);
+    data = read_raw(TESTDATADIR "/goforward.raw", &nsamp);
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    config_set_str(config, "samprate", "16000");
+    config_set_str(config, "cmn", "batch");
+    config_set_str(config, "loglevel", "ERROR");
+    /* Adding alternate pronunciations is quadratic in the size of
+     * the grammar, and they aren't what we're measuring here. */
+    config_set_bool(config, "fsgusealtpron", FALSE);
+    TEST_ASSERT(ps = decoder_init(config));
+    gram = alternatives_grammar(ps->dict, n_words, &n_words);
+    TEST_EQUAL(0, decoder_set_jsgf_string(ps, gram));
+    ckd_free(gram);
+
+    start = clock();
+    decoder_start_utt(ps);
+    decoder_process_int16(ps, data, nsamp, FALSE, TRUE);
+    decoder_end_utt(ps);
+    t_first = (double)(clock() - start) / CLOCKS_PER_SEC;
+    start = clock();
+    decoder_start_utt(ps);
+    decoder_process_int16(ps, data, nsamp, FALSE, TRUE);
+    decoder_end_utt(ps);
+    t_second = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    fsgs = (fsg_search_t *)ps->search;
+    lextree = fsgs->lextree;
+    max_tree = 0;
+    for (t = 0; t < lextree->n_tree; ++t)
+        if (lextree->n_root[t] > lextree->n_root[max_tree])
+            max_tree = t;
+    printf("%d alternatives: %d nodes, at most %d roots (%d groups) "
+           "per state\n", n_words, lextree->n_pnode,
+           lextree->n_root[max_tree],
+           lextree->grp_off[max_tree + 1] - lextree->grp_off[max_tree]);
+    /* Roots looked at by a word exit with each left context, and no
+     * restriction on right context. */
+    n_ci = bin_mdef_n_ciphone(ps->acmod->mdef);
+    n_touched = 0;
+    for (lc = 0; lc < n_ci; ++lc) {
+        int32 g, root = lextree->root_off[max_tree];
+        for (g = lextree->grp_off[max_tree];
+             g < lextree->grp_off[max_tree + 1]; ++g) {
+            if (fsg_pnode_ctxt_has(lextree->grp_ctxt[g], lc))
+                n_touched += lextree->grp_end[g] - root;
+            root = lextree->grp_end[g];
+        }
+    }
+    printf("roots entered per word exit: %.1f\n", (double)n_touched / n_ci);
+    printf("decode %.3f s, %.3f s CPU: %s (%d)\n", t_first, t_second,
+           decoder_hyp(ps, &score), score);
+
+    decoder_free(ps);
+    ckd_free(data);
+    return 0;
+}
@@ -0,0 +1,200 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+
+/*
+ * Benchmark for Gaussian selection.  Scores the top-N densities of
+ * every codebook for real speech features with and without a
+ * shortlist, and reports the time taken and how often the shortlist
+ * finds the same densities.  Not run as part of the test suite.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/configuration.h>
+#include <soundswallower/err.h>
+#include <soundswallower/fe.h>
+#include <soundswallower/feat.h>
+#include <soundswallower/gmm_simd.h>
+#include <soundswallower/ms_gauden.h>
+
+#include "test_macros.h"
+
+#define N_TOP 4
+
+static mfcc_t ***
+read_feats(int32 *out_n_frame)
+{
+    config_t *config;
+    fe_t *fe;
+    feat_t *fcb;
+    FILE *raw;
+    int16 *buf, *bptr;
+    mfcc_t **cep, ***feats;
+    size_t nsamp;
+    int32 n_frame, ncep;
+
+    config = config_init(NULL);
+    config_set_str(config, "lowerf", "130");
+    config_set_str(config, "upperf", "3700");
+    config_set_str(config, "nfilt", "20");
+    config_set_str(config, "transform", "dct");
+    config_set_str(config, "lifter", "22");
+    config_set_str(config, "feat", "1s_c_d_dd");
+    config_set_str(config, "svspec", "0-12/13-25/26-38");
+    fe = fe_init(config);
+    fcb = feat_init(config);
+    TEST_ASSERT(raw = fopen(TESTDATADIR "/goforward.raw", "rb"));
+    fseek(raw, 0, SEEK_END);
+    nsamp = ftell(raw) / sizeof(int16);
+    fseek(raw, 0, SEEK_SET);
+    buf = ckd_calloc(nsamp, sizeof(*buf));
+    TEST_EQUAL(nsamp, fread(buf, sizeof(*buf), nsamp, raw));
+    fclose(raw);
+
+    n_frame = fe_process_int16(fe, NULL, &nsamp, NULL, 0);
+    cep = (mfcc_t **)ckd_calloc_2d(n_frame + 1, fe_get_output_size(fe), sizeof(**cep));
+    fe_start(fe);
+    bptr = buf;
+    ncep = fe_process_int16(fe, &bptr, &nsamp, cep, n_frame);
+    ncep += fe_end(fe, cep + ncep, n_frame + 1 - ncep);
+    feats = feat_array_alloc(fcb, ncep);
+    n_frame = ncep;
+    *out_n_frame = feat_s2mfc2feat_live(fcb, cep, &ncep, TRUE, TRUE, feats);
+
+    ckd_free(buf);
+    ckd_free_2d(cep);
+    fe_free(fe);
+    feat_free(fcb);
+    config_free(config);
+    return feats;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const int32 n_lists[] = { 8, 16, 32, 64 };
+    static const int32 n_vqs[] = { 16, 32 };
+    logmath_t *lmath;
+    gauden_t *g;
+    const gmm_simd_t *simd;
+    gauden_dist_t ***ref, **out;
+    mfcc_t ***feats;
+    clock_t start;
+    double t_full, t_full_simd;
+    int32 n_frame, fr, m, f, i, j, k, l;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_ERROR);
+    feats = read_feats(&n_frame);
+    lmath = logmath_init(1.0001, 0, 0);
+    TEST_ASSERT(g = gauden_init(MODELDIR "/en-us/means",
+                                MODELDIR "/en-us/variances", 0.0001, lmath));
+    simd = gmm_simd_get("auto");
+    ref = (gauden_dist_t ***)ckd_calloc_3d(n_frame * g->n_mgau, g->n_feat,
+                                           N_TOP, sizeof(***ref));
+    out = (gauden_dist_t **)ckd_calloc_2d(g->n_feat, N_TOP, sizeof(**out));
+
+    start = clock();
+    for (fr = 0; fr < n_frame; ++fr)
+        for (m = 0; m < g->n_mgau; ++m)
+            gauden_dist(g, m, N_TOP, feats[fr], ref[fr * g->n_mgau + m]);
+    t_full = (double)(clock() - start) / CLOCKS_PER_SEC * 1e6 / n_frame;
+    t_full_simd = 0;
+    if (simd) {
+        gmm_simd_layout_t *layout = gmm_simd_layout_init(simd, g);
+        start = clock();
+        for (fr = 0; fr < n_frame; ++fr)
+            for (m = 0; m < g->n_mgau; ++m)
+                gmm_simd_gauden_dist(simd, layout, g, m, N_TOP, feats[fr], out);
+        t_full_simd = (double)(clock() - start) / CLOCKS_PER_SEC * 1e6 / n_frame;
+        gmm_simd_layout_free(layout);
+    }
+    printf("%d frames, %d codebooks x %d streams x %d densities, top-%d\n",
+           n_frame, g->n_mgau, g->n_feat, g->n_density, N_TOP);
+    printf("full:              scalar %7.1f usec/frame  %s %7.1f usec/frame\n",
+           t_full, simd ? simd->name : "-", t_full_simd);
+    printf("%5s %5s %8s %8s %8s %8s %8s\n", "vq", "list", "scalar", "simd",
+           "top-1 %", "top-N %", "loss");
+
+    for (i = 0; i < (int32)(sizeof(n_vqs) / sizeof(n_vqs[0])); ++i) {
+        for (j = 0; j < (int32)(sizeof(n_lists) / sizeof(n_lists[0])); ++j) {
+            gauden_gs_t *gs = gauden_gs_init(g, n_vqs[i], n_lists[j]);
+            double t_gs, t_gs_simd = 0, loss = 0;
+            int32 n_best = 0, n_found = 0, n_obs = 0;
+
+            start = clock();
+            for (fr = 0; fr < n_frame; ++fr)
+                for (m = 0; m < g->n_mgau; ++m)
+                    gauden_dist_gs(g, gs, m, N_TOP, feats[fr], out);
+            t_gs = (double)(clock() - start) / CLOCKS_PER_SEC * 1e6 / n_frame;
+            if (simd) {
+                start = clock();
+                for (fr = 0; fr < n_frame; ++fr)
+                    for (m = 0; m < g->n_mgau; ++m)
+                        gmm_simd_gauden_dist_gs(simd, g, gs, m, N_TOP, feats[fr], out);
+                t_gs_simd = (double)(clock() - start) / CLOCKS_PER_SEC * 1e6 / n_frame;
+            }
+            for (fr = 0; fr < n_frame; ++fr) {
+                for (m = 0; m < g->n_mgau; ++m) {
+                    gauden_dist_t **r = ref[fr * g->n_mgau + m];
+                    gauden_dist_gs(g, gs, m, N_TOP, feats[fr], out);
+                    for (f = 0; f < g->n_feat; ++f) {
+                        n_best += (r[f][0].id == out[f][0].id);
+                        for (k = 0; k < N_TOP; ++k)
+                            for (l = 0; l < N_TOP; ++l)
+                                n_found += (r[f][k].id == out[f][l].id);
+                        /* Log-likelihood lost for the best density,
+                         * in the same units as senone scores. */
+                        loss += (r[f][0].dist - out[f][0].dist) / (1 << SENSCR_SHIFT);
+                        ++n_obs;
+                    }
+                }
+            }
+            printf("%5d %5d %8.1f %8.1f %8.1f %8.1f %8.2f\n",
+                   n_vqs[i], n_lists[j], t_gs, t_gs_simd,
+                   100.0 * n_best / n_obs, 100.0 * n_found / (n_obs * N_TOP),
+                   loss / n_obs);
+            gauden_gs_free(gs);
+        }
+    }
+
+    ckd_free_3d(ref);
+    ckd_free_2d(out);
+    feat_array_free(feats);
+    gauden_free(g);
+    logmath_free(lmath);
+    return 0;
+}
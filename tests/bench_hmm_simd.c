@@ -0,0 +1,166 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+
+/*
+ * Benchmark for batched HMM evaluation.  Evaluates sets of random
+ * 3- and 5-state HMMs of various sizes with hmm_vit_eval() one at a
+ * time and with each SIMD kernel (which hmm_simd_vit_eval() only uses
+ * from HMM_SIMD_MIN_BATCH up, so that is where the rows part ways).
+ * Not run as part of the test suite.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/err.h>
+#include <soundswallower/hmm_simd.h>
+
+#define N_TMAT 128
+#define N_SSEQ 4096
+#define N_SEN 5000
+#define N_EVAL 2000000
+#define N_REP 5
+#define N_FRAME 16
+
+static double
+elapsed(clock_t start, int n_iter, int n)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / n_iter / n;
+}
+
+/* Reset scores to something plausible, so nothing falls out of the
+ * beam over many iterations (which would make things too easy for
+ * the branch predictor). */
+static void
+reset_hmms(hmm_t *hmms, int n, int n_emit)
+{
+    int i, j;
+
+    for (i = 0; i < n; ++i) {
+        hmm_enter(&hmms[i], -(rand() % 1000), i, 0);
+        for (j = 1; j < n_emit; ++j)
+            hmm_score(&hmms[i], j) = (rand() % 8 == 0) ? WORST_SCORE : -(rand() % 1000);
+    }
+}
+
+static void
+bench(int n_emit)
+{
+    static const char *kernels[] = { "scalar", "sse2", "avx2", "neon", "simd128" };
+    static const int ns[] = { 8, 32, 64, 128, 256, 512, 1024, 2048, 8192, 32768 };
+    uint8 ***tp;
+    uint16 **sseq;
+    int16 *senscore;
+    hmm_context_t *ctx;
+    hmm_t *hmms, **list;
+    int i, j, k, it, n_max = ns[sizeof(ns) / sizeof(ns[0]) - 1];
+
+    tp = (uint8 ***)ckd_calloc_3d(N_TMAT, n_emit, n_emit + 1, sizeof(***tp));
+    for (i = 0; i < N_TMAT; ++i)
+        for (j = 0; j < n_emit; ++j)
+            for (k = j; k < n_emit + 1 && k <= j + 2; ++k)
+                tp[i][j][k] = (k == j + 2 && n_emit == 3) ? 255 : rand() % 32;
+    sseq = (uint16 **)ckd_calloc_2d(N_SSEQ, n_emit, sizeof(**sseq));
+    for (i = 0; i < N_SSEQ; ++i)
+        for (j = 0; j < n_emit; ++j)
+            sseq[i][j] = rand() % N_SEN;
+    /* Several frames' worth of senone scores, so the branches in
+     * the scalar code are not too predictable. */
+    senscore = ckd_calloc(N_FRAME * N_SEN, sizeof(*senscore));
+    for (i = 0; i < N_FRAME * N_SEN; ++i)
+        senscore[i] = rand() % 200;
+    ctx = hmm_context_init(n_emit, (uint8 **const *)tp, senscore, sseq);
+    hmms = ckd_calloc(n_max, sizeof(*hmms));
+    list = ckd_calloc(n_max, sizeof(*list));
+    for (i = 0; i < n_max; ++i) {
+        hmm_init(ctx, &hmms[i], FALSE, rand() % N_SSEQ, rand() % N_TMAT);
+        list[i] = &hmms[i];
+    }
+
+    printf("%d-state HMMs, nsec/HMM\n%-8s", n_emit, "active");
+    for (i = 0; i < (int)(sizeof(ns) / sizeof(ns[0])); ++i)
+        printf(" %8d", ns[i]);
+    printf("\n");
+    for (k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); ++k) {
+        const hmm_simd_t *simd = NULL;
+        if (k > 0 && (simd = hmm_simd_get(kernels[k])) == NULL)
+            continue;
+        printf("%-8s", kernels[k]);
+        for (i = 0; i < (int)(sizeof(ns) / sizeof(ns[0])); ++i) {
+            int n = ns[i], n_iter = N_EVAL / n, rep;
+            double t, best = 1e9;
+
+            /* Best of a few runs, as timings are noisy. */
+            for (rep = 0; rep < N_REP; ++rep) {
+                clock_t start;
+
+                reset_hmms(hmms, n, n_emit);
+                start = clock();
+                for (it = 0; it < n_iter; ++it) {
+                    hmm_context_set_senscore(ctx, senscore + (it % N_FRAME) * N_SEN);
+                    if (simd)
+                        hmm_simd_vit_eval(simd, list, n);
+                    else {
+                        for (j = 0; j < n; ++j)
+                            hmm_vit_eval(list[j]);
+                    }
+                }
+                if ((t = elapsed(start, n_iter, n)) < best)
+                    best = t;
+            }
+            printf(" %8.2f", best);
+        }
+        printf("\n");
+    }
+
+    ckd_free(list);
+    ckd_free(hmms);
+    hmm_context_free(ctx);
+    ckd_free(senscore);
+    ckd_free_2d(sseq);
+    ckd_free_3d(tp);
+}
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_ERROR);
+    srand(42);
+    bench(3);
+    bench(5);
+    return 0;
+}
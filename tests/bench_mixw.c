@@ -0,0 +1,228 @@
+/* -*- c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* ====================================================================
+ * Copyright (c) 2022 David Huggins-Daines.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESSED OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ * ====================================================================
+ */
+
+/*
+ * Benchmark for semi-continuous mixture weight scoring.  Compares the
+ * SIMD kernels with the scalar code, and with the unrolled top-4 loops
+ * that s2_semi_mgau used before them, on random weights for a
+ * typically sized model.  Not run as part of the test suite.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/err.h>
+#include <soundswallower/gmm_simd.h>
+#include <soundswallower/tied_mgau_common.h>
+
+#define N_SEN 5000
+#define TOPN 4
+#define N_ITER 2000
+
+/* The old s2_semi_mgau inner loop for 8-bit weights and top-4. */
+static void
+old_8b_4(logmath_t *lmath, int16 *senone_scores, uint8 **cw,
+         const int32 *score, const uint8 *senone_active, int n_senone_active)
+{
+    int j, l, n;
+
+    for (l = j = 0; j < n_senone_active; j++) {
+        int tmp;
+        n = senone_active ? senone_active[j] + l : j;
+        tmp = cw[0][n] + score[0];
+        tmp = fast_logmath_add(lmath, tmp, cw[1][n] + score[1]);
+        tmp = fast_logmath_add(lmath, tmp, cw[2][n] + score[2]);
+        tmp = fast_logmath_add(lmath, tmp, cw[3][n] + score[3]);
+        senone_scores[n] += tmp;
+        l = n;
+    }
+}
+
+/* The old s2_semi_mgau inner loop for 4-bit weights and top-4. */
+static void
+old_4b_4(logmath_t *lmath, int16 *senone_scores, uint8 **cw,
+         const uint8 *w_den, const uint8 *senone_active, int n_senone_active)
+{
+    int j, k, l, n;
+
+    for (l = j = 0; j < n_senone_active; j++) {
+        int tmp, shift;
+        n = senone_active ? senone_active[j] + l : j;
+        shift = (n & 1) * 4;
+        tmp = w_den[(cw[0][n / 2] >> shift) & 0x0f];
+        for (k = 1; k < TOPN; ++k)
+            tmp = fast_logmath_add(lmath, tmp,
+                                   w_den[k * 16 + ((cw[k][n / 2] >> shift) & 0x0f)]);
+        senone_scores[n] += tmp;
+        l = n;
+    }
+}
+
+/* Score active senones the way s2_semi_mgau does now. */
+static void
+new_active(const gmm_simd_t *simd, int16 *senone_scores, int16 *dense,
+           uint8 **cw, const int32 *score, const uint8 *w_den,
+           const uint8 *logadd, int n_logadd,
+           const uint8 *senone_active, int n_senone_active)
+{
+    int j, l;
+
+    if (simd && simd->mixw) {
+        memset(dense, 0, N_SEN * sizeof(*dense));
+        if (w_den)
+            gmm_simd_mixw4(simd, dense, (const uint8 *const *)cw, w_den,
+                           TOPN, logadd, n_logadd, N_SEN);
+        else
+            gmm_simd_mixw(simd, dense, (const uint8 *const *)cw, score,
+                          TOPN, logadd, n_logadd, N_SEN);
+        for (l = j = 0; j < n_senone_active; ++j) {
+            l += senone_active[j];
+            senone_scores[l] += dense[l];
+        }
+    } else if (w_den) {
+        gmm_simd_mixw4_active(senone_scores, (const uint8 *const *)cw, w_den,
+                              TOPN, logadd, n_logadd,
+                              senone_active, n_senone_active);
+    } else {
+        gmm_simd_mixw_active(senone_scores, (const uint8 *const *)cw, score,
+                             TOPN, logadd, n_logadd,
+                             senone_active, n_senone_active);
+    }
+}
+
+static double
+elapsed(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC * 1e6 / N_ITER;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *kernels[] = { "scalar", "sse2", "avx2", "neon", "simd128" };
+    logmath_t *lmath;
+    const uint8 *logadd;
+    uint8 **cw, **cw4, *w_den, *senone_active;
+    int16 *senone_scores, *dense;
+    int32 score[TOPN];
+    int i, j, k, n_logadd = 0, n_active = 0;
+    clock_t start;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_ERROR);
+    lmath = logmath_init(1.0001, 10, TRUE);
+    logadd = (const uint8 *)LOGMATH_TABLE(lmath)->table;
+    for (i = 0; i < (int)LOGMATH_TABLE(lmath)->table_size; ++i)
+        if (logadd[i])
+            n_logadd = i + 1;
+    cw = (uint8 **)ckd_calloc_2d(TOPN, N_SEN, sizeof(**cw));
+    cw4 = (uint8 **)ckd_calloc_2d(TOPN, N_SEN / 2, sizeof(**cw4));
+    w_den = ckd_calloc(TOPN * 16, sizeof(*w_den));
+    senone_scores = ckd_calloc(N_SEN, sizeof(*senone_scores));
+    dense = ckd_calloc(N_SEN, sizeof(*dense));
+    senone_active = ckd_calloc(N_SEN, sizeof(*senone_active));
+    srand(42);
+    for (k = 0; k < TOPN; ++k) {
+        score[k] = rand() % 8;
+        for (j = 0; j < N_SEN; ++j)
+            cw[k][j] = rand() % 160;
+        for (j = 0; j < N_SEN / 2; ++j)
+            cw4[k][j] = rand() % 256;
+        for (j = 0; j < 16; ++j)
+            w_den[k * 16 + j] = rand() % 160 + score[k];
+    }
+    /* About a third of senones active, as delta-coded indices. */
+    for (i = j = 0; j < N_SEN; ++j) {
+        if (rand() % 3 == 0) {
+            senone_active[n_active++] = j - i;
+            i = j;
+        }
+    }
+
+    printf("%d senones, %d active, top-%d, usec/frame/stream\n",
+           N_SEN, n_active, TOPN);
+    start = clock();
+    for (i = 0; i < N_ITER; ++i)
+        old_8b_4(lmath, senone_scores, cw, score, NULL, N_SEN);
+    printf("%-8s 8-bit all %8.2f", "old", elapsed(start));
+    start = clock();
+    for (i = 0; i < N_ITER; ++i)
+        old_4b_4(lmath, senone_scores, cw4, w_den, NULL, N_SEN);
+    printf("  4-bit all %8.2f", elapsed(start));
+    start = clock();
+    for (i = 0; i < N_ITER; ++i)
+        old_8b_4(lmath, senone_scores, cw, score, senone_active, n_active);
+    printf("  8-bit active %8.2f", elapsed(start));
+    start = clock();
+    for (i = 0; i < N_ITER; ++i)
+        old_4b_4(lmath, senone_scores, cw4, w_den, senone_active, n_active);
+    printf("  4-bit active %8.2f\n", elapsed(start));
+
+    for (k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); ++k) {
+        const gmm_simd_t *simd = NULL;
+        if (k > 0 && (simd = gmm_simd_get(kernels[k])) == NULL)
+            continue;
+        start = clock();
+        for (i = 0; i < N_ITER; ++i)
+            gmm_simd_mixw(simd, senone_scores, (const uint8 *const *)cw,
+                          score, TOPN, logadd, n_logadd, N_SEN);
+        printf("%-8s 8-bit all %8.2f", kernels[k], elapsed(start));
+        start = clock();
+        for (i = 0; i < N_ITER; ++i)
+            gmm_simd_mixw4(simd, senone_scores, (const uint8 *const *)cw4,
+                           w_den, TOPN, logadd, n_logadd, N_SEN);
+        printf("  4-bit all %8.2f", elapsed(start));
+        start = clock();
+        for (i = 0; i < N_ITER; ++i)
+            new_active(simd, senone_scores, dense, cw, score, NULL,
+                       logadd, n_logadd, senone_active, n_active);
+        printf("  8-bit active %8.2f", elapsed(start));
+        start = clock();
+        for (i = 0; i < N_ITER; ++i)
+            new_active(simd, senone_scores, dense, cw4, score, w_den,
+                       logadd, n_logadd, senone_active, n_active);
+        printf("  4-bit active %8.2f\n", elapsed(start));
+    }
+
+    ckd_free_2d(cw);
+    ckd_free_2d(cw4);
+    ckd_free(w_den);
+    ckd_free(senone_scores);
+    ckd_free(dense);
+    ckd_free(senone_active);
+    logmath_free(lmath);
+    return 0;
+}
@@ -44,6 +44,7 @@ main(int argc, char *argv[])
     int nfr;
     int frame_counter;
     int bestsen1[NUM_BEST_SEN];
+    int bestsen2[NUM_BEST_SEN];
 
     (void)argc;
     (void)argv;
@@ -244,14 +245,306 @@ main(int argc, char *argv[])
             best_score = acmod_best_score(acmod, &best_senid);
             E_INFO("Frame %d best senone %d score %d\n",
                    frame_idx, best_senid, best_score);
-            if (frame_counter < NUM_BEST_SEN)
+            if (frame_counter < NUM_BEST_SEN) {
                 TEST_EQUAL_LOG(best_score, bestsen1[frame_counter]);
+                bestsen2[frame_counter] = best_score;
+            }
+            TEST_EQUAL(frame_counter, frame_idx);
+            ++frame_counter;
+            frame_idx = -1;
+        }
+    }
+
+    E_INFO("Rewound, batched (MFCC):\n");
+    TEST_EQUAL(0, acmod_rewind(acmod));
+    {
+        int16 best_score;
+        int frame_idx = -1, best_senid, n_batch = 0;
+        frame_counter = 0;
+        while (acmod->n_feat_frame > 0) {
+            if (n_batch == 0) {
+                n_batch = acmod_score_batch(acmod, acmod->output_frame,
+                                            ACMOD_MAX_BATCH);
+                TEST_ASSERT(n_batch > 0);
+                TEST_ASSERT(n_batch <= ACMOD_MAX_BATCH);
+                TEST_ASSERT(n_batch <= acmod->n_feat_frame);
+            }
+            acmod_score(acmod, &frame_idx);
+            acmod_advance(acmod);
+            --n_batch;
+            best_score = acmod_best_score(acmod, &best_senid);
+            E_INFO("Frame %d best senone %d score %d\n",
+                   frame_idx, best_senid, best_score);
+            if (frame_counter < NUM_BEST_SEN)
+                TEST_EQUAL(best_score, bestsen2[frame_counter]);
             TEST_EQUAL(frame_counter, frame_idx);
             ++frame_counter;
             frame_idx = -1;
         }
     }
 
+    E_INFO("Rewound, cached (MFCC):\n");
+    acmod->score_cache_max = 1 << 23;
+    TEST_EQUAL(0, acmod_rewind(acmod));
+    {
+        int16 best_score;
+        int frame_idx = -1, best_senid, pass;
+        for (pass = 0; pass < 2; ++pass) {
+            frame_counter = 0;
+            acmod->score_cache_hits = acmod->score_cache_misses = 0;
+            while (acmod->n_feat_frame > 0) {
+                acmod_score(acmod, &frame_idx);
+                acmod_advance(acmod);
+                best_score = acmod_best_score(acmod, &best_senid);
+                if (frame_counter < NUM_BEST_SEN)
+                    TEST_EQUAL(best_score, bestsen2[frame_counter]);
+                TEST_EQUAL(frame_counter, frame_idx);
+                ++frame_counter;
+                frame_idx = -1;
+            }
+            E_INFO("Pass %d: %d hits %d misses\n", pass,
+                   acmod->score_cache_hits, acmod->score_cache_misses);
+            if (pass == 0) {
+                TEST_EQUAL(0, acmod->score_cache_hits);
+                TEST_EQUAL(acmod->score_cache_misses, frame_counter);
+            } else {
+                TEST_EQUAL(acmod->score_cache_hits, frame_counter);
+            }
+            /* Nothing to precompute, it's all there. */
+            TEST_EQUAL(0, acmod_rewind(acmod));
+            if (pass == 1) {
+                TEST_EQUAL(0, acmod_score_batch(acmod, 0, ACMOD_MAX_BATCH));
+            }
+        }
+    }
+
+    E_INFO("Rewound, cached, active senones (MFCC):\n");
+    acmod_clear_score_cache(acmod);
+    acmod->compallsen = FALSE;
+    {
+        int16 scores[NUM_BEST_SEN][2];
+        int frame_idx = -1, pass, sen;
+        for (pass = 0; pass < 4; ++pass) {
+            frame_counter = 0;
+            acmod->score_cache_hits = acmod->score_cache_misses = 0;
+            while (acmod->n_feat_frame > 0) {
+                int16 const *senscr;
+                acmod_clear_active(acmod);
+                /* Use a different active set in the last two passes. */
+                for (sen = pass / 2; sen < 300; sen += 3)
+                    bitvec_set(acmod->senone_active_vec, sen);
+                senscr = acmod_score(acmod, &frame_idx);
+                acmod_advance(acmod);
+                /* Scores are only reused for the same active set,
+                 * since they are normalized over it. */
+                if (frame_counter < NUM_BEST_SEN) {
+                    if (pass % 2 == 0) {
+                        scores[frame_counter][0] = senscr[150 + pass / 2];
+                        scores[frame_counter][1] = senscr[153 + pass / 2];
+                    } else {
+                        TEST_EQUAL(senscr[150 + pass / 2],
+                                   scores[frame_counter][0]);
+                        TEST_EQUAL(senscr[153 + pass / 2],
+                                   scores[frame_counter][1]);
+                    }
+                }
+                ++frame_counter;
+                frame_idx = -1;
+            }
+            E_INFO("Pass %d: %d hits %d misses\n", pass,
+                   acmod->score_cache_hits, acmod->score_cache_misses);
+            if (pass % 2 == 0) {
+                TEST_EQUAL(0, acmod->score_cache_hits);
+                TEST_EQUAL(acmod->score_cache_misses, frame_counter);
+            } else {
+                TEST_EQUAL(acmod->score_cache_hits, frame_counter);
+            }
+            TEST_EQUAL(0, acmod_rewind(acmod));
+        }
+    }
+
+    E_INFO("Rewound, CI-gated active senones (MFCC):\n");
+    acmod_clear_score_cache(acmod);
+    acmod->score_cache_max = 0;
+    {
+        int16 **ref;
+        int n_sen = bin_mdef_n_sen(acmod->mdef);
+        int frame_idx = -1, pass, sen, n_computed = 0, n_backoff = 0, n_gated = 0;
+
+        ref = ckd_calloc_2d(frame_counter, n_sen, sizeof(**ref));
+        TEST_ASSERT(acmod_set_ci_beam(acmod, 1e-3) < 0);
+        TEST_EQUAL(0, acmod_set_ci_beam(acmod, 0));
+        for (pass = 0; pass < 3; ++pass) {
+            frame_counter = 0;
+            acmod->n_ci_gated = 0;
+            if (pass == 1)
+                acmod_set_ci_beam(acmod, 1e-3);
+            /* A beam so wide that nothing is gated. */
+            if (pass == 2)
+                acmod_set_ci_beam(acmod, 1e-30);
+            while (acmod->n_feat_frame > 0) {
+                int16 const *senscr;
+                int offset;
+                acmod_clear_active(acmod);
+                for (sen = 0; sen < n_sen; sen += 4)
+                    bitvec_set(acmod->senone_active_vec, sen);
+                senscr = acmod_score(acmod, &frame_idx);
+                acmod_advance(acmod);
+                if (pass == 0) {
+                    memcpy(ref[frame_counter], senscr, n_sen * sizeof(*senscr));
+                    ++frame_counter;
+                    frame_idx = -1;
+                    continue;
+                }
+                /* Then the scores are exactly the same as without
+                 * the beam. */
+                if (pass == 2) {
+                    for (sen = 0; sen < n_sen; sen += 4)
+                        TEST_EQUAL(ref[frame_counter][sen], senscr[sen]);
+                    ++frame_counter;
+                    frame_idx = -1;
+                    continue;
+                }
+                /* Computed senones are the same up to normalization
+                 * (senone 0 is CI, so it is always computed), and the
+                 * others are worse than their CI parent. */
+                offset = senscr[0] - ref[frame_counter][0];
+                for (sen = 0; sen < n_sen; sen += 4) {
+                    int ci = bin_mdef_cd2cisen(acmod->mdef, sen);
+                    if (sen < bin_mdef_n_ci_sen(acmod->mdef))
+                        continue;
+                    if (senscr[sen] == ref[frame_counter][sen] + offset)
+                        ++n_computed;
+                    else {
+                        TEST_ASSERT(senscr[sen] > senscr[ci]);
+                        ++n_backoff;
+                    }
+                }
+                ++frame_counter;
+                frame_idx = -1;
+            }
+            if (pass == 2)
+                TEST_EQUAL(0, acmod->n_ci_gated);
+            TEST_EQUAL(0, acmod_rewind(acmod));
+            if (pass == 1)
+                n_gated = acmod->n_ci_gated;
+        }
+        E_INFO("%d computed %d backed off (%d gated)\n",
+               n_computed, n_backoff, n_gated);
+        TEST_ASSERT(n_backoff > 0);
+        TEST_ASSERT(n_computed > 0);
+        TEST_ASSERT(n_gated >= n_backoff);
+        TEST_EQUAL(0, acmod_set_ci_beam(acmod, 0));
+        ckd_free_2d(ref);
+    }
+
+    E_INFO("Rewound, batched, active senones (MFCC):\n");
+    {
+        int16 **ref;
+        int n_sen = bin_mdef_n_sen(acmod->mdef);
+        int span = n_sen / 8;
+        int frame_idx = -1, pass, sen, n_batch, n_batched;
+
+        ref = ckd_calloc_2d(frame_counter, n_sen, sizeof(**ref));
+        for (pass = 0; pass < 2; ++pass) {
+            frame_counter = n_batch = n_batched = 0;
+            while (acmod->n_feat_frame > 0) {
+                int16 const *senscr;
+                /* A different part of the model in every frame, so
+                 * that the guess made for the batch is never right. */
+                int lo = (frame_counter * 97) % (n_sen - span);
+
+                if (pass == 1 && n_batch == 0) {
+                    int guess = (lo + span) % (n_sen - span);
+                    acmod_clear_active(acmod);
+                    for (sen = guess; sen < guess + span; sen += 2)
+                        bitvec_set(acmod->senone_active_vec, sen);
+                    n_batch = acmod_score_batch(acmod, acmod->output_frame,
+                                                ACMOD_MAX_BATCH);
+                    TEST_ASSERT(n_batch > 0);
+                    TEST_ASSERT(n_batch <= ACMOD_MAX_BATCH);
+                    n_batched += n_batch;
+                }
+                acmod_clear_active(acmod);
+                for (sen = lo; sen < lo + span; sen += 2)
+                    bitvec_set(acmod->senone_active_vec, sen);
+                senscr = acmod_score(acmod, &frame_idx);
+                acmod_advance(acmod);
+                if (n_batch > 0)
+                    --n_batch;
+                if (pass == 0)
+                    memcpy(ref[frame_counter], senscr, n_sen * sizeof(*senscr));
+                else {
+                    for (sen = lo; sen < lo + span; sen += 2)
+                        TEST_EQUAL(ref[frame_counter][sen], senscr[sen]);
+                }
+                ++frame_counter;
+                frame_idx = -1;
+            }
+            TEST_EQUAL(0, acmod_rewind(acmod));
+        }
+        E_INFO("%d of %d frames batched\n", n_batched, frame_counter);
+        TEST_EQUAL(frame_counter, n_batched);
+        ckd_free_2d(ref);
+    }
+
+    E_INFO("Rewound, cached, downsampled (MFCC):\n");
+    {
+        config_t *ds_config;
+        acmod_t *ds_acmod;
+        int16 **ref;
+        int n_sen = bin_mdef_n_sen(acmod->mdef);
+        int frame_idx = -1, pass, sen;
+
+        /* Only room for a few frames, so that the first miss is on a
+         * downsampled frame right after a hit. */
+        ds_config = config_parse_json(
+            NULL,
+            "hmm: \"" MODELDIR "/en-us\","
+            "compallsen: true, cmn: live, tmatfloor: 0.0001,"
+            "mixwfloor: 0.001, varfloor: 0.0001,"
+            "topn: 4, ds: 2, samprate: 0, scorecache: 72");
+        TEST_ASSERT(ds_config);
+        config_expand(ds_config);
+        TEST_ASSERT(ds_acmod = acmod_init(ds_config, lmath, fe, fcb));
+        fe_start(ds_acmod->fe);
+        nsamps = ftell(rawfh) / sizeof(*buf);
+        bptr = buf;
+        nfr = frame_counter;
+        fe_process_int16(ds_acmod->fe, &bptr, &nsamps, cepbuf, nfr);
+        fe_end(ds_acmod->fe, cepbuf + frame_counter - 1, 1);
+        cmn_live_set(ds_acmod->fcb->cmn_struct, cmninit);
+        TEST_EQUAL(0, acmod_start_utt(ds_acmod));
+        cptr = cepbuf;
+        nfr = frame_counter;
+        acmod_process_cep(ds_acmod, &cptr, &nfr, TRUE);
+        TEST_EQUAL(0, acmod_end_utt(ds_acmod));
+
+        ref = ckd_calloc_2d(frame_counter, n_sen, sizeof(**ref));
+        for (pass = 0; pass < 2; ++pass) {
+            frame_counter = 0;
+            while (ds_acmod->n_feat_frame > 0) {
+                int16 const *senscr = acmod_score(ds_acmod, &frame_idx);
+                acmod_advance(ds_acmod);
+                if (pass == 0)
+                    memcpy(ref[frame_counter], senscr, n_sen * sizeof(*senscr));
+                else {
+                    for (sen = 0; sen < n_sen; ++sen)
+                        TEST_EQUAL(ref[frame_counter][sen], senscr[sen]);
+                }
+                ++frame_counter;
+                frame_idx = -1;
+            }
+            TEST_EQUAL(0, acmod_rewind(ds_acmod));
+        }
+        E_INFO("%d hits %d misses\n",
+               ds_acmod->score_cache_hits, ds_acmod->score_cache_misses);
+        TEST_EQUAL(0, ds_acmod->score_cache_hits);
+        ckd_free_2d(ref);
+        acmod_free(ds_acmod);
+        config_free(ds_config);
+    }
+
     /* Clean up, go home. */
     ckd_free_2d(cepbuf);
     fclose(rawfh);
@@ -0,0 +1,199 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <soundswallower/bin_mdef.h>
+#include <soundswallower/datacache.h>
+#include <soundswallower/decoder.h>
+#include <soundswallower/dict.h>
+#include <soundswallower/dict2pid.h>
+#include <soundswallower/logmath.h>
+#include <soundswallower/ptm_mgau.h>
+
+#include "test_macros.h"
+
+#define CACHEDIR "test_datacache.d"
+
+static void
+test_store_map(datacache_t *dc)
+{
+    int32 data[100], i;
+    const int32 *out;
+    s3file_t *mf;
+    size_t size;
+    uint64 key;
+
+    for (i = 0; i < 100; ++i)
+        data[i] = i * i;
+    key = datacache_hash(DATACACHE_HASH_INIT, data, sizeof(data));
+    TEST_ASSERT(key != datacache_hash(DATACACHE_HASH_INIT, data, sizeof(data) - 1));
+    TEST_ASSERT(key != datacache_hash_str(DATACACHE_HASH_INIT, "squares"));
+    TEST_EQUAL(0, datacache_store(dc, "test", key, data, sizeof(data)));
+    TEST_ASSERT(mf = datacache_map(dc, "test", key, (const void **)&out, &size));
+    TEST_EQUAL(sizeof(data), size);
+    TEST_EQUAL(0, memcmp(data, out, size));
+    s3file_free(mf);
+    TEST_ASSERT(NULL == datacache_map(dc, "test", key + 1, (const void **)&out, &size));
+    TEST_ASSERT(NULL == datacache_map(dc, "nothing", key, (const void **)&out, &size));
+    TEST_ASSERT(NULL == datacache_map(NULL, "test", key, (const void **)&out, &size));
+}
+
+static void
+test_logmath(datacache_t *dc)
+{
+    logmath_t *lmath, *cached;
+    uint32 size, width, shift, csize, cwidth, cshift;
+    int i, j, pass;
+
+    TEST_ASSERT(lmath = logmath_init(1.0001, 0, TRUE));
+    /* Once to store, once to load */
+    for (pass = 0; pass < 2; ++pass) {
+        TEST_ASSERT(cached = logmath_init_cached(1.0001, 0, TRUE, dc));
+        logmath_get_table_shape(lmath, &size, &width, &shift);
+        logmath_get_table_shape(cached, &csize, &cwidth, &cshift);
+        TEST_EQUAL(size, csize);
+        TEST_EQUAL(width, cwidth);
+        TEST_EQUAL(shift, cshift);
+        for (i = 0; i > -100000; i -= 977)
+            for (j = 0; j > -100000; j -= 1013)
+                TEST_EQUAL(logmath_add(lmath, i, j), logmath_add(cached, i, j));
+        logmath_free(cached);
+    }
+    logmath_free(lmath);
+}
+
+static void
+compare_xwdssid(xwdssid_t **a, xwdssid_t **b, int n_ci)
+{
+    int i, j;
+
+    for (i = 0; i < n_ci; ++i) {
+        for (j = 0; j < n_ci; ++j) {
+            TEST_EQUAL(a[i][j].n_ssid, b[i][j].n_ssid);
+            if (a[i][j].n_ssid == 0)
+                continue;
+            TEST_EQUAL(0, memcmp(a[i][j].ssid, b[i][j].ssid,
+                                 a[i][j].n_ssid * sizeof(*a[i][j].ssid)));
+            TEST_EQUAL(0, memcmp(a[i][j].cimap, b[i][j].cimap,
+                                 n_ci * sizeof(*a[i][j].cimap)));
+        }
+    }
+}
+
+static void
+test_dict2pid(datacache_t *dc)
+{
+    config_t *config;
+    bin_mdef_t *mdef;
+    dict_t *dict;
+    dict2pid_t *d2p, *cached;
+    int n_ci, pass;
+
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "dict", TESTDATADIR "/turtle.dic");
+    config_set_str(config, "fdict", MODELDIR "/en-us/noisedict.txt");
+    TEST_ASSERT(mdef = bin_mdef_read(NULL, MODELDIR "/en-us/mdef"));
+    TEST_ASSERT(dict = dict_init(config, mdef));
+    TEST_ASSERT(d2p = dict2pid_build(mdef, dict));
+    n_ci = bin_mdef_n_ciphone(mdef);
+    for (pass = 0; pass < 2; ++pass) {
+        TEST_ASSERT(cached = dict2pid_build_cached(mdef, dict, dc));
+        TEST_EQUAL(0, memcmp(d2p->ldiph_lc[0][0], cached->ldiph_lc[0][0],
+                             n_ci * n_ci * n_ci * sizeof(s3ssid_t)));
+        TEST_EQUAL(0, memcmp(d2p->lrdiph_rc[0][0], cached->lrdiph_rc[0][0],
+                             n_ci * n_ci * n_ci * sizeof(s3ssid_t)));
+        compare_xwdssid(d2p->rssid, cached->rssid, n_ci);
+        compare_xwdssid(d2p->lrssid, cached->lrssid, n_ci);
+        dict2pid_free(cached);
+    }
+    dict2pid_free(d2p);
+    dict_free(dict);
+    bin_mdef_free(mdef);
+    config_free(config);
+}
+
+static const char *
+decode(const char *cachedir, int shared, int *out_score)
+{
+    static char hypbuf[256];
+    config_t *config;
+    decoder_t *ps;
+    FILE *rawfh;
+    const char *hyp;
+    int16 buf[2048];
+    size_t nread;
+
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    config_set_str(config, "dict", TESTDATADIR "/turtle.dic");
+    config_set_str(config, "jsgf", TESTDATADIR "/goforward.gram");
+    if (cachedir)
+        config_set_str(config, "cachedir", cachedir);
+    config_set_bool(config, "sharedmodel", shared);
+    TEST_ASSERT(ps = decoder_init(config));
+    if (shared) {
+        /* Even the first one should use the cached copy. */
+        ptm_mgau_t *s = (ptm_mgau_t *)ps->acmod->mgau;
+        TEST_ASSERT(s->g->mmap != NULL);
+        TEST_ASSERT(s->cb_mixw_mmap != NULL);
+        if (s->simd)
+            TEST_ASSERT(s->simd_layout->mmap != NULL);
+    }
+    TEST_ASSERT(rawfh = fopen(TESTDATADIR "/goforward.raw", "rb"));
+    decoder_start_utt(ps);
+    while (!feof(rawfh)) {
+        nread = fread(buf, sizeof(*buf), sizeof(buf) / sizeof(*buf), rawfh);
+        decoder_process_int16(ps, buf, nread, FALSE, FALSE);
+    }
+    decoder_end_utt(ps);
+    fclose(rawfh);
+    TEST_ASSERT(hyp = decoder_hyp(ps, out_score));
+    printf("%s: %s (%d)\n", cachedir ? cachedir : "no cache", hyp, *out_score);
+    strncpy(hypbuf, hyp, sizeof(hypbuf) - 1);
+    decoder_free(ps);
+    return hypbuf;
+}
+
+int
+main(int argc, char *argv[])
+{
+    datacache_t *dc;
+    int score, cached_score, pass;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_INFO);
+    TEST_ASSERT(NULL == datacache_init(NULL));
+    TEST_ASSERT(NULL == datacache_init(""));
+    TEST_ASSERT(dc = datacache_init(CACHEDIR));
+    test_store_map(dc);
+    test_logmath(dc);
+    test_dict2pid(dc);
+    datacache_free(dc);
+
+    /* The same, in memory. */
+    TEST_ASSERT(dc = datacache_init_memory());
+    TEST_EQUAL(0, datacache_n_tables(dc));
+    test_store_map(dc);
+    TEST_EQUAL(1, datacache_n_tables(dc));
+    test_logmath(dc);
+    TEST_ASSERT(datacache_n_tables(dc) > 1);
+    datacache_free(dc);
+
+    TEST_EQUAL(0, strcmp("go forward ten meters", decode(NULL, FALSE, &score)));
+    /* Once to store, once to load */
+    for (pass = 0; pass < 2; ++pass) {
+        TEST_EQUAL(0, strcmp("go forward ten meters",
+                             decode(CACHEDIR, FALSE, &cached_score)));
+        TEST_EQUAL(score, cached_score);
+    }
+    /* Used in place, once to store, once to load */
+    for (pass = 0; pass < 2; ++pass) {
+        TEST_EQUAL(0, strcmp("go forward ten meters",
+                             decode(CACHEDIR ".shared", TRUE, &cached_score)));
+        TEST_EQUAL(score, cached_score);
+    }
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <soundswallower/decoder.h>
+
+#include "test_macros.h"
+#include "test_fixtures.h"
+
+static int
+decode_expect(decoder_t *ps, int16 *data, size_t nsamp, const char *expected)
+{
+    const char *hyp;
+    int score;
+
+    TEST_ASSERT(hyp = decode(ps, data, nsamp, &score));
+    printf("%s (%d)\n", hyp, score);
+    TEST_EQUAL(0, strcmp(expected, hyp));
+    return score;
+}
+
+static void
+test_clone(const char *model, const char *gram, const char *raw,
+           const char *expected)
+{
+    config_t *config;
+    decoder_t *ps, *clone, *clone2;
+    int16 *data;
+    size_t nsamp, i, half;
+    int score, clone_score;
+
+    data = read_raw(raw, &nsamp);
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", model);
+    config_set_str(config, "jsgf", gram);
+    TEST_ASSERT(ps = decoder_init(config));
+    decode_expect(ps, data, nsamp, expected);
+
+    /* Models are shared, per-stream state is not. */
+    TEST_ASSERT(clone = decoder_clone(ps));
+    TEST_ASSERT(clone->config == ps->config);
+    TEST_ASSERT(clone->dict == ps->dict);
+    TEST_ASSERT(clone->d2p == ps->d2p);
+    TEST_ASSERT(clone->acmod->mdef == ps->acmod->mdef);
+    TEST_ASSERT(clone->acmod->tmat == ps->acmod->tmat);
+    TEST_ASSERT(clone->acmod->mgau->shared == ps->acmod->mgau);
+    TEST_ASSERT(clone->fe != ps->fe);
+    TEST_ASSERT(clone->fcb != ps->fcb);
+    TEST_ASSERT(clone->search != ps->search);
+    TEST_EQUAL(0, strcmp(decoder_get_cmn(ps, FALSE),
+                         decoder_get_cmn(clone, FALSE)));
+    TEST_ASSERT(NULL == decoder_apply_mllr(clone, NULL));
+    TEST_ASSERT(decoder_add_word(ps, "foobie", "F UW B IY", TRUE) < 0);
+    TEST_ASSERT(decoder_add_word(clone, "foobie", "F UW B IY", TRUE) < 0);
+
+    /* Both start from the same CMN, so they should agree. */
+    score = decode_expect(ps, data, nsamp, expected);
+    clone_score = decode_expect(clone, data, nsamp, expected);
+    TEST_EQUAL(score, clone_score);
+    TEST_ASSERT(clone2 = decoder_clone(clone));
+
+    /* Interleaving the two streams should not change anything. */
+    decoder_start_utt(ps);
+    decoder_start_utt(clone2);
+    half = nsamp / 2;
+    for (i = 0; i < nsamp; i += half) {
+        size_t n = (i + half > nsamp) ? nsamp - i : half;
+        decoder_process_int16(ps, data + i, n, FALSE, FALSE);
+        decoder_process_int16(clone2, data + i, n, FALSE, FALSE);
+    }
+    decoder_end_utt(ps);
+    decoder_end_utt(clone2);
+    TEST_EQUAL(0, strcmp(decoder_hyp(ps, &score), decoder_hyp(clone2, &clone_score)));
+    TEST_EQUAL(score, clone_score);
+
+    /* Clones keep the models alive. */
+    TEST_EQUAL(0, decoder_free(ps));
+    TEST_EQUAL(0, decoder_free(clone));
+    decode_expect(clone2, data, nsamp, expected);
+    TEST_EQUAL(0, decoder_free(clone2));
+    ckd_free(data);
+}
+
+#ifdef HAVE_PTHREAD
+#define N_STREAMS 4
+
+typedef struct stream_s {
+    decoder_t *ps;
+    int16 *data;
+    size_t nsamp;
+    char *hyp;
+    int score;
+} stream_t;
+
+static void *
+run_stream(void *arg)
+{
+    stream_t *st = arg;
+    decoder_t *clone;
+    const char *hyp;
+
+    /* Create, use and free the clone in this thread. */
+    if ((clone = decoder_clone(st->ps)) == NULL)
+        return NULL;
+    if ((hyp = decode(clone, st->data, st->nsamp, &st->score)) != NULL)
+        st->hyp = ckd_salloc(hyp);
+    decoder_free(clone);
+    return st;
+}
+
+static void
+test_threads(const char *model, const char *gram, const char *raw,
+             const char *expected)
+{
+    config_t *config;
+    decoder_t *ps;
+    pthread_t threads[N_STREAMS];
+    stream_t streams[N_STREAMS];
+    int16 *data;
+    size_t nsamp;
+    int i, score;
+
+    data = read_raw(raw, &nsamp);
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", model);
+    config_set_str(config, "jsgf", gram);
+    TEST_ASSERT(ps = decoder_init(config));
+    decode_expect(ps, data, nsamp, expected);
+    for (i = 0; i < N_STREAMS; ++i) {
+        memset(&streams[i], 0, sizeof(streams[i]));
+        streams[i].ps = ps;
+        streams[i].data = data;
+        streams[i].nsamp = nsamp;
+        TEST_EQUAL(0, pthread_create(&threads[i], NULL,
+                                     run_stream, &streams[i]));
+    }
+    for (i = 0; i < N_STREAMS; ++i)
+        TEST_EQUAL(0, pthread_join(threads[i], NULL));
+    /* They all started from the same CMN as ps. */
+    score = decode_expect(ps, data, nsamp, expected);
+    for (i = 0; i < N_STREAMS; ++i) {
+        TEST_ASSERT(streams[i].hyp);
+        TEST_EQUAL(0, strcmp(expected, streams[i].hyp));
+        TEST_EQUAL(score, streams[i].score);
+        ckd_free(streams[i].hyp);
+    }
+    /* All the references taken by the clones were released. */
+    TEST_EQUAL(0, decoder_free(ps));
+    ckd_free(data);
+}
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    decoder_t *ps;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_INFO);
+
+    TEST_ASSERT(ps = decoder_create(NULL));
+    TEST_ASSERT(NULL == decoder_clone(ps));
+    decoder_free(ps);
+
+    test_clone(MODELDIR "/en-us", TESTDATADIR "/goforward.gram",
+               TESTDATADIR "/goforward.raw", "go forward ten meters");
+    test_clone(MODELDIR "/fr-fr", TESTDATADIR "/goforward_fr.gram",
+               TESTDATADIR "/goforward_fr.raw", "avance de dix mètres");
+#ifdef HAVE_PTHREAD
+    test_threads(MODELDIR "/en-us", TESTDATADIR "/goforward.gram",
+                 TESTDATADIR "/goforward.raw", "go forward ten meters");
+#endif
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+/* -*- c-basic-offset: 4 -*- */
+/*
+ * Helpers shared by the decoder tests and benchmarks: reading raw
+ * audio, decoding it in one go, and checking FSG search results.
+ * Include after test_macros.h.
+ */
+#ifndef __TEST_FIXTURES_H__
+#define __TEST_FIXTURES_H__
+
+#include <stdio.h>
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/decoder.h>
+#include <soundswallower/fsg_search.h>
+
+/* Any four of ten words, which covers goforward.raw and gives an FSG
+ * with several states competing at once. */
+#define CHAIN_GRAM "#JSGF V1.0; grammar chain;\n"                  \
+                   "public <s> = <w> <w> <w> <w>;\n"               \
+                   "<w> = go | forward | backward | ten | meters" \
+                   " | one | two | three | four | five;\n"
+
+/* Read a whole raw audio file, which must be freed with ckd_free(). */
+static inline int16 *
+read_raw(const char *raw, size_t *out_nsamp)
+{
+    FILE *rawfh;
+    int16 *data;
+    long size;
+
+    TEST_ASSERT(rawfh = fopen(raw, "rb"));
+    fseek(rawfh, 0, SEEK_END);
+    size = ftell(rawfh);
+    fseek(rawfh, 0, SEEK_SET);
+    data = ckd_malloc(size);
+    *out_nsamp = fread(data, sizeof(*data), size / sizeof(*data), rawfh);
+    fclose(rawfh);
+    return data;
+}
+
+/* Decode a whole utterance and return the hypothesis. */
+static inline const char *
+decode(decoder_t *ps, int16 *data, size_t nsamp, int *out_score)
+{
+    decoder_start_utt(ps);
+    decoder_process_int16(ps, data, nsamp, FALSE, TRUE);
+    decoder_end_utt(ps);
+    return decoder_hyp(ps, out_score);
+}
+
+/* Check that every word in the FSG backtrace leaves the state its
+ * predecessor arrived in, even if it came from a shared lextree. */
+static inline void
+check_backtrace(decoder_t *ps)
+{
+    fsg_search_t *fsgs = (fsg_search_t *)ps->search;
+    int32 bpidx, s;
+
+    bpidx = fsg_history_n_entries(fsgs->history) - 1;
+    while (bpidx > 0) {
+        fsg_hist_entry_t *entry = fsg_history_entry_get(fsgs->history, bpidx);
+        fsg_hist_entry_t *pred;
+        fsg_link_t *l;
+
+        bpidx = fsg_hist_entry_pred(entry);
+        if (fsg_hist_entry_fsglink(entry) == NULL || bpidx < 0)
+            continue;
+        pred = fsg_history_entry_get(fsgs->history, bpidx);
+        l = fsg_hist_entry_fsglink(pred);
+        s = l ? fsg_link_to_state(l) : fsg_model_start_state(fsgs->fsg);
+        TEST_EQUAL(s, fsg_link_from_state(fsg_hist_entry_fsglink(entry)));
+    }
+}
+
+/* Write an MLLR transform for n_feat streams of veclen[f] dimensions,
+ * which leaves the means alone and multiplies the variances by
+ * var_scale. */
+static inline void
+write_mllr(const char *path, int n_feat, int32 const *veclen,
+           double var_scale)
+{
+    FILE *fh;
+    int f, i, j;
+
+    TEST_ASSERT(fh = fopen(path, "w"));
+    fprintf(fh, "1\n%d\n", n_feat);
+    for (f = 0; f < n_feat; ++f) {
+        fprintf(fh, "%d\n", veclen[f]);
+        for (i = 0; i < veclen[f]; ++i) {
+            for (j = 0; j < veclen[f]; ++j)
+                fprintf(fh, "%d ", i == j);
+            fprintf(fh, "\n");
+        }
+        for (i = 0; i < veclen[f]; ++i)
+            fprintf(fh, "0 ");
+        fprintf(fh, "\n");
+        for (i = 0; i < veclen[f]; ++i)
+            fprintf(fh, "%g ", var_scale);
+        fprintf(fh, "\n");
+    }
+    fclose(fh);
+}
+
+#endif /* __TEST_FIXTURES_H__ */
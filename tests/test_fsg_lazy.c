@@ -0,0 +1,161 @@
+/* -*- c-basic-offset: 4 -*- */
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <soundswallower/decoder.h>
+#include <soundswallower/fsg_search.h>
+
+#include "test_macros.h"
+#include "test_fixtures.h"
+
+static fsg_lextree_t *
+get_lextree(decoder_t *ps)
+{
+    return ((fsg_search_t *)ps->search)->lextree;
+}
+
+/* Check that the trees are laid out end to end, that children never
+ * point outside their own tree, that root groups cover exactly the
+ * roots of their tree, and that the HMMs of each instance line up
+ * with the nodes of its tree. */
+static void
+check_lextree(fsg_lextree_t *lextree)
+{
+    int32 s, t, p, i, g;
+
+    TEST_EQUAL(0, lextree->root_off[0]);
+    TEST_EQUAL(lextree->n_tnode, lextree->root_off[lextree->n_tree]);
+    TEST_EQUAL(0, lextree->grp_off[0]);
+    TEST_EQUAL(lextree->n_grp, lextree->grp_off[lextree->n_tree]);
+    for (t = 0; t < lextree->n_tree; t++) {
+        TEST_ASSERT(lextree->n_root[t]
+                    <= lextree->root_off[t + 1] - lextree->root_off[t]);
+        p = lextree->root_off[t];
+        for (g = lextree->grp_off[t]; g < lextree->grp_off[t + 1]; g++) {
+            TEST_ASSERT(lextree->grp_end[g] > p);
+            for (; p < lextree->grp_end[g]; p++) {
+                TEST_EQUAL(lextree->grp_ci[g], lextree->ci_ext[p]);
+                TEST_EQUAL(0, memcmp(&lextree->grp_ctxt[g], &lextree->ctxt[p],
+                                     sizeof(lextree->ctxt[p])));
+            }
+        }
+        TEST_EQUAL(lextree->root_off[t] + lextree->n_root[t], p);
+        for (p = lextree->root_off[t]; p < lextree->root_off[t + 1]; p++) {
+            TEST_ASSERT(lextree->succ_off[p] <= lextree->succ_off[p + 1]);
+            for (i = lextree->succ_off[p]; i < lextree->succ_off[p + 1]; i++) {
+                TEST_ASSERT(lextree->succ[i] > p);
+                TEST_ASSERT(lextree->succ[i] < lextree->root_off[t + 1]);
+            }
+        }
+    }
+    TEST_EQUAL(0, lextree->inst_off[0]);
+    TEST_EQUAL(lextree->n_pnode, lextree->inst_off[lextree->n_inst]);
+    for (i = 0; i < lextree->n_inst; i++) {
+        t = lextree->inst_tree[i];
+        TEST_ASSERT(t >= 0 && t < lextree->n_tree);
+        TEST_EQUAL(lextree->root_off[t + 1] - lextree->root_off[t],
+                   lextree->inst_off[i + 1] - lextree->inst_off[i]);
+        for (p = lextree->inst_off[i]; p < lextree->inst_off[i + 1]; p++)
+            TEST_EQUAL(lextree->root_off[t] + p - lextree->inst_off[i],
+                       lextree->node[p]);
+    }
+    for (s = 0; s < fsg_model_n_state(lextree->fsg); s++) {
+        TEST_ASSERT(lextree->state_tree[s] < lextree->n_tree);
+        TEST_ASSERT(lextree->state_inst[s] < lextree->n_inst);
+        if (lextree->state_tree[s] < 0) {
+            TEST_ASSERT(lextree->arc_link[s] == NULL);
+            TEST_EQUAL(-1, lextree->state_inst[s]);
+        }
+        if (lextree->state_inst[s] >= 0)
+            TEST_EQUAL(lextree->state_tree[s],
+                       lextree->inst_tree[lextree->state_inst[s]]);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    decoder_t *ps;
+    config_t *config;
+    int16 *data;
+    size_t nsamp;
+    const char *hyp;
+    int score, eager_score;
+    int32 n_pnode, n_tree, n_inst;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_INFO);
+    data = read_raw(TESTDATADIR "/goforward.raw", &nsamp);
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    config_set_str(config, "dict", TESTDATADIR "/turtle.dic");
+    config_set_str(config, "samprate", "16000");
+    /* So that every utterance gets the same features. */
+    config_set_str(config, "cmn", "batch");
+    config_set_str(config, "loglevel", "INFO");
+    TEST_ASSERT(ps = decoder_init(config));
+
+    TEST_EQUAL(0, decoder_set_jsgf_string(ps, CHAIN_GRAM));
+    hyp = decode(ps, data, nsamp, &eager_score);
+    printf("eager: %s (%d) %d nodes\n", hyp, eager_score,
+           get_lextree(ps)->n_pnode);
+    TEST_EQUAL(0, strcmp("go forward ten meters", hyp));
+    n_pnode = get_lextree(ps)->n_pnode;
+
+    /* Nothing is built until the search gets there, and the result
+     * is the same. */
+    config_set_bool(ps->config, "fsglazy", TRUE);
+    TEST_EQUAL(0, decoder_set_jsgf_string(ps, CHAIN_GRAM));
+    TEST_EQUAL(0, get_lextree(ps)->n_pnode);
+    hyp = decode(ps, data, nsamp, &score);
+    printf("lazy: %s (%d) %d nodes\n", hyp, score, get_lextree(ps)->n_pnode);
+    TEST_EQUAL(0, strcmp("go forward ten meters", hyp));
+    TEST_EQUAL(eager_score, score);
+    TEST_ASSERT(get_lextree(ps)->n_pnode <= n_pnode);
+    check_lextree(get_lextree(ps));
+
+    /* Trees which are only needed for the full utterance get evicted
+     * after two utterances which don't reach them. */
+    config_set_int(ps->config, "fsgevict", 1);
+    TEST_EQUAL(0, decoder_set_jsgf_string(ps, CHAIN_GRAM));
+    hyp = decode(ps, data, nsamp, &score);
+    TEST_EQUAL(eager_score, score);
+    decode(ps, data, nsamp / 10, &score);
+    n_tree = get_lextree(ps)->n_tree;
+    decode(ps, data, nsamp / 10, &score);
+    printf("evict: %d of %d trees left\n", get_lextree(ps)->n_tree, n_tree);
+    TEST_ASSERT(get_lextree(ps)->n_tree < n_tree);
+    check_lextree(get_lextree(ps));
+
+    /* And get rebuilt when needed again. */
+    hyp = decode(ps, data, nsamp, &score);
+    printf("rebuilt: %s (%d) %d trees\n", hyp, score, get_lextree(ps)->n_tree);
+    TEST_EQUAL(0, strcmp("go forward ten meters", hyp));
+    TEST_EQUAL(eager_score, score);
+    check_lextree(get_lextree(ps));
+
+    /* With shared trees, instances get evicted on their own. */
+    config_set_bool(ps->config, "fsgshare", TRUE);
+    TEST_EQUAL(0, decoder_set_jsgf_string(ps, CHAIN_GRAM));
+    hyp = decode(ps, data, nsamp, &score);
+    TEST_EQUAL(eager_score, score);
+    decode(ps, data, nsamp / 10, &score);
+    n_inst = get_lextree(ps)->n_inst;
+    decode(ps, data, nsamp / 10, &score);
+    printf("evict shared: %d of %d instances left\n",
+           get_lextree(ps)->n_inst, n_inst);
+    TEST_ASSERT(get_lextree(ps)->n_inst < n_inst);
+    check_lextree(get_lextree(ps));
+    hyp = decode(ps, data, nsamp, &score);
+    TEST_EQUAL(0, strcmp("go forward ten meters", hyp));
+    TEST_EQUAL(eager_score, score);
+    check_lextree(get_lextree(ps));
+
+    decoder_free(ps);
+    ckd_free(data);
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+/* -*- c-basic-offset: 4 -*- */
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <soundswallower/decoder.h>
+#include <soundswallower/fsg_search.h>
+
+#include "test_macros.h"
+#include "test_fixtures.h"
+
+static fsg_search_t *
+decode_pruned(decoder_t *ps, int16 *data, size_t nsamp,
+              int maxhmmpf, int maxwpf)
+{
+    fsg_search_t *fsgs;
+    const char *hyp;
+    int score;
+
+    config_set_int(ps->config, "maxhmmpf", maxhmmpf);
+    config_set_int(ps->config, "maxwpf", maxwpf);
+    TEST_EQUAL(0, decoder_set_jsgf_string(ps, CHAIN_GRAM));
+    hyp = decode(ps, data, nsamp, &score);
+    fsgs = (fsg_search_t *)ps->search;
+    printf("maxhmmpf=%d maxwpf=%d: %s (%d) %d HMMs (max %d/fr), "
+           "%d senones, pruned %d HMMs %d words\n",
+           maxhmmpf, maxwpf, hyp, score, fsgs->n_hmm_eval,
+           fsgs->max_hmm_eval_frame, fsgs->n_sen_eval, fsgs->n_hmm_hist_prune,
+           fsgs->n_word_hist_prune);
+    TEST_EQUAL(0, strcmp("go forward ten meters", hyp));
+
+    return fsgs;
+}
+
+/* Most word exits in any one frame, from the history. */
+static int32
+max_word_exits(fsg_search_t *fsgs)
+{
+    int32 i, n, frame, max;
+
+    frame = -1;
+    n = max = 0;
+    for (i = 0; i < fsg_history_n_entries(fsgs->history); ++i) {
+        fsg_hist_entry_t *entry = fsg_history_entry_get(fsgs->history, i);
+        fsg_link_t *l = fsg_hist_entry_fsglink(entry);
+
+        if (l == NULL || fsg_link_wid(l) < 0)
+            continue;
+        if (fsg_hist_entry_frame(entry) != frame) {
+            frame = fsg_hist_entry_frame(entry);
+            n = 0;
+        }
+        if (++n > max)
+            max = n;
+    }
+    return max;
+}
+
+int
+main(int argc, char *argv[])
+{
+    decoder_t *ps;
+    config_t *config;
+    fsg_search_t *fsgs;
+    int16 *data;
+    size_t nsamp;
+    int32 max_hmm, max_word, n_sen;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_INFO);
+    data = read_raw(TESTDATADIR "/goforward.raw", &nsamp);
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    config_set_str(config, "dict", TESTDATADIR "/turtle.dic");
+    config_set_str(config, "samprate", "16000");
+    config_set_str(config, "cmn", "batch");
+    config_set_str(config, "loglevel", "INFO");
+    TEST_ASSERT(ps = decoder_init(config));
+
+    fsgs = decode_pruned(ps, data, nsamp, -1, -1);
+    max_hmm = fsgs->max_hmm_eval_frame;
+    max_word = max_word_exits(fsgs);
+    n_sen = fsgs->n_sen_eval;
+    TEST_EQUAL(0, fsgs->n_hmm_hist_prune);
+    TEST_EQUAL(0, fsgs->n_word_hist_prune);
+
+    /* A limit which is never reached changes nothing. */
+    fsgs = decode_pruned(ps, data, nsamp, max_hmm, max_word);
+    TEST_EQUAL(max_hmm, fsgs->max_hmm_eval_frame);
+    TEST_EQUAL(0, fsgs->n_hmm_hist_prune);
+    TEST_EQUAL(0, fsgs->n_word_hist_prune);
+
+    /* Otherwise it is never exceeded. */
+    fsgs = decode_pruned(ps, data, nsamp, max_hmm / 2, -1);
+    TEST_ASSERT(fsgs->n_hmm_hist_prune > 0);
+    TEST_ASSERT(fsgs->max_hmm_eval_frame <= max_hmm / 2);
+    /* Pruned HMMs should not have their senones scored either, which
+     * saves a good deal more than just having fewer successors. */
+    TEST_ASSERT(fsgs->n_sen_eval < n_sen - n_sen / 20);
+    fsgs = decode_pruned(ps, data, nsamp, -1, max_word / 2);
+    TEST_ASSERT(fsgs->n_word_hist_prune > 0);
+    TEST_ASSERT(max_word_exits(fsgs) <= max_word / 2);
+
+    decoder_free(ps);
+    ckd_free(data);
+
+    return 0;
+}
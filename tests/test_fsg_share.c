@@ -0,0 +1,123 @@
+/* -*- c-basic-offset: 4 -*- */
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <soundswallower/decoder.h>
+#include <soundswallower/fsg_search.h>
+
+#include "test_macros.h"
+#include "test_fixtures.h"
+
+/* States 1 and 2 have the same transitions (there are no filler
+ * self-loops), so they share a lextree and its HMMs whether or not
+ * fsgshare is enabled. */
+static void
+test_exact(decoder_t *ps, int16 *data, size_t nsamp)
+{
+    fsg_model_t *fsg;
+    fsg_lextree_t *lextree;
+    const char *hyp;
+    int score, go, forward;
+
+    fsg = fsg_model_init("exact", ps->lmath, 7.5, 6);
+    go = fsg_model_word_add(fsg, "go");
+    forward = fsg_model_word_add(fsg, "forward");
+    fsg_model_trans_add(fsg, 0, 1, logmath_log(ps->lmath, 0.5), go);
+    fsg_model_trans_add(fsg, 0, 2, logmath_log(ps->lmath, 0.5), go);
+    fsg_model_trans_add(fsg, 1, 3, 0, forward);
+    fsg_model_trans_add(fsg, 2, 3, 0, forward);
+    fsg_model_trans_add(fsg, 3, 4, 0, fsg_model_word_add(fsg, "ten"));
+    fsg_model_trans_add(fsg, 4, 5, 0, fsg_model_word_add(fsg, "meters"));
+    fsg->start_state = 0;
+    fsg->final_state = 5;
+    TEST_EQUAL(0, decoder_set_fsg(ps, fsg));
+
+    hyp = decode(ps, data, nsamp, &score);
+    printf("%s (%d)\n", hyp, score);
+    TEST_EQUAL(0, strcmp("go forward ten meters", hyp));
+    lextree = ((fsg_search_t *)ps->search)->lextree;
+    TEST_EQUAL(lextree->state_tree[1], lextree->state_tree[2]);
+    TEST_EQUAL(lextree->state_inst[1], lextree->state_inst[2]);
+    TEST_ASSERT(lextree->state_tree[0] != lextree->state_tree[1]);
+    TEST_ASSERT(lextree->arc_link[0] == NULL);
+    TEST_ASSERT(lextree->arc_link[1] == NULL);
+    TEST_ASSERT(lextree->arc_link[2] != NULL);
+    check_backtrace(ps);
+}
+
+/* Decode the chain grammar, and return the number of tree nodes, HMM
+ * nodes, and HMMs evaluated. */
+static void
+test_chain(decoder_t *ps, int16 *data, size_t nsamp, int share,
+           int *out_score, int32 *out_n_tnode, int32 *out_n_pnode,
+           int32 *out_n_hmm_eval)
+{
+    fsg_search_t *fsgs;
+    fsg_lextree_t *lextree;
+    const char *hyp;
+
+    config_set_bool(ps->config, "fsgshare", share);
+    TEST_EQUAL(0, decoder_set_jsgf_string(ps, CHAIN_GRAM));
+    hyp = decode(ps, data, nsamp, out_score);
+    fsgs = (fsg_search_t *)ps->search;
+    lextree = fsgs->lextree;
+    printf("fsgshare=%d: %s (%d) %d nodes in %d trees, "
+           "%d HMM nodes in %d instances for %d states, %d HMMs evaluated\n",
+           share, hyp, *out_score, lextree->n_tnode, lextree->n_tree,
+           lextree->n_pnode, lextree->n_inst,
+           fsg_model_n_state(lextree->fsg), fsgs->n_hmm_eval);
+    TEST_EQUAL(0, strcmp("go forward ten meters", hyp));
+    if (share) {
+        TEST_ASSERT(lextree->n_tree < lextree->n_inst);
+    } else {
+        TEST_EQUAL(lextree->n_tree, lextree->n_inst);
+    }
+    check_backtrace(ps);
+
+    *out_n_tnode = lextree->n_tnode;
+    *out_n_pnode = lextree->n_pnode;
+    *out_n_hmm_eval = fsgs->n_hmm_eval;
+}
+
+int
+main(int argc, char *argv[])
+{
+    decoder_t *ps;
+    config_t *config;
+    int16 *data;
+    size_t nsamp;
+    int score, share_score;
+    int32 n_tnode, n_pnode, n_hmm_eval;
+    int32 share_n_tnode, share_n_pnode, share_n_hmm_eval;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_INFO);
+    data = read_raw(TESTDATADIR "/goforward.raw", &nsamp);
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    config_set_str(config, "dict", TESTDATADIR "/turtle.dic");
+    config_set_str(config, "samprate", "16000");
+    config_set_bool(config, "fsgusefiller", FALSE);
+    TEST_ASSERT(ps = decoder_init(config));
+
+    test_exact(ps, data, nsamp);
+    config_set_bool(ps->config, "fsgusefiller", TRUE);
+    test_chain(ps, data, nsamp, FALSE,
+               &score, &n_tnode, &n_pnode, &n_hmm_eval);
+    test_chain(ps, data, nsamp, TRUE,
+               &share_score, &share_n_tnode, &share_n_pnode, &share_n_hmm_eval);
+    /* Sharing the trees saves nodes, but every state still has its
+     * own HMMs, so the search is exactly the same. */
+    TEST_ASSERT(share_n_tnode < n_tnode);
+    TEST_EQUAL(share_n_pnode, n_pnode);
+    TEST_EQUAL(share_score, score);
+    TEST_EQUAL(share_n_hmm_eval, n_hmm_eval);
+
+    decoder_free(ps);
+    ckd_free(data);
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+/* -*- c-basic-offset: 4 -*- */
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <soundswallower/decoder.h>
+#include <soundswallower/fsg_search.h>
+
+#include "test_macros.h"
+#include "test_fixtures.h"
+
+/* Check the backtrace, and that fillers from a bank come back to the
+ * state they were entered from. */
+static void
+check_fillers(decoder_t *ps)
+{
+    fsg_search_t *fsgs = (fsg_search_t *)ps->search;
+    int32 bpidx, n_fill;
+
+    check_backtrace(ps);
+    n_fill = 0;
+    for (bpidx = fsg_history_n_entries(fsgs->history) - 1; bpidx > 0;
+         bpidx = fsg_hist_entry_pred(fsg_history_entry_get(fsgs->history,
+                                                           bpidx))) {
+        fsg_link_t *l = fsg_hist_entry_fsglink(fsg_history_entry_get(fsgs->history,
+                                                                     bpidx));
+        if (l && fsg_model_is_filler(fsgs->fsg, fsg_link_wid(l))) {
+            TEST_EQUAL(fsg_link_from_state(l), fsg_link_to_state(l));
+            ++n_fill;
+        }
+    }
+    /* There is silence at both ends of the utterance. */
+    TEST_ASSERT(n_fill >= 2);
+}
+
+/* Check that the banks are separate trees of leaves, each used by at
+ * most one state, and that no state has a filler self-loop of its own
+ * any more. */
+static void
+check_lextree(fsg_lextree_t *lextree)
+{
+    int32 s, p, f, b, t;
+
+    TEST_ASSERT(lextree->n_fill > 0);
+    for (f = 0; f < lextree->n_fill; f++)
+        TEST_EQUAL(f, lextree->fill_idx[lextree->fill_wid[f]]);
+    for (b = 0; b < lextree->n_fill_bank; b++) {
+        t = lextree->fill_tree[b];
+        TEST_EQUAL(lextree->n_fill, lextree->n_root[t]);
+        TEST_EQUAL(lextree->n_fill,
+                   lextree->root_off[t + 1] - lextree->root_off[t]);
+        for (p = lextree->root_off[t]; p < lextree->root_off[t + 1]; p++)
+            TEST_ASSERT(lextree->leaf[p]);
+        if (lextree->fill_state[b] >= 0)
+            TEST_EQUAL(b, lextree->state_fill[lextree->fill_state[b]]);
+    }
+    for (s = 0; s < fsg_model_n_state(lextree->fsg); s++) {
+        if (lextree->state_fill[s] >= 0)
+            TEST_EQUAL(s, lextree->fill_state[lextree->state_fill[s]]);
+        for (b = 0; b < lextree->n_fill_bank; b++)
+            TEST_ASSERT(lextree->state_tree[s] != lextree->fill_tree[b]);
+        for (f = 0; f < lextree->n_fill; f++) {
+            fsg_link_t *l = fsg_lextree_fill_link(lextree, s, f);
+            if (l == NULL)
+                continue;
+            TEST_EQUAL(s, fsg_link_from_state(l));
+            TEST_EQUAL(s, fsg_link_to_state(l));
+        }
+        if (lextree->state_tree[s] < 0)
+            continue;
+        for (p = fsg_lextree_first_root(lextree, s);
+             p < lextree->root_off[lextree->state_tree[s] + 1]; p++) {
+            fsg_link_t *l;
+            if (!lextree->leaf[p])
+                continue;
+            l = fsg_lextree_fsglink(lextree, p, s);
+            TEST_ASSERT(!(fsg_model_is_filler(lextree->fsg, fsg_link_wid(l))
+                          && fsg_link_from_state(l) == fsg_link_to_state(l)
+                          && lextree->fill_idx[fsg_link_wid(l)] >= 0));
+        }
+    }
+}
+
+/* Write the word segmentation into buf, to compare two decodes. */
+static void
+seg_string(decoder_t *ps, char *buf, size_t len)
+{
+    seg_iter_t *seg;
+    size_t n = 0;
+
+    buf[0] = '\0';
+    for (seg = decoder_seg_iter(ps); seg; seg = seg_iter_next(seg)) {
+        int sf, ef;
+        seg_iter_frames(seg, &sf, &ef);
+        n += snprintf(buf + n, len - n, "%s %d-%d ", seg_iter_word(seg),
+                      sf, ef);
+        TEST_ASSERT(n < len);
+    }
+}
+
+/* Decode with and without shared fillers, check that nothing changes
+ * except the size of the lextree, and return the one with them. */
+static fsg_search_t *
+test_share(decoder_t *ps, int16 *data, size_t nsamp, const char *text)
+{
+    fsg_search_t *fsgs;
+    char seg[2][1024];
+    int i, score[2], n_hmm_eval[2], n_pnode[2];
+
+    for (i = 0; i < 2; i++) {
+        const char *hyp;
+
+        config_set_bool(ps->config, "fsgsharefiller", i);
+        if (text) {
+            TEST_EQUAL(0, decoder_set_align_text(ps, text));
+        } else {
+            TEST_EQUAL(0, decoder_set_jsgf_string(ps, CHAIN_GRAM));
+        }
+        hyp = decode(ps, data, nsamp, &score[i]);
+        fsgs = (fsg_search_t *)ps->search;
+        n_hmm_eval[i] = fsgs->n_hmm_eval;
+        n_pnode[i] = fsgs->lextree->n_pnode;
+        printf("%s fsgsharefiller=%d: %s (%d) %d nodes, %d HMMs, "
+               "%d filler banks\n", text ? "align" : "chain", i, hyp,
+               score[i], n_pnode[i], n_hmm_eval[i],
+               fsgs->lextree->n_fill_bank);
+        TEST_EQUAL(0, strcmp("go forward ten meters", hyp));
+        check_fillers(ps);
+        seg_string(ps, seg[i], sizeof(seg[i]));
+    }
+    check_lextree(fsgs->lextree);
+    TEST_EQUAL(score[0], score[1]);
+    TEST_EQUAL(n_hmm_eval[0], n_hmm_eval[1]);
+    TEST_EQUAL(0, strcmp(seg[0], seg[1]));
+    TEST_ASSERT(n_pnode[1] < n_pnode[0]);
+
+    return fsgs;
+}
+
+int
+main(int argc, char *argv[])
+{
+    decoder_t *ps;
+    config_t *config;
+    fsg_search_t *fsgs;
+    int16 *data;
+    size_t nsamp;
+    int score;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_INFO);
+    data = read_raw(TESTDATADIR "/goforward.raw", &nsamp);
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    config_set_str(config, "dict", TESTDATADIR "/turtle.dic");
+    config_set_str(config, "samprate", "16000");
+    /* So that every utterance gets the same features. */
+    config_set_str(config, "cmn", "batch");
+    config_set_str(config, "loglevel", "INFO");
+    TEST_ASSERT(ps = decoder_init(config));
+
+    /* Filler banks only for the states which need them, with the
+     * same result as one filler per state.  Several states are in
+     * silence at once here, and each one must keep its own paths. */
+    fsgs = test_share(ps, data, nsamp, NULL);
+    TEST_ASSERT(fsgs->lextree->n_fill_bank >= 2);
+    TEST_ASSERT(fsgs->lextree->n_fill_bank < fsg_model_n_state(fsgs->fsg));
+    fsgs = test_share(ps, data, nsamp, "go forward ten meters");
+    TEST_ASSERT(fsgs->lextree->n_fill_bank >= 2);
+
+    /* The banks are never evicted, even when nothing else is left. */
+    config_set_bool(ps->config, "fsglazy", TRUE);
+    config_set_int(ps->config, "fsgevict", 1);
+    fsgs = test_share(ps, data, nsamp, NULL);
+    decode(ps, data, nsamp / 10, &score);
+    decode(ps, data, nsamp / 10, &score);
+    check_lextree(fsgs->lextree);
+    TEST_EQUAL(0, strcmp("go forward ten meters",
+                         decode(ps, data, nsamp, &score)));
+    check_fillers(ps);
+    check_lextree(fsgs->lextree);
+
+    decoder_free(ps);
+    ckd_free(data);
+
+    return 0;
+}
@@ -0,0 +1,282 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <soundswallower/acmod.h>
+#include <soundswallower/gmm_simd.h>
+#include <soundswallower/ptm_mgau.h>
+
+#include "test_macros.h"
+
+static const char *kernels[] = {
+    "sse2", "avx2", "neon", "simd128"
+};
+
+static int16 *
+score_all_frames(const char *simd, int *out_n_frame, int *out_n_sen)
+{
+    logmath_t *lmath;
+    config_t *config;
+    acmod_t *acmod;
+    fe_t *fe;
+    feat_t *fcb;
+    FILE *rawfh;
+    int16 *buf, *scores;
+    int16 *bptr;
+    size_t nsamps, nread;
+    int n_frame, n_alloc;
+
+    lmath = logmath_init(1.0001, 0, 0);
+    config = config_init(NULL);
+    config_set_str(config, "compallsen", "yes");
+    config_set_str(config, "input_endian", "little");
+    config_set_str(config, "lowerf", "130");
+    config_set_str(config, "upperf", "3700");
+    config_set_str(config, "nfilt", "20");
+    config_set_str(config, "transform", "dct");
+    config_set_str(config, "lifter", "22");
+    config_set_str(config, "feat", "1s_c_d_dd");
+    config_set_str(config, "svspec", "0-12/13-25/26-38");
+    config_set_str(config, "mdef", MODELDIR "/en-us/mdef");
+    config_set_str(config, "mean", MODELDIR "/en-us/means");
+    config_set_str(config, "var", MODELDIR "/en-us/variances");
+    config_set_str(config, "tmat", MODELDIR "/en-us/transition_matrices");
+    config_set_str(config, "sendump", MODELDIR "/en-us/sendump");
+    config_set_str(config, "simd", simd);
+    fe = fe_init(config);
+    fcb = feat_init(config);
+    TEST_ASSERT((acmod = acmod_init(config, lmath, fe, fcb)));
+    TEST_EQUAL(0, strcmp(acmod->mgau->vt->name, "ptm"));
+    if (0 == strcmp(simd, "scalar")) {
+        TEST_ASSERT(((ptm_mgau_t *)acmod->mgau)->simd == NULL);
+    } else {
+        TEST_EQUAL(0, strcmp(((ptm_mgau_t *)acmod->mgau)->simd->name, simd));
+    }
+
+    TEST_ASSERT(rawfh = fopen(TESTDATADIR "/goforward.raw", "rb"));
+    fseek(rawfh, 0, SEEK_END);
+    nsamps = ftell(rawfh) / sizeof(*buf);
+    fseek(rawfh, 0, SEEK_SET);
+    buf = ckd_calloc(nsamps, sizeof(*buf));
+    TEST_EQUAL(nsamps, fread(buf, sizeof(*buf), nsamps, rawfh));
+    fclose(rawfh);
+
+    n_frame = 0;
+    n_alloc = 1024;
+    scores = ckd_calloc(n_alloc * bin_mdef_n_sen(acmod->mdef), sizeof(*scores));
+    TEST_EQUAL(0, acmod_start_utt(acmod));
+    bptr = buf;
+    nread = nsamps;
+    while (TRUE) {
+        if (nread > 0)
+            acmod_process_raw(acmod, &bptr, &nread, FALSE);
+        else if (acmod->state != ACMOD_ENDED)
+            acmod_end_utt(acmod);
+        else if (acmod->n_feat_frame == 0)
+            break;
+        while (acmod->n_feat_frame > 0) {
+            int frame_idx = -1;
+            TEST_ASSERT(n_frame < n_alloc);
+            acmod_score(acmod, &frame_idx);
+            TEST_EQUAL(n_frame, frame_idx);
+            memcpy(scores + n_frame * bin_mdef_n_sen(acmod->mdef),
+                   acmod->senone_scores,
+                   bin_mdef_n_sen(acmod->mdef) * sizeof(*scores));
+            acmod_advance(acmod);
+            ++n_frame;
+        }
+    }
+    *out_n_frame = n_frame;
+    *out_n_sen = bin_mdef_n_sen(acmod->mdef);
+
+    ckd_free(buf);
+    acmod_free(acmod);
+    fe_free(fe);
+    feat_free(fcb);
+    logmath_free(lmath);
+    config_free(config);
+    return scores;
+}
+
+/* Compare top-N densities (for continuous models) with gauden_dist(). */
+static void
+test_gauden_dist(const gmm_simd_t *simd)
+{
+    static const int32 n_tops[] = { 1, 4, 16, 100000 };
+    logmath_t *lmath;
+    gauden_t *g;
+    gmm_simd_layout_t *layout;
+    gauden_dist_t **ref, **out;
+    mfcc_t **obs;
+    int32 i, m, f, j, n_match = 0;
+
+    lmath = logmath_init(1.0001, 0, 0);
+    TEST_ASSERT(g = gauden_init(MODELDIR "/en-us/means",
+                                MODELDIR "/en-us/variances", 0.0001, lmath));
+    TEST_ASSERT(layout = gmm_simd_layout_init(simd, g));
+    /* Layout should be aligned for the widest vectors. */
+    TEST_EQUAL(0, (size_t)layout->mean[0][0] & 63);
+    TEST_EQUAL(0, (size_t)layout->var[g->n_mgau - 1][g->n_feat - 1] & 63);
+    ref = (gauden_dist_t **)ckd_calloc_2d(g->n_feat, g->n_density, sizeof(**ref));
+    out = (gauden_dist_t **)ckd_calloc_2d(g->n_feat, g->n_density, sizeof(**out));
+    obs = (mfcc_t **)ckd_calloc(g->n_feat, sizeof(*obs));
+    for (f = 0; f < g->n_feat; ++f)
+        obs[f] = ckd_calloc(g->featlen[f], sizeof(**obs));
+    for (i = 0; i < (int32)(sizeof(n_tops) / sizeof(n_tops[0])); ++i) {
+        int32 n_top = n_tops[i] > g->n_density ? g->n_density : n_tops[i];
+        for (m = 0; m < g->n_mgau; ++m) {
+            /* Use a perturbed density from some other codebook, which
+             * may or may not be close to anything. */
+            for (f = 0; f < g->n_feat; ++f)
+                for (j = 0; j < g->featlen[f]; ++j)
+                    obs[f][j] = g->mean[(m + i) % g->n_mgau][f][(m * 7 + j) % g->n_density][j]
+                                + 0.1 * (j % 3 - 1);
+            TEST_EQUAL(0, gauden_dist(g, m, n_top, obs, ref));
+            TEST_EQUAL(0, gmm_simd_gauden_dist(simd, layout, g, m, n_top, obs, out));
+            for (f = 0; f < g->n_feat; ++f) {
+                for (j = 0; j < n_top; ++j) {
+                    TEST_EQUAL(ref[f][j].id, out[f][j].id);
+                    TEST_EQUAL(ref[f][j].dist, out[f][j].dist);
+                    ++n_match;
+                }
+            }
+        }
+    }
+    printf("%s: %d top-N densities match\n", simd->name, n_match);
+
+    for (f = 0; f < g->n_feat; ++f)
+        ckd_free(obs[f]);
+    ckd_free(obs);
+    ckd_free_2d(ref);
+    ckd_free_2d(out);
+    gmm_simd_layout_free(layout);
+    gauden_free(g);
+    logmath_free(lmath);
+}
+
+/* Compare mixture weight kernels (for semi-continuous models) with
+ * scalar code for all top-N counts and awkward numbers of senones. */
+static void
+test_mixw(const gmm_simd_t *simd)
+{
+    static const int ns[] = { 1, 15, 16, 17, 31, 32, 33, 64, 100, 255 };
+    logmath_t *lmath;
+    const uint8 *logadd;
+    uint8 **mixw, **mixw4, *w_den;
+    int16 *ref, *out;
+    int32 score[8];
+    uint8 active[256];
+    int i, j, k, l, topn, n_active, n_logadd = 0, n_match = 0;
+
+    lmath = logmath_init(1.0001, 10, TRUE);
+    logadd = (const uint8 *)LOGMATH_TABLE(lmath)->table;
+    for (i = 0; i < (int)LOGMATH_TABLE(lmath)->table_size; ++i)
+        if (logadd[i])
+            n_logadd = i + 1;
+    TEST_ASSERT(n_logadd > 0);
+    mixw = (uint8 **)ckd_calloc_2d(8, 256, sizeof(**mixw));
+    mixw4 = (uint8 **)ckd_calloc_2d(8, 128, sizeof(**mixw4));
+    w_den = ckd_calloc(8 * 16, sizeof(*w_den));
+    ref = ckd_calloc(256, sizeof(*ref));
+    out = ckd_calloc(256, sizeof(*out));
+    srand(42);
+    for (k = 0; k < 8; ++k) {
+        for (j = 0; j < 256; ++j)
+            mixw[k][j] = rand() % 160;
+        for (j = 0; j < 128; ++j)
+            mixw4[k][j] = rand() % 256;
+    }
+    for (topn = 1; topn <= 8; ++topn) {
+        for (i = 0; i < (int)(sizeof(ns) / sizeof(ns[0])); ++i) {
+            for (k = 0; k < topn; ++k) {
+                /* Make some weights close enough to add. */
+                score[k] = (k & 1) ? rand() % 4 : rand() % 97;
+                for (j = 0; j < 16; ++j)
+                    w_den[k * 16 + j] = mixw[k][j] + score[k];
+            }
+            for (j = 0; j < ns[i]; ++j)
+                ref[j] = out[j] = j;
+            gmm_simd_mixw(NULL, ref, (const uint8 *const *)mixw, score, topn,
+                          logadd, n_logadd, ns[i]);
+            gmm_simd_mixw(simd, out, (const uint8 *const *)mixw, score, topn,
+                          logadd, n_logadd, ns[i]);
+            TEST_EQUAL(0, memcmp(ref, out, ns[i] * sizeof(*ref)));
+            for (j = 0; j < ns[i]; ++j)
+                ref[j] = out[j] = j;
+            gmm_simd_mixw4(NULL, ref, (const uint8 *const *)mixw4, w_den, topn,
+                           logadd, n_logadd, ns[i]);
+            gmm_simd_mixw4(simd, out, (const uint8 *const *)mixw4, w_den, topn,
+                           logadd, n_logadd, ns[i]);
+            TEST_EQUAL(0, memcmp(ref, out, ns[i] * sizeof(*ref)));
+            n_match += 2 * ns[i];
+            /* Active senones should get the same scores as all of them. */
+            memset(ref, 0, ns[i] * sizeof(*ref));
+            memset(out, 0, ns[i] * sizeof(*out));
+            for (n_active = l = j = 0; j < ns[i]; j += 1 + j % 3) {
+                active[n_active++] = j - l;
+                l = j;
+            }
+            gmm_simd_mixw(NULL, ref, (const uint8 *const *)mixw, score, topn,
+                          logadd, n_logadd, ns[i]);
+            gmm_simd_mixw_active(out, (const uint8 *const *)mixw, score, topn,
+                                 logadd, n_logadd, active, n_active);
+            for (l = j = 0; j < n_active; ++j) {
+                l += active[j];
+                TEST_EQUAL(ref[l], out[l]);
+            }
+            memset(ref, 0, ns[i] * sizeof(*ref));
+            memset(out, 0, ns[i] * sizeof(*out));
+            gmm_simd_mixw4(NULL, ref, (const uint8 *const *)mixw4, w_den, topn,
+                           logadd, n_logadd, ns[i]);
+            gmm_simd_mixw4_active(out, (const uint8 *const *)mixw4, w_den, topn,
+                                  logadd, n_logadd, active, n_active);
+            for (l = j = 0; j < n_active; ++j) {
+                l += active[j];
+                TEST_EQUAL(ref[l], out[l]);
+            }
+        }
+    }
+    printf("%s: %d mixture weight scores match\n", simd->name, n_match);
+
+    ckd_free_2d(mixw);
+    ckd_free_2d(mixw4);
+    ckd_free(w_den);
+    ckd_free(ref);
+    ckd_free(out);
+    logmath_free(lmath);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int16 *ref;
+    int n_frame, n_sen;
+    size_t i;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_WARN);
+    ref = score_all_frames("scalar", &n_frame, &n_sen);
+    TEST_ASSERT(n_frame > 0);
+    for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        int16 *scores;
+        int n_frame2, n_sen2;
+
+        if (gmm_simd_get(kernels[i]) == NULL) {
+            printf("%s: not supported\n", kernels[i]);
+            continue;
+        }
+        scores = score_all_frames(kernels[i], &n_frame2, &n_sen2);
+        TEST_EQUAL(n_frame, n_frame2);
+        TEST_EQUAL(n_sen, n_sen2);
+        TEST_EQUAL(0, memcmp(ref, scores, n_frame * n_sen * sizeof(*ref)));
+        printf("%s: %d frames match\n", kernels[i], n_frame);
+        ckd_free(scores);
+        test_gauden_dist(gmm_simd_get(kernels[i]));
+        test_mixw(gmm_simd_get(kernels[i]));
+    }
+    ckd_free(ref);
+    return 0;
+}
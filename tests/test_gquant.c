@@ -0,0 +1,57 @@
+/* -*- c-basic-offset: 4 -*- */
+#include "config.h"
+
+#include "test_macros.h"
+#include <soundswallower/decoder.h>
+#include <stdio.h>
+#include <string.h>
+
+static int
+decode_gquant(const char *gquant)
+{
+    decoder_t *ps;
+    config_t *config;
+    const char *hyp;
+    int32 score;
+    FILE *rawfh;
+    int16 buf[2048];
+    size_t nread;
+
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "fsg", TESTDATADIR "/goforward.fsg");
+    config_set_str(config, "dict", TESTDATADIR "/turtle.dic");
+    config_set_str(config, "loglevel", "INFO");
+    config_set_str(config, "samprate", "16000");
+    config_set_str(config, "input_endian", "little");
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    config_set_str(config, "gquant", gquant);
+    TEST_ASSERT(ps = decoder_init(config));
+
+    TEST_ASSERT(rawfh = fopen(TESTDATADIR "/goforward.raw", "rb"));
+    decoder_start_utt(ps);
+    while (!feof(rawfh)) {
+        nread = fread(buf, sizeof(*buf), sizeof(buf) / sizeof(*buf), rawfh);
+        decoder_process_int16(ps, buf, nread, FALSE, FALSE);
+    }
+    fclose(rawfh);
+    decoder_end_utt(ps);
+    hyp = decoder_hyp(ps, &score);
+    printf("gquant=%s: %s (%d)\n", gquant, hyp, score);
+    TEST_ASSERT(hyp);
+    TEST_EQUAL(0, strcmp("go forward ten meters", hyp));
+    decoder_free(ps);
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+    err_set_loglevel_str("INFO");
+    decode_gquant("0");
+    decode_gquant("16");
+    decode_gquant("8");
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/err.h>
+#include <soundswallower/gmm_simd.h>
+#include <soundswallower/ms_gauden.h>
+
+#include "test_macros.h"
+
+static const char *kernels[] = {
+    "sse2", "avx2", "neon", "simd128"
+};
+
+/* Make an observation near some density in some other codebook. */
+static void
+make_obs(gauden_t *g, int32 m, int32 i, mfcc_t **obs)
+{
+    int32 f, j;
+
+    for (f = 0; f < g->n_feat; ++f)
+        for (j = 0; j < g->featlen[f]; ++j)
+            obs[f][j] = g->mean[(m + i) % g->n_mgau][f][(m * 7 + i) % g->n_density][j]
+                        + 0.1 * (j % 3 - 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    logmath_t *lmath;
+    gauden_t *g;
+    gauden_gs_t *gs;
+    gauden_dist_t **ref, **out;
+    mfcc_t **obs;
+    int32 i, m, f, j, k, n_top = 4, n_obs = 0, n_best = 0;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_WARN);
+    lmath = logmath_init(1.0001, 0, 0);
+    TEST_ASSERT(g = gauden_init(MODELDIR "/en-us/means",
+                                MODELDIR "/en-us/variances", 0.0001, lmath));
+    /* Not useful if the shortlist is the whole codebook. */
+    TEST_ASSERT(gauden_gs_init(g, 16, g->n_density) == NULL);
+    TEST_ASSERT(gauden_gs_init(g, 0, 16) == NULL);
+    TEST_ASSERT(gs = gauden_gs_init(g, 16, g->n_density / 4));
+    TEST_EQUAL(16, gs->n_vq);
+    TEST_EQUAL(g->n_density / 4, gs->n_list);
+
+    ref = (gauden_dist_t **)ckd_calloc_2d(g->n_feat, n_top, sizeof(**ref));
+    out = (gauden_dist_t **)ckd_calloc_2d(g->n_feat, n_top, sizeof(**out));
+    obs = (mfcc_t **)ckd_calloc(g->n_feat, sizeof(*obs));
+    for (f = 0; f < g->n_feat; ++f)
+        obs[f] = ckd_calloc(g->featlen[f], sizeof(**obs));
+
+    for (i = 0; i < 8; ++i) {
+        for (m = 0; m < g->n_mgau; ++m) {
+            make_obs(g, m, i, obs);
+            TEST_EQUAL(0, gauden_dist(g, m, n_top, obs, ref));
+            TEST_EQUAL(0, gauden_dist_gs(g, gs, m, n_top, obs, out));
+            for (f = 0; f < g->n_feat; ++f) {
+                const int32 *list = gauden_gs_shortlist(gs, g, m, f, obs[f]);
+                /* Shortlists are sorted and results come from them. */
+                for (j = 1; j < gs->n_list; ++j)
+                    TEST_ASSERT(list[j - 1] < list[j]);
+                for (j = 0; j < n_top; ++j) {
+                    for (k = 0; k < gs->n_list; ++k)
+                        if (list[k] == out[f][j].id)
+                            break;
+                    TEST_ASSERT(k < gs->n_list);
+                    /* Never better than the real thing. */
+                    TEST_ASSERT(out[f][j].dist <= ref[f][j].dist);
+                }
+                n_best += (ref[f][0].id == out[f][0].id);
+                ++n_obs;
+            }
+        }
+    }
+    printf("Best density found for %d of %d observations\n", n_best, n_obs);
+    TEST_ASSERT(n_best * 10 >= n_obs * 9);
+
+    /* SIMD results should be identical. */
+    for (k = 0; k < (int32)(sizeof(kernels) / sizeof(kernels[0])); ++k) {
+        const gmm_simd_t *simd = gmm_simd_get(kernels[k]);
+        if (simd == NULL)
+            continue;
+        for (m = 0; m < g->n_mgau; ++m) {
+            make_obs(g, m, k, obs);
+            TEST_EQUAL(0, gauden_dist_gs(g, gs, m, n_top, obs, ref));
+            TEST_EQUAL(0, gmm_simd_gauden_dist_gs(simd, g, gs, m, n_top, obs, out));
+            for (f = 0; f < g->n_feat; ++f) {
+                for (j = 0; j < n_top; ++j) {
+                    TEST_EQUAL(ref[f][j].id, out[f][j].id);
+                    TEST_EQUAL(ref[f][j].dist, out[f][j].dist);
+                }
+            }
+        }
+        printf("%s: shortlist scores match\n", simd->name);
+    }
+
+    for (f = 0; f < g->n_feat; ++f)
+        ckd_free(obs[f]);
+    ckd_free(obs);
+    ckd_free_2d(ref);
+    ckd_free_2d(out);
+    gauden_gs_free(gs);
+    gauden_free(g);
+    logmath_free(lmath);
+    return 0;
+}
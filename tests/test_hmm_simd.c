@@ -0,0 +1,132 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <soundswallower/ckd_alloc.h>
+#include <soundswallower/err.h>
+#include <soundswallower/hmm_simd.h>
+
+#include "test_macros.h"
+
+#define N_TMAT 4
+#define N_SSEQ 16
+#define N_SEN 64
+/* Some batches go to the SIMD kernels and some do not. */
+#define N_HMM (HMM_SIMD_MIN_BATCH + 5)
+#define N_FRAME 200
+
+/* Small random scores, so that there are lots of ties. */
+static int32
+random_score(void)
+{
+    switch (rand() % 4) {
+    case 0:
+        return WORST_SCORE;
+    case 1:
+        return WORST_SCORE + rand() % 8 - 4;
+    default:
+        return -(rand() % 16);
+    }
+}
+
+static void
+test_eval(const hmm_simd_t *simd, int n_emit)
+{
+    uint8 ***tp;
+    uint16 **sseq;
+    int16 *senscore;
+    hmm_context_t *ctx;
+    hmm_t *ref, *out, *hmms[N_HMM];
+    int i, j, k, f, n_match = 0;
+
+    /* Random transition matrices, with some missing transitions. */
+    tp = (uint8 ***)ckd_calloc_3d(N_TMAT, n_emit, n_emit + 1, sizeof(***tp));
+    for (i = 0; i < N_TMAT; ++i)
+        for (j = 0; j < n_emit; ++j)
+            for (k = j; k < n_emit + 1 && k <= j + 2; ++k)
+                tp[i][j][k] = (rand() % 4 == 0) ? 255 : rand() % 8;
+    sseq = (uint16 **)ckd_calloc_2d(N_SSEQ, n_emit, sizeof(**sseq));
+    for (i = 0; i < N_SSEQ; ++i)
+        for (j = 0; j < n_emit; ++j)
+            sseq[i][j] = rand() % N_SEN;
+    senscore = ckd_calloc(N_SEN, sizeof(*senscore));
+    TEST_ASSERT(ctx = hmm_context_init(n_emit, (uint8 **const *)tp,
+                                       senscore, sseq));
+
+    ref = ckd_calloc(N_HMM, sizeof(*ref));
+    out = ckd_calloc(N_HMM, sizeof(*out));
+    for (i = 0; i < N_HMM; ++i) {
+        /* Throw in some multiplex ones, which use scalar code. */
+        hmm_init(ctx, &ref[i], i % 7 == 3, rand() % N_SSEQ, rand() % N_TMAT);
+        out[i] = ref[i];
+        hmms[i] = &out[i];
+    }
+    for (f = 0; f < N_FRAME; ++f) {
+        int32 ref_best = WORST_SCORE, best;
+        int n = N_HMM - f % 11;
+
+        for (i = 0; i < N_SEN; ++i)
+            senscore[i] = rand() % 8;
+        for (i = 0; i < n; ++i) {
+            if (rand() % 3 == 0)
+                hmm_enter(&ref[i], random_score(), f * N_HMM + i, f);
+            if (rand() % 5 == 0) {
+                for (j = 1; j < n_emit; ++j)
+                    hmm_score(&ref[i], j) = random_score();
+                hmm_out_score(&ref[i]) = random_score();
+            }
+            out[i] = ref[i];
+        }
+        for (i = 0; i < n; ++i) {
+            int32 score = hmm_vit_eval(&ref[i]);
+            if (score BETTER_THAN ref_best)
+                ref_best = score;
+        }
+        best = hmm_simd_vit_eval(simd, hmms, n);
+        TEST_EQUAL(ref_best, best);
+        for (i = 0; i < n; ++i) {
+            for (j = 0; j < n_emit; ++j) {
+                TEST_EQUAL(hmm_score(&ref[i], j), hmm_score(&out[i], j));
+                TEST_EQUAL(hmm_history(&ref[i], j), hmm_history(&out[i], j));
+                TEST_EQUAL(ref[i].senid[j], out[i].senid[j]);
+            }
+            TEST_EQUAL(hmm_out_score(&ref[i]), hmm_out_score(&out[i]));
+            TEST_EQUAL(hmm_out_history(&ref[i]), hmm_out_history(&out[i]));
+            TEST_EQUAL(hmm_bestscore(&ref[i]), hmm_bestscore(&out[i]));
+            ++n_match;
+        }
+    }
+    printf("%s: %d %d-state HMMs match\n", simd ? simd->name : "scalar",
+           n_match, n_emit);
+
+    ckd_free(ref);
+    ckd_free(out);
+    hmm_context_free(ctx);
+    ckd_free(senscore);
+    ckd_free_2d(sseq);
+    ckd_free_3d(tp);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *kernels[] = { "scalar", "sse2", "avx2", "neon", "simd128" };
+    int i;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_INFO);
+    TEST_ASSERT(hmm_simd_get("scalar") == NULL);
+    TEST_ASSERT(hmm_simd_get("nosuchthing") == NULL);
+    srand(42);
+    for (i = 0; i < (int)(sizeof(kernels) / sizeof(kernels[0])); ++i) {
+        const hmm_simd_t *simd = NULL;
+        if (i > 0 && (simd = hmm_simd_get(kernels[i])) == NULL)
+            continue;
+        test_eval(simd, 3);
+        test_eval(simd, 5);
+    }
+    return 0;
+}
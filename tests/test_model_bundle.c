@@ -0,0 +1,150 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <soundswallower/decoder.h>
+#include <soundswallower/model_bundle.h>
+#include <soundswallower/ptm_mgau.h>
+
+#include "test_macros.h"
+#include "test_fixtures.h"
+
+#define BUNDLE "test_model_bundle.bin"
+#define MLLR "test_model_bundle.mllr"
+
+static int
+decode_model(const char *model, const char *bundle, const char *mllr,
+             int tables, const char *gram, const char *raw,
+             const char *expected)
+{
+    config_t *config;
+    decoder_t *ps;
+    FILE *rawfh;
+    const char *hyp;
+    int16 buf[2048];
+    size_t nread;
+    int score;
+
+    TEST_ASSERT(config = config_init(NULL));
+    if (bundle)
+        config_set_str(config, "bundle", bundle);
+    else
+        config_set_str(config, "hmm", model);
+    if (mllr)
+        config_set_str(config, "mllr", mllr);
+    config_set_str(config, "jsgf", gram);
+    TEST_ASSERT(ps = decoder_init(config));
+    if (bundle) {
+        /* Model definition should be read from the mapping. */
+        TEST_ASSERT(ps->acmod->mdef->filemap);
+        TEST_ASSERT(ps->acmod->mdef->filemap->parent);
+    }
+    if (tables) {
+        /* So should the precomputed Gaussians and mixture weights. */
+        ptm_mgau_t *s = (ptm_mgau_t *)ps->acmod->mgau;
+        TEST_EQUAL(0, strcmp("ptm", ps->acmod->mgau->vt->name));
+        TEST_ASSERT(s->g->mmap);
+        TEST_ASSERT(s->g->mmap->parent);
+        TEST_ASSERT(s->cb_mixw_mmap);
+        TEST_ASSERT(s->cb_mixw_mmap->parent);
+    }
+    TEST_ASSERT(rawfh = fopen(raw, "rb"));
+    decoder_start_utt(ps);
+    while (!feof(rawfh)) {
+        nread = fread(buf, sizeof(*buf), sizeof(buf) / sizeof(*buf), rawfh);
+        decoder_process_int16(ps, buf, nread, FALSE, FALSE);
+    }
+    decoder_end_utt(ps);
+    fclose(rawfh);
+    TEST_ASSERT(hyp = decoder_hyp(ps, &score));
+    printf("%s%s: %s (%d)\n", bundle ? bundle : model,
+           mllr ? " + MLLR" : "", hyp, score);
+    TEST_EQUAL(0, strcmp(expected, hyp));
+    decoder_free(ps);
+    return score;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *names[] = { "foo", "bar" };
+    int32 const veclen[] = { 13, 13, 13 };
+    const char *paths[] = { TESTDATADIR "/goforward.gram",
+                            MODELDIR "/en-us/noisedict.txt" };
+    model_bundle_t *bundle;
+    config_t *config;
+    s3file_t *s3f, *orig;
+    int i, n_tables;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_INFO);
+
+    /* Arbitrary sections. */
+    TEST_EQUAL(0, model_bundle_write(BUNDLE, names, paths, 2));
+    TEST_ASSERT(bundle = model_bundle_read(BUNDLE));
+    TEST_EQUAL(2, model_bundle_n_sections(bundle));
+    for (i = 0; i < 2; ++i) {
+        TEST_EQUAL(0, strcmp(names[i], model_bundle_section_name(bundle, i)));
+        TEST_ASSERT(s3f = model_bundle_get(bundle, names[i]));
+        TEST_ASSERT(orig = s3file_map_file(paths[i]));
+        TEST_EQUAL(0, ((size_t)s3f->buf) % MODEL_BUNDLE_ALIGN);
+        TEST_EQUAL(orig->end - (const char *)orig->buf,
+                   s3f->end - (const char *)s3f->buf);
+        TEST_EQUAL(0, memcmp(orig->buf, s3f->buf,
+                             s3f->end - (const char *)s3f->buf));
+        s3file_free(orig);
+        /* Stays valid after the bundle is released. */
+        if (i == 1)
+            model_bundle_free(bundle);
+        TEST_ASSERT(s3file_nextline(s3f));
+        s3file_free(s3f);
+    }
+    TEST_ASSERT(NULL == model_bundle_read(TESTDATADIR "/goforward.gram"));
+
+    /* Whole models, with precomputed tables. */
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    TEST_EQUAL(0, decoder_pack_model(config, BUNDLE));
+    config_free(config);
+    TEST_ASSERT(bundle = model_bundle_read(BUNDLE));
+    for (i = n_tables = 0; i < model_bundle_n_sections(bundle); ++i) {
+        if (0 == strncmp("cache/", model_bundle_section_name(bundle, i), 6))
+            ++n_tables;
+    }
+    TEST_ASSERT(n_tables > 0);
+    model_bundle_free(bundle);
+    TEST_EQUAL(decode_model(MODELDIR "/en-us", NULL, NULL, FALSE,
+                            TESTDATADIR "/goforward.gram",
+                            TESTDATADIR "/goforward.raw",
+                            "go forward ten meters"),
+               decode_model(NULL, BUNDLE, NULL, TRUE,
+                            TESTDATADIR "/goforward.gram",
+                            TESTDATADIR "/goforward.raw",
+                            "go forward ten meters"));
+    /* MLLR has to reload the original parameters from the bundle. */
+    write_mllr(MLLR, 3, veclen, 1.5);
+    TEST_EQUAL(decode_model(MODELDIR "/en-us", NULL, MLLR, FALSE,
+                            TESTDATADIR "/goforward.gram",
+                            TESTDATADIR "/goforward.raw",
+                            "go forward ten meters"),
+               decode_model(NULL, BUNDLE, MLLR, FALSE,
+                            TESTDATADIR "/goforward.gram",
+                            TESTDATADIR "/goforward.raw",
+                            "go forward ten meters"));
+    remove(MLLR);
+    /* And without them. */
+    TEST_EQUAL(0, model_bundle_pack(MODELDIR "/fr-fr", BUNDLE));
+    TEST_EQUAL(decode_model(MODELDIR "/fr-fr", NULL, NULL, FALSE,
+                            TESTDATADIR "/goforward_fr.gram",
+                            TESTDATADIR "/goforward_fr.raw",
+                            "avance de dix mètres"),
+               decode_model(NULL, BUNDLE, NULL, FALSE,
+                            TESTDATADIR "/goforward_fr.gram",
+                            TESTDATADIR "/goforward_fr.raw",
+                            "avance de dix mètres"));
+    remove(BUNDLE);
+
+    return 0;
+}
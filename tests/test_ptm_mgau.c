@@ -10,6 +10,7 @@
 #include <soundswallower/ptm_mgau.h>
 
 #include "test_macros.h"
+#include "test_fixtures.h"
 
 static const mfcc_t cmninit[13] = {
     FLOAT2MFCC(41.00),
@@ -83,6 +84,208 @@ run_acmod_test(acmod_t *acmod)
     ckd_free(buf);
 }
 
+/* Score an utterance, recording best scores and which frames had all
+ * codewords evaluated. */
+static int
+score_utt(acmod_t *acmod, int16 *scores, int *full_eval, int max_frames)
+{
+    ptm_mgau_t *s = (ptm_mgau_t *)acmod->mgau;
+    FILE *rawfh;
+    int16 *buf, *bptr;
+    size_t nread, nsamps;
+    int n_frame = 0;
+
+    cmn_live_set(acmod->fcb->cmn_struct, cmninit);
+    TEST_ASSERT(rawfh = fopen(TESTDATADIR "/goforward.raw", "rb"));
+    fseek(rawfh, 0, SEEK_END);
+    nsamps = ftell(rawfh) / sizeof(*buf);
+    fseek(rawfh, 0, SEEK_SET);
+    buf = ckd_calloc(nsamps, sizeof(*buf));
+    TEST_EQUAL(nsamps, fread(buf, sizeof(*buf), nsamps, rawfh));
+    fclose(rawfh);
+    TEST_EQUAL(0, acmod_start_utt(acmod));
+    bptr = buf;
+    nread = nsamps;
+    while (TRUE) {
+        if (nread > 0)
+            acmod_process_raw(acmod, &bptr, &nread, FALSE);
+        else if (acmod->state != ACMOD_ENDED)
+            acmod_end_utt(acmod);
+        else if (acmod->n_feat_frame == 0)
+            break;
+        while (acmod->n_feat_frame > 0) {
+            int frame_idx = -1, best_senid;
+            TEST_ASSERT(n_frame < max_frames);
+            acmod_score(acmod, &frame_idx);
+            TEST_EQUAL(n_frame, frame_idx);
+            full_eval[n_frame] = s->hist[frame_idx % s->n_fast_hist].full_eval;
+            scores[n_frame] = acmod_best_score(acmod, &best_senid);
+            acmod_advance(acmod);
+            ++n_frame;
+        }
+    }
+    ckd_free(buf);
+    return n_frame;
+}
+
+static void
+test_adaptive_ds(config_t *config, logmath_t *lmath)
+{
+    static const char *settings[][2] = {
+        /* Never skip, so same as default. */
+        { "0.001", "4" },
+        /* Always skip as much as possible. */
+        { "1000000", "2" },
+        /* Somewhere in between. */
+        { "0.5", "4" }
+    };
+    int16 ref[1024], scores[1024];
+    int full_eval[1024];
+    int i, j, n_frame, n_full;
+    acmod_t *acmod;
+    fe_t *fe;
+    feat_t *fcb;
+
+    fe = fe_init(config);
+    fcb = feat_init(config);
+    TEST_ASSERT((acmod = acmod_init(config, lmath, fe, fcb)));
+    n_frame = score_utt(acmod, ref, full_eval, 1024);
+    for (j = 0; j < n_frame; ++j)
+        TEST_ASSERT(full_eval[j]);
+    acmod_free(acmod);
+
+    for (i = 0; i < 3; ++i) {
+        config_set_str(config, "ds_thresh", settings[i][0]);
+        config_set_str(config, "ds_max", settings[i][1]);
+        TEST_ASSERT((acmod = acmod_init(config, lmath, fe, fcb)));
+        TEST_EQUAL(n_frame, score_utt(acmod, scores, full_eval, 1024));
+        for (n_full = j = 0; j < n_frame; ++j)
+            n_full += full_eval[j];
+        printf("ds_thresh %s ds_max %s: %d of %d frames fully evaluated\n",
+               settings[i][0], settings[i][1], n_full, n_frame);
+        if (i == 0) {
+            TEST_EQUAL(n_frame, n_full);
+            TEST_EQUAL(0, memcmp(ref, scores, n_frame * sizeof(*ref)));
+        } else if (i == 1) {
+            for (j = 0; j < n_frame; ++j)
+                TEST_EQUAL(j % 3 == 0, full_eval[j]);
+        } else {
+            TEST_ASSERT(n_full > n_frame / 3);
+            TEST_ASSERT(n_full < n_frame);
+            TEST_ASSERT(full_eval[0]);
+        }
+        acmod_free(acmod);
+    }
+    config_set_str(config, "ds_thresh", "0");
+    config_set_int(config, "gquant", 0);
+    fe_free(fe);
+    feat_free(fcb);
+}
+
+/* Distances for downsampling are weighted by the variances, so they
+ * have to follow MLLR. */
+static void
+test_ds_mllr(config_t *config, logmath_t *lmath, int gquant)
+{
+    acmod_t *acmod;
+    ptm_mgau_t *s;
+    fe_t *fe;
+    feat_t *fcb;
+    mllr_t *mllr;
+    mfcc_t *ds_weight;
+    int i, veclen;
+
+    config_set_str(config, "ds_thresh", "0.5");
+    config_set_int(config, "gquant", gquant);
+    fe = fe_init(config);
+    fcb = feat_init(config);
+    TEST_ASSERT((acmod = acmod_init(config, lmath, fe, fcb)));
+    s = (ptm_mgau_t *)acmod->mgau;
+    TEST_ASSERT(s->ds_weight);
+    veclen = s->g->featlen[0];
+    ds_weight = ckd_calloc(veclen, sizeof(*ds_weight));
+    memcpy(ds_weight, s->ds_weight, veclen * sizeof(*ds_weight));
+
+    write_mllr("test_ptm_mgau.mllr", s->g->n_feat, s->g->featlen, 4.0);
+    TEST_ASSERT(mllr = mllr_read("test_ptm_mgau.mllr"));
+    TEST_EQUAL(mllr, acmod_update_mllr(acmod, mllr));
+    for (i = 0; i < veclen; ++i) {
+        printf("ds_weight[%d] %f => %f\n", i,
+               MFCC2FLOAT(ds_weight[i]), MFCC2FLOAT(s->ds_weight[i]));
+        TEST_ASSERT(fabs(MFCC2FLOAT(ds_weight[i]) / 4
+                         - MFCC2FLOAT(s->ds_weight[i]))
+                    < 0.05 * MFCC2FLOAT(ds_weight[i]));
+    }
+    /* Quantized Gaussians have to be requantized afterwards. */
+    TEST_EQUAL(gquant, s->g->quant_bits);
+    if (gquant) {
+        TEST_ASSERT(s->g->qmean);
+        TEST_ASSERT(s->g->mean == NULL);
+    }
+
+    mllr_free(mllr);
+    ckd_free(ds_weight);
+    acmod_free(acmod);
+    config_set_str(config, "ds_thresh", "0");
+    config_set_int(config, "gquant", 0);
+    fe_free(fe);
+    feat_free(fcb);
+}
+
+/* Mixture weights from a sendump are used in place unless there is a
+ * cache to store a reordered copy in, and both give the same scores. */
+static void
+test_inplace_mixw(config_t *config, logmath_t *lmath)
+{
+    acmod_t *inplace, *reordered;
+    ptm_mgau_t *s;
+    fe_t *fe;
+    feat_t *fcb;
+    int16 *buf, *bptr, *bptr2;
+    size_t nsamps, nread, nread2;
+    int n_frame = 0;
+
+    fe = fe_init(config);
+    fcb = feat_init(config);
+    TEST_ASSERT((inplace = acmod_init(config, lmath, fe, fcb)));
+    s = (ptm_mgau_t *)inplace->mgau;
+    TEST_ASSERT(s->cb_mixw == NULL);
+    TEST_ASSERT(s->sendump_mmap != NULL);
+    config_set_str(config, "cachedir", "test_ptm_mgau.d");
+    TEST_ASSERT((reordered = acmod_init(config, lmath, fe, fcb)));
+    config_set_str(config, "cachedir", NULL);
+    s = (ptm_mgau_t *)reordered->mgau;
+    TEST_ASSERT(s->cb_mixw != NULL);
+    TEST_ASSERT(s->sendump_mmap == NULL);
+
+    buf = read_raw(TESTDATADIR "/goforward.raw", &nsamps);
+    cmn_live_set(inplace->fcb->cmn_struct, cmninit);
+    TEST_EQUAL(0, acmod_start_utt(inplace));
+    TEST_EQUAL(0, acmod_start_utt(reordered));
+    bptr = bptr2 = buf;
+    nread = nread2 = nsamps;
+    acmod_process_raw(inplace, &bptr, &nread, TRUE);
+    cmn_live_set(reordered->fcb->cmn_struct, cmninit);
+    acmod_process_raw(reordered, &bptr2, &nread2, TRUE);
+    TEST_EQUAL(inplace->n_feat_frame, reordered->n_feat_frame);
+    while (inplace->n_feat_frame > 0) {
+        int16 const *a, *b;
+        TEST_ASSERT(a = acmod_score(inplace, NULL));
+        TEST_ASSERT(b = acmod_score(reordered, NULL));
+        TEST_EQUAL(0, memcmp(a, b, s->n_sen * sizeof(*a)));
+        acmod_advance(inplace);
+        acmod_advance(reordered);
+        ++n_frame;
+    }
+    printf("%d frames identical with mixture weights in place\n", n_frame);
+    TEST_ASSERT(n_frame > 0);
+    ckd_free(buf);
+    acmod_free(inplace);
+    acmod_free(reordered);
+    fe_free(fe);
+    feat_free(fcb);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -137,8 +340,12 @@ main(int argc, char *argv[])
     }
     E_INFOCONT("-%d\n", i - 1);
     run_acmod_test(acmod);
-
     acmod_free(acmod);
+    test_adaptive_ds(config, lmath);
+    test_ds_mllr(config, lmath, 0);
+    test_ds_mllr(config, lmath, 8);
+    test_inplace_mixw(config, lmath);
+
     fe_free(fe);
     feat_free(fcb);
     logmath_free(lmath);
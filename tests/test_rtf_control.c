@@ -0,0 +1,149 @@
+/* -*- c-basic-offset: 4 -*- */
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <soundswallower/decoder.h>
+#include <soundswallower/rtf_control.h>
+
+#include "test_macros.h"
+#include "test_fixtures.h"
+
+static void
+run_frames(rtf_control_t *rc, int n, double secs)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+        rtf_control_update(rc, secs);
+}
+
+static void
+test_control(void)
+{
+    rtf_control_t *rc;
+
+    TEST_ASSERT(NULL == rtf_control_init(0, 100, 0.5, 4));
+    TEST_ASSERT(NULL == rtf_control_init(0.5, 100, 0, 4));
+    TEST_ASSERT(rc = rtf_control_init(0.5, 100, 0.5, 4));
+    TEST_EQUAL_FLOAT(0.005, rc->budget);
+
+    /* Too slow: beams go first, then top-N. */
+    run_frames(rc, 30, 0.01);
+    TEST_ASSERT(rc->factor < 1.0);
+    TEST_EQUAL(4, rc->topn);
+    run_frames(rc, 200, 0.01);
+    TEST_EQUAL_FLOAT(0.5, rc->factor);
+    TEST_EQUAL(1, rc->topn);
+    TEST_EQUAL(230, rc->n_frames);
+    TEST_EQUAL(230, rc->n_miss);
+
+    /* Settings carry over to the next utterance, statistics don't. */
+    rtf_control_start_utt(rc);
+    TEST_EQUAL(0, rc->n_frames);
+    TEST_EQUAL(0, rc->n_miss);
+    TEST_EQUAL_FLOAT(0.5, rc->factor);
+
+    /* Fast enough: top-N comes back first, then beams. */
+    run_frames(rc, 60, 0.001);
+    TEST_EQUAL(4, rc->topn);
+    TEST_ASSERT(rc->factor < 1.0);
+    run_frames(rc, 200, 0.001);
+    TEST_EQUAL_FLOAT(1.0, rc->factor);
+    TEST_EQUAL(0, rc->n_miss);
+
+    /* Within budget but without much to spare: nothing changes. */
+    rtf_control_free(rc);
+    TEST_ASSERT(rc = rtf_control_init(0.5, 100, 0.5, 4));
+    run_frames(rc, 10, 0.0045);
+    TEST_EQUAL(FALSE, rtf_control_update(rc, 0.006));
+    run_frames(rc, 100, 0.0045);
+    TEST_EQUAL_FLOAT(1.0, rc->factor);
+    TEST_EQUAL(4, rc->topn);
+    TEST_EQUAL(1, rc->n_miss);
+    rtf_control_free(rc);
+}
+
+static void
+test_decoder(void)
+{
+    decoder_t *ps;
+    config_t *config;
+    rtf_stats_t stats;
+    int16 *data;
+    size_t nsamp;
+    const char *hyp;
+    int score, base_score;
+
+    data = read_raw(TESTDATADIR "/goforward.raw", &nsamp);
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    config_set_str(config, "dict", TESTDATADIR "/turtle.dic");
+    config_set_str(config, "jsgf", TESTDATADIR "/goforward.gram");
+    config_set_str(config, "samprate", "16000");
+    config_set_str(config, "cmn", "batch");
+    config_set_str(config, "loglevel", "INFO");
+    TEST_ASSERT(ps = decoder_init(config));
+
+    hyp = decode(ps, data, nsamp, &base_score);
+    printf("disabled: %s (%d)\n", hyp, base_score);
+    TEST_EQUAL(-1, decoder_rtf_stats(ps, &stats));
+    TEST_EQUAL_FLOAT(0, stats.target);
+    TEST_EQUAL_FLOAT(config_float(ps->config, "beam"), stats.beam);
+    TEST_EQUAL(config_int(ps->config, "topn"), stats.topn);
+    TEST_ASSERT(stats.rtf > 0);
+
+    /* A generous target changes nothing. */
+    config_set_float(ps->config, "rtf", 1000);
+    TEST_EQUAL(0, decoder_reinit(ps, NULL));
+    hyp = decode(ps, data, nsamp, &score);
+    TEST_EQUAL(0, decoder_rtf_stats(ps, &stats));
+    printf("rtf %.3f (target %.0f): %s (%d)\n",
+           stats.rtf, stats.target, hyp, score);
+    TEST_EQUAL(base_score, score);
+    TEST_EQUAL(decoder_n_frames(ps) - 1, stats.n_frames);
+    TEST_EQUAL(0, stats.n_miss);
+    TEST_EQUAL_FLOAT(config_float(ps->config, "beam"), stats.beam);
+    TEST_EQUAL(config_int(ps->config, "topn"), stats.topn);
+
+    /* An impossible one prunes as hard as allowed, and still gets
+     * some sort of result. */
+    config_set_float(ps->config, "rtf", 1e-6);
+    TEST_EQUAL(0, decoder_reinit(ps, NULL));
+    hyp = decode(ps, data, nsamp, &score);
+    TEST_EQUAL(0, decoder_rtf_stats(ps, &stats));
+    printf("rtf %.3f (target %g): %s (%d) beam %g pbeam %g wbeam %g "
+           "topn %d, %d/%d frames over budget\n",
+           stats.rtf, stats.target, hyp, score, stats.beam, stats.pbeam,
+           stats.wbeam, stats.topn, stats.n_miss, stats.n_frames);
+    TEST_ASSERT(hyp != NULL);
+    TEST_EQUAL(stats.n_frames, stats.n_miss);
+    TEST_EQUAL(1, stats.topn);
+    TEST_ASSERT(stats.beam > config_float(ps->config, "beam"));
+    TEST_ASSERT(stats.pbeam > config_float(ps->config, "pbeam"));
+    TEST_ASSERT(stats.wbeam > config_float(ps->config, "wbeam"));
+
+    /* Restoring everything gives the original result. */
+    ps->rtf->budget = 1000;
+    ps->rtf->factor = 1.0;
+    ps->rtf->topn = ps->rtf->max_topn;
+    hyp = decode(ps, data, nsamp, &score);
+    printf("restored: %s (%d)\n", hyp, score);
+    TEST_EQUAL(base_score, score);
+
+    decoder_free(ps);
+    ckd_free(data);
+}
+
+int
+main(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_INFO);
+    test_control();
+    test_decoder();
+
+    return 0;
+}
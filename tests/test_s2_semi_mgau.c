@@ -0,0 +1,424 @@
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <soundswallower/acmod.h>
+#include <soundswallower/gmm_simd.h>
+#include <soundswallower/s2_semi_mgau.h>
+#include <soundswallower/s3file.h>
+
+#include "test_macros.h"
+#include "test_fixtures.h"
+
+/* There is no semi-continuous model in the tree, so one is made from
+ * the first codebook of en-us, with its mixture weights. */
+#define MEANS "test_s2_semi_mgau.means"
+#define VARS "test_s2_semi_mgau.variances"
+#define SENDUMP4 "test_s2_semi_mgau.sendump"
+
+static const char *kernels[] = {
+    "scalar", "sse2", "avx2", "neon", "simd128"
+};
+
+/* Write the first codebook of a Gaussian parameter file. */
+static void
+write_codebook(const char *inpath, const char *outpath)
+{
+    s3file_t *s;
+    FILE *fh;
+    int32 hdr[3], veclen[4], magic = 0x11223344;
+    int32 i, n, blk;
+    float32 *buf;
+
+    TEST_ASSERT(s = s3file_map_file(inpath));
+    TEST_EQUAL(0, s3file_parse_header(s, "1.0"));
+    TEST_EQUAL(3, s3file_get(hdr, sizeof(*hdr), 3, s));
+    TEST_ASSERT(hdr[1] <= 4);
+    TEST_EQUAL((size_t)hdr[1], s3file_get(veclen, sizeof(*veclen), hdr[1], s));
+    TEST_EQUAL(1, s3file_get(&n, sizeof(n), 1, s));
+    for (blk = i = 0; i < hdr[1]; ++i)
+        blk += veclen[i];
+    TEST_EQUAL(n, hdr[0] * hdr[2] * blk);
+    n = hdr[2] * blk;
+    buf = ckd_calloc(n, sizeof(*buf));
+    TEST_EQUAL((size_t)n, s3file_get(buf, sizeof(*buf), n, s));
+    s3file_free(s);
+
+    TEST_ASSERT(fh = fopen(outpath, "wb"));
+    fprintf(fh, "s3\nversion 1.0\nendhdr\n");
+    fwrite(&magic, sizeof(magic), 1, fh);
+    hdr[0] = 1;
+    fwrite(hdr, sizeof(*hdr), 3, fh);
+    fwrite(veclen, sizeof(*veclen), hdr[1], fh);
+    fwrite(&n, sizeof(n), 1, fh);
+    fwrite(buf, sizeof(*buf), n, fh);
+    fclose(fh);
+    ckd_free(buf);
+}
+
+static acmod_t *
+semi_acmod_init(config_t *config, logmath_t *lmath)
+{
+    acmod_t *acmod;
+
+    config_set_str(config, "mean", MEANS);
+    config_set_str(config, "var", VARS);
+    TEST_ASSERT(acmod = acmod_init(config, lmath,
+                                   fe_init(config), feat_init(config)));
+    /* acmod_init() takes its own references. */
+    fe_free(acmod->fe);
+    feat_free(acmod->fcb);
+    TEST_EQUAL(0, strcmp(acmod->mgau->vt->name, "s2_semi"));
+    TEST_EQUAL(config_int(config, "gquant"),
+               ((s2_semi_mgau_t *)acmod->mgau)->g->quant_bits);
+    return acmod;
+}
+
+static void
+write_str(FILE *fh, const char *str)
+{
+    int32 len = strlen(str) + 1;
+
+    fwrite(&len, sizeof(len), 1, fh);
+    fwrite(str, 1, len, fh);
+}
+
+/* Write 4-bit mixture weights, clustered from 8-bit ones.  Like real
+ * ones, the codebook leaves room to add a density score in 8 bits. */
+static void
+write_sendump4(s2_semi_mgau_t *s, const char *outpath)
+{
+    FILE *fh;
+    char str[64];
+    uint8 cb[16], *row;
+    int32 zero = 0, rowlen = (s->n_sen + 1) / 2;
+    int f, i, j;
+
+    TEST_ASSERT(s->mixw_cb == NULL);
+    TEST_ASSERT(fh = fopen(outpath, "wb"));
+    write_str(fh, "test_s2_semi_mgau");
+    write_str(fh, "4-bit mixture weights");
+    sprintf(str, "feature_count %d", s->g->n_feat);
+    write_str(fh, str);
+    sprintf(str, "mixture_count %d", s->g->n_density);
+    write_str(fh, str);
+    sprintf(str, "model_count %d", s->n_sen);
+    write_str(fh, str);
+    write_str(fh, "cluster_count 16");
+    write_str(fh, "cluster_bits 4");
+    fwrite(&zero, sizeof(zero), 1, fh);
+    for (i = 0; i < 16; ++i)
+        cb[i] = i * 10;
+    fwrite(cb, 1, 16, fh);
+    row = ckd_calloc(rowlen, 1);
+    for (f = 0; f < s->g->n_feat; ++f) {
+        for (i = 0; i < s->g->n_density; ++i) {
+            memset(row, 0, rowlen);
+            for (j = 0; j < s->n_sen; ++j) {
+                int c = (s->mixw[f][i][j] + 5) / 10;
+                if (c > 15)
+                    c = 15;
+                row[j / 2] |= c << ((j & 1) * 4);
+            }
+            fwrite(row, 1, rowlen, fh);
+        }
+    }
+    ckd_free(row);
+    fclose(fh);
+}
+
+/* Score one senone from the top-N densities for a frame, as
+ * s2_semi_mgau did before it had mixture weight kernels. */
+static int
+ref_score(s2_semi_mgau_t *s, int frame, int sen)
+{
+    logadd_t *t = LOGMATH_TABLE(s->lmath_8b);
+    int topn_idx = frame % s->n_topn_hist;
+    int f, k, score = 0;
+
+    for (f = 0; f < s->g->n_feat; ++f) {
+        vqFeature_t *topn = s->topn_hist[topn_idx][f];
+        int tmp = 0;
+
+        for (k = 0; k < s->topn_hist_n[topn_idx][f]; ++k) {
+            uint8 *pid_cw = s->mixw[f][topn[k].codeword];
+            int w, d;
+
+            if (s->mixw_cb)
+                w = s->mixw_cb[(sen & 1) ? pid_cw[sen / 2] >> 4
+                                         : pid_cw[sen / 2] & 0x0f];
+            else
+                w = pid_cw[sen];
+            w += topn[k].score;
+            if (k == 0) {
+                tmp = w;
+                continue;
+            }
+            d = abs(tmp - w);
+            tmp = (tmp < w ? tmp : w)
+                  - ((uint32)d < t->table_size ? ((uint8 *)t->table)[d] : 0);
+        }
+        score += tmp;
+    }
+    return score;
+}
+
+/*
+ * Compare senone scores for goforward.raw with ref_score(), for all
+ * senones, or every nth one as active senones.
+ */
+static int
+check_scores(config_t *config, logmath_t *lmath, const char *simd,
+             int bits, int every)
+{
+    acmod_t *acmod;
+    s2_semi_mgau_t *s;
+    int16 *buf, *bptr;
+    size_t nsamp, nread;
+    int n_frame = 0, n_match = 0;
+
+    config_set_str(config, "simd", simd);
+    config_set_bool(config, "compallsen", every == 0);
+    acmod = semi_acmod_init(config, lmath);
+    s = (s2_semi_mgau_t *)acmod->mgau;
+    TEST_EQUAL(bits == 4, s->mixw_cb != NULL);
+    TEST_ASSERT(buf = read_raw(TESTDATADIR "/goforward.raw", &nsamp));
+    TEST_EQUAL(0, acmod_start_utt(acmod));
+    bptr = buf;
+    nread = nsamp;
+    while (TRUE) {
+        if (nread > 0)
+            acmod_process_raw(acmod, &bptr, &nread, FALSE);
+        else if (acmod->state != ACMOD_ENDED)
+            acmod_end_utt(acmod);
+        else if (acmod->n_feat_frame == 0)
+            break;
+        while (acmod->n_feat_frame > 0) {
+            int frame_idx = -1, j;
+
+            if (every) {
+                acmod_clear_active(acmod);
+                for (j = n_frame % every; j < s->n_sen; j += every)
+                    bitvec_set(acmod->senone_active_vec, j);
+            }
+            acmod_score(acmod, &frame_idx);
+            TEST_EQUAL(n_frame, frame_idx);
+            for (j = every ? n_frame % every : 0; j < s->n_sen;
+                 j += every ? every : 1) {
+                TEST_EQUAL(ref_score(s, n_frame, j), acmod->senone_scores[j]);
+                ++n_match;
+            }
+            acmod_advance(acmod);
+            ++n_frame;
+        }
+    }
+    printf("%s, %d-bit weights, %s senones: %d scores match\n",
+           simd, bits, every ? "active" : "all", n_match);
+    ckd_free(buf);
+    acmod_free(acmod);
+    config_set_str(config, "simd", "auto");
+    config_set_bool(config, "compallsen", TRUE);
+    return n_match;
+}
+
+/* Score all senones for every frame of goforward.raw. */
+static int16 *
+score_utt(acmod_t *acmod, int *out_n_frame)
+{
+    int16 *buf, *bptr, *scores;
+    size_t nsamp, nread;
+    int n_sen = bin_mdef_n_sen(acmod->mdef);
+    int n_frame = 0, n_alloc = 1024;
+
+    TEST_ASSERT(buf = read_raw(TESTDATADIR "/goforward.raw", &nsamp));
+    scores = ckd_calloc(n_alloc * n_sen, sizeof(*scores));
+    TEST_EQUAL(0, acmod_start_utt(acmod));
+    bptr = buf;
+    nread = nsamp;
+    while (TRUE) {
+        if (nread > 0)
+            acmod_process_raw(acmod, &bptr, &nread, FALSE);
+        else if (acmod->state != ACMOD_ENDED)
+            acmod_end_utt(acmod);
+        else if (acmod->n_feat_frame == 0)
+            break;
+        while (acmod->n_feat_frame > 0) {
+            int frame_idx = -1;
+            TEST_ASSERT(n_frame < n_alloc);
+            acmod_score(acmod, &frame_idx);
+            TEST_EQUAL(n_frame, frame_idx);
+            memcpy(scores + n_frame * n_sen, acmod->senone_scores,
+                   n_sen * sizeof(*scores));
+            acmod_advance(acmod);
+            ++n_frame;
+        }
+    }
+    ckd_free(buf);
+    *out_n_frame = n_frame;
+    return scores;
+}
+
+/* Compare quantized distances with floating-point ones. */
+static void
+test_quant_dist(logmath_t *lmath, int bits)
+{
+    gauden_t *g, *q;
+    mfcc_t obs[16];
+    int32 qobs[16];
+    double err = 0, max_err = 0;
+    int32 f, i, j, cw, n = 0;
+
+    TEST_ASSERT(g = gauden_init(MEANS, VARS, 0.0001, lmath));
+    TEST_ASSERT(q = gauden_init(MEANS, VARS, 0.0001, lmath));
+    TEST_EQUAL(1, q->n_mgau);
+    TEST_EQUAL(0, gauden_quantize(q, bits));
+    TEST_EQUAL(bits, q->quant_bits);
+    TEST_ASSERT(q->mean == NULL);
+    for (f = 0; f < g->n_feat; ++f) {
+        for (i = 0; i < g->n_density; i += 7) {
+            /* A perturbed density, which may or may not be close to
+             * anything. */
+            for (j = 0; j < g->featlen[f]; ++j)
+                obs[j] = g->mean[0][f][i][j] + 0.1 * (j % 3 - 1);
+            gauden_quant_obs(q, 0, f, obs, qobs);
+            for (cw = 0; cw < g->n_density; ++cw) {
+                mfcc_t ref = g->det[0][f][cw], d, thresh;
+                double e;
+
+                for (j = 0; j < g->featlen[f]; ++j) {
+                    mfcc_t diff = obs[j] - g->mean[0][f][cw][j];
+                    ref -= diff * diff * g->var[0][f][cw][j];
+                }
+                /* This threshold is low enough to never stop early. */
+                d = gauden_quant_dist(q, 0, f, qobs, cw, (mfcc_t)-1e30);
+                e = fabs(d - ref) / (fabs(ref) + 1);
+                err += e;
+                if (e > max_err)
+                    max_err = e;
+                ++n;
+                /* A lower threshold does not change the distance. */
+                thresh = d - fabs(d) * 0.01 - 1;
+                TEST_EQUAL(d, gauden_quant_dist(q, 0, f, qobs, cw, thresh));
+                /* A higher one can stop early, but stays below it. */
+                thresh = d + fabs(d) * 0.01 + 1;
+                TEST_ASSERT(gauden_quant_dist(q, 0, f, qobs, cw, thresh)
+                            < thresh);
+            }
+        }
+    }
+    printf("%d bits: mean relative error %.4f, max %.4f\n",
+           bits, err / n, max_err);
+    TEST_ASSERT(err / n < (bits == 8 ? 0.02 : 0.001));
+    gauden_free(q);
+    gauden_free(g);
+}
+
+/* Compare senone scores with quantized and floating-point Gaussians. */
+static void
+test_quant_scores(config_t *config, logmath_t *lmath,
+                  int16 *ref, int n_frame, int bits)
+{
+    acmod_t *acmod;
+    int16 *scores;
+    int i, j, n, n_sen, n_best = 0;
+    double err = 0;
+
+    config_set_int(config, "gquant", bits);
+    acmod = semi_acmod_init(config, lmath);
+    n_sen = bin_mdef_n_sen(acmod->mdef);
+    scores = score_utt(acmod, &n);
+    TEST_EQUAL(n_frame, n);
+    for (i = 0; i < n_frame; ++i) {
+        int16 *r = ref + i * n_sen, *s = scores + i * n_sen;
+        int best = 0;
+        for (j = 0; j < n_sen; ++j) {
+            err += abs(r[j] - s[j]);
+            if (r[j] < r[best])
+                best = j;
+        }
+        /* The best senone should be nearly the best one. */
+        for (j = 0; j < n_sen; ++j)
+            if (s[j] < s[best] - 4)
+                break;
+        n_best += (j == n_sen);
+    }
+    err /= n_frame * n_sen;
+    printf("%d bits: mean score error %.2f, best senone kept in %d/%d frames\n",
+           bits, err, n_best, n_frame);
+    TEST_ASSERT(err < (bits == 8 ? 4 : 1));
+    TEST_ASSERT(n_best * 10 >= n_frame * 9);
+    ckd_free(scores);
+    acmod_free(acmod);
+    config_set_int(config, "gquant", 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    logmath_t *lmath;
+    config_t *config;
+    acmod_t *acmod;
+    int16 *ref;
+    int n_frame, bits;
+    size_t i;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel(ERR_WARN);
+    write_codebook(MODELDIR "/en-us/means", MEANS);
+    write_codebook(MODELDIR "/en-us/variances", VARS);
+
+    lmath = logmath_init(1.0001, 0, 0);
+    config = config_init(NULL);
+    config_set_str(config, "compallsen", "yes");
+    config_set_str(config, "input_endian", "little");
+    config_set_str(config, "lowerf", "130");
+    config_set_str(config, "upperf", "3700");
+    config_set_str(config, "nfilt", "20");
+    config_set_str(config, "transform", "dct");
+    config_set_str(config, "lifter", "22");
+    config_set_str(config, "feat", "1s_c_d_dd");
+    config_set_str(config, "svspec", "0-12/13-25/26-38");
+    config_set_str(config, "mdef", MODELDIR "/en-us/mdef");
+    config_set_str(config, "tmat", MODELDIR "/en-us/transition_matrices");
+    config_set_str(config, "sendump", MODELDIR "/en-us/sendump");
+
+    test_quant_dist(lmath, 16);
+    test_quant_dist(lmath, 8);
+
+    acmod = semi_acmod_init(config, lmath);
+    ref = score_utt(acmod, &n_frame);
+    acmod_free(acmod);
+    test_quant_scores(config, lmath, ref, n_frame, 16);
+    test_quant_scores(config, lmath, ref, n_frame, 8);
+    ckd_free(ref);
+
+    /* Mixture weight scoring, for all senones, for enough active ones
+     * to score all of them in parallel, and for a few. */
+    for (bits = 8; bits >= 4; bits -= 4) {
+        if (bits == 4) {
+            acmod = semi_acmod_init(config, lmath);
+            write_sendump4((s2_semi_mgau_t *)acmod->mgau, SENDUMP4);
+            acmod_free(acmod);
+            config_set_str(config, "sendump", SENDUMP4);
+        }
+        for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+            if (strcmp(kernels[i], "scalar") && gmm_simd_get(kernels[i]) == NULL) {
+                printf("%s: not supported\n", kernels[i]);
+                continue;
+            }
+            TEST_ASSERT(check_scores(config, lmath, kernels[i], bits, 0) > 0);
+            TEST_ASSERT(check_scores(config, lmath, kernels[i], bits, 3) > 0);
+            TEST_ASSERT(check_scores(config, lmath, kernels[i], bits, 20) > 0);
+        }
+    }
+
+    config_free(config);
+    logmath_free(lmath);
+    remove(MEANS);
+    remove(VARS);
+    remove(SENDUMP4);
+    return 0;
+}
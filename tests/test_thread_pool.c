@@ -0,0 +1,103 @@
+/* -*- c-basic-offset: 4 -*- */
+#include "config.h"
+
+#include <soundswallower/decoder.h>
+#include <soundswallower/thread_pool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test_macros.h"
+
+#define N_ITEMS 1000
+
+static void
+count_items(void *data, int idx, int n_threads)
+{
+    int *items = (int *)data;
+    int i;
+
+    for (i = idx; i < N_ITEMS; i += n_threads)
+        items[i]++;
+}
+
+static void
+test_pool(int n_threads)
+{
+    thread_pool_t *pool;
+    int items[N_ITEMS];
+    int i, j;
+
+    pool = thread_pool_init(n_threads);
+    if (n_threads < 2)
+        TEST_ASSERT(pool == NULL);
+    memset(items, 0, sizeof(items));
+    for (j = 0; j < 10; ++j)
+        thread_pool_run(pool, count_items, items);
+    for (i = 0; i < N_ITEMS; ++i)
+        TEST_EQUAL(10, items[i]);
+    thread_pool_free(pool);
+}
+
+static void
+decode(const char *nthreads, const char *gquant,
+       char *out_hyp, int32 *out_score)
+{
+    decoder_t *ps;
+    config_t *config;
+    const char *hyp;
+    FILE *rawfh;
+    int16 buf[2048];
+    size_t nread;
+
+    TEST_ASSERT(config = config_init(NULL));
+    config_set_str(config, "fsg", TESTDATADIR "/goforward.fsg");
+    config_set_str(config, "dict", TESTDATADIR "/turtle.dic");
+    config_set_str(config, "loglevel", "INFO");
+    config_set_str(config, "samprate", "16000");
+    config_set_str(config, "input_endian", "little");
+    config_set_str(config, "hmm", MODELDIR "/en-us");
+    config_set_str(config, "nthreads", nthreads);
+    config_set_str(config, "gquant", gquant);
+    TEST_ASSERT(ps = decoder_init(config));
+
+    TEST_ASSERT(rawfh = fopen(TESTDATADIR "/goforward.raw", "rb"));
+    decoder_start_utt(ps);
+    while (!feof(rawfh)) {
+        nread = fread(buf, sizeof(*buf), sizeof(buf) / sizeof(*buf), rawfh);
+        decoder_process_int16(ps, buf, nread, FALSE, FALSE);
+    }
+    fclose(rawfh);
+    decoder_end_utt(ps);
+    hyp = decoder_hyp(ps, out_score);
+    TEST_ASSERT(hyp);
+    printf("nthreads=%s gquant=%s: %s (%d)\n", nthreads, gquant,
+           hyp, *out_score);
+    strcpy(out_hyp, hyp);
+    decoder_free(ps);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char hyp1[256], hyp4[256];
+    int32 score1, score4;
+
+    (void)argc;
+    (void)argv;
+    err_set_loglevel_str("INFO");
+    test_pool(1);
+    test_pool(2);
+    test_pool(7);
+
+    /* Results must be identical with and without threads. */
+    decode("1", "0", hyp1, &score1);
+    decode("4", "0", hyp4, &score4);
+    TEST_EQUAL(0, strcmp(hyp1, hyp4));
+    TEST_EQUAL(score1, score4);
+    decode("1", "8", hyp1, &score1);
+    decode("4", "8", hyp4, &score4);
+    TEST_EQUAL(0, strcmp(hyp1, hyp4));
+    TEST_EQUAL(score1, score4);
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 /* -*- c-basic-offset: 4 -*- */
 #include <soundswallower.h>
+#include <string.h>
 
 #include "test_macros.h"
 
@@ -28,6 +29,45 @@ do_decode(decoder_t *ps)
     return 0;
 }
 
+/* Decode and align with the given option, and check that the results
+ * are exactly the same as with the defaults. */
+static void
+test_same_result(const char *name, const char *value)
+{
+    decoder_t *ps;
+    config_t *config;
+    const char *hyp;
+    alignment_iter_t *itor;
+    int i, score[2], n_al, al_score[2][32];
+
+    for (i = 0; i < 2; ++i) {
+        config = config_init(NULL);
+        config_set_str(config, "loglevel", "INFO");
+        config_set_str(config, "hmm", MODELDIR "/en-us");
+        config_set_int(config, "samprate", 8000);
+        if (i == 1)
+            config_set_str(config, name, value);
+        TEST_ASSERT(ps = decoder_init(config));
+        TEST_EQUAL(0, decoder_set_align_text(ps, AUSTEN_TEXT));
+        do_decode(ps);
+        TEST_ASSERT(hyp = decoder_hyp(ps, &score[i]));
+        printf("%s=%s: %s (%d)\n", name, i ? value : "default", hyp, score[i]);
+        TEST_EQUAL(0, strcmp(AUSTEN_TEXT, hyp));
+        /* Nothing is reused in the first pass. */
+        TEST_EQUAL(0, ps->acmod->score_cache_hits);
+        n_al = 0;
+        for (itor = alignment_words(decoder_alignment(ps)); itor;
+             itor = alignment_iter_next(itor)) {
+            TEST_ASSERT(n_al < 32);
+            al_score[i][n_al++] = alignment_iter_seg(itor, NULL, NULL);
+        }
+        decoder_free(ps);
+    }
+    TEST_EQUAL(score[0], score[1]);
+    for (i = 0; i < n_al; ++i)
+        TEST_EQUAL(al_score[0][i], al_score[1][i]);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -163,5 +203,10 @@ main(int argc, char *argv[])
     ckd_free(efs);
     decoder_free(ps);
 
+    /* Keeping senone scores must not change them. */
+    test_same_result("scorecache", "4096");
+    /* Nor must a CI beam which gates nothing out. */
+    test_same_result("cibeam", "1e-30");
+
     return 0;
 }